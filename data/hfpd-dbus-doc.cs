@@ -52,7 +52,8 @@
  * reconnection
  * - Supports multiple concurrently connected audio gateway devices
  * - Resilient to loss of Bluetooth service
- * - Supports the ALSA and OSS audio hardware interfaces
+ * - Supports the ALSA and OSS audio hardware interfaces, and a virtual
+ * sound card for systems without one
  * - Supports audio system test modes
  * - Supports microphone input cleanup, including echo cancellation and
  * noise reduction.
@@ -894,6 +895,42 @@ namespace net.sf.nohands.hfpd {
 		public AudioGatewayStart(in objectpath audio_gateway,
 					 in bool initiate_connection);
 
+		/**
+		 * @brief Add an AudioGateway device to an audio stream
+		 * already in progress.
+		 *
+		 * This method joins a second or subsequent AudioGateway
+		 * device to the stream started with AudioGatewayStart().
+		 * The audio received from all of the devices is mixed
+		 * and played through the local sound card, and the audio
+		 * captured from the local sound card is sent to all of
+		 * the devices.  This can be used to conference calls
+		 * in progress on several phones.
+		 *
+		 * The devices must all use the same audio format.  In
+		 * particular, devices using wideband speech can't be
+		 * mixed with devices using narrowband speech.
+		 *
+		 * The stream remains bound to the device passed to
+		 * AudioGatewayStart(), which is reported by the
+		 * AudioGateway property.  If the audio connection of
+		 * that device is lost, or Stop() is invoked, the audio
+		 * connections of all added devices are closed.  If the
+		 * audio connection of an added device is lost, that
+		 * device is dropped from the stream, and streaming
+		 * continues with the others.
+		 *
+		 * @param[in] audio_gateway Object path of audio gateway
+		 * device to add.  An audio connection to the device
+		 * must already be open.
+		 *
+		 * @throw net.sf.nohands.hfpd.Error Thrown on any
+		 * sort of error, unspecific of the reason of failure,
+		 * including the SoundIo object not streaming with an
+		 * audio gateway device.
+		 */
+		public AudioGatewayAdd(in objectpath audio_gateway);
+
 		/**
 		 * @brief Start a WAV file audio stream
 		 *
@@ -1043,6 +1080,15 @@ namespace net.sf.nohands.hfpd {
 		public SetSnoopFile(in string filename,
 				    in bool capture, in bool playback);
 
+		/**
+		 * @brief Clear the audio path latency histograms
+		 *
+		 * Discards all durations recorded in the histograms
+		 * reported by SoundIo.Latency, e.g. to measure a
+		 * single call.
+		 */
+		public LatencyReset();
+
 		/**
 		 * @brief State of the SoundIo object
 		 *
@@ -1125,7 +1171,7 @@ namespace net.sf.nohands.hfpd {
 		 *
 		 * This property allows a D-Bus client to interrogate the
 		 * sound card driver back-ends that are available to HFPD.
-		 * Typical values include ALSA and OSS.
+		 * Typical values include ALSA, OSS, and Virtual.
 		 *
 		 * - The first subscript of each array element is the
 		 * name of the driver backend as can be specified as a
@@ -1162,6 +1208,54 @@ namespace net.sf.nohands.hfpd {
 		 */
 		const string DriverOpts;
 
+		/** Structure used for SoundIo.Latency */
+		struct LatencyInfo {
+			/**
+			 * @brief Measured stage of the audio path
+			 * - "process": handling of one endpoint
+			 * notification by the pump
+			 * - "wakeup": lateness of endpoint notifications
+			 * relative to the sample clock of the endpoint
+			 * - "push-in": transfers from the device into
+			 * the input queue of an endpoint
+			 * - "push-out": transfers from the output queue
+			 * of an endpoint to the device
+			 * - "filter": processing of one packet by a
+			 * signal processing filter
+			 */
+			string	stage;
+			/**
+			 * @brief Measured object: "pump", "bottom" for
+			 * the local sound card, "top" for the secondary
+			 * endpoint, or the name of a filter
+			 */
+			string	name;
+			/** @brief Number of recorded durations */
+			uint64	count;
+			/** @brief Median duration in nanoseconds */
+			uint32	p50;
+			/** @brief 99th percentile duration in nanoseconds */
+			uint32	p99;
+			/** @brief 99.9th percentile duration in nanoseconds */
+			uint32	p999;
+			/** @brief Longest duration in nanoseconds */
+			uint32	max;
+		};
+
+		/**
+		 * @brief Latency histograms of the audio path
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * HFPD always times each stage of the audio path, and
+		 * this property reports a summary of each stage's
+		 * histogram.  Durations accumulate across streams until
+		 * cleared with LatencyReset().  Percentiles are accurate
+		 * to within one eighth of their value.
+		 */
+		const LatencyInfo Latency[];
+
 		/**
 		 * @brief Active sample packet interval in use by the local
 		 * sound card
@@ -1327,6 +1421,27 @@ namespace net.sf.nohands.hfpd {
 		 */
 		uint32 JitterWindowHint;
 
+		/**
+		 * @brief Sound card standby setting
+		 *
+		 * When set to @c true, the sound card is kept open and
+		 * streaming silence whenever an audio gateway is connected
+		 * and the SoundIo object is otherwise idle.  An incoming
+		 * call then attaches to the running stream rather than
+		 * waiting for the sound card to be opened and configured,
+		 * and a call ending returns the sound card to standby
+		 * without closing it.
+		 *
+		 * Standby is only active while @ref State is 2 (Stopped),
+		 * and is abandoned if the sound card reports an error.
+		 * It costs a small amount of CPU time and power for as
+		 * long as it is active.
+		 *
+		 * @note The standby setting is a persistent option that
+		 * is saved to the HFPD configuration file.
+		 */
+		bool Standby;
+
 		/**
 		 * @brief Digital signal processor denoise setting
 		 *
@@ -1380,11 +1495,110 @@ namespace net.sf.nohands.hfpd {
 		 * - 100 for a normal amount of sound card latency
 		 * - 200 if your sound card latency is higher
 		 *
+		 * Like the other DSP settings, this takes effect
+		 * immediately, even while streaming.  Changing it
+		 * discards what the echo canceler has learned.
+		 *
 		 * @note The echo cancel tail setting is a persistent
 		 * option that is saved to the HFPD configuration file.
 		 */
 		uint32 EchoCancelTail;
 
+		/**
+		 * @brief Digital signal processor voice activity gate
+		 * threshold
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * This option sets the RMS signal level, on a scale of
+		 * 0-32767, at or below which a packet of audio is
+		 * considered silent.  Once the output to the sound card
+		 * has been silent for longer than the echo cancel tail,
+		 * the echo canceler is skipped.  Once the captured audio
+		 * has been silent for as long, the rest of the signal
+		 * processor is skipped, and if the noise reduction feature
+		 * is enabled, the captured audio is muted.  This saves a
+		 * good deal of CPU time during pauses in conversation.
+		 *
+		 * Reasonable values for this property might be:
+		 * - 0 to disable the gate
+		 * - 64 to skip only processing of near-silence
+		 *
+		 * @note The gate threshold is a persistent option
+		 * that is saved to the HFPD configuration file.
+		 */
+		uint32 DspGate;
+
+		/** Structure used for SoundIo.DspGateStats */
+		struct DspGateInfo {
+			/** @brief Captured audio packets processed */
+			uint64	packets;
+			/** @brief Packets that skipped the echo canceler */
+			uint64	echo_skipped;
+			/** @brief Packets that skipped the preprocessor */
+			uint64	preprocess_skipped;
+			/**
+			 * @brief Estimated CPU time saved, in nanoseconds,
+			 * based on the average cost of the packets that
+			 * were processed
+			 */
+			uint64	saved_ns;
+		};
+
+		/**
+		 * @brief Voice activity gate statistics
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * Reports the effect of the DspGate setting on the
+		 * current audio gateway call, or on the most recent one
+		 * if none is in progress.
+		 */
+		const DspGateInfo DspGateStats;
+
+		/**
+		 * @brief Digital signal processor CPU budget
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * On slow machines, the Speex software digital signal
+		 * processor may not keep up with the audio stream at
+		 * its configured settings.  This option sets the share
+		 * of CPU time, as a percentage of real time, that it
+		 * may use.  When it uses more, its quality is reduced a
+		 * step at a time: first dereverberation is disabled, then
+		 * noise reduction is disabled, then the echo cancel tail
+		 * is halved.  The last step restarts the echo canceler,
+		 * which takes a few seconds to reconverge, as does
+		 * restoring it.  Once the load has dropped well below the
+		 * budget for several seconds, quality is restored a step
+		 * at a time.  Each step is reported by DspLevelNotify().
+		 *
+		 * Reasonable values for this property might be:
+		 * - 0 to always use the configured settings
+		 * - 75 to reduce quality only when necessary
+		 *
+		 * @note The CPU budget is a persistent option that is
+		 * saved to the HFPD configuration file.
+		 */
+		uint32 DspBudget;
+
+		/**
+		 * @brief Digital signal processor quality reduction level
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * Reports the number of steps by which the DspBudget
+		 * governor has reduced the quality of the digital signal
+		 * processor, 0 if it is running at its configured
+		 * settings.
+		 */
+		const uint32 DspLevel;
+
 		/**
 		 * @brief Notification of change of state of the SoundIo
 		 *
@@ -1494,6 +1708,22 @@ namespace net.sf.nohands.hfpd {
 		public signal SkewNotify(out byte skew_type,
 					 out double skew_value);
 
+		/**
+		 * @brief Notification of digital signal processor
+		 * quality reduction
+		 *
+		 * This signal is emitted when the DspBudget governor
+		 * reduces or restores the quality of the digital signal
+		 * processor.
+		 *
+		 * @param[out] level New value of SoundIo.DspLevel.
+		 * @param[out] load Measured CPU load of the digital
+		 * signal processor that prompted the change, as a
+		 * percentage of real time.
+		 */
+		public signal DspLevelNotify(out uint32 level,
+					     out uint32 load);
+
 		/**
 		 * @brief Notification of audio stream progress
 		 *
@@ -2434,6 +2664,26 @@ namespace net.sf.nohands.hfpd {
 		 */
 		const uint32 RawFeatures;
 
+		/**
+		 * @brief Target depth of the audio jitter buffer, in
+		 * milliseconds
+		 *
+		 * This property can be accessed using the
+		 * @ref property "standard D-Bus property interface".
+		 *
+		 * While audio is streaming with the device, the arrival
+		 * timing of its audio packets is measured, and audio
+		 * sent to the device is paced so that no more than this
+		 * much is queued in the Bluetooth stack.  The target is
+		 * raised as soon as jitter is observed, and lowered
+		 * gradually while the link is stable.  It is zero when
+		 * audio is not streaming.
+		 *
+		 * No change notification signal is emitted for this
+		 * property.
+		 */
+		const uint32 AudioJitterTarget;
+
 		/**
 		 * @brief Notification of a service-level connection state
 		 * change
@@ -210,6 +210,7 @@ public:
 
 	bool SoundConfigure(void) {
 		const char *driver, *driveropts;
+		unsigned int budget;
 
 		assert(m_sound_user == SOUND_DECONFIGURED);
 
@@ -236,6 +237,8 @@ public:
 			     m_sound_procprops.dereverb_level, 0.0);
 		m_config.Get("dsp", "dereverb_decay",
 			     m_sound_procprops.dereverb_decay, 0.0);
+		m_config.Get("dsp", "gate_level",
+			     m_sound_procprops.gate_level, 64);
 
 		m_sound_sigproc = SoundIoFltCreateSpeex(m_di);
 		if (!m_sound_sigproc ||
@@ -244,6 +247,8 @@ public:
 		}
 
 		m_sound->SetDsp(m_sound_sigproc);
+		m_config.Get("dsp", "cpu_budget", budget, 75);
+		m_sound->SetDspBudget(budget);
 
 		m_sound_user = SOUND_NONE;
 		return true;
@@ -763,9 +768,6 @@ public:
 			if ((argc != 3) || !ParseParam(argv[2], val))
 				goto bad_parameters;
 
-			if (m_sound_user != SOUND_NONE)
-				SoundRelease();
-
 			old = m_sound_procprops.noisereduce;
 			m_sound_procprops.noisereduce = val;
 
@@ -795,9 +797,6 @@ public:
 			if (val == m_sound_procprops.echocancel_ms)
 				goto success_nochange;
 
-			if (m_sound_user != SOUND_NONE)
-				SoundRelease();
-
 			old = m_sound_procprops.echocancel_ms;
 			m_sound_procprops.echocancel_ms = val;
 
@@ -827,9 +826,6 @@ public:
 			if (val == m_sound_procprops.agc_level)
 				goto success_nochange;
 
-			if (m_sound_user != SOUND_NONE)
-				SoundRelease();
-
 			old = m_sound_procprops.agc_level;
 			m_sound_procprops.agc_level = val;
 
@@ -860,9 +856,6 @@ public:
 				goto bad_parameters;
 
 
-			if (m_sound_user != SOUND_NONE)
-				SoundRelease();
-
 			oldl = m_sound_procprops.dereverb_level;
 			oldd = m_sound_procprops.dereverb_decay;
 			m_sound_procprops.dereverb_level = level;
@@ -880,6 +873,37 @@ public:
 			goto success;
 		}
 
+		if (!strcasecmp(argv[1], "LATENCY")) {
+			const char *stage, *name;
+			SoundIoLatencyHist *histp;
+			int i;
+
+			if (argc == 3) {
+				if (strcasecmp(argv[2], "RESET"))
+					goto bad_parameters;
+				m_sound->ResetLatency();
+				goto success_nochange;
+			}
+			if (argc != 2)
+				goto bad_parameters;
+
+			/* Durations are in nanoseconds */
+			for (i = 0;
+			     m_sound->GetLatency(i, stage, name, histp);
+			     i++) {
+				sessp->printf("+X SOUND LATENCY %s %s %llu "
+					      "%u %u %u %u\n",
+					      stage, name,
+					      (unsigned long long)
+					      histp->GetCount(),
+					      histp->Percentile(500),
+					      histp->Percentile(990),
+					      histp->Percentile(999),
+					      histp->GetMax());
+			}
+			goto success_nochange;
+		}
+
 	bad_parameters:
 		sessp->printf("ERROR bad parameters\n");
 		sessp->SetDefunct();
@@ -527,6 +527,8 @@ NotifyConnection(libhfp::HfpSession *sessp, ErrorInfo */*reason*/)
 	}
 
 	UpdateState(st);
+	if (m_hf->m_sound)
+		m_hf->m_sound->UpdateStandby();
 }
 
 void AudioGateway::
@@ -598,6 +600,9 @@ NotifyAudioConnection(libhfp::HfpSession */*sessp*/, libhfp::ErrorInfo */*error*
 
 	UpdateAudioState(st);
 
+	if ((st == HFPD_AG_AUDIO_DISCONNECTED) && !m_mix_links.Empty())
+		m_hf->m_sound->EpAudioGatewayDrop(this);
+
 	if (m_audio_bind)
 		m_audio_bind->EpAudioGatewayComplete(this, 0);
 
@@ -1384,6 +1389,20 @@ GetRawFeatures(DBusMessage */*msgp*/, dbus_uint32_t &val)
 	return true;
 }
 
+bool AudioGateway::
+GetAudioJitterTarget(DBusMessage */*msgp*/, dbus_uint32_t &val)
+{
+	SoundIoFormat fmt;
+
+	val = 0;
+	if (m_sess->SndIsAsyncStarted()) {
+		m_sess->SndGetFormat(fmt);
+		val = (m_sess->GetAudioJitterTarget() * 1000) /
+			fmt.samplerate;
+	}
+	return true;
+}
+
 
 HandsFree::
 HandsFree(DispatchInterface *dip, DbusSession *dbusp)
@@ -2529,6 +2548,12 @@ public:
 		/* Nothing to do! */
 	}
 
+	virtual const char *FltGetName(void) const { return "micvolume"; }
+
+	virtual unsigned int FltGetFlags(bool /*up*/) const {
+		return SIO_FLT_PASSTHRU;
+	}
+
 	virtual SoundIoBuffer const *FltProcess(bool up,
 						SoundIoBuffer const &src,
 						SoundIoBuffer &/*dest*/) {
@@ -2580,9 +2605,10 @@ SoundIoObj(HandsFree *hfp)
 	: HfpdExportObject(HFPD_SOUNDIO_OBJECT, s_ifaces),
 	  m_hf(hfp), m_sound(0),
 	  m_state(HFPD_SIO_DECONFIGURED), m_state_sent(HFPD_SIO_DECONFIGURED),
-	  m_ringtone(0), m_sigproc(0),
+	  m_ringtone(0), m_sigproc(0), m_standby(false),
 	  m_membuf(0), m_membuf_size(0),
 	  m_config(hfp->m_config),
+	  m_bound_ag(0), m_mixer(0),
 	  m_snoop(0), m_snoop_ep(0), m_snoop_filename(0),
 	  m_state_owner(0)
 {
@@ -2604,6 +2630,18 @@ NotifySoundStop(SoundIoManager *mgrp, ErrorInfo &error)
 	EpRelease(HFPD_SIO_INVALID, &error);
 }
 
+void SoundIoObj::
+NotifyDspLevel(SoundIoManager */*mgrp*/, unsigned int level, unsigned int load)
+{
+	dbus_uint32_t lval = level, ldval = load;
+
+	(void) SendSignalArgs(HFPD_SOUNDIO_INTERFACE_NAME,
+			      "DspLevelNotify",
+			      DBUS_TYPE_UINT32, &lval,
+			      DBUS_TYPE_UINT32, &ldval,
+			      DBUS_TYPE_INVALID);
+}
+
 void SoundIoObj::
 NotifySkew(SoundIoManager */*mgrp*/, sio_stream_skewinfo_t reason, double value)
 {
@@ -2621,6 +2659,7 @@ Init(DbusSession *dbusp)
 {
 	const char *driver, *driveropts;
 	int val;
+	bool bval;
 
 	assert(m_state == HFPD_SIO_DECONFIGURED);
 
@@ -2632,6 +2671,19 @@ Init(DbusSession *dbusp)
 					      &SoundIoObj::NotifySoundStop);
 	m_sound->cb_NotifySkew.Register(this,
 					&SoundIoObj::NotifySkew);
+	m_sound->cb_NotifyDspLevel.Register(this,
+					    &SoundIoObj::NotifyDspLevel);
+
+	/* Have device lists ready before anyone asks for them */
+	if (!m_sound->PrefetchDevices())
+		GetDi()->LogWarn("Could not start sound device probe");
+
+	m_mixer = SoundIoCreateMixer();
+	if (!m_mixer)
+		goto failed;
+
+	m_mixer->cb_NotifyMemberStop.Register(this,
+				&SoundIoObj::NotifyMixerMemberStop);
 
 	m_config->Get("audio", "driver", driver, 0);
 	m_config->Get("audio", "driveropts", driveropts, 0);
@@ -2657,6 +2709,9 @@ Init(DbusSession *dbusp)
 	m_sound->SetMinBufferFillHint(val);
 	m_config->Get("audio", "jitterwindow", val, 0);
 	m_sound->SetJitterWindowHint(val);
+	m_config->Get("audio", "driftcomp", bval, true);
+	m_sound->SetDriftCompensation(bval);
+	m_config->Get("audio", "standby", m_standby, false);
 
 #if defined(USE_SPEEXDSP)
 	m_sigproc = SoundIoFltCreateSpeex(GetDi());
@@ -2675,6 +2730,10 @@ Init(DbusSession *dbusp)
 		      m_procprops.dereverb_level, 0.0);
 	m_config->Get("dsp", "dereverb_decay",
 		      m_procprops.dereverb_decay, 0.0);
+	m_config->Get("dsp", "gate_level",
+		      m_procprops.gate_level, 64);
+	m_config->Get("dsp", "cpu_budget", val, 75);
+	m_sound->SetDspBudget(val);
 
 	if (!m_sigproc->Configure(m_procprops)) {
 		GetDi()->LogWarn("Could not configure DSP settings");
@@ -2688,6 +2747,7 @@ Init(DbusSession *dbusp)
 		goto failed;
 
 	UpdateState(HFPD_SIO_STOPPED);
+	UpdateStandby();
 	return true;
 
 failed:
@@ -2706,6 +2766,10 @@ Cleanup(void)
 		delete m_sound;
 		m_sound = 0;
 	}
+	if (m_mixer) {
+		delete m_mixer;
+		m_mixer = 0;
+	}
 	if (m_sigproc) {
 		delete m_sigproc;
 		m_sigproc = 0;
@@ -2715,8 +2779,16 @@ Cleanup(void)
 void SoundIoObj::
 CleanupSnoop(void)
 {
+	SoundIoSnoopStatistics stat;
+
 	if (m_snoop) {
 		m_sound->RemoveFilter(m_snoop);
+		m_snoop->GetStatistics(stat);
+		if (stat.dropped || stat.failed)
+			GetDi()->LogWarn("Snoop file %s: %u samples dropped, "
+					 "%u failed, %u written",
+					 m_snoop_filename, stat.dropped,
+					 stat.failed, stat.written);
 		delete m_snoop;
 		m_snoop = 0;
 	}
@@ -2836,6 +2908,55 @@ StateOwnerDisconnectNotify(DbusPeerDisconnectNotifier *notp)
 	assert(!m_state_owner);
 }
 
+void SoundIoObj::
+LogDspGateStats(void)
+{
+	SoundIoSpeexGateStats gs;
+
+	m_sigproc->GetGateStats(gs);
+	if (!gs.packets)
+		return;
+
+	GetDi()->LogInfo("DSP gate: skipped echo canceler %llu/%llu, "
+			 "preprocessor %llu/%llu, saved ~%llums",
+			 (unsigned long long) gs.echo_skipped,
+			 (unsigned long long) gs.packets,
+			 (unsigned long long) gs.preprocess_skipped,
+			 (unsigned long long) gs.packets,
+			 (unsigned long long) (gs.SavedNs() / 1000000));
+}
+
+/*
+ * Hold the sound card in standby at the audio format of the first
+ * connected audio gateway, so that an incoming call finds it running.
+ */
+void SoundIoObj::
+UpdateStandby(void)
+{
+	AudioGateway *agp;
+	ListItem *listp;
+	SoundIoFormat fmt;
+	ErrorInfo error;
+
+	if (m_standby) {
+		ListForEach(listp, &m_hf->m_gateways) {
+			agp = GetContainer(listp, AudioGateway, m_links);
+			if (agp->State() != HFPD_AG_CONNECTED)
+				continue;
+
+			agp->m_sess->SndGetFormat(fmt);
+			if (!m_sound->SetStandby(true, fmt.samplerate,
+						 &error))
+				GetDi()->LogWarn("Could not place sound card "
+						 "in standby: %s",
+						 error.Desc());
+			return;
+		}
+	}
+
+	(void) m_sound->SetStandby(false);
+}
+
 void SoundIoObj::
 EpRelease(SoundIoState st, ErrorInfo *reason)
 {
@@ -2856,10 +2977,16 @@ EpRelease(SoundIoState st, ErrorInfo *reason)
 		break;
 	case HFPD_SIO_AUDIOGATEWAY:
 		assert(m_bound_ag);
-		assert(m_sound->GetSecondary() == m_bound_ag->GetSoundIo());
+		assert((m_sound->GetSecondary() == m_bound_ag->GetSoundIo()) ||
+		       (m_sound->GetSecondary() == m_mixer));
 		assert(m_sound->IsDspEnabled());
 		m_sound->Stop();
 		m_sound->SetSecondary(0);
+		EpMixerRelease();
+		if (m_sigproc) {
+			LogDspGateStats();
+			(void) m_sigproc->SetStateKey(0);
+		}
 		/* fall-thru */
 	case HFPD_SIO_AUDIOGATEWAY_CONNECTING:
 		assert(m_bound_ag);
@@ -2949,6 +3076,26 @@ fail:
 	return false;
 }
 
+/*
+ * Echo canceler state is kept per audio gateway and sound card, so
+ * that a call through the same pair resumes where the last one left
+ * off rather than reconverging.
+ */
+void SoundIoObj::
+SetDspStateKey(AudioGateway *agp)
+{
+	char addr[32], key[64];
+
+	if (!m_sigproc)
+		return;
+
+	agp->m_sess->GetDevice()->GetAddr(addr);
+	snprintf(key, sizeof(key), "%s %s:%s", addr,
+		 m_sound->GetDriverName() ? m_sound->GetDriverName() : "",
+		 m_sound->GetDriverOpts() ? m_sound->GetDriverOpts() : "");
+	(void) m_sigproc->SetStateKey(key);
+}
+
 bool SoundIoObj::
 EpAudioGatewayComplete(AudioGateway *agp, ErrorInfo *error)
 {
@@ -2998,6 +3145,7 @@ EpAudioGatewayComplete(AudioGateway *agp, ErrorInfo *error)
 
 	res = m_sound->SetSecondary(agp->GetSoundIo());
 	assert(res);
+	SetDspStateKey(agp);
 	if (!m_sound->Start(false, false, error)) {
 		GetDi()->LogWarn("Could not start stream");
 		EpRelease(HFPD_SIO_AUDIOGATEWAY, throwme);
@@ -3008,6 +3156,121 @@ EpAudioGatewayComplete(AudioGateway *agp, ErrorInfo *error)
 	return true;
 }
 
+bool SoundIoObj::
+EpAudioGatewayAdd(AudioGateway *agp, ErrorInfo *error)
+{
+	ErrorInfo local_error, *throwme;
+	bool res;
+
+	assert(m_state == HFPD_SIO_AUDIOGATEWAY);
+	assert(agp != m_bound_ag);
+	assert(agp->m_mix_links.Empty());
+	assert(agp->AudioState() == HFPD_AG_AUDIO_CONNECTED);
+
+	if (m_sound->GetSecondary() == m_mixer) {
+		if (!m_mixer->AddMember(agp->GetSoundIo(), error))
+			return false;
+		agp->Get();
+		m_mixed_ags.AppendItem(agp->m_mix_links);
+		return true;
+	}
+
+	/*
+	 * Move the stream over to the mixer, with the bound audio
+	 * gateway as its first member, which will clock it.  The
+	 * members are added first, so that a format mismatch leaves
+	 * the stream as it was.
+	 */
+	assert(m_sound->GetSecondary() == m_bound_ag->GetSoundIo());
+	assert(!m_mixer->GetMemberCount());
+	if (!m_mixer->AddMember(m_bound_ag->GetSoundIo(), error))
+		return false;
+	if (!m_mixer->AddMember(agp->GetSoundIo(), error) ||
+	    !m_mixer->SndOpen(true, true, error)) {
+		m_mixer->SndClose();
+		m_mixer->RemoveMember(m_bound_ag->GetSoundIo());
+		if (m_mixer->GetMemberCount())
+			m_mixer->RemoveMember(agp->GetSoundIo());
+		return false;
+	}
+
+	throwme = 0;
+	if (!error) {
+		error = &local_error;
+		throwme = &local_error;
+	}
+
+	m_sound->Stop();
+	m_sound->SetSecondary(0);
+	res = m_sound->SetSecondary(m_mixer);
+	assert(res);
+
+	agp->Get();
+	m_mixed_ags.AppendItem(agp->m_mix_links);
+
+	if (!m_sound->Start(false, false, error)) {
+		GetDi()->LogWarn("Could not start mixed stream");
+		EpRelease(HFPD_SIO_AUDIOGATEWAY, throwme);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Remove an audio gateway added by EpAudioGatewayAdd() from the mixer
+ */
+void SoundIoObj::
+EpAudioGatewayDrop(AudioGateway *agp)
+{
+	assert(!agp->m_mix_links.Empty());
+	m_mixer->RemoveMember(agp->GetSoundIo());
+	agp->m_mix_links.Unlink();
+	agp->GetSoundIo()->SndClose();
+	agp->Put();
+}
+
+void SoundIoObj::
+EpMixerRelease(void)
+{
+	AudioGateway *agp;
+
+	assert(m_sound->GetSecondary() != m_mixer);
+	if (!m_mixer->GetMemberCount())
+		return;
+
+	m_mixer->SndClose();
+	m_mixer->RemoveMember(m_bound_ag->GetSoundIo());
+	while (!m_mixed_ags.Empty()) {
+		agp = GetContainer(m_mixed_ags.next, AudioGateway,
+				   m_mix_links);
+		agp->Get();
+		EpAudioGatewayDrop(agp);
+		agp->NotifyAudioConnection(0, 0);
+		agp->Put();
+	}
+	assert(!m_mixer->GetMemberCount());
+}
+
+void SoundIoObj::
+NotifyMixerMemberStop(SoundIoMixer *mixp, SoundIo *memberp,
+		      ErrorInfo &error)
+{
+	assert(mixp == m_mixer);
+
+	/*
+	 * The stream belongs to the bound audio gateway, and stops
+	 * with it.  Added audio gateways are dropped from the mixer
+	 * when their audio connections are reported closed.
+	 */
+	if (memberp == m_bound_ag->GetSoundIo()) {
+		EpRelease(HFPD_SIO_INVALID, &error);
+		return;
+	}
+
+	GetDi()->LogInfo("SoundIo: Mixed audio gateway stopped: %s",
+			 error.Desc());
+}
+
 bool SoundIoObj::
 EpFile(const char *filename, bool writing, libhfp::ErrorInfo *error)
 {
@@ -3232,7 +3495,7 @@ ProbeDevices(DBusMessage *msgp)
 				      "Unknown driver \"%s\"", driver);
 	}
 
-	if (!m_sound->GetDriverInfo(i, 0, 0, &devlist, &error)) {
+	if (!m_sound->GetDeviceList(i, &devlist, &error)) {
 		assert(!error.Matches(LIBHFP_ERROR_SUBSYS_SOUNDIO,
 				      LIBHFP_ERROR_SOUNDIO_NO_DRIVER));
 		return SendReplyErrorInfo(msgp, error);
@@ -3347,6 +3610,57 @@ AudioGatewayStart(DBusMessage *msgp)
 	return true;
 }
 
+bool SoundIoObj::
+AudioGatewayAdd(DBusMessage *msgp)
+{
+	DBusMessageIter mi;
+	char *agpath;
+	AudioGateway *agp;
+	bool res;
+	ErrorInfo error;
+
+	res = dbus_message_iter_init(msgp, &mi);
+	assert(res);
+	assert(dbus_message_iter_get_arg_type(&mi) == DBUS_TYPE_OBJECT_PATH);
+	dbus_message_iter_get_basic(&mi, &agpath);
+
+	agp = m_hf->FindAudioGateway(agpath);
+	if (!agp) {
+		return SendReplyError(msgp,
+				      HFPD_ERROR_FAILED,
+				      "Audio Gateway Path Invalid");
+	}
+
+	GetDi()->LogDebug("AudioGatewayAdd: %s", agpath);
+
+	if ((agp == m_bound_ag) || !agp->m_mix_links.Empty()) {
+		/*
+		 * Ignore re-requests to add an audiogateway that is
+		 * already streaming
+		 */
+		assert((m_state == HFPD_SIO_AUDIOGATEWAY) ||
+		       (m_state == HFPD_SIO_AUDIOGATEWAY_CONNECTING));
+		return SendReplyArgs(msgp, DBUS_TYPE_INVALID);
+	}
+
+	if (m_state != HFPD_SIO_AUDIOGATEWAY) {
+		return SendReplyError(msgp,
+				      HFPD_ERROR_FAILED,
+				      "Not streaming with an audio gateway");
+	}
+
+	if (agp->AudioState() != HFPD_AG_AUDIO_CONNECTED) {
+		return SendReplyError(msgp,
+				      HFPD_ERROR_FAILED,
+				      "Audio connection not established");
+	}
+
+	if (!EpAudioGatewayAdd(agp, &error))
+		return SendReplyErrorInfo(msgp, error);
+
+	return SendReplyArgs(msgp, DBUS_TYPE_INVALID);
+}
+
 bool SoundIoObj::
 FileStart(DBusMessage *msgp)
 {
@@ -3487,7 +3801,7 @@ SetSnoopFile(DBusMessage *msgp)
 	dbus_bool_t in, out;
 	ErrorInfo error;
 	SoundIo *ep;
-	SoundIoFilter *fltp;
+	SoundIoFltSnoop *fltp;
 	bool res;
 
 	res = dbus_message_iter_init(msgp, &mi);
@@ -3520,7 +3834,8 @@ SetSnoopFile(DBusMessage *msgp)
 		return SendReplyErrorInfo(msgp, error);
 	}
 
-	fltp = SoundIoCreateSnooper(ep, in, out);
+	/* Keep file I/O off of the audio path */
+	fltp = SoundIoCreateAsyncSnooper(ep, in, out);
 	if (!fltp) {
 		delete ep;
 		free(fncopy);
@@ -3549,6 +3864,13 @@ SetSnoopFile(DBusMessage *msgp)
 	return true;
 }
 
+bool SoundIoObj::
+LatencyReset(DBusMessage *msgp)
+{
+	m_sound->ResetLatency();
+	return SendReplyArgs(msgp, DBUS_TYPE_INVALID);
+}
+
 
 bool SoundIoObj::
 GetState(DBusMessage */*msgp*/, uint8_t &val)
@@ -3680,6 +4002,72 @@ GetDrivers(DBusMessage */*msgp*/, const DbusProperty */*propp*/,
 	return true;
 }
 
+bool SoundIoObj::
+GetLatency(DBusMessage */*msgp*/, const DbusProperty */*propp*/,
+	   DBusMessageIter &mi)
+{
+	DBusMessageIter ami, smi;
+	const char *stage, *name;
+	SoundIoLatencyHist *histp;
+	dbus_uint64_t count;
+	dbus_uint32_t p50, p99, p999, max;
+	int i;
+
+	if (!dbus_message_iter_open_container(&mi,
+					      DBUS_TYPE_ARRAY,
+					      DBUS_STRUCT_BEGIN_CHAR_AS_STRING
+					      DBUS_TYPE_STRING_AS_STRING
+					      DBUS_TYPE_STRING_AS_STRING
+					      DBUS_TYPE_UINT64_AS_STRING
+					      DBUS_TYPE_UINT32_AS_STRING
+					      DBUS_TYPE_UINT32_AS_STRING
+					      DBUS_TYPE_UINT32_AS_STRING
+					      DBUS_TYPE_UINT32_AS_STRING
+					      DBUS_STRUCT_END_CHAR_AS_STRING,
+					      &ami))
+		return false;
+
+	for (i = 0; m_sound->GetLatency(i, stage, name, histp); i++) {
+		count = histp->GetCount();
+		p50 = histp->Percentile(500);
+		p99 = histp->Percentile(990);
+		p999 = histp->Percentile(999);
+		max = histp->GetMax();
+		if (!dbus_message_iter_open_container(&ami,
+						      DBUS_TYPE_STRUCT,
+						      0,
+						      &smi) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_STRING,
+						    &stage) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_STRING,
+						    &name) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_UINT64,
+						    &count) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_UINT32,
+						    &p50) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_UINT32,
+						    &p99) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_UINT32,
+						    &p999) ||
+		    !dbus_message_iter_append_basic(&smi,
+						    DBUS_TYPE_UINT32,
+						    &max) ||
+		    !dbus_message_iter_close_container(&ami, &smi))
+			return false;
+	}
+
+	if (!dbus_message_iter_close_container(&mi, &ami))
+		return false;
+
+	return true;
+}
+
 bool SoundIoObj::
 GetPacketInterval(DBusMessage */*msgp*/, dbus_uint32_t &val)
 {
@@ -3768,6 +4156,27 @@ SetJitterWindowHint(DBusMessage *msgp, const dbus_uint32_t &val,
 	return true;
 }
 
+bool SoundIoObj::
+GetStandby(DBusMessage */*msgp*/, bool &val)
+{
+	val = m_standby;
+	return true;
+}
+
+bool SoundIoObj::
+SetStandby(DBusMessage *msgp, const bool &val, bool &doreply)
+{
+	ErrorInfo error;
+
+	if (!m_config->Set("audio", "standby", val, &error) ||
+	    !SaveConfig(&error)) {
+		doreply = false;
+		return SendReplyErrorInfo(msgp, error);
+	}
+	m_standby = val;
+	UpdateStandby();
+	return true;
+}
 
 bool SoundIoObj::
 GetDenoise(DBusMessage */*msgp*/, bool &val)
@@ -3904,3 +4313,94 @@ SetDereverbDecay(DBusMessage *msgp, const float &val, bool &doreply)
 	}
 	return true;
 }
+
+bool SoundIoObj::
+GetDspGate(DBusMessage */*msgp*/, dbus_uint32_t &val)
+{
+	val = m_procprops.gate_level;
+	return true;
+}
+
+bool SoundIoObj::
+SetDspGate(DBusMessage *msgp, const dbus_uint32_t &val, bool &doreply)
+{
+	ErrorInfo error;
+	SoundIoSpeexProps save = m_procprops;
+	m_procprops.gate_level = val;
+	if (!m_sigproc->Configure(m_procprops, &error)) {
+		m_procprops = save;
+		doreply = false;
+		return SendReplyErrorInfo(msgp, error);
+	}
+	if (!m_config->Set("dsp", "gate_level", val, &error) ||
+	    !SaveConfig(&error)) {
+		m_procprops = save;
+		doreply = false;
+		return SendReplyErrorInfo(msgp, error);
+	}
+	return true;
+}
+
+bool SoundIoObj::
+GetDspGateStats(DBusMessage */*msgp*/, const DbusProperty */*propp*/,
+		DBusMessageIter &mi)
+{
+	DBusMessageIter smi;
+	SoundIoSpeexGateStats gs;
+	dbus_uint64_t packets, echo, preprocess, saved;
+
+	m_sigproc->GetGateStats(gs);
+	packets = gs.packets;
+	echo = gs.echo_skipped;
+	preprocess = gs.preprocess_skipped;
+	saved = gs.SavedNs();
+
+	if (!dbus_message_iter_open_container(&mi,
+					      DBUS_TYPE_STRUCT,
+					      0,
+					      &smi) ||
+	    !dbus_message_iter_append_basic(&smi,
+					    DBUS_TYPE_UINT64,
+					    &packets) ||
+	    !dbus_message_iter_append_basic(&smi,
+					    DBUS_TYPE_UINT64,
+					    &echo) ||
+	    !dbus_message_iter_append_basic(&smi,
+					    DBUS_TYPE_UINT64,
+					    &preprocess) ||
+	    !dbus_message_iter_append_basic(&smi,
+					    DBUS_TYPE_UINT64,
+					    &saved) ||
+	    !dbus_message_iter_close_container(&mi, &smi))
+		return false;
+	return true;
+}
+
+bool SoundIoObj::
+GetDspBudget(DBusMessage */*msgp*/, dbus_uint32_t &val)
+{
+	val = m_sound->GetDspBudget();
+	return true;
+}
+
+bool SoundIoObj::
+SetDspBudget(DBusMessage *msgp, const dbus_uint32_t &val, bool &doreply)
+{
+	ErrorInfo error;
+	unsigned int save = m_sound->GetDspBudget();
+	m_sound->SetDspBudget(val);
+	if (!m_config->Set("dsp", "cpu_budget", val, &error) ||
+	    !SaveConfig(&error)) {
+		m_sound->SetDspBudget(save);
+		doreply = false;
+		return SendReplyErrorInfo(msgp, error);
+	}
+	return true;
+}
+
+bool SoundIoObj::
+GetDspLevel(DBusMessage */*msgp*/, dbus_uint32_t &val)
+{
+	val = m_sound->GetDspLevel();
+	return true;
+}
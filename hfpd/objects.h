@@ -67,6 +67,9 @@ class AudioGateway : public HfpdExportObject {
 	DbusPeerDisconnectNotifier	*m_owner;
 	SoundIoObj			*m_audio_bind;
 
+	/* Links into SoundIoObj::m_mixed_ags when added to the mixer */
+	libhfp::ListItem		m_mix_links;
+
 	void OwnerDisconnectNotify(DbusPeerDisconnectNotifier *notp);
 
 	static const DbusInterface	s_ifaces[];
@@ -169,6 +172,7 @@ public:
 	bool GetFeatures(DBusMessage *msgp, const DbusProperty *propp,
 			 DBusMessageIter &mi);
 	bool GetRawFeatures(DBusMessage *msgp, dbus_uint32_t &val);
+	bool GetAudioJitterTarget(DBusMessage *msgp, dbus_uint32_t &val);
 };
 
 #if defined(HFPD_AUDIOGATEWAY_DEFINE_INTERFACES)
@@ -242,6 +246,8 @@ static const DbusProperty g_AudioGateway_properties[] = {
 	DbusPropertyRawImmutable("a{sb}", Features, AudioGateway, GetFeatures),
 	DbusPropertyMarshallImmutable(dbus_uint32_t, RawFeatures, AudioGateway,
 				      GetRawFeatures),
+	DbusPropertyMarshallImmutable(dbus_uint32_t, AudioJitterTarget,
+				      AudioGateway, GetAudioJitterTarget),
 	{ 0, 0, 0, 0 }
 };
 
@@ -442,6 +448,12 @@ public:
 	libhfp::SoundIoFltSpeex		*m_sigproc;
 	libhfp::SoundIoSpeexProps	m_procprops;
 
+	/*
+	 * Keep the sound card streaming while an audio gateway
+	 * is connected, see SoundIoManager::SetStandby()
+	 */
+	bool				m_standby;
+
 	libhfp::SoundIo			*m_membuf;
 	libhfp::sio_sampnum_t		m_membuf_size;
 
@@ -449,7 +461,14 @@ public:
 
 	AudioGateway			*m_bound_ag;
 
-	libhfp::SoundIoFilter		*m_snoop;
+	/*
+	 * Additional audio gateways streaming alongside m_bound_ag,
+	 * all connected to the sound card through m_mixer
+	 */
+	libhfp::SoundIoMixer		*m_mixer;
+	libhfp::ListItem		m_mixed_ags;
+
+	libhfp::SoundIoFltSnoop		*m_snoop;
 	libhfp::SoundIo			*m_snoop_ep;
 	char				*m_snoop_filename;
 
@@ -482,6 +501,12 @@ public:
 			    libhfp::ErrorInfo *error);
 	bool EpAudioGatewayComplete(AudioGateway *agp,
 				    libhfp::ErrorInfo *error);
+	bool EpAudioGatewayAdd(AudioGateway *agp, libhfp::ErrorInfo *error);
+	void EpAudioGatewayDrop(AudioGateway *agp);
+	void EpMixerRelease(void);
+	void SetDspStateKey(AudioGateway *agp);
+	void LogDspGateStats(void);
+	void UpdateStandby(void);
 	bool EpFile(const char *filename, bool writing,
 		    libhfp::ErrorInfo *error);
 	bool EpLoopback(libhfp::ErrorInfo *error);
@@ -490,19 +515,26 @@ public:
 
 	void NotifySoundStop(libhfp::SoundIoManager *mgrp,
 			     libhfp::ErrorInfo &error);
+	void NotifyDspLevel(libhfp::SoundIoManager *mgrp,
+			    unsigned int level, unsigned int load);
 	void NotifySkew(libhfp::SoundIoManager *mgrp,
 			libhfp::sio_stream_skewinfo_t reason, double value);
+	void NotifyMixerMemberStop(libhfp::SoundIoMixer *mixp,
+				   libhfp::SoundIo *memberp,
+				   libhfp::ErrorInfo &error);
 
 	/* D-Bus SoundIo interface related methods */
 	bool SetDriver(DBusMessage *msgp);
 	bool ProbeDevices(DBusMessage *msgp);
 	bool Stop(DBusMessage *msgp);
 	bool AudioGatewayStart(DBusMessage *msgp);
+	bool AudioGatewayAdd(DBusMessage *msgp);
 	bool FileStart(DBusMessage *msgp);
 	bool LoopbackStart(DBusMessage *msgp);
 	bool MembufClear(DBusMessage *msgp);
 	bool MembufStart(DBusMessage *msgp);
 	bool SetSnoopFile(DBusMessage *msgp);
+	bool LatencyReset(DBusMessage *msgp);
 
 	/* D-Bus SoundIo property related methods */
 	bool GetState(DBusMessage *msgp, uint8_t &val);
@@ -515,6 +547,8 @@ public:
 			     DBusMessageIter &mi);
 	bool GetDriverName(DBusMessage *msgp, const char * &val);
 	bool GetDriverOpts(DBusMessage *msgp, const char * &val);
+	bool GetLatency(DBusMessage *msgp, const DbusProperty *propp,
+			DBusMessageIter &mi);
 
 	bool GetPacketInterval(DBusMessage *msgp, dbus_uint32_t &val);
 	bool GetMinBufferFill(DBusMessage *msgp, dbus_uint32_t &val);
@@ -531,6 +565,8 @@ public:
 	bool GetJitterWindowHint(DBusMessage *msgp, dbus_uint32_t &val);
 	bool SetJitterWindowHint(DBusMessage *msgp,
 				      const dbus_uint32_t &val, bool &doreply);
+	bool GetStandby(DBusMessage *msgp, bool &val);
+	bool SetStandby(DBusMessage *msgp, const bool &val, bool &doreply);
 	bool GetDenoise(DBusMessage *msgp, bool &val);
 	bool SetDenoise(DBusMessage *msgp, const bool &val, bool &doreply);
 	bool GetAutoGain(DBusMessage *msgp, dbus_uint32_t &val);
@@ -545,6 +581,15 @@ public:
 	bool GetDereverbDecay(DBusMessage *msgp, float &val);
 	bool SetDereverbDecay(DBusMessage *msgp, const float &val,
 			       bool &doreply);
+	bool GetDspGate(DBusMessage *msgp, dbus_uint32_t &val);
+	bool SetDspGate(DBusMessage *msgp, const dbus_uint32_t &val,
+			bool &doreply);
+	bool GetDspGateStats(DBusMessage *msgp, const DbusProperty *propp,
+			     DBusMessageIter &mi);
+	bool GetDspBudget(DBusMessage *msgp, dbus_uint32_t &val);
+	bool SetDspBudget(DBusMessage *msgp, const dbus_uint32_t &val,
+			  bool &doreply);
+	bool GetDspLevel(DBusMessage *msgp, dbus_uint32_t &val);
 };
 
 
@@ -554,11 +599,13 @@ static const DbusMethod g_SoundIo_methods[] = {
 	DbusMethodEntry(SoundIoObj, ProbeDevices, "s", "a(ss)"),
 	DbusMethodEntry(SoundIoObj, Stop, "", ""),
 	DbusMethodEntry(SoundIoObj, AudioGatewayStart, "ob", ""),
+	DbusMethodEntry(SoundIoObj, AudioGatewayAdd, "o", ""),
 	DbusMethodEntry(SoundIoObj, FileStart, "sb", ""),
 	DbusMethodEntry(SoundIoObj, LoopbackStart, "", ""),
 	DbusMethodEntry(SoundIoObj, MembufStart, "bbuu", ""),
 	DbusMethodEntry(SoundIoObj, MembufClear, "", ""),
 	DbusMethodEntry(SoundIoObj, SetSnoopFile, "sbb", ""),
+	DbusMethodEntry(SoundIoObj, LatencyReset, "", ""),
 	{ 0, 0, 0, 0 }
 };
 
@@ -568,6 +615,7 @@ static const DbusMethod g_SoundIo_signals[] = {
 	DbusSignalEntry(StreamAborted, "ss"),
 	DbusSignalEntry(MuteChanged, "b"),
 	DbusSignalEntry(SkewNotify, "yd"),
+	DbusSignalEntry(DspLevelNotify, "uu"),
 	DbusSignalEntry(MonitorNotify, "uq"),
 	{ 0, 0, 0, 0 }
 };
@@ -586,6 +634,8 @@ static const DbusProperty g_SoundIo_properties[] = {
 				      GetDriverName),
 	DbusPropertyMarshallImmutable(const char *, DriverOpts, SoundIoObj,
 				      GetDriverOpts),
+	DbusPropertyRawImmutable("a(sstuuuu)", Latency, SoundIoObj,
+				 GetLatency),
 	DbusPropertyMarshallImmutable(dbus_uint32_t, PacketInterval,
 				      SoundIoObj, GetPacketInterval),
 	DbusPropertyMarshallImmutable(dbus_uint32_t, MinBufferFill,
@@ -598,6 +648,8 @@ static const DbusProperty g_SoundIo_properties[] = {
 			     GetMinBufferFillHint, SetMinBufferFillHint),
 	DbusPropertyMarshall(dbus_uint32_t, JitterWindowHint, SoundIoObj,
 			     GetJitterWindowHint, SetJitterWindowHint),
+	DbusPropertyMarshall(bool, Standby, SoundIoObj,
+			     GetStandby, SetStandby),
 #if defined(USE_SPEEXDSP)
 	DbusPropertyMarshall(bool, Denoise, SoundIoObj,
 			     GetDenoise, SetDenoise),
@@ -609,6 +661,14 @@ static const DbusProperty g_SoundIo_properties[] = {
 			     GetDereverbLevel, SetDereverbLevel),
 	DbusPropertyMarshall(float, DereverbDecay, SoundIoObj,
 			     GetDereverbDecay, SetDereverbDecay),
+	DbusPropertyMarshall(dbus_uint32_t, DspGate, SoundIoObj,
+			     GetDspGate, SetDspGate),
+	DbusPropertyRawImmutable("(tttt)", DspGateStats, SoundIoObj,
+				 GetDspGateStats),
+	DbusPropertyMarshall(dbus_uint32_t, DspBudget, SoundIoObj,
+			     GetDspBudget, SetDspBudget),
+	DbusPropertyMarshallImmutable(dbus_uint32_t, DspLevel, SoundIoObj,
+				      GetDspLevel),
 #endif /* defined(USE_SPEEXDSP) */
 	{ 0, 0, 0, 0 }
 };
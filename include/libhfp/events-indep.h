@@ -22,11 +22,20 @@
 /*
  * Independent event loop implementation for libhfp.
  * Supports file handles and timers only.
+ *
+ * File handle readiness can be collected either with select(), which
+ * rescans every registered file handle on each pass, or on Linux with
+ * epoll, which keeps the interest set in the kernel and only reports
+ * the file handles that are actually ready.
+ *
+ * Timers are kept on CLOCK_MONOTONIC with microsecond resolution, in a
+ * hierarchical timer wheel with O(1) arming and cancellation.
  */
 
 #if !defined(__LIBHFP_EVENTS_INDEP_H__)
 #define __LIBHFP_EVENTS_INDEP_H__
 
+#include <stdint.h>
 #include <sys/time.h>
 
 #if defined(USE_PTHREADS)
@@ -41,18 +50,51 @@ namespace libhfp {
 
 class IndepTimerNotifier;
 class IndepSocketNotifier;
+class IndepFdEntry;
 
 class IndepEventDispatcher : public DispatchInterface {
 	friend class IndepTimerNotifier;
 	friend class IndepSocketNotifier;
 
 private:
-	ListItem	m_timers;
+	/*
+	 * Timer wheel geometry: c_wheel_levels levels of c_wheel_slots
+	 * slots each, with level N slots spanning 2^(N * c_wheel_bits)
+	 * microseconds.  Eight six-bit levels cover 2^48us, about
+	 * eight years of dispatcher uptime.
+	 */
+	enum {
+		c_wheel_bits = 6,
+		c_wheel_slots = (1 << c_wheel_bits),
+		c_wheel_levels = 8
+	};
+
+	ListItem	m_wheel[c_wheel_levels][c_wheel_slots];
+	uint64_t	m_wheel_map[c_wheel_levels];
+	uint64_t	m_wheel_time;
+	uint64_t	m_clock_base;
+	unsigned int	m_ntimers;
 	ListItem	m_sockets;
-	struct timeval	m_last_run;
 
 	bool		m_sleeping;
 
+#if defined(USE_EPOLL)
+	enum { c_epoll_batch = 32 };
+
+	int		m_epoll_fh;
+	int		m_timer_fh;
+	bool		m_timer_armed;
+	IndepFdEntry	**m_fdtab;
+	int		m_fdtab_size;
+	unsigned int	m_epoll_gen;
+
+	bool EpollSetup(void);
+	void EpollCleanup(void);
+	IndepFdEntry *EpollEntry(int fh);
+	void EpollUpdate(int fh);
+	void EpollDispatch(int fh, unsigned int events);
+#endif
+
 #if defined(USE_PTHREADS)
 	pthread_mutex_t	m_lock;
 	int		m_wake_pipe[2];
@@ -70,11 +112,12 @@ private:
 	void WakeCleanup(void) {}
 #endif
 
-	static void PairTimers(ListItem &siblings, ListItem &dest,
-			       unsigned int delta);
-	void AddTimer(IndepTimerNotifier *);
+	uint64_t ClockNow(void) const;
+	void WheelInsert(IndepTimerNotifier *);
+	bool WheelNext(uint64_t &when) const;
+	void AddTimer(IndepTimerNotifier *, uint64_t usec);
 	void RemoveTimer(IndepTimerNotifier *);
-	void RunTimers(unsigned int ms_elapsed);
+	void RunTimers(void);
 
 	void AddSocket(IndepSocketNotifier *);
 	void RemoveSocket(IndepSocketNotifier *);
@@ -88,6 +131,18 @@ public:
 	virtual void LogVa(DispatchInterface::logtype_t lt,
 			   const char *fmt, va_list ap);
 
+	/*
+	 * Readiness collection mechanisms
+	 * DISPATCH_DEFAULT selects epoll where it is available,
+	 * and select() otherwise.  If epoll is requested but cannot
+	 * be set up, select() is used instead.
+	 */
+	enum backend_t {
+		DISPATCH_DEFAULT,
+		DISPATCH_SELECT,
+		DISPATCH_EPOLL
+	};
+
 	/*
 	 * Direct methods
 	 */
@@ -95,7 +150,9 @@ public:
 	void RunOnce(int max_sleep_ms = -1);
 	void Run(void);
 
-	IndepEventDispatcher(void);
+	backend_t GetBackend(void) const;
+
+	IndepEventDispatcher(backend_t backend = DISPATCH_DEFAULT);
 	virtual ~IndepEventDispatcher();
 };
 
@@ -1059,6 +1059,18 @@ public:
 	 */
 	virtual void Set(int msec) = 0;
 
+	/**
+	 * @brief Set the timer with microsecond resolution
+	 *
+	 * Equivalent to Set(), but with the timeout specified in
+	 * microseconds.  Environments that cannot schedule timers
+	 * more precisely than milliseconds round the timeout up to
+	 * the next whole millisecond.
+	 *
+	 * @param usec Time to wait until trigger
+	 */
+	virtual void SetUsec(unsigned int usec) { Set((usec + 999) / 1000); }
+
 	/**
 	 * @brief Cancels a pending timer
 	 *
@@ -26,11 +26,13 @@
 #include <bluetooth/sdp_lib.h>
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include <libhfp/bt.h>
 #include <libhfp/rfcomm.h>
 #include <libhfp/soundio.h>
 #include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-msbc.h>
 
 /**
  * @file libhfp/hfp.h
@@ -40,6 +42,20 @@ namespace libhfp {
 
 class HfpSession;
 
+/**
+ * @brief Voice codec identifiers for Hands-Free Profile 1.6 codec
+ * negotiation
+ * @ingroup hfp
+ *
+ * @sa HfpSession::GetAudioCodec()
+ */
+enum hfp_codec_t {
+	/** @brief CVSD, 8KHz narrowband, always supported */
+	HFP_CODEC_CVSD = 1,
+	/** @brief mSBC, 16KHz wideband */
+	HFP_CODEC_MSBC = 2
+};
+
 /**
  * @brief Service Handler for Hands-Free Profile
  * @ingroup hfp
@@ -96,6 +112,7 @@ private:
 	sdp_record_t		*m_sdp_rec;
 
 	bool			m_sco_enable;
+	bool			m_sco_defer;
 
 	bool			m_complaint_sco_mtu;
 	bool			m_complaint_sco_vs;
@@ -424,7 +441,14 @@ public:
 	/** Query advertised hands-free capabilities */
 	int GetCaps(void) const { return m_brsf_my_caps; }
 
-	/** Set advertised hands-free capabilities */
+	/**
+	 * @brief Set advertised hands-free capabilities
+	 *
+	 * The capabilities are the hands-free feature bits of the
+	 * Hands-Free Profile specification.  Setting bit 7, codec
+	 * negotiation, enables wideband speech with devices that
+	 * support it.  See HfpSession::GetAudioCodec().
+	 */
 	bool SetCaps(int caps, ErrorInfo *error = 0);
 
 	/** Query service name advertised in SDP record */
@@ -753,6 +777,9 @@ private:
 
 	/* SCO and audio-related members */
 	enum { SCO_MAX_PKTSIZE = 512 };
+
+	/* Most SCO packets moved by one system call */
+	enum { SCO_BATCH = 8 };
 	enum {
 		BVS_Invalid,
 		BVS_SocketConnecting,
@@ -760,7 +787,6 @@ private:
 	}				m_sco_state;
 	int				m_sco_sock;
 	bool				m_sco_use_tiocoutq;
-	bool				m_sco_nonblock;
 	uint16_t			m_sco_handle;
 	uint16_t			m_sco_mtu;
 	uint16_t			m_sco_packet_samps;
@@ -770,10 +796,80 @@ private:
 
 	SocketNotifier			*m_sco_not;
 
+	/*
+	 * Output staged for the socket, one or more packets that
+	 * ScoSend() transmits as a batch.  Samples are removed from
+	 * m_output, or encoded, as they are staged.  If a send was
+	 * short, m_sco_tx_part is the size of the unsent remainder at
+	 * the front, which goes out first, as a piece of its own.
+	 */
+	uint8_t				m_sco_tx[SCO_MAX_PKTSIZE];
+	size_t				m_sco_tx_len;
+	size_t				m_sco_tx_part;
+
+	/*
+	 * The SCO socket is nonblocking for the life of the audio
+	 * connection.  These transfer batches of packets, and a
+	 * blocking transfer waits with poll().
+	 */
+	bool ScoWait(short events);
+	int ScoRecv(struct iovec *iov, size_t *lens, int count,
+		    bool nonblock);
+	int ScoSend(struct iovec *iov, size_t *lens, int count,
+		    bool nonblock);
+	void ScoInputAppend(const uint8_t *data, sio_sampnum_t nsamples);
+	void ScoStageOutput(size_t piece, bool paced, sio_sampnum_t room);
+	sio_sampnum_t ScoTxSamples(size_t bytes) const;
+	sio_sampnum_t ScoInFlight(void);
+
+	/*
+	 * Adaptive jitter buffer for the SCO link.
+	 *
+	 * The arrival of SCO input is tracked against a steady clock,
+	 * and the spread of the arrival lag over a window determines
+	 * the target depth.  Output is released to the socket only
+	 * while the number of samples in flight, from TIOCOUTQ where
+	 * the socket supports it and estimated otherwise, is below the
+	 * target, and the rest is held in m_output, where the pump can
+	 * see it.  The target grows as soon as more jitter is observed,
+	 * and shrinks by one packet after several stable windows.
+	 */
+	enum {
+		SCO_JB_WINDOW_MS = 1000,
+		SCO_JB_STABLE_WINDOWS = 5,
+		SCO_JB_MAX_MS = 120,
+	};
+	uint64_t			m_sco_jb_start;
+	uint64_t			m_sco_jb_window;
+	uint64_t			m_sco_jb_rx;
+	int64_t				m_sco_jb_lag_min;
+	int64_t				m_sco_jb_lag_max;
+	sio_sampnum_t			m_sco_jb_target;
+	unsigned int			m_sco_jb_stable;
+
+	void ScoJitterReset(void);
+	void ScoJitterUpdate(sio_sampnum_t nsamples);
+
+	/*
+	 * Codec negotiation and mSBC state.  m_sco_codec is the codec
+	 * most recently selected by the audio gateway, and m_sco_msbc
+	 * is set if the current audio connection carries mSBC.
+	 */
+	friend class BacCommand;
+	friend class BcsCommand;
+	int				m_sco_codec;
+	bool				m_sco_msbc;
+	SoundIoMsbc			*m_msbc;
+
+	bool CodecNegotiation(void) const;
+	void ConfirmCodec(int codec);
+	size_t MsbcDecodeInput(const uint8_t *data, size_t len);
+	bool MsbcEncodeOutput(void);
+
 	void __DisconnectSco(bool notifyvs, bool notifyp, bool async,
 			     ErrorInfo &error);
 	bool ScoGetParams(int ssock, ErrorInfo *error);
-	bool ScoAccept(int ssock);
+	bool ScoAccept(int ssock, bool deferred);
 	bool ScoConnect(ErrorInfo *error);
 	void ScoConnectNotify(SocketNotifier *notp, int fh);
 	void ScoDataNotify(SocketNotifier *, int fh);
@@ -1380,6 +1476,21 @@ public:
 		{ return (m_brsf & 128) ? true : false; }
 	bool FeatureExtendedErrors(void) const
 		{ return (m_brsf & 256) ? true : false; }
+	/**
+	 * @brief Query whether the attached device supports codec
+	 * negotiation
+	 *
+	 * Devices supporting codec negotiation may select the mSBC
+	 * wideband speech codec, if codec negotiation is also enabled
+	 * through HfpService::SetCaps().
+	 *
+	 * @note This information is only valid when the device is in the
+	 * connected state.
+	 * @retval true Codec negotiation supported
+	 * @retval false Codec negotiation not supported
+	 */
+	bool FeatureCodecNegotiation(void) const
+		{ return (m_brsf & 512) ? true : false; }
 	bool FeatureIndCallSetup(void) const
 		{ return (m_inum_callsetup != 0); }
 	bool FeatureIndCallHeld(void) const
@@ -1850,6 +1961,37 @@ public:
 		{ return IsConnectedAudio() && (m_sco_not != 0); }
 
 	size_t AudioPacketNumSamples(void) const { return m_sco_packet_samps; }
+
+	/**
+	 * @brief Query the target depth of the audio jitter buffer
+	 *
+	 * While asynchronous audio handling is enabled, the arrival
+	 * timing of audio packets from the device is measured, and
+	 * output to the device is paced so that no more than this many
+	 * samples are in flight at once.  The target is increased
+	 * promptly when jitter is observed, and decreased gradually
+	 * while the link is stable.
+	 *
+	 * @return The current target depth, in samples at the rate
+	 * reported by SndGetFormat(), or zero if asynchronous audio
+	 * handling has not been started.
+	 */
+	sio_sampnum_t GetAudioJitterTarget(void) const
+		{ return m_sco_jb_target; }
+
+	/**
+	 * @brief Query the voice codec selected by the device
+	 *
+	 * Devices that do not support codec negotiation always use
+	 * @c HFP_CODEC_CVSD.  When @c HFP_CODEC_MSBC is selected,
+	 * audio connections are established in transparent mode and
+	 * the audio handling interface operates at 16KHz, with mSBC
+	 * encoding and decoding done internally.
+	 *
+	 * @return The most recently selected codec, a value of
+	 * ::hfp_codec_t.
+	 */
+	int GetAudioCodec(void) const { return m_sco_codec; }
 };
 
 
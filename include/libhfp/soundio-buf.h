@@ -32,6 +32,9 @@
  * Includes:
  * VarBuf            A stupid contiguous buffer used in the loopback class.
  * PacketSeq         A fragment buffer queue used by SoundIoBufferMgr.
+ * SoundIoRing       A lock-free single producer, single consumer
+ *		     alternative to PacketSeq for threaded SoundIo
+ *		     implementations.
  * SoundIoBufferMgr  A general purpose utility class forming the
  *		     base of most non-trivial, non-mmap SoundIo
  *		     implementations.
@@ -127,6 +130,8 @@ struct PacketSeq {
 
 	int PacketSize(void) const { return m_packetsize / m_bpr; }
 
+	bool Empty(void) const { return !m_npackets; }
+
 	static SoundIoPacket *GetBuffer(int packetbytes) {
 		SoundIoPacket *resp = (SoundIoPacket*)
 			malloc(packetbytes + sizeof(*resp));
@@ -292,11 +297,12 @@ struct PacketSeq {
 		assert(!nbytes);
 	}
 
-	void SetPacketSize(int packetsize, int bps) {
+	bool SetPacketSize(int packetsize, int bps) {
 		Clear();
 		CollectBuffers();
 		m_packetsize = packetsize * bps;
 		m_bpr = bps;
+		return true;
 	}
 
 	PacketSeq(int packetsize = 0, int bpr = 2)
@@ -308,6 +314,157 @@ struct PacketSeq {
 	~PacketSeq() { Clear(); CollectBuffers(); }
 };
 
+/*
+ * SoundIoRing
+ *
+ * A contiguous ring buffer with the same interface as PacketSeq, for
+ * queues with exactly one producer thread, calling GetUnfilled() and
+ * PutUnfilled(), and one consumer thread, calling Peek() and Dequeue().
+ * The producer only ever advances m_tail and the consumer only ever
+ * advances m_head, so neither side takes a lock or waits on the other.
+ * The two positions are aligned to cache lines of their own, so
+ * neither shares a line with the other or with a neighbouring member
+ * such as the queue lock.
+ *
+ * The positions are free-running byte counts, and are only ever
+ * subtracted from each other, which stays correct when they wrap.
+ * The storage size is rarely a power of two, so each side tracks its
+ * offset into the storage separately rather than deriving it from a
+ * position.
+ *
+ * Where the platform allows it, the storage is mapped twice back to
+ * back, so that Peek() and GetUnfilled() return everything available
+ * in one piece instead of stopping at the end of the storage.
+ *
+ * Unlike PacketSeq, the capacity is fixed when the packet size is set.
+ * GetUnfilled() reports zero samples when the ring is full.
+ */
+struct SoundIoRing {
+	enum {
+		c_cacheline = 64,
+		c_ring_packets = 32
+	};
+
+	/* Consumer side, clear of whatever precedes the ring */
+	unsigned long	m_head __attribute__((aligned(c_cacheline)));
+	size_t		m_head_off;
+
+	/* Producer side */
+	unsigned long	m_tail __attribute__((aligned(c_cacheline)));
+	size_t		m_tail_off;
+	char		m_tail_pad[c_cacheline - sizeof(unsigned long) -
+				   sizeof(size_t)];
+
+	/* Constant while the queue is in use */
+	uint8_t		*m_buf;
+	size_t		m_size;
+	int		m_bpr;
+	int		m_packetsize;
+	bool		m_mirrored;
+
+	bool Allocate(size_t nbytes);
+	void Free(void);
+
+	static unsigned long LoadAcquire(const unsigned long &pos) {
+		return __atomic_load_n(&pos, __ATOMIC_ACQUIRE);
+	}
+	static void StoreRelease(unsigned long &pos, unsigned long val) {
+		__atomic_store_n(&pos, val, __ATOMIC_RELEASE);
+	}
+
+	int PacketSize(void) const { return m_packetsize / m_bpr; }
+
+	bool Empty(void) const {
+		return LoadAcquire(m_tail) == LoadAcquire(m_head);
+	}
+
+	void Clear(void) {
+		m_head = m_tail = 0;
+		m_head_off = m_tail_off = 0;
+	}
+
+	size_t Advance(size_t off, size_t nbytes) const {
+		off += nbytes;
+		if (off >= m_size)
+			off -= m_size;
+		return off;
+	}
+
+	int TotalFill(void) const {
+		if (!m_buf) { return 0; }
+		return (LoadAcquire(m_tail) - LoadAcquire(m_head)) / m_bpr;
+	}
+
+	bool GetUnfilled(uint8_t *&ptr, unsigned int &nsamples) {
+		sio_sampnum_t real_nsamples;
+		size_t off, nbytes;
+		if (!m_buf) {
+			nsamples = 0;
+			return false;
+		}
+		off = m_tail_off;
+		nbytes = m_size - (m_tail - LoadAcquire(m_head));
+		if (!m_mirrored && (nbytes > (m_size - off)))
+			nbytes = m_size - off;
+		real_nsamples = nbytes / m_bpr;
+		ptr = &m_buf[off];
+		if (!nsamples || (nsamples > real_nsamples))
+			nsamples = real_nsamples;
+		return nsamples != 0;
+	}
+
+	void PutUnfilled(int nsamples_added) {
+		assert(nsamples_added >= 0);
+		assert((m_tail - LoadAcquire(m_head) +
+			(nsamples_added * m_bpr)) <= m_size);
+		m_tail_off = Advance(m_tail_off, nsamples_added * m_bpr);
+		StoreRelease(m_tail, m_tail + (nsamples_added * m_bpr));
+	}
+
+	void Peek(uint8_t *&buf, sio_sampnum_t &nsamples) {
+		sio_sampnum_t real_nsamples;
+		size_t off, nbytes;
+		if (!m_buf) {
+			nsamples = 0;
+			return;
+		}
+		off = m_head_off;
+		nbytes = LoadAcquire(m_tail) - m_head;
+		if (!m_mirrored && (nbytes > (m_size - off)))
+			nbytes = m_size - off;
+		real_nsamples = nbytes / m_bpr;
+		buf = &m_buf[off];
+		if (!nsamples || (nsamples > real_nsamples))
+			nsamples = real_nsamples;
+	}
+
+	void Dequeue(int nsamples) {
+		assert(nsamples >= 0);
+		assert((unsigned long) (nsamples * m_bpr) <=
+		       (LoadAcquire(m_tail) - m_head));
+		m_head_off = Advance(m_head_off, nsamples * m_bpr);
+		StoreRelease(m_head, m_head + (nsamples * m_bpr));
+	}
+
+	bool SetQueueSize(int packetsize, int npackets, int bps) {
+		Clear();
+		m_packetsize = packetsize * bps;
+		m_bpr = bps;
+		return Allocate(npackets * m_packetsize);
+	}
+
+	bool SetPacketSize(int packetsize, int bps) {
+		return SetQueueSize(packetsize, c_ring_packets, bps);
+	}
+
+	SoundIoRing(void)
+		: m_head(0), m_head_off(0), m_tail(0), m_tail_off(0),
+		  m_buf(NULL), m_size(0),
+		  m_bpr(2), m_packetsize(0), m_mirrored(false) {}
+
+	~SoundIoRing() { Free(); }
+};
+
 class NullSync {
 public:
 	void Lock(void) {}
@@ -322,12 +479,12 @@ public:
  */
 
 /** @brief SoundIo skeleton with integrated buffer management */
-template <typename SyncT = NullSync>
+template <typename SyncT = NullSync, typename QueueT = PacketSeq>
 class SoundIoBufferBaseSync : public SoundIo {
 public:
 	SyncT			m_lock;
-	PacketSeq		m_input;
-	PacketSeq		m_output;
+	QueueT			m_input;
+	QueueT			m_output;
 	sio_sampnum_t		m_hw_outq;
 	ErrorInfo		m_abort;
 	TimerNotifier		*m_abort_to;
@@ -338,6 +495,9 @@ public:
 
 	SoundIoQueueState	m_qs;
 
+	SoundIoLatencyHist	m_lat_in;
+	SoundIoLatencyHist	m_lat_out;
+
 	SoundIoBufferBaseSync(void)
 		: m_input(), m_output(), m_hw_outq(0),
 		  m_abort_to(0), m_async_state(0) {}
@@ -349,6 +509,25 @@ public:
 	virtual void SndPushInput(bool nonblock) = 0;
 	virtual void SndPushOutput(bool nonblock) = 0;
 
+	/* Call these instead, they time each transfer */
+	void BufPushInput(bool nonblock) {
+		uint64_t start = SoundIoLatencyHist::Now();
+		SndPushInput(nonblock);
+		m_lat_in.AddSince(start);
+	}
+	void BufPushOutput(bool nonblock) {
+		uint64_t start = SoundIoLatencyHist::Now();
+		SndPushOutput(nonblock);
+		m_lat_out.AddSince(start);
+	}
+
+	virtual bool SndGetLatency(SoundIoLatencyHist *&in,
+				   SoundIoLatencyHist *&out) {
+		in = &m_lat_in;
+		out = &m_lat_out;
+		return true;
+	}
+
 	void BufCancelAbort(void) {
 		m_lock.Lock();
 		m_abort.Clear();
@@ -370,8 +549,8 @@ public:
 
 	virtual void SndGetIBuf(SoundIoBuffer &fillme) {
 		m_lock.Lock();
-		if (!m_input.m_npackets) {
-			SndPushInput((m_async_state != 0) ||
+		if (m_input.Empty()) {
+			BufPushInput((m_async_state != 0) ||
 				     SndIsAsyncStarted());
 		}
 		m_input.Peek(fillme.m_data, fillme.m_size);
@@ -397,7 +576,7 @@ public:
 		m_qs.out_underflow = false;
 		m_lock.Unlock();
 		if (!m_async_state) {
-			SndPushOutput(SndIsAsyncStarted());
+			BufPushOutput(SndIsAsyncStarted());
 		}
 	}
 
@@ -407,16 +586,18 @@ public:
 		qs = m_qs;
 	}
 
-	void BufOpen(int packetsize, int bps) {
+	bool BufOpen(int packetsize, int bps) {
+		bool res;
 		BufCancelAbort();
-		m_input.SetPacketSize(packetsize, bps);
-		m_output.SetPacketSize(packetsize, bps);
+		res = (m_input.SetPacketSize(packetsize, bps) &&
+		       m_output.SetPacketSize(packetsize, bps));
 		m_hw_outq = 0;
 		m_qs.in_queued = 0;
 		m_qs.out_queued = 0;
 		m_qs.in_overflow = false;
 		m_qs.out_underflow = false;
 		m_abort.Clear();
+		return res;
 	}
 
 	void BufClose(void) {
@@ -447,7 +628,7 @@ public:
 			cb_NotifyPacket(this, ss);
 		if (as.m_stopped) { return false; }
 		if (!m_abort.IsSet()) {
-			SndPushOutput(true);
+			BufPushOutput(true);
 			if (as.m_stopped) { return false; }
 		}
 		m_lock.Lock();
@@ -484,7 +665,8 @@ public:
 			assert(!m_abort_to);
 			m_abort_to = eip->NewTimer();
 			m_abort_to->Register(this,
-				     &SoundIoBufferBaseSync<SyncT>::BufAsyncAbort);
+				&SoundIoBufferBaseSync<SyncT, QueueT>::
+					     BufAsyncAbort);
 			m_abort_to->Set(0);
 		}
 		m_lock.Unlock();
@@ -0,0 +1,378 @@
+/* -*- C++ -*- */
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if !defined(__LIBHFP_SOUNDIO_DSP_H__)
+#define __LIBHFP_SOUNDIO_DSP_H__
+
+/**
+ * @file libhfp/soundio-dsp.h
+ */
+
+/*
+ * Sample processing kernels shared by SoundIoPump and the stock filters.
+ *
+ * The S16_LE and U8 kernels come in several implementations, scalar
+ * plus SSE2, AVX2 or NEON where the build target supports them.  The
+ * fastest implementation supported by the CPU is chosen the first time
+ * a kernel is needed.  A-law and Mu-law samples are handled through
+ * lookup tables, and are mixed by way of S16.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <libhfp/soundio.h>
+
+namespace libhfp {
+
+/**
+ * @brief Unity gain value for SoundIoDspGain()
+ * @ingroup soundio
+ *
+ * Gain values are fixed point with 12 fractional bits.
+ */
+#define SIO_DSP_GAIN_UNITY	4096
+
+/**
+ * @brief Largest gain value accepted by SoundIoDspGain()
+ * @ingroup soundio
+ */
+#define SIO_DSP_GAIN_MAX	32767
+
+/**
+ * @brief Signal level accumulator for SoundIoDspMeasure()
+ * @ingroup soundio
+ *
+ * Callers zero this structure, then pass it to SoundIoDspMeasure() one
+ * or more times.
+ */
+struct SoundIoDspLevel {
+	/** @brief Largest absolute sample value seen, 0-32768 */
+	uint32_t	peak;
+	/** @brief Sum of the squares of the sample values seen */
+	uint64_t	sum_sq;
+	/** @brief Number of samples accumulated */
+	uint64_t	count;
+
+	/** @brief Compute the RMS level of the accumulated samples */
+	unsigned int Rms(void) const;
+};
+
+/**
+ * @brief Table of sample processing kernel implementations
+ * @ingroup soundio
+ *
+ * All counts are of individual samples, i.e. records multiplied by
+ * the number of channels.  No alignment is required of any buffer.
+ */
+struct SoundIoDspKernels {
+	/** @brief Name of the implementation, e.g. "sse2" */
+	const char	*name;
+
+	/** @brief Saturating add of @em src into @em dest */
+	void (*mix_s16)(int16_t *dest, const int16_t *src, size_t count);
+	/** @brief Saturating add of @em src into @em dest */
+	void (*mix_u8)(uint8_t *dest, const uint8_t *src, size_t count);
+	/** @brief Saturating multiply of @em buf by a fixed point gain */
+	void (*gain_s16)(int16_t *buf, size_t count, unsigned int gain);
+	/** @brief Accumulate the peak and sum of squares of @em src */
+	void (*level_s16)(const int16_t *src, size_t count,
+			  SoundIoDspLevel &lev);
+};
+
+/**
+ * @brief Select a kernel implementation
+ * @ingroup soundio
+ *
+ * The implementation selected will be used by all SoundIoDsp*()
+ * functions.  This is intended for testing and benchmarking.  Normal
+ * clients need not call this function, as the fastest supported
+ * implementation is selected automatically.
+ *
+ * @param[in] name Name of the implementation to select, or 0 to
+ * select the fastest implementation supported by the CPU.
+ *
+ * @return The selected kernel table, or 0 if @em name is unknown or
+ * not supported by the CPU.  In the latter case the selection is
+ * not changed.
+ */
+extern SoundIoDspKernels const *SoundIoDspSelect(const char *name = 0);
+
+/**
+ * @brief Retrieve the selected kernel implementation
+ * @ingroup soundio
+ */
+extern SoundIoDspKernels const *SoundIoDspGetKernels(void);
+
+/**
+ * @brief Fill a buffer with copies of one sample record
+ * @ingroup soundio
+ *
+ * @param[out] dest Buffer to be filled.
+ * @param[in] rec Sample record to replicate, @em bpr bytes long.
+ * @param[in] bpr Size of the sample record in bytes.
+ * @param[in] nrecs Number of records to be written to @em dest.
+ */
+extern void SoundIoDspFill(uint8_t *dest, const uint8_t *rec,
+			   unsigned int bpr, size_t nrecs);
+
+/**
+ * @brief Fractional bits of SoundIoDspRecordKernels::interp positions
+ * @ingroup soundio
+ */
+#define SIO_DSP_INTERP_SHIFT	20
+
+/**
+ * @brief Record kernels specialized for one stream format
+ * @ingroup soundio
+ *
+ * SoundIoPump looks up a table for its stream format when it is
+ * started, and uses it for every transfer.  Tables exist for U8 and
+ * S16_LE at one and two channels, and for A-law and Mu-law at one
+ * and two channels, with the record size and channel count fixed at
+ * compile time.  Other channel counts get a generic table that takes
+ * them at run time.
+ */
+struct SoundIoDspRecordKernels {
+	/** @brief Channel count specialized for, or 0 if generic */
+	unsigned int	nchannels;
+
+	/**
+	 * @brief Fill a buffer with copies of one sample record, as
+	 * SoundIoDspFill()
+	 */
+	void (*fill)(uint8_t *dest, const uint8_t *rec, unsigned int bpr,
+		     size_t nrecs);
+
+	/**
+	 * @brief Resample by linear interpolation between records
+	 *
+	 * Output record @em i is interpolated from @em src at position
+	 * @em pos + @em i * @em step, both fixed point with
+	 * @c SIO_DSP_INTERP_SHIFT fractional bits.  @em src must
+	 * extend one record past the last position.
+	 *
+	 * This is 0 for companded formats.
+	 */
+	void (*interp)(uint8_t *dest, const uint8_t *src, size_t nrecs,
+		       uint32_t pos, uint32_t step, unsigned int nchannels);
+};
+
+/**
+ * @brief Look up the record kernels for a stream format
+ * @ingroup soundio
+ *
+ * @param[in] type Sample format.
+ * @param[in] nchannels Number of channels per record.
+ * @param[in] generic Set to @c true to get the generic table even if
+ * a specialized one exists.  This is intended for testing and
+ * benchmarking.
+ *
+ * @return The kernel table, or 0 if @em type is not recognized.
+ */
+extern SoundIoDspRecordKernels const *
+SoundIoDspGetRecordKernels(sio_sampletype_t type, unsigned int nchannels,
+			   bool generic = false);
+
+/**
+ * @brief Fill a buffer with silence
+ * @ingroup soundio
+ *
+ * @param[in] type Sample format of @em dest.
+ * @param[out] dest Buffer to be filled.
+ * @param[in] count Number of samples to be written.
+ *
+ * @retval true Silence was written.
+ * @retval false @em type is not recognized.
+ */
+extern bool SoundIoDspSilence(sio_sampletype_t type, uint8_t *dest,
+			      size_t count);
+
+/**
+ * @brief Mix one buffer into another, saturating on overflow
+ * @ingroup soundio
+ *
+ * @param[in] type Sample format of both buffers.
+ * @param[in,out] dest Buffer to receive the mix.
+ * @param[in] src Buffer to be mixed into @em dest.
+ * @param[in] count Number of samples in each buffer.
+ *
+ * @retval true The buffers were mixed.
+ * @retval false @em type is not recognized.
+ */
+extern bool SoundIoDspMix(sio_sampletype_t type, uint8_t *dest,
+			  const uint8_t *src, size_t count);
+
+/**
+ * @brief Scale samples in place, saturating on overflow
+ * @ingroup soundio
+ *
+ * @param[in] type Sample format of @em buf.
+ * @param[in,out] buf Buffer to be scaled.
+ * @param[in] count Number of samples in @em buf.
+ * @param[in] gain Gain to apply, relative to @c SIO_DSP_GAIN_UNITY,
+ * no larger than @c SIO_DSP_GAIN_MAX.
+ *
+ * @retval true The samples were scaled.
+ * @retval false @em type is not recognized.
+ */
+extern bool SoundIoDspGain(sio_sampletype_t type, uint8_t *buf,
+			   size_t count, unsigned int gain);
+
+/**
+ * @brief Convert samples between formats
+ * @ingroup soundio
+ *
+ * @param[in] dtype Sample format of @em dest.
+ * @param[out] dest Buffer to receive converted samples.
+ * @param[in] stype Sample format of @em src.
+ * @param[in] src Buffer of samples to be converted.
+ * @param[in] count Number of samples to convert.
+ *
+ * @retval true The samples were converted.
+ * @retval false @em dtype or @em stype is not recognized.
+ *
+ * @note @em src and @em dest must not overlap unless the formats
+ * are the same size.
+ */
+extern bool SoundIoDspConvert(sio_sampletype_t dtype, uint8_t *dest,
+			      sio_sampletype_t stype, const uint8_t *src,
+			      size_t count);
+
+/**
+ * @brief Change the channel count of S16 sample records
+ * @ingroup soundio
+ *
+ * Records are down-mixed to one channel by averaging, and one channel
+ * is up-mixed by copying it to every channel.
+ *
+ * @param[out] dest Buffer to receive @em nrecs records of @em dnch
+ * channels.
+ * @param[in] dnch Number of channels per record of @em dest.
+ * @param[in] src Buffer of @em nrecs records of @em snch channels.
+ * @param[in] snch Number of channels per record of @em src.
+ * @param[in] nrecs Number of records to convert.
+ *
+ * @retval true The records were converted.
+ * @retval false Neither channel count is one, and they differ.
+ *
+ * @note @em src and @em dest must not overlap.
+ */
+extern bool SoundIoDspRemix(int16_t *dest, unsigned int dnch,
+			    const int16_t *src, unsigned int snch,
+			    size_t nrecs);
+
+/**
+ * @brief Integer ratio polyphase resampler for S16 sample records
+ * @ingroup soundio
+ *
+ * Either interpolates by an integer factor, or decimates by one.  The
+ * anti-aliasing filter is a windowed sinc with a fixed number of taps
+ * per phase, passing 90% of the band of the lower rate, and it is
+ * applied in polyphase form, so no work is spent on the zeros of
+ * interpolation or the discarded records of decimation.  Filter
+ * history is kept across calls to Process().
+ */
+class SoundIoDspResampler {
+	enum {
+		c_phase_taps = 16,
+		c_block = 256,
+	};
+
+	unsigned int	m_up;
+	unsigned int	m_down;
+	unsigned int	m_nch;
+	unsigned int	m_ntaps;
+	unsigned int	m_skip;
+	int16_t		*m_coef;
+	int16_t		*m_hist;
+
+public:
+	/** @brief Largest supported interpolation or decimation factor */
+	enum { MAX_RATIO = 12 };
+
+	SoundIoDspResampler(void);
+	~SoundIoDspResampler();
+
+	/**
+	 * @brief Set the conversion ratio
+	 *
+	 * @param[in] up Interpolation factor.
+	 * @param[in] down Decimation factor.  At least one of @em up
+	 * and @em down must be one, and neither may exceed MAX_RATIO.
+	 * @param[in] nchannels Number of channels per record.
+	 *
+	 * @retval true The resampler was configured and reset.
+	 * @retval false The ratio is not supported, or memory could
+	 * not be allocated.
+	 */
+	bool Configure(unsigned int up, unsigned int down,
+		       unsigned int nchannels);
+
+	/** @brief Discard the filter history */
+	void Reset(void);
+
+	/**
+	 * @brief Number of records Process() will produce
+	 *
+	 * @param[in] nrecs Number of records to be passed to Process().
+	 */
+	size_t OutputCount(size_t nrecs) const {
+		if (m_up > 1)
+			return nrecs * m_up;
+		if (nrecs <= m_skip)
+			return 0;
+		return ((nrecs - m_skip - 1) / m_down) + 1;
+	}
+
+	/**
+	 * @brief Resample a buffer of records
+	 *
+	 * @param[out] dest Buffer to receive OutputCount(@em nrecs)
+	 * records.
+	 * @param[in] src Buffer of records to be resampled.
+	 * @param[in] nrecs Number of records in @em src.
+	 *
+	 * @return The number of records written to @em dest.
+	 */
+	size_t Process(int16_t *dest, const int16_t *src, size_t nrecs);
+};
+
+/**
+ * @brief Accumulate signal level statistics
+ * @ingroup soundio
+ *
+ * Values are measured on the S16 scale regardless of the sample format.
+ *
+ * @param[in] type Sample format of @em src.
+ * @param[in] src Buffer of samples to be measured.
+ * @param[in] count Number of samples in @em src.
+ * @param[in,out] lev Accumulator to be updated.
+ *
+ * @retval true @em lev was updated.
+ * @retval false @em type is not recognized.
+ */
+extern bool SoundIoDspMeasure(sio_sampletype_t type, const uint8_t *src,
+			      size_t count, SoundIoDspLevel &lev);
+
+} /* namespace libhfp */
+
+#endif /* !defined(__LIBHFP_SOUNDIO_DSP_H__) */
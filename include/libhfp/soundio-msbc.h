@@ -0,0 +1,154 @@
+/* -*- C++ -*- */
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if !defined(__LIBHFP_SOUNDIO_MSBC_H__)
+#define __LIBHFP_SOUNDIO_MSBC_H__
+
+/**
+ * @file libhfp/soundio-msbc.h
+ */
+
+/*
+ * mSBC codec for Hands-Free Profile 1.6 wideband speech.
+ *
+ * mSBC is SBC with its parameters fixed at 16KHz, mono, 8 subbands,
+ * 15 blocks, loudness allocation and a bitpool of 26.  Each 57 byte
+ * frame carries 120 samples, and is transported over a transparent
+ * SCO link with a two byte H2 synchronization header and one byte of
+ * padding, for 60 bytes per packet.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace libhfp {
+
+/**
+ * @brief mSBC encoder and decoder
+ * @ingroup soundio
+ *
+ * SoundIoMsbc converts between 16KHz S16 native-endian PCM and a stream
+ * of H2-framed mSBC packets.  The encoder produces one complete packet
+ * per 120 samples.  The decoder accepts the packet stream in arbitrarily
+ * sized pieces, as it is received from a SCO socket, and locates packet
+ * boundaries by their synchronization headers.
+ *
+ * Packets that are lost, fail their CRC check, or are otherwise
+ * unreadable are replaced with concealment frames, which repeat the
+ * last good output with decaying gain.  The first good frame after a
+ * loss is cross-faded against the concealment signal.  Thus the decoder
+ * always produces 120 samples for each 60 bytes of packet stream.
+ */
+class SoundIoMsbc {
+public:
+	enum {
+		/** @brief Samples per mSBC frame */
+		MSBC_PCM_SAMPS = 120,
+		/** @brief Size of an mSBC frame, without H2 framing */
+		MSBC_FRAME_SIZE = 57,
+		/** @brief Size of an H2-framed mSBC packet */
+		MSBC_PACKET_SIZE = 60,
+		/** @brief Sample rate of mSBC */
+		MSBC_SAMPLERATE = 16000,
+	};
+
+private:
+	enum {
+		NSUBBANDS = 8,
+		NBLOCKS = 15,
+		BITPOOL = 26,
+		XFADE_SAMPS = 32,
+	};
+
+	/* Encoder state */
+	float		m_enc_x[10 * NSUBBANDS];
+	uint8_t		m_enc_seq;
+
+	/* Decoder state */
+	float		m_dec_v[20 * NSUBBANDS];
+	uint8_t		m_rx[MSBC_PACKET_SIZE];
+	size_t		m_rx_len;
+	size_t		m_rx_skip;
+	bool		m_rx_held;
+	int		m_rx_seq;
+	unsigned int	m_lost_pending;
+
+	/* Packet loss concealment state */
+	int16_t		m_plc_last[MSBC_PCM_SAMPS];
+	unsigned int	m_plc_count;
+	bool		m_plc_valid;
+	unsigned int	m_conceal_total;
+
+	void Analyze(const int16_t *pcm, float *sb);
+	void Synthesize(const float *sb, int16_t *pcm);
+	bool DecodeFrame(const uint8_t *frame, int16_t *pcm);
+	int PlcGain(void) const;
+	void Conceal(int16_t *pcm);
+	void GoodFrame(int16_t *pcm);
+
+public:
+	SoundIoMsbc();
+
+	/**
+	 * @brief Reset all encoder and decoder state
+	 *
+	 * This should be called each time a new audio connection is
+	 * established.
+	 */
+	void Reset(void);
+
+	/**
+	 * @brief Encode one frame into an H2-framed mSBC packet
+	 *
+	 * @param[in] pcm Buffer of @c MSBC_PCM_SAMPS samples to encode.
+	 * @param[out] packet Buffer of @c MSBC_PACKET_SIZE bytes to
+	 * receive the packet.
+	 */
+	void Encode(const int16_t *pcm, uint8_t *packet);
+
+	/**
+	 * @brief Decode one frame from the mSBC packet stream
+	 *
+	 * Bytes are consumed from @em data until a frame of output is
+	 * available or @em data is exhausted.  Callers will typically
+	 * invoke this method in a loop until it returns @c false.
+	 *
+	 * @param[in,out] data Pointer to packet stream data, advanced
+	 * past the bytes consumed.
+	 * @param[in,out] len Number of bytes available at @em data,
+	 * reduced by the number of bytes consumed.
+	 * @param[out] pcm Buffer of @c MSBC_PCM_SAMPS samples to receive
+	 * decoded or concealed output.
+	 *
+	 * @retval true @em pcm was filled.
+	 * @retval false More data is required to produce a frame.
+	 */
+	bool Decode(const uint8_t *&data, size_t &len, int16_t *pcm);
+
+	/**
+	 * @brief Query the number of frames concealed since the last Reset()
+	 */
+	unsigned int GetConcealCount(void) const { return m_conceal_total; }
+};
+
+} /* namespace libhfp */
+
+#endif /* !defined(__LIBHFP_SOUNDIO_MSBC_H__) */
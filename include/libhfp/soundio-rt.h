@@ -0,0 +1,265 @@
+/* -*- C++ -*- */
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if !defined(__LIBHFP_SOUNDIO_RT_H__)
+#define __LIBHFP_SOUNDIO_RT_H__
+
+/**
+ * @file libhfp/soundio-rt.h
+ */
+
+/*
+ * Dedicated audio thread for SoundIoPump.
+ *
+ * The audio thread runs its own IndepEventDispatcher.  A SoundIoPump
+ * and endpoints created with that dispatcher have all of their
+ * notifications delivered on the audio thread, away from the main
+ * event loop.  Control operations are passed to the audio thread, and
+ * notifications back to the main thread, through single producer,
+ * single consumer rings that neither side ever blocks on.
+ */
+
+#if defined(USE_PTHREADS)
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <libhfp/events.h>
+#include <libhfp/events-indep.h>
+
+namespace libhfp {
+
+/**
+ * @brief Scheduling configuration for SoundIoRtThread
+ * @ingroup soundio
+ */
+struct SoundIoRtConfig {
+	/// SCHED_FIFO priority of the audio thread, 0 to inherit
+	int		priority;
+	/// Mask of CPUs the audio thread may run on, 0 for any
+	unsigned long	cpu_mask;
+	/// Lock the memory of the process to avoid paging stalls
+	bool		mlock;
+};
+
+/**
+ * @brief Dedicated real-time thread for audio processing
+ * @ingroup soundio
+ *
+ * SoundIoRtThread runs an event loop on a thread of its own, which
+ * may be given real-time scheduling priority and a CPU affinity.
+ * To move audio processing onto the thread, construct SoundIoPump or
+ * SoundIoManager, and the endpoints they use, with the dispatcher
+ * returned by GetDi().
+ *
+ * Once the thread is started, objects bound to its dispatcher must
+ * only be touched on the audio thread.  The main thread uses Post()
+ * or Call() to run control operations there, such as muting, adding
+ * or removing filters, or swapping endpoints.  Notifications raised
+ * on the audio thread should be passed to the main thread with
+ * PostMain().
+ *
+ * Both directions use fixed size lock-free rings.  The audio thread
+ * never waits for the main thread, and Call() is the only operation
+ * that makes the main thread wait for the audio thread.
+ */
+class SoundIoRtThread {
+	/*
+	 * Log messages from the audio thread are formatted there, and
+	 * logged by the main thread, see LogPush().
+	 */
+	class RtDispatcher : public IndepEventDispatcher {
+	public:
+		SoundIoRtThread		*m_rt;
+		RtDispatcher(SoundIoRtThread *rtp) : m_rt(rtp) {}
+		virtual void LogVa(DispatchInterface::logtype_t lt,
+				   const char *fmt, va_list ap);
+	};
+
+	enum {
+		c_queue_size = 64,
+		c_log_len = 160,
+	};
+
+	struct LogEntry {
+		DispatchInterface::logtype_t	lt;
+		char				text[c_log_len];
+	};
+
+	class CommandQueue {
+	public:
+		Callback<void>	m_cmds[c_queue_size];
+		unsigned int	m_head;
+		unsigned int	m_tail;
+		int		m_pipe[2];
+		SocketNotifier	*m_not;
+
+		CommandQueue(void) : m_head(0), m_tail(0), m_not(0) {
+			m_pipe[0] = m_pipe[1] = -1;
+		}
+
+		bool Open(DispatchInterface *dip, ErrorInfo *error);
+		void Close(void);
+		bool Push(Callback<void> const &cmd);
+		bool Pop(Callback<void> &cmd);
+		void Drain(void);
+	};
+
+	DispatchInterface	*m_main_di;
+	RtDispatcher		m_rt_di;
+	CommandQueue		m_cmdq;
+	CommandQueue		m_mainq;
+	pthread_t		m_thread;
+	bool			m_started;
+	bool			m_run;
+	bool			m_mlocked;
+	Callback<void>		m_call;
+	sem_t			m_call_done;
+
+	LogEntry		m_log[c_queue_size];
+	unsigned int		m_log_head;
+	unsigned int		m_log_tail;
+	unsigned int		m_log_dropped;
+	unsigned int		m_log_reported;
+
+	static void *ThreadHelper(void *arg);
+	void ThreadLoop(void);
+	void CommandNotify(SocketNotifier *notp, int fh);
+	void MainNotify(SocketNotifier *notp, int fh);
+	void CallHelper(void);
+	void Quit(void);
+	void LogPush(DispatchInterface::logtype_t lt,
+		     const char *fmt, va_list ap);
+	void LogDeliver(void);
+
+public:
+	/**
+	 * @brief Standard constructor
+	 *
+	 * @param mainp Dispatcher of the main thread, which receives
+	 * operations passed with PostMain(), and log messages from
+	 * the audio thread.
+	 */
+	SoundIoRtThread(DispatchInterface *mainp);
+
+	/**
+	 * @brief Standard destructor
+	 *
+	 * Stops the audio thread if it is running.
+	 */
+	~SoundIoRtThread();
+
+	/**
+	 * @brief Query the dispatcher of the audio thread
+	 *
+	 * Objects created with this dispatcher have their timer and
+	 * socket notifications delivered on the audio thread.
+	 */
+	DispatchInterface *GetDi(void) { return &m_rt_di; }
+
+	/**
+	 * @brief Query the dispatcher of the main thread
+	 */
+	DispatchInterface *GetMainDi(void) const { return m_main_di; }
+
+	/**
+	 * @brief Start the audio thread
+	 *
+	 * @param cfg Scheduling configuration for the thread.
+	 * @param error Error information structure.  If this method
+	 * fails and returns @c false, the reason for the failure will
+	 * be reported through this parameter.
+	 *
+	 * @retval true The audio thread is running.
+	 * @retval false The thread could not be started with the
+	 * requested configuration, most often because the process
+	 * lacks the privileges needed for real-time scheduling or
+	 * memory locking.
+	 */
+	bool Start(SoundIoRtConfig const &cfg, ErrorInfo *error = 0);
+
+	/**
+	 * @brief Stop the audio thread
+	 *
+	 * Operations already queued with Post() are run before the
+	 * thread exits.  Objects bound to the audio thread's
+	 * dispatcher may be touched by the main thread again once
+	 * this method returns.
+	 */
+	void Stop(void);
+
+	/**
+	 * @brief Query whether the audio thread is running
+	 */
+	bool IsStarted(void) const { return m_started; }
+
+	/**
+	 * @brief Query whether the caller is running on the audio thread
+	 */
+	bool IsAudioThread(void) const {
+		return m_started && pthread_equal(pthread_self(), m_thread);
+	}
+
+	/**
+	 * @brief Queue an operation to run on the audio thread
+	 *
+	 * Must only be called from the main thread.
+	 *
+	 * @param cmd Operation to run, usually set up with
+	 * Callback::Bind().
+	 *
+	 * @retval true The operation was queued, or if the audio
+	 * thread is not running, was run immediately.
+	 * @retval false The command queue is full.
+	 */
+	bool Post(Callback<void> const &cmd);
+
+	/**
+	 * @brief Run an operation on the audio thread and wait for it
+	 *
+	 * Must only be called from the main thread.  If the audio
+	 * thread is not running, the operation is run immediately.
+	 *
+	 * @param cmd Operation to run, usually set up with
+	 * Callback::Bind().
+	 */
+	void Call(Callback<void> const &cmd);
+
+	/**
+	 * @brief Queue an operation to run on the main thread
+	 *
+	 * Must only be called from the audio thread.  The operation
+	 * is run from the main thread's dispatcher.
+	 *
+	 * @param cmd Operation to run, usually set up with
+	 * Callback::Bind().
+	 *
+	 * @retval true The operation was queued.
+	 * @retval false The notification queue is full.
+	 */
+	bool PostMain(Callback<void> const &cmd);
+};
+
+} /* namespace libhfp */
+
+#endif /* defined(USE_PTHREADS) */
+
+#endif /* !defined(__LIBHFP_SOUNDIO_RT_H__) */
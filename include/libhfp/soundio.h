@@ -190,6 +190,95 @@ struct SoundIoBuffer {
 	uint8_t		*m_data;
 };
 
+/**
+ * @brief Log-linear latency histogram
+ * @ingroup soundio
+ *
+ * SoundIoLatencyHist counts durations, in nanoseconds, into a fixed
+ * array of buckets.  Each power of two range is divided into eight
+ * linear buckets, so percentiles are reported with a relative error
+ * of at most one eighth, and recording a duration costs a few integer
+ * operations and no allocation.  Durations longer than about four
+ * seconds are all counted in the last bucket.
+ *
+ * Reads are not synchronized with Add().  A histogram read from
+ * another thread may be off by the samples that are in flight.
+ */
+class SoundIoLatencyHist {
+	enum {
+		c_sub_bits = 3,
+		c_sub_count = (1 << c_sub_bits),
+		c_buckets = (32 - c_sub_bits + 1) * c_sub_count,
+	};
+
+	uint32_t	m_buckets[c_buckets];
+	uint64_t	m_count;
+	uint32_t	m_max;
+
+public:
+	SoundIoLatencyHist(void) { Clear(); }
+
+	/** @brief Discard all recorded durations */
+	void Clear(void);
+
+	/**
+	 * @brief Record a duration
+	 *
+	 * @param ns Duration in nanoseconds
+	 */
+	void Add(uint64_t ns) {
+		uint32_t val;
+		unsigned int idx, shift;
+
+		val = (ns > 0xffffffffULL) ? 0xffffffff : (uint32_t) ns;
+		if (val < c_sub_count)
+			idx = val;
+		else {
+			shift = (31 - __builtin_clz(val)) - c_sub_bits;
+			idx = ((shift + 1) << c_sub_bits) +
+				((val >> shift) & (c_sub_count - 1));
+		}
+		m_buckets[idx]++;
+		m_count++;
+		if (val > m_max)
+			m_max = val;
+	}
+
+	/**
+	 * @brief Record the time elapsed since a timestamp
+	 *
+	 * @param start Timestamp previously returned by Now()
+	 */
+	void AddSince(uint64_t start) {
+		uint64_t now = Now();
+		Add((now > start) ? (now - start) : 0);
+	}
+
+	/** @brief Query the number of recorded durations */
+	uint64_t GetCount(void) const { return m_count; }
+
+	/** @brief Query the longest recorded duration in nanoseconds */
+	uint32_t GetMax(void) const { return m_max; }
+
+	/**
+	 * @brief Query a percentile of the recorded durations
+	 *
+	 * @param per_mille Rank of the percentile in thousandths,
+	 * e.g. 990 for the 99th percentile, or 999 for the 99.9th.
+	 *
+	 * @return The upper bound in nanoseconds of the bucket that
+	 * contains the requested rank, or 0 if nothing was recorded.
+	 */
+	uint32_t Percentile(unsigned int per_mille) const;
+
+	/**
+	 * @brief Read the monotonic clock
+	 *
+	 * @return A timestamp in nanoseconds, suitable for AddSince()
+	 */
+	static uint64_t Now(void);
+};
+
 
 /**
  * @brief Audio Source/Sink Interface
@@ -599,6 +688,26 @@ public:
 	 * @retval false Asynchronous audio handling is not started
 	 */
 	virtual bool SndIsAsyncStarted(void) const = 0;
+
+	/**
+	 * @brief Query latency histograms of the device transfer path
+	 *
+	 * Endpoints that move samples between their queues and a
+	 * device may time each transfer.  SoundIoPump collects these
+	 * histograms with its own.
+	 *
+	 * @param[out] in Set to the histogram of transfers from the
+	 * device into the input queue.
+	 * @param[out] out Set to the histogram of transfers from the
+	 * output queue to the device.
+	 *
+	 * @retval true Both histograms were returned.
+	 * @retval false The endpoint does not time its transfers.  The
+	 * default implementation returns @c false.
+	 */
+	virtual bool SndGetLatency(SoundIoLatencyHist *&/*in*/,
+				   SoundIoLatencyHist *&/*out*/)
+		{ return false; }
 };
 
 
@@ -624,6 +733,14 @@ public:
 
 	bool Add(const char *name, const char *desc);
 
+	/**
+	 * @brief Make an independent copy of the list
+	 *
+	 * @return A new SoundIoDeviceList with the same entries, or
+	 * NULL if memory is exhausted.
+	 */
+	SoundIoDeviceList *Copy(void) const;
+
 	/**
 	 * @brief Move the internal cursor to the beginning of the list
 	 *
@@ -711,6 +828,54 @@ extern SoundIo *SoundIoCreateAlsa(DispatchInterface *dip,
 extern SoundIoDeviceList *SoundIoGetDeviceListAlsa(ErrorInfo *error);
 
 
+/**
+ * @brief Construct a virtual clocked SoundIo object
+ * @ingroup soundio
+ *
+ * This function constructs a SoundIo object that behaves like a
+ * full-duplex sound card, but is clocked by a timer rather than by
+ * hardware.  It is intended for systems with no sound card, and for
+ * repeatable measurements of the whole audio pipeline.  It requires
+ * timerfd support.
+ *
+ * @param[in] dip Dispatcher interface object adapted to the environment in
+ * which the SoundIo object is to run.
+ * @param[in] driveropts Driver options string.  This can be empty, in
+ * which case the card captures silence at any requested sample rate,
+ * and discards its output.  It can also be a concatenation of
+ * @c name @c = @c value pairs of the following form:
+ * @code
+ * name1=value1[&name2=value2[&...]]
+ * @endcode
+ * Recognized parameters for the virtual driver include:
+ * - @c in @c = @em filename (audio file to capture, looped)
+ * - @c out @c = @em filename (audio file to record playback into)
+ * - @c rate @c = @em hz (only accept this sample rate)
+ * - @c packet @c = @em records (force the packet size)
+ * - @c jitter @c = @em usec (maximum random delay of each interrupt)
+ * - @c drift @c = @em ppm (clock rate error, positive is fast)
+ * - @c seed @c = @em number (seed for the jitter sequence)
+ * @param[out] error Error information structure.  If this method
+ * fails and returns 0, and @em error is not 0, @em error will be filled
+ * out with information on the cause of the failure.
+ *
+ * @return A newly constructed virtual SoundIo object, or NULL on failure.
+ *
+ * The capture file must have the same format as the card, as set by
+ * SoundIo::SndSetFormat().
+ *
+ * An example @c driveropts string:
+ * @code
+ * in=speech.wav&out=played.wav&rate=8000&jitter=2000&drift=-50
+ * @endcode
+ */
+extern SoundIo *SoundIoCreateVirtual(DispatchInterface *dip,
+				     const char *driveropts,
+				     ErrorInfo *error);
+
+extern SoundIoDeviceList *SoundIoGetDeviceListVirtual(ErrorInfo *error);
+
+
 /**
  * @brief Construct a SoundIo object backed by a fixed-size memory buffer
  * @ingroup soundio
@@ -739,6 +904,44 @@ extern SoundIoDeviceList *SoundIoGetDeviceListAlsa(ErrorInfo *error);
 extern SoundIo *SoundIoCreateMembuf(const SoundIoFormat *fmt,
 				    sio_sampnum_t nsamps);
 
+/**
+ * @brief Construct a SoundIo object that converts the format of another
+ * @ingroup soundio
+ *
+ * The converter presents a different sample type, sample rate, and
+ * channel count to its client than the SoundIo object it wraps, and
+ * converts the sample records passing through in both directions.
+ * SoundIoPump uses it to connect endpoints whose formats differ,
+ * so that a sound card may run in its native format.
+ *
+ * Channels are down-mixed by averaging and up-mixed by copying, so
+ * one of the two channel counts must be one, unless they are equal.
+ * Sample rates must be related by an integer ratio of at most
+ * SoundIoDspResampler::MAX_RATIO, and are converted with a polyphase
+ * filter, e.g. 8KHz to 48KHz.
+ *
+ * @param[in] native SoundIo object to be wrapped.  Its format must
+ * be set before the converter is constructed.  The converter does not
+ * take ownership of it.
+ * @param[in] fmt Format to present to the client of the converter.
+ * @param[out] error Error information structure.  If this method
+ * fails and returns 0, and @em error is not 0, @em error will be filled
+ * out with information on the cause of the failure.
+ *
+ * @return A newly constructed converter object, or NULL on failure.
+ *
+ * @note Open, close, and asynchronous start and stop requests are
+ * passed to @em native.  SoundIo::cb_NotifyPacket and
+ * SoundIo::cb_NotifyAsyncStop are not relayed, and must be registered
+ * with @em native, and the queue state they report is in the native
+ * format.
+ * @note If the format of @em native changes, SoundIo::SndSetFormat()
+ * must be called on the converter before it is used again.
+ */
+extern SoundIo *SoundIoCreateConverter(SoundIo *native,
+				       SoundIoFormat const &fmt,
+				       ErrorInfo *error = 0);
+
 /**
  * @brief Construct a SoundIo object backed by a disk file
  * @ingroup soundio
@@ -769,6 +972,151 @@ extern SoundIo *SoundIoCreateFileHandler(DispatchInterface *ei,
 					 const char *filename, bool create,
 					 ErrorInfo *error = 0);
 
+/**
+ * @brief Statistics structure for members of a SoundIoMixer
+ * @ingroup soundio
+ *
+ * All values are sample counts, accumulated since the endpoint
+ * became a member of the mixer.
+ */
+struct SoundIoMixerStatistics {
+	/// Input samples discarded to hold the member to its fill level
+	sio_sampnum_t	in_dropped;
+	/// Input samples missing from the mix due to member underflow
+	sio_sampnum_t	in_padded;
+	/// Output samples discarded to hold the member to its fill level
+	sio_sampnum_t	out_dropped;
+	/// Silence samples sent to the member due to output underflow
+	sio_sampnum_t	out_padded;
+};
+
+/**
+ * @brief Mixing endpoint for multiple clocked SoundIo objects
+ * @ingroup soundio
+ *
+ * SoundIoMixer presents a group of member endpoints, typically the
+ * SCO audio connections of several audio gateways, as a single
+ * SoundIo object that can be used as the top endpoint of a
+ * SoundIoPump, or as the secondary endpoint of a SoundIoManager.
+ * Thus one sound card can be shared by several audio gateways.
+ *
+ * - Input from all members is mixed, using saturating additions,
+ * and presented as the input of the mixer.
+ * - Output written to the mixer is copied to the output of each member.
+ *
+ * All members must have the same sample rate, sample type and
+ * channel count, but may use different packet sizes.
+ *
+ * The mixer is clocked by its lead member, the first member added
+ * that is still streaming.  Each other member is driven by its own
+ * clock, and is held to a target fill level in each direction:
+ * input is buffered until the fill level is reached before it is
+ * mixed, and excess input or output that accumulates due to clock
+ * drift is discarded.  A member that stops contributing input is
+ * left out of the mix, and a member that runs short of output is
+ * sent silence.  SoundIoMixerStatistics accounts for each of these
+ * corrections.
+ *
+ * The mixer does not open, close, or otherwise perform life cycle
+ * management on its members.  Members should be opened by their
+ * owners before being added, and should be removed before being
+ * destroyed.
+ *
+ * Constructed by SoundIoCreateMixer().
+ */
+class SoundIoMixer : public SoundIo {
+public:
+	/**
+	 * @brief Add an endpoint to the mixer
+	 *
+	 * Endpoints may be added while the mixer is streaming, in which
+	 * case asynchronous processing is started on the new member.
+	 *
+	 * @param[in] memberp Clocked endpoint to add.  It must not be
+	 * a member already.
+	 * @param[out] error Error information structure.  If this method
+	 * fails and returns @c false, and @em error is not 0, @em error
+	 * will be filled out with information on the cause of the failure.
+	 *
+	 * @retval true @em memberp was added.
+	 * @retval false @em memberp is not clocked, its format does not
+	 * match the other members, or it could not be started.
+	 */
+	virtual bool AddMember(SoundIo *memberp, ErrorInfo *error = 0) = 0;
+
+	/**
+	 * @brief Remove an endpoint from the mixer
+	 *
+	 * If the mixer is streaming, asynchronous processing is stopped
+	 * on the member.  If @em memberp is the lead member, the next
+	 * streaming member takes its place.  Removing the last member
+	 * leaves a streaming mixer without a clock, so the stream should
+	 * be stopped first.
+	 *
+	 * @param[in] memberp Endpoint to remove.
+	 */
+	virtual void RemoveMember(SoundIo *memberp) = 0;
+
+	/**
+	 * @brief Query the number of members of the mixer
+	 */
+	virtual unsigned int GetMemberCount(void) const = 0;
+
+	/**
+	 * @brief Set the target fill level of a member
+	 *
+	 * @param[in] memberp Member endpoint to configure.
+	 * @param[in] fill Target fill level in sample records, in each
+	 * direction.  Pass 0 for the default of two packets.
+	 *
+	 * @retval true The fill level was set.
+	 * @retval false @em memberp is not a member.
+	 */
+	virtual bool SetMemberFill(SoundIo *memberp, sio_sampnum_t fill) = 0;
+
+	/**
+	 * @brief Retrieve rate matching accounting for a member
+	 *
+	 * @retval true @em stat was filled in.
+	 * @retval false @em memberp is not a member.
+	 */
+	virtual bool GetMemberStatistics(SoundIo *memberp,
+				 SoundIoMixerStatistics &stat) const = 0;
+
+	/**
+	 * @brief Notification of a member halting asynchronous processing
+	 *
+	 * Invoked when a member endpoint stops on its own, e.g. due to
+	 * a remote disconnection of its SCO socket.  The member remains
+	 * in the mixer, but is left out of the stream.  The target may
+	 * remove the member.
+	 *
+	 * If no streaming members remain, SoundIo::cb_NotifyAsyncStop
+	 * is invoked for the mixer after this callback returns.
+	 *
+	 * @param SoundIoMixer* The mixer that the member belongs to.
+	 * @param SoundIo* The member endpoint that stopped.
+	 * @param ErrorInfo& Reason reported by the member for stopping.
+	 */
+	Callback<void, SoundIoMixer*, SoundIo*, ErrorInfo&>
+		cb_NotifyMemberStop;
+};
+
+/**
+ * @brief Construct a mixing endpoint
+ * @ingroup soundio
+ *
+ * @param[out] error Error information structure.  If this method
+ * fails and returns @c 0, and @em error is not 0, @em error
+ * will be filled out with information on the cause of the failure.
+ * Currently, the only reason for failure of this function is a memory
+ * allocation failure.
+ *
+ * @return A newly constructed SoundIoMixer with no members, or
+ * @c 0 on error.
+ */
+extern SoundIoMixer *SoundIoCreateMixer(ErrorInfo *error = 0);
+
 /**
  * @brief Audio Filtering and Signal Processing Interface
  * @ingroup soundio
@@ -776,10 +1124,32 @@ extern SoundIo *SoundIoCreateFileHandler(DispatchInterface *ei,
 class SoundIoFilter {
 	friend class SoundIoPump;
 	SoundIoFilter	*m_up, *m_down;
+	unsigned int	m_flags_up, m_flags_dn;
+	SoundIoLatencyHist m_lat;
+	uint64_t	m_cost_ns;
+	uint32_t	m_cost_max_ns;
+	sio_sampnum_t	m_cost_packets;
 
 public:
+	/**
+	 * @brief Buffer handling properties reported by FltGetFlags()
+	 */
+	enum {
+		/**
+		 * FltProcess() produces correct results when @em dest
+		 * refers to the same memory as @em src.
+		 */
+		SIO_FLT_INPLACE = 0x01,
+		/**
+		 * FltProcess() never modifies sample data and always
+		 * returns @em src.
+		 */
+		SIO_FLT_PASSTHRU = 0x02,
+	};
+
 	/** @brief Standard constructor */
-	SoundIoFilter() : m_up(0), m_down(0) {}
+	SoundIoFilter() : m_up(0), m_down(0), m_flags_up(0), m_flags_dn(0),
+			  m_cost_ns(0), m_cost_max_ns(0), m_cost_packets(0) {}
 
 	/** @brief Standard destructor */
 	virtual ~SoundIoFilter() {}
@@ -829,6 +1199,28 @@ public:
 	 */
 	virtual void FltCleanup(void) = 0;
 
+	/**
+	 * @brief Query buffer handling properties of the filter
+	 *
+	 * SoundIoPump uses the result to plan its intermediate buffers
+	 * so that samples are copied as few times as possible.  When a
+	 * filter reports @c SIO_FLT_INPLACE, the pump may pass the same
+	 * buffer as both the source and destination of FltProcess().
+	 * The last filter in a direction that does not report
+	 * @c SIO_FLT_PASSTHRU is given the output buffer of the
+	 * destination endpoint as its destination buffer.
+	 *
+	 * This method is invoked after FltPrepare() succeeds, and the
+	 * result must remain valid until FltCleanup().
+	 *
+	 * @param up @c true to query the upward direction, @c false
+	 * to query the downward direction.
+	 *
+	 * @return A mask of @c SIO_FLT_* values.  The default
+	 * implementation returns 0, which is always safe.
+	 */
+	virtual unsigned int FltGetFlags(bool /*up*/) const { return 0; }
+
 	/**
 	 * @brief Request processing of a sample buffer
 	 *
@@ -849,11 +1241,60 @@ public:
 	 * filter stack, @c false otherwise.
 	 * @param src Buffer containing source samples for filter
 	 * @param dest Buffer to contain result samples from filter,
-	 * if modification is required.
+	 * if modification is required.  If the filter reported
+	 * @c SIO_FLT_INPLACE from FltGetFlags(), @em dest may refer to
+	 * the same memory as @em src.
+	 *
+	 * @return @em src if the samples were not changed, or @em dest
+	 * if the filter stored its result there.
 	 */
 	virtual SoundIoBuffer const *FltProcess(bool up,
 						SoundIoBuffer const &src,
 						SoundIoBuffer &dest) = 0;
+
+	/**
+	 * @brief Query a short name for the filter
+	 *
+	 * The name labels the filter's latency histogram.
+	 */
+	virtual const char *FltGetName(void) const { return "filter"; }
+
+	/**
+	 * @brief Query the latency histogram of the filter
+	 *
+	 * SoundIoPump records the duration of each FltProcess() call
+	 * in both directions here.
+	 */
+	SoundIoLatencyHist &FltGetLatency(void) { return m_lat; }
+
+	/**
+	 * @brief Query the number of reduced quality levels supported
+	 *
+	 * Filters with expensive processing may offer cheaper modes of
+	 * operation, to be selected with FltSetDegradeLevel() when the
+	 * CPU can't keep up.  See SoundIoManager::SetDspBudget().
+	 *
+	 * @return The highest degrade level accepted by
+	 * FltSetDegradeLevel().  The default implementation returns 0,
+	 * for filters that offer no reduced quality levels.
+	 */
+	virtual unsigned int FltGetDegradeLevels(void) const { return 0; }
+
+	/**
+	 * @brief Select a reduced quality level
+	 *
+	 * May be called while the filter is streaming, from the
+	 * context that invokes FltProcess().
+	 *
+	 * @param level 0 for full quality, up to the value returned
+	 * by FltGetDegradeLevels() for the cheapest processing.
+	 *
+	 * @retval true The level was selected.
+	 * @retval false The level is not supported, or could not be
+	 * applied.
+	 */
+	virtual bool FltSetDegradeLevel(unsigned int level)
+		{ return !level; }
 };
 
 /**
@@ -904,6 +1345,77 @@ extern SoundIoFilter *SoundIoCreateSnooper(SoundIo *target,
 					   bool up = true, bool dn = true,
 					   ErrorInfo *error = 0);
 
+/**
+ * @brief Statistics structure for stream snooping filters
+ * @ingroup soundio
+ *
+ * All values are sample counts, accumulated over the life of the
+ * snooper.
+ */
+struct SoundIoSnoopStatistics {
+	/// Samples accepted from the stream
+	sio_sampnum_t	queued;
+	/// Samples discarded because the queue was full
+	sio_sampnum_t	dropped;
+	/// Samples written to the slave endpoint
+	sio_sampnum_t	written;
+	/// Samples the slave endpoint did not accept
+	sio_sampnum_t	failed;
+	/// Largest number of samples seen waiting in the queue
+	sio_sampnum_t	max_level;
+};
+
+/**
+ * @brief Stream snooping filter with statistics
+ * @ingroup soundio
+ *
+ * Constructed by SoundIoCreateAsyncSnooper().
+ */
+class SoundIoFltSnoop : public SoundIoFilter {
+public:
+	/**
+	 * @brief Retrieve sample accounting for the snooper
+	 *
+	 * This method may be called at any time, including while the
+	 * writer thread is running.
+	 */
+	virtual void GetStatistics(SoundIoSnoopStatistics &stat) const = 0;
+};
+
+/**
+ * @brief Construct a stream snooping filter with a writer thread
+ * @ingroup soundio
+ *
+ * This is a variant of SoundIoCreateSnooper() for slow slave endpoints,
+ * e.g. files.  Rather than writing to the slave from within
+ * SoundIoFilter::FltProcess(), the snooper copies packets into a
+ * lock-free queue that is drained into the slave by a dedicated thread.
+ * A slave that stalls can't hold up the pump; once the queue fills,
+ * packets are dropped and counted in SoundIoSnoopStatistics::dropped.
+ *
+ * The slave endpoint is only accessed by the writer thread while the
+ * filter is prepared.  Its queue is flushed to it when the filter is
+ * cleaned up.
+ *
+ * If libhfp is built without thread support, or the writer thread can't
+ * be created, the snooper writes to the slave synchronously.
+ *
+ * @param[in] target Slave endpoint to receive snooped sample data.
+ * @param[in] up Set to @c true to snoop audio data streaming upward.
+ * @param[in] dn Set to @c true to snoop audio data streaming downward.
+ * @param[in] queue_ms Length of the queue in milliseconds, or 0 for
+ * the default of one second.
+ * @param[out] error Error information structure.
+ *
+ * @return A newly constructed snoop filter configured with the target
+ * endpoint, or @c 0 on error
+ */
+extern SoundIoFltSnoop *SoundIoCreateAsyncSnooper(SoundIo *target,
+						  bool up = true,
+						  bool dn = true,
+						  unsigned int queue_ms = 0,
+						  ErrorInfo *error = 0);
+
 
 /**
  * @brief Signal processing configuration for SoundIoFltSpeex
@@ -919,6 +1431,51 @@ struct SoundIoSpeexProps {
 	float		dereverb_level;
 	/// Dereverberation decay value
 	float		dereverb_decay;
+	/// Voice activity gate threshold, RMS on the S16 scale, 0=disable
+	int		gate_level;
+
+	SoundIoSpeexProps(void)
+		: noisereduce(false), echocancel_ms(0), agc_level(0),
+		  dereverb_level(0), dereverb_decay(0), gate_level(0) {}
+};
+
+/**
+ * @brief Voice activity gate statistics for SoundIoFltSpeex
+ *
+ * Counts are cleared at the start of each stream.  Time spent in
+ * the echo canceler and preprocessor is measured only for packets
+ * that ran them, so the time saved by the gate can be estimated
+ * from the average cost of a packet that did run.
+ *
+ * Reads are not synchronized with the filter, and a structure read
+ * while the filter is streaming may be off by a packet.
+ */
+struct SoundIoSpeexGateStats {
+	/// Input packets seen
+	uint64_t	packets;
+	/// Packets run through the echo canceler
+	uint64_t	echo_run;
+	/// Packets that skipped the echo canceler
+	uint64_t	echo_skipped;
+	/// Time spent in the echo canceler, nanoseconds
+	uint64_t	echo_ns;
+	/// Packets run through the preprocessor
+	uint64_t	preprocess_run;
+	/// Packets that skipped or downgraded the preprocessor
+	uint64_t	preprocess_skipped;
+	/// Time spent in the preprocessor, nanoseconds
+	uint64_t	preprocess_ns;
+
+	/// Estimate the processing time saved by the gate, nanoseconds
+	uint64_t SavedNs(void) const {
+		uint64_t saved = 0;
+		if (echo_run)
+			saved += (echo_ns / echo_run) * echo_skipped;
+		if (preprocess_run)
+			saved += ((preprocess_ns / preprocess_run) *
+				  preprocess_skipped);
+		return saved;
+	}
 };
 
 /**
@@ -928,9 +1485,60 @@ class SoundIoFltSpeex : public SoundIoFilter {
 public:
 	/**
 	 * @brief Set signal processing configuration
+	 *
+	 * May be called while the filter is streaming.  New DSP state
+	 * is allocated by the caller, and takes effect at the next
+	 * packet boundary.  The echo canceler is kept, along with what
+	 * it has learned, if the echo tail length is unchanged.
+	 *
+	 * The settings are reduced according to the degrade level
+	 * selected with FltSetDegradeLevel(): level 1 disables
+	 * dereverberation, level 2 also disables noise reduction, and
+	 * level 3 also halves the echo tail.  A change of echo tail
+	 * replaces the echo canceler, which must then reconverge over
+	 * the next few seconds, so it is the last resort.
 	 */
 	virtual bool Configure(SoundIoSpeexProps const &props,
 			       ErrorInfo *error = 0) = 0;
+
+	/**
+	 * @brief Select the saved DSP state for the next stream
+	 *
+	 * The echo canceler and preprocessor adapt to the acoustics
+	 * of a particular remote device and sound card over the first
+	 * seconds of a stream.  When a stream ends, its state is saved
+	 * under the key that was selected when it started, and a later
+	 * stream started with the same key resumes it, provided that
+	 * the packet size, sample rate, and echo tail are unchanged.
+	 * A few recent states are kept, and unkeyed ones are recycled
+	 * so that starting a stream usually needn't allocate.
+	 *
+	 * @param key Key identifying the remote device and sound card,
+	 * or 0 to start afresh.  The string is copied.
+	 * @param error Error information structure.
+	 *
+	 * @retval true The key was set.
+	 * @retval false The key was too long.
+	 */
+	virtual bool SetStateKey(const char *key, ErrorInfo *error = 0) = 0;
+
+	/**
+	 * @brief Query voice activity gate statistics
+	 *
+	 * When SoundIoSpeexProps::gate_level is nonzero, each packet's
+	 * energy is compared against it.  Once the output signal has
+	 * been quiet for longer than the echo tail plus a short
+	 * hangover, the echo canceler is skipped, as it has nothing
+	 * left to cancel and its history is already silent.  Once the
+	 * input signal has been quiet for as long, the preprocessor is
+	 * skipped.  If noise reduction is enabled, its noise estimate
+	 * is still updated on quiet packets, which are muted rather
+	 * than passed through unprocessed.
+	 *
+	 * @param[out] stats Statistics of the current or most recent
+	 * stream.
+	 */
+	virtual void GetGateStats(SoundIoSpeexGateStats &stats) const = 0;
 };
 
 /**
@@ -997,6 +1605,8 @@ struct SoundIoPumpStatistics {
 		sio_sampnum_t	drop;
 		sio_sampnum_t	pad;
 		sio_sampnum_t	fail;
+		sio_sampnum_t	stretch;
+		sio_sampnum_t	shrink;
 	};
 
 	struct Endpoint {
@@ -1027,10 +1637,20 @@ struct SoundIoPumpStatistics {
  * transferred between one source/sink pair is always the same as all
  * others -- and must satisfy the fill level constraints of all sources and
  * sinks in the system.  When fill level constraints cannot be satisfied,
- * silence-padding and sample dropping will occur.  Sophisticated methods
- * such as resampling are not employed.  Fill level configuration is a
- * closed process, but hints for fill level constraints can be provided via
- * SetMinBufferFill() and SetJitterWindow().
+ * silence-padding and sample dropping will occur.  Fill level configuration
+ * is a closed process, but hints for fill level constraints can be provided
+ * via SetMinBufferFill() and SetJitterWindow().
+ *
+ * When both endpoints are clocked, their clocks will inevitably drift
+ * apart, and the fill level constraints would eventually be violated.
+ * To avoid the resulting periodic padding and dropping, the pump can
+ * employ a drift compensation stage at one of the endpoints.  The stage
+ * is a small interpolating resampler whose ratio is steered by the
+ * output buffer fill level of each direction, keeping the levels
+ * centered in their windows.  The compensated endpoint is the top
+ * endpoint unless SetLossMode() forbids loss there, so that filters such
+ * as echo cancelers observe unaltered samples from the bottom endpoint.
+ * See SetDriftCompensation().
  *
  * Besides the fill level constraints and the packet sizes of each
  * endpoint, the pump also chooses a "filter packet size" which is the
@@ -1048,6 +1668,13 @@ struct SoundIoPumpStatistics {
  * started.  If the replacement endpoint has a smaller packet size or
  * output buffer size, it may not satisfy constraints.
  *
+ * The filters run in the format of the top endpoint.  If the bottom
+ * endpoint has a different sample type, sample rate, or channel count,
+ * the pump places a converter in front of it, see
+ * SoundIoCreateConverter(), so that a sound card may run in its native
+ * format.  The format cannot change while the pump is running, so a
+ * replacement endpoint whose format would change it is refused.
+ *
  * The endpoints are required to implement the SoundIo::SndAsyncStart()
  * and SoundIo::cb_NotifyPacket interfaces in order to work with
  * SoundIoPump.  Invocations of SoundIo::cb_NotifyPacket must occur on
@@ -1079,15 +1706,39 @@ struct SoundIoPumpStatistics {
  * to play audio files and monitor the position of their playback.  See
  * SoundIoCreateFileHandler().
  */
+struct SoundIoDspRecordKernels;
+
+/* Fractional bits of the pump's drift compensator positions */
+#define SIO_DRIFT_SHIFT 20
+
 class SoundIoPump {
 private:
 	enum {
 		c_sampsize = 4,
+		c_offline_packets = 16,
+	};
+
+	enum {
+		c_drift_shift = SIO_DRIFT_SHIFT,
+		c_drift_one = (1 << c_drift_shift),
+		c_drift_max_adj = (c_drift_one >> 7),
+		c_drift_kp_shift = 3,
+		c_drift_ki_shift = 12,
+	};
+
+	struct SoundIoDriftState {
+		uint32_t	pos;
+		uint32_t	step;
+		int32_t		integ;
+		uint8_t		hist[2 * c_sampsize];
 	};
 
 	struct SoundIoWorkingState {
 		SoundIo		*siop;
+		SoundIoDriftState *in_drift;
+		SoundIoDriftState *out_drift;
 		uint8_t		bpr;
+		SoundIoDspRecordKernels const *rec;
 		SoundIoBuffer	in_buf;
 		sio_sampnum_t	in_xfer;
 		sio_sampnum_t	in_xfer_expect;
@@ -1115,6 +1766,8 @@ private:
 		bool			bottom_roe, top_roe;
 		bool			pump_down, pump_up;
 		bool			warn_loss;
+		bool			drift_comp, drift_top;
+		bool			offline;
 		int8_t			watchdog_strikes;
 		unsigned int		watchdog_to;
 		sio_sampnum_t		watchdog_min_progress;
@@ -1123,6 +1776,12 @@ private:
 
 	DispatchInterface	*m_ei;
 	SoundIo			*m_bottom, *m_top;
+
+	/* Format converter wrapping m_bottom, if needed */
+	SoundIo			*m_bottom_cv;
+	/* Bottom side of data transfers: m_bottom_cv, or m_bottom */
+	SoundIo			*m_bottom_io;
+
 	SoundIoQueueState	m_bottom_qs, m_top_qs;
 	SoundIoPumpConfig	m_config;
 	bool			m_running;
@@ -1141,6 +1800,9 @@ private:
 	sio_sampnum_t		m_bottom_in_count, m_top_in_count;
 	sio_sampnum_t	      	m_bottom_out_count, m_top_out_count;
 
+	/* Samples moved by the current RunOffline() pass */
+	sio_sampnum_t		m_offline_count;
+
 	uint8_t			m_bo_last[c_sampsize], m_bi_last[c_sampsize];
 	uint8_t			m_to_last[c_sampsize], m_ti_last[c_sampsize];
 
@@ -1148,18 +1810,64 @@ private:
 
 	unsigned int		m_config_out_min_ms;
 	unsigned int		m_config_out_window_ms;
+	bool			m_config_drift_comp;
+
+	SoundIoDriftState	m_drift_up, m_drift_dn;
+
+	/* Record kernels for the stream format, chosen by __Start() */
+	SoundIoDspRecordKernels const *m_rec;
+
+	/*
+	 * Working memory for the streaming path, sized by
+	 * PrepareScratch() before endpoints are started.
+	 * m_proc_buf and m_drift_buf point into m_scratch, laid out
+	 * for m_config by CommitScratch().
+	 */
+	uint8_t			*m_scratch;
+	size_t			m_scratch_size;
+	uint8_t			*m_proc_buf;
+	uint8_t			*m_drift_buf;
+
+	/*
+	 * Buffer plan: the last filter in each direction that may
+	 * change sample data, set by BuildBufferPlan().  It receives
+	 * the destination endpoint's output buffer directly.
+	 */
+	SoundIoFilter		*m_up_sink_flt, *m_dn_sink_flt;
 
 	SoundIoPumpStatistics	*m_stat;
 
+	/*
+	 * Wakeup lag is measured against a timeline derived from the
+	 * samples each endpoint reports.  The earliest notification
+	 * seen in the current or previous window is taken as on time,
+	 * so that clock skew between endpoints does not accumulate.
+	 */
+	struct SoundIoWakeupState {
+		uint64_t	start;
+		uint64_t	samps;
+		uint64_t	window;
+		int64_t		min_cur, min_prev;
+	};
+
+	SoundIoLatencyHist	m_lat_process;
+	SoundIoLatencyHist	m_lat_wake_bottom, m_lat_wake_top;
+	SoundIoWakeupState	m_wake_bottom, m_wake_top;
+
 	void DumpQueueState(bool start, bool top) const;
 	void AsyncProcess(SoundIo *subp, SoundIoQueueState &statep);
 	void AsyncStopped(SoundIo *subp, ErrorInfo &error);
+	void WakeupUpdate(SoundIoWakeupState &ws, SoundIoLatencyHist &hist,
+			  uint64_t now, sio_sampnum_t nsamps);
 	bool WatchdogThreshold(sio_sampnum_t &count, int8_t &strikes,
 			       const char *name, ErrorInfo &error);
 	void Watchdog(TimerNotifier *notp);
+	bool __Start(bool offline, ErrorInfo *error);
 	void __Stop(ErrorInfo *reason = 0, SoundIo *offender = 0);
 
 	static void FillSilence(SoundIoFormat &fmt, uint8_t *dest);
+	static bool SameFormat(SoundIoFormat const &a,
+			       SoundIoFormat const &b);
 
 	static sio_sampnum_t CopyIn(uint8_t *dest, SoundIoWorkingState *swsp,
 				    sio_sampnum_t nsamps);
@@ -1172,6 +1880,31 @@ private:
 	static sio_sampnum_t OutputSilence(SoundIoWorkingState *dwsp,
 					   sio_sampnum_t nsamps);
 
+	static sio_sampnum_t DriftFwd(SoundIoDriftState const &ds,
+				      sio_sampnum_t nsamps);
+	static sio_sampnum_t DriftRev(SoundIoDriftState const &ds,
+				      sio_sampnum_t nsamps);
+	static sio_sampnum_t DriftLimit(SoundIoDriftState const &ds,
+					sio_sampnum_t nsamps, bool src);
+	static void DriftUpdate(SoundIoDriftState &ds, sio_sampnum_t level,
+				sio_sampnum_t target, sio_sampnum_t weight);
+	void DriftResample(SoundIoDriftState *dsp, const uint8_t *src,
+			   uint8_t *dest, sio_sampnum_t nsamps) const;
+	void DriftIn(SoundIoWorkingState *swsp, SoundIoBuffer &dest);
+	void DriftOut(SoundIoWorkingState *dwsp, SoundIoBuffer const &src);
+	void DriftReset(SoundIoPumpConfig &cfg);
+
+	static void ScratchLayout(SoundIoPumpConfig const &cfg,
+				  size_t &proc_size, size_t &drift_size);
+	bool PrepareScratch(SoundIoPumpConfig &cfg, ErrorInfo *error);
+	void CommitScratch(SoundIoPumpConfig &cfg);
+	void FreeScratch(void);
+	void BuildBufferPlan(void);
+	static bool GetSinkBuf(SoundIoWorkingState *dwsp,
+			       sio_sampnum_t nsamps, SoundIoBuffer &dest);
+	static void CommitSinkBuf(SoundIoWorkingState *dwsp,
+				  sio_sampnum_t nsamps);
+
 	void ProcessOneWay(SoundIoWorkingState *swsp,
 			   SoundIoWorkingState *dwsp,
 			   bool up, SoundIoBuffer &buf1,
@@ -1183,10 +1916,32 @@ private:
 
 	bool ConfigureEndpoints(SoundIo *bottom, SoundIo *top,
 				SoundIoPumpConfig &cfg, ErrorInfo *error);
+	bool ConfigureConverter(SoundIo *bottom, SoundIo *top,
+				SoundIo *reuse, SoundIo *&io,
+				ErrorInfo *error);
+	bool CheckRunningFormat(SoundIoPumpConfig const &cfg,
+				ErrorInfo *error);
+	void SetBottomIo(SoundIo *io);
+	void DiscardBottomIo(SoundIo *io);
 
 	static bool PrepareFilter(SoundIoFilter *fltp, SoundIoPumpConfig &cfg,
 				  ErrorInfo *error);
 
+	/* A packet counts once, whether it passes one way or both */
+	void AddFilterCost(SoundIoFilter *fltp, bool up, uint64_t ns) {
+		fltp->m_cost_ns += ns;
+		if (ns > fltp->m_cost_max_ns)
+			fltp->m_cost_max_ns = (ns > 0xffffffffULL) ?
+				0xffffffff : (uint32_t) ns;
+		if (up || !m_config.pump_up)
+			fltp->m_cost_packets++;
+	}
+	static void ResetFilterCost(SoundIoFilter *fltp) {
+		fltp->m_cost_ns = 0;
+		fltp->m_cost_max_ns = 0;
+		fltp->m_cost_packets = 0;
+	}
+
 public:
 	/** @brief Standard destructor */
 	virtual ~SoundIoPump();
@@ -1327,7 +2082,8 @@ public:
 	 * enabled at the endpoints.
 	 * @retval false Pump could not be started.  Possible reasons:
 	 * - No top endpoint configured
-	 * - Neither bottom nor top endpoint support asynchronous operation
+	 * - Neither bottom nor top endpoint support asynchronous operation,
+	 * see RunOffline()
 	 * - One or both of the endpoints has not been opened, see
 	 * SoundIo::SndOpen()
 	 * - The endpoints do not agree on a transfer direction
@@ -1335,7 +2091,39 @@ public:
 	 * data formats
 	 * - One of the configured filters failed to prepare itself
 	 */
-	bool Start(ErrorInfo *error = 0);
+	bool Start(ErrorInfo *error = 0) { return __Start(false, error); }
+
+	/**
+	 * @brief Run the pump offline, as fast as possible
+	 *
+	 * Some endpoints, such as those created by
+	 * SoundIoCreateFileHandler() and SoundIoCreateMembuf(), have
+	 * no clock.  A pair of such endpoints can't be serviced by
+	 * Start(), but can be run through the filter stack with this
+	 * method instead.  The pump is started, the bottom endpoint
+	 * is treated as a clock that is always ready, and transfers
+	 * are performed back to back on the calling thread until a
+	 * remove-on-exhaust endpoint runs dry.  The pump is stopped
+	 * when this method returns.
+	 *
+	 * Filters see the same packet sequence they would if the
+	 * endpoints were clocked, with a filter packet size of 20ms.
+	 *
+	 * The event dispatcher is not run by this method.  Separate
+	 * pumps, each with its own endpoints and filters, may be
+	 * run concurrently on separate threads.
+	 *
+	 * @param[out] error Error information structure.  If this method
+	 * fails and returns @em false, and @em error is not 0, @em error
+	 * will be filled out with information on the cause of the failure.
+	 *
+	 * @retval true An endpoint was exhausted and the pump stopped.
+	 * cb_NotifyAsyncState is invoked in this case, as it is when
+	 * a started pump exhausts an endpoint.
+	 * @retval false The pump could not be started, either endpoint
+	 * has a clock, or the pump stopped making progress.
+	 */
+	bool RunOffline(ErrorInfo *error = 0);
 
 	/**
 	 * @brief Request pump to stop
@@ -1370,6 +2158,61 @@ public:
 	void SetStatistics(SoundIoPumpStatistics *statp)
 		{ m_stat = statp; }
 
+	/**
+	 * @brief Enumerate the latency histograms of the audio path
+	 *
+	 * The pump always times its own processing of each endpoint
+	 * notification, the FltProcess() calls of each installed
+	 * filter, and the lag of each endpoint notification behind
+	 * the sample clock of the endpoint.  Histograms kept by the
+	 * endpoints, see SoundIo::SndGetLatency(), are included.
+	 *
+	 * Histograms are enumerated in a stable order: pump
+	 * processing, wakeup lag, endpoint transfers, then filters
+	 * from the bottom of the stack to the top.
+	 *
+	 * @param[in] index Index of the histogram to query, starting
+	 * from 0.
+	 * @param[out] stage Set to the name of the measured stage:
+	 * "process", "wakeup", "push-in", "push-out" or "filter".
+	 * @param[out] name Set to the name of the measured object:
+	 * "pump", "bottom", "top", or the name of the filter.
+	 * @param[out] histp Set to the histogram.
+	 *
+	 * @retval true The histogram at @em index was returned.
+	 * @retval false @em index is past the last histogram.
+	 */
+	bool GetLatency(int index, const char *&stage, const char *&name,
+			SoundIoLatencyHist *&histp);
+
+	/**
+	 * @brief Clear all latency histograms of the audio path
+	 */
+	void ResetLatency(void);
+
+	/**
+	 * @brief Read and clear the processing load of a filter
+	 *
+	 * The pump totals the time spent in the FltProcess() calls of
+	 * each installed filter, in both directions, and relates it to
+	 * the duration of the audio processed.  Each call to this
+	 * method starts a new measurement window for the filter.
+	 * Windows are also restarted when the pump is started.
+	 *
+	 * @param[in] fltp Filter to query.
+	 * @param[out] avg_pct Set to the time spent in the filter since
+	 * the last call, as a percentage of the audio duration.
+	 * @param[out] peak_pct Set to the longest single FltProcess()
+	 * call since the last call, as a percentage of the duration of
+	 * a packet.
+	 *
+	 * @retval true The load was measured.
+	 * @retval false The pump isn't running, @em fltp isn't
+	 * installed, or it has processed no packets since the last call.
+	 */
+	bool GetFilterLoad(SoundIoFilter *fltp, unsigned int &avg_pct,
+			   unsigned int &peak_pct);
+
 	/**
 	 * @brief Query the topmost filter installed in the stack
 	 */
@@ -1505,9 +2348,49 @@ public:
 	 * over another.  Loss will still occur at an endpoint where it is
 	 * not tolerated if there is a rate mismatch between the input and
 	 * output sides of the endpoint.
+	 *
+	 * @note The loss mode also selects the endpoint at which drift
+	 * compensation is applied.  See SetDriftCompensation().
 	 */
 	void SetLossMode(bool loss_at_bottom, bool loss_at_top);
 
+	/**
+	 * @brief Query whether drift compensation is enabled
+	 */
+	bool GetDriftCompensation(void) const
+		{ return m_config_drift_comp; }
+
+	/**
+	 * @brief Enable or disable clock drift compensation
+	 *
+	 * When two clocked endpoints are connected, SoundIoPump can
+	 * compensate for the divergence of their sample clocks by
+	 * resampling the stream at one endpoint by a slowly varying
+	 * ratio, rather than waiting for the fill level constraints to
+	 * be violated and padding or dropping whole blocks of samples.
+	 * The ratio is adjusted to keep the output buffer fill level of
+	 * each direction centered in its jitter window, and is limited
+	 * to a deviation of less than 1%.
+	 *
+	 * Drift compensation is applied at the top endpoint if loss is
+	 * tolerated there, and at the bottom endpoint otherwise.  See
+	 * SetLossMode().  Samples inserted or removed by the compensator
+	 * are reported through the @c stretch and @c shrink fields of
+	 * SoundIoPumpStatistics.
+	 *
+	 * Drift compensation is only employed when both endpoints are
+	 * clocked, neither is a loop or remove-on-exhaust endpoint, and
+	 * the sample format is linear PCM.
+	 *
+	 * @param enable Set to @c true to enable drift compensation,
+	 * @c false to rely on padding and dropping alone.
+	 *
+	 * @note This setting will be applied the next time the pump is
+	 * started with Start().
+	 */
+	void SetDriftCompensation(bool enable)
+		{ m_config_drift_comp = enable; }
+
 	/**
 	 * @brief Query the active minimum output buffer fill level of the
 	 * bottom or top endpoint
@@ -1627,6 +2510,8 @@ public:
 };
 
 
+class SoundIoDeviceCache;
+
 enum sio_stream_skewinfo_t {
 	SIO_STREAM_SKEW_INVALID = 0,
 	SIO_STREAM_SKEW_XRUN,
@@ -1680,9 +2565,33 @@ private:
 	bool			m_dsp_enabled;
 	bool			m_dsp_installed;
 
+	/* CPU budget governor, see SetDspBudget() */
+	enum {
+		c_dsp_period_ms = 1000,
+		c_dsp_calm_periods = 5,
+	};
+	unsigned int		m_dsp_budget;
+	unsigned int		m_dsp_level;
+	unsigned int		m_dsp_calm;
+	TimerNotifier		*m_dsp_timer;
+
+	/*
+	 * Warm standby, see SetStandby().  While m_standby_active,
+	 * the pump runs with m_standby_ep as its top endpoint, and
+	 * the client's secondary endpoint is kept in m_standby_sec.
+	 */
+	bool			m_standby;
+	bool			m_standby_active;
+	sio_sampnum_t		m_standby_rate;
+	SoundIo			*m_standby_ep;
+	SoundIo			*m_standby_sec;
+
 	char			*m_driver_name;
 	char			*m_driver_opts;
 
+	/* Background device enumeration, see GetDeviceList() */
+	SoundIoDeviceCache	*m_devcache;
+
 	bool			m_stream_up, m_stream_dn;
 
 	SoundIoPumpStatistics	m_pump_stat;
@@ -1719,11 +2628,21 @@ private:
 
 	bool OpenPrimary(bool sink, bool source, ErrorInfo *error);
 	void ClosePrimary(void);
+	bool SetPrimaryFormat(SoundIoFormat &fmt, ErrorInfo *error);
 	SoundIo *CreatePrimary(const char *name, const char *opts,
 			       ErrorInfo *error);
 
 	bool DspInstall(ErrorInfo *error);
 	void DspRemove(void);
+	void DspGovernUpdate(void);
+	void DspGovern(TimerNotifier *notp);
+	void DspSetLevel(unsigned int level, unsigned int load);
+
+	bool StandbyStart(ErrorInfo *error);
+	void StandbyStop(void);
+	void StandbyCheck(void);
+	bool StandbyAttach(bool up, bool down);
+	bool StandbyDetach(void);
 
 public:
 	/**
@@ -1782,6 +2701,22 @@ public:
 	Callback<void, SoundIoManager*, sio_stream_skewinfo_t, double>
 							cb_NotifySkew;
 
+	/**
+	 * @brief Notification of DSP quality changes
+	 *
+	 * When a CPU budget is set with SetDspBudget(), this callback
+	 * is invoked each time the DSP filter is degraded or restored.
+	 *
+	 * @param SoundIoManager* SoundIoManager object originating the
+	 * notification.
+	 * @param unsigned int New degrade level of the DSP filter,
+	 * 0 for full quality.  See SoundIoFilter::FltSetDegradeLevel().
+	 * @param unsigned int Measured load of the DSP filter that
+	 * prompted the change, as a percentage of real time.
+	 */
+	Callback<void, SoundIoManager*, unsigned int, unsigned int>
+							cb_NotifyDspLevel;
+
 	/**
 	 * @brief Get descriptive information about a configured audio
 	 * driver
@@ -1814,6 +2749,56 @@ public:
 				  SoundIoDeviceList **devlist,
 				  ErrorInfo *error = 0);
 
+	/**
+	 * @brief Get the detected device list of an audio driver,
+	 * without waiting for enumeration
+	 *
+	 * This method is the non-blocking counterpart to the
+	 * @em devlist parameter of GetDriverInfo().  Device lists
+	 * are enumerated for all drivers on a helper thread, and
+	 * cached until a device node is added to or removed from
+	 * @c /dev/snd, at which point they are enumerated again
+	 * in the background.  Until the new lists are ready, the
+	 * old ones continue to be returned.
+	 *
+	 * The enumeration only blocks the caller if no lists have
+	 * been cached yet.  Use PrefetchDevices() early to avoid this.
+	 *
+	 * @param[in] index Driver index number, as with GetDriverInfo().
+	 * @param[out] devlist Address of pointer to receive a new copy
+	 * of the detected device list.  The caller is responsible for
+	 * deleting it.
+	 * @param[out] error Error information structure.  If this method
+	 * fails and returns @em false, and @em error is not 0, @em error
+	 * will be filled out with information on the cause of the failure.
+	 *
+	 * @retval true Device list retrieved.
+	 * @retval false Driver index is invalid, or enumerating devices
+	 * failed.
+	 *
+	 * @note Without thread support, this method is equivalent to
+	 * GetDriverInfo().
+	 */
+	bool GetDeviceList(int index, SoundIoDeviceList **devlist,
+			   ErrorInfo *error = 0);
+
+	/**
+	 * @brief Start enumerating devices in the background
+	 *
+	 * Begins filling the device list cache used by GetDeviceList(),
+	 * and begins watching @c /dev/snd for changes.  This method
+	 * returns immediately.
+	 *
+	 * @param[out] error Error information structure.  If this method
+	 * fails and returns @em false, and @em error is not 0, @em error
+	 * will be filled out with information on the cause of the failure.
+	 *
+	 * @retval true Enumeration started, or thread support is
+	 * not available and GetDeviceList() will enumerate on demand.
+	 * @retval false The helper thread could not be started.
+	 */
+	bool PrefetchDevices(ErrorInfo *error = 0);
+
 	/**
 	 * @brief Set the audio driver parameters
 	 */
@@ -1838,6 +2823,8 @@ public:
 	 * @brief Query the secondary endpoint
 	 */
 	SoundIo *GetSecondary(void) const {
+		if (m_standby_active)
+			return m_standby_sec;
 		return m_top_loop ? 0 : m_pump.GetTop();
 	}
 
@@ -1998,6 +2985,43 @@ public:
 	 */
 	bool IsDspEnabled(void) { return m_dsp_enabled; }
 
+	/**
+	 * @brief Set the CPU budget of the DSP filter
+	 *
+	 * On slow machines, a DSP filter with expensive settings may
+	 * not keep up with the stream, causing dropouts and watchdog
+	 * failures.  With a budget set, the load of the DSP filter is
+	 * checked each second while it is installed in the pump, using
+	 * SoundIoPump::GetFilterLoad().  The governor runs from its own
+	 * timer, whether or not stream statistics are being collected
+	 * for cb_NotifySkew.
+	 * If it exceeds the budget, or any single packet takes longer
+	 * to process than it takes to play, the filter is moved to its
+	 * next reduced quality level, see
+	 * SoundIoFilter::FltSetDegradeLevel().  Once the load has
+	 * stayed below half of the budget for several seconds, one
+	 * level is restored.  Each change is reported through
+	 * cb_NotifyDspLevel.
+	 *
+	 * The degrade level is kept from one stream to the next.
+	 *
+	 * @param[in] percent Budget as a percentage of real time,
+	 * or 0 to disable the governor and restore full quality.
+	 */
+	void SetDspBudget(unsigned int percent);
+
+	/**
+	 * @brief Query the CPU budget of the DSP filter
+	 * @sa SetDspBudget()
+	 */
+	unsigned int GetDspBudget(void) const { return m_dsp_budget; }
+
+	/**
+	 * @brief Query the degrade level selected by the governor
+	 * @sa SetDspBudget()
+	 */
+	unsigned int GetDspLevel(void) const { return m_dsp_level; }
+
 	/**
 	 * @brief Request stream to start
 	 *
@@ -2070,7 +3094,62 @@ public:
 	 * @copydoc SoundIoPump::IsStarted()
 	 * @brief Query operation state of audio stream
 	 */
-	bool IsStarted(void) const { return m_pump.IsStarted(); }
+	bool IsStarted(void) const
+		{ return m_pump.IsStarted() && !m_standby_active; }
+
+	/**
+	 * @brief Keep the primary endpoint running between streams
+	 *
+	 * Starting a stream normally opens the primary endpoint and
+	 * negotiates its format, which for a sound card can take long
+	 * enough to clip the start of a call.  In standby mode, the
+	 * primary endpoint is opened for playback and capture in
+	 * advance, and streams silence to a null endpoint while no
+	 * stream is started.
+	 *
+	 * Start() then attaches the secondary endpoint to the running
+	 * stream, which takes effect within a packet interval, if the
+	 * stream is bidirectional and the secondary endpoint uses the
+	 * standby sample rate with single channel S16_LE samples.
+	 * Otherwise, the standby stream is stopped and the stream is
+	 * started as usual.  Stop() returns to standby.
+	 *
+	 * Standby is suspended while loopback or hard mute is
+	 * configured, and if the primary endpoint fails while in
+	 * standby, it is closed and standby resumes at the next
+	 * Stop() or SetSecondary().
+	 *
+	 * IsStarted() reports @c false in standby mode, unless a
+	 * stream is started.
+	 *
+	 * @param[in] enable @c true to enter standby mode, @c false
+	 * to leave it and close the primary endpoint.
+	 * @param[in] samplerate Sample rate expected of the next
+	 * secondary endpoint.  If standby is already active at a
+	 * different rate, the standby stream is restarted.
+	 * @param[out] error Error information structure.  If this method
+	 * fails and returns @em false, and @em error is not 0, @em error
+	 * will be filled out with information on the cause of the failure.
+	 *
+	 * @retval true Standby mode was configured.
+	 * @retval false The primary endpoint could not be started.
+	 * Standby mode remains configured, and will be retried.
+	 */
+	bool SetStandby(bool enable, sio_sampnum_t samplerate = 8000,
+			ErrorInfo *error = 0);
+
+	/**
+	 * @brief Query whether standby mode is configured
+	 * @sa SetStandby()
+	 */
+	bool GetStandby(void) const { return m_standby; }
+
+	/**
+	 * @brief Query whether the primary endpoint is idling in
+	 * standby mode
+	 * @sa SetStandby()
+	 */
+	bool IsStandbyActive(void) const { return m_standby_active; }
 
 	/**
 	 * @brief Query the topmost filter installed in the stack
@@ -2219,6 +3298,34 @@ public:
 	 */
 	void SetJitterWindowHint(unsigned int ms)
 		{ m_pump.SetJitterWindowHint(ms); }
+
+	/**
+	 * @copydoc SoundIoPump::GetDriftCompensation()
+	 */
+	bool GetDriftCompensation(void) const
+		{ return m_pump.GetDriftCompensation(); }
+
+	/**
+	 * @copydoc SoundIoPump::SetDriftCompensation()
+	 */
+	void SetDriftCompensation(bool enable)
+		{ m_pump.SetDriftCompensation(enable); }
+
+	/**
+	 * @copydoc SoundIoPump::GetLatency()
+	 *
+	 * The primary endpoint is the bottom endpoint of the pump,
+	 * and the secondary endpoint is the top.
+	 */
+	bool GetLatency(int index, const char *&stage, const char *&name,
+			SoundIoLatencyHist *&histp)
+		{ return m_pump.GetLatency(index, stage, name, histp); }
+
+	/**
+	 * @copydoc SoundIoPump::ResetLatency()
+	 */
+	void ResetLatency(void)
+		{ m_pump.ResetLatency(); }
 };
 
 
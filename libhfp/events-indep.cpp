@@ -19,16 +19,23 @@
  */
 
 /*
- * Standalone select()-based event loop for libhfp.
+ * Standalone select()/epoll-based event loop for libhfp.
  * Useful for environments lacking a native event loop, e.g. SDL.
  */
 
 #include <sys/select.h>
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 
 #include <libhfp/events-indep.h>
@@ -132,28 +139,41 @@ WakeCleanup(void)
 #endif  /* defined(USE_PTHREADS) */
 
 /*
- * Timers are stored in a Pairing Heap structure with the values
- * represented as a delta hierarchy.  All children of a particular
- * node have that node's effective timeout value PLUS their own
- * m_msec_delta.
+ * Timers are stored in a hierarchical timer wheel, keyed by their
+ * absolute expiration time in microseconds on CLOCK_MONOTONIC,
+ * relative to when the dispatcher was created.
+ *
+ * m_wheel_time is the time up to which the wheel has been processed.
+ * A timer is placed on the level of the most significant c_wheel_bits
+ * group in which its expiration time differs from m_wheel_time, in the
+ * slot indexed by that group of its expiration time.  Each level has a
+ * bitmap of its occupied slots, so the next expiration can be found
+ * without scanning, and arming or canceling a timer is a list insertion
+ * or removal.  When the wheel reaches the start of an occupied slot on
+ * a higher level, its timers are redistributed to the lower levels.
  */
 
-
 class IndepTimerNotifier : public TimerNotifier {
 public:
 	ListItem		m_links;
-	ListItem		m_children;
-	unsigned int		m_msec_delta;
+	uint64_t		m_expire;
+	uint8_t			m_level;
+	uint8_t			m_slot;
 	IndepEventDispatcher	*m_dispatcher;
 
-	virtual void Set(int msec) {
+	void SetInterval(uint64_t usec) {
 		m_dispatcher->Lock();
 		if (!m_links.Empty())
 			m_dispatcher->RemoveTimer(this);
-		m_msec_delta = msec;
-		m_dispatcher->AddTimer(this);
+		m_dispatcher->AddTimer(this, usec);
 		m_dispatcher->Unlock(true);
 	}
+	virtual void Set(int msec) {
+		SetInterval((msec > 0) ? ((uint64_t) msec * 1000) : 0);
+	}
+	virtual void SetUsec(unsigned int usec) {
+		SetInterval(usec);
+	}
 	virtual void Cancel(void) {
 		m_dispatcher->Lock();
 		if (!m_links.Empty())
@@ -168,142 +188,158 @@ public:
 };
 } /* namespace libhfp */
 
-void IndepEventDispatcher::
-PairTimers(ListItem &siblings, ListItem &dest, unsigned int delta)
+uint64_t IndepEventDispatcher::
+ClockNow(void) const
 {
-	ListItem newsublist;
-	IndepTimerNotifier *a;
-
-	assert(!siblings.Empty());
-
-	/* Step 1: Pair items left-to-right */
-	do {
-		a = GetContainer(siblings.next,
-				 IndepTimerNotifier, m_links);
-		a->m_links.UnlinkOnly();
-		a->m_msec_delta += delta;
-
-		if (!siblings.Empty()) {
-			IndepTimerNotifier *b;
-			b = GetContainer(siblings.next, IndepTimerNotifier,
-				      m_links);
-			b->m_links.UnlinkOnly();
-			b->m_msec_delta += delta;
-
-			if (b->m_msec_delta < a->m_msec_delta) {
-				IndepTimerNotifier *t = a; a = b; b = t;
-			}
-
-			a->m_children.AppendItem(b->m_links);
-			b->m_msec_delta -= a->m_msec_delta;
-		}
-
-		newsublist.AppendItem(a->m_links);
+	struct timespec ts;
 
-	} while (!siblings.Empty());
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000)) -
+		m_clock_base;
+}
 
-	/* Step 2: Collect items right-to-left */
-	a = GetContainer(newsublist.prev, IndepTimerNotifier, m_links);
-	a->m_links.UnlinkOnly();
+void IndepEventDispatcher::
+WheelInsert(IndepTimerNotifier *timerp)
+{
+	uint64_t diff;
+	int level;
 
-	while (!newsublist.Empty()) {
-		IndepTimerNotifier *b;
-		b = GetContainer(newsublist.prev, IndepTimerNotifier,
-				 m_links);
-		b->m_links.UnlinkOnly();
+	assert(timerp->m_links.Empty());
+	assert(timerp->m_expire > m_wheel_time);
+
+	diff = timerp->m_expire ^ m_wheel_time;
+	level = 0;
+	while ((level < (c_wheel_levels - 1)) &&
+	       (diff >> ((level + 1) * c_wheel_bits)))
+		level++;
+	assert(!(diff >> ((level + 1) * c_wheel_bits)));
+
+	timerp->m_level = level;
+	timerp->m_slot = (timerp->m_expire >> (level * c_wheel_bits)) &
+		(c_wheel_slots - 1);
+	m_wheel[level][timerp->m_slot].AppendItem(timerp->m_links);
+	m_wheel_map[level] |= (1ULL << timerp->m_slot);
+}
 
-		if (b->m_msec_delta < a->m_msec_delta) {
-			b->m_children.PrependItem(a->m_links);
-			a->m_msec_delta -= b->m_msec_delta;
-			a = b;
-		} else {
-			a->m_children.PrependItem(b->m_links);
-			b->m_msec_delta -= a->m_msec_delta;
+/*
+ * Find the time of the next wheel event: the expiration time of the
+ * earliest timer on level 0, or the start of the earliest occupied
+ * slot on a higher level, whichever comes first.  Occupied slots are
+ * always ahead of m_wheel_time on their level.
+ */
+bool IndepEventDispatcher::
+WheelNext(uint64_t &when) const
+{
+	uint64_t t, map;
+	unsigned int shift;
+	int level;
+	bool found = false;
+
+	for (level = 0; level < c_wheel_levels; level++) {
+		map = m_wheel_map[level];
+		if (!map)
+			continue;
+
+		shift = level * c_wheel_bits;
+		assert(!(map & ((2ULL << ((m_wheel_time >> shift) &
+					   (c_wheel_slots - 1))) - 1)));
+
+		t = (m_wheel_time & ~((1ULL << shift) - 1)) &
+			~((uint64_t) (c_wheel_slots - 1) << shift);
+		t |= (uint64_t) __builtin_ctzll(map) << shift;
+		if (!found || (t < when)) {
+			when = t;
+			found = true;
 		}
 	}
 
-	dest.AppendItem(a->m_links);
+	return found;
 }
 
 void IndepEventDispatcher::
-AddTimer(IndepTimerNotifier *timerp)
+AddTimer(IndepTimerNotifier *timerp, uint64_t usec)
 {
+	uint64_t now;
+
 	assert(timerp->m_links.Empty());
-	assert(timerp->m_children.Empty());
-
-	if (!m_timers.Empty()) {
-		IndepTimerNotifier *root_to =
-			GetContainer(m_timers.next, IndepTimerNotifier,
-				     m_links);
-		if (root_to->m_msec_delta < timerp->m_msec_delta) {
-			root_to->m_children.PrependItem(timerp->m_links);
-			timerp->m_msec_delta -= root_to->m_msec_delta;
-			return;
-		} else {
-			root_to->m_links.UnlinkOnly();
-			timerp->m_children.AppendItem(root_to->m_links);
-			root_to->m_msec_delta -= timerp->m_msec_delta;
-		}
-	}
 
-	m_timers.AppendItem(timerp->m_links);
+	now = ClockNow();
+	if (!m_ntimers && (now > m_wheel_time))
+		m_wheel_time = now;
+
+	timerp->m_expire = now + usec;
+	if (timerp->m_expire <= m_wheel_time)
+		timerp->m_expire = m_wheel_time + 1;
+
+	WheelInsert(timerp);
+	m_ntimers++;
 }
 
 void IndepEventDispatcher::
 RemoveTimer(IndepTimerNotifier *timerp)
 {
 	assert(!timerp->m_links.Empty());
-	if (!timerp->m_children.Empty())
-		PairTimers(timerp->m_children, timerp->m_links,
-			   timerp->m_msec_delta);
-	assert(timerp->m_children.Empty());
 	timerp->m_links.Unlink();
+
+	/* Timers on the run list in RunTimers() have m_level == levels */
+	if (timerp->m_level < c_wheel_levels) {
+		if (m_wheel[timerp->m_level][timerp->m_slot].Empty())
+			m_wheel_map[timerp->m_level] &=
+				~(1ULL << timerp->m_slot);
+		assert(m_ntimers);
+		m_ntimers--;
+	}
 }
 
 void IndepEventDispatcher::
-RunTimers(unsigned int ms_elapsed)
+RunTimers(void)
 {
-	ListItem runlist;
-	ListItem *listp;
+	ListItem runlist, cascade;
+	IndepTimerNotifier *to;
+	uint64_t now, t;
+	unsigned int shift, slot;
+	int level;
 
-	assert(m_timers.Length() <= 1);
+	now = ClockNow();
 
-	ListForEach(listp, &m_timers) {
-		IndepTimerNotifier *to, *to2;
-		to = GetContainer(listp, IndepTimerNotifier, m_links);
+	while (WheelNext(t) && (t <= now)) {
+		m_wheel_time = t;
 
 		/*
-		 * If the timer has expired, append its children
-		 * to the m_timers list, and move it to the run list.
+		 * Redistribute the timers of any higher level slots
+		 * starting at this time, top-down, and collect the
+		 * timers expiring now.
 		 */
-		if (to->m_msec_delta <= ms_elapsed) {
-			listp = listp->prev;
-			while (!to->m_children.Empty()) {
-				to2 = GetContainer(to->m_children.next,
-						   IndepTimerNotifier,
-						   m_links);
-				to2->m_links.UnlinkOnly();
-				to2->m_msec_delta += to->m_msec_delta;
-				to2->m_links.UnlinkOnly();
-				m_timers.AppendItem(to2->m_links);
+		for (level = c_wheel_levels - 1; level >= 0; level--) {
+			shift = level * c_wheel_bits;
+			if (t & ((1ULL << shift) - 1))
+				continue;
+			slot = (t >> shift) & (c_wheel_slots - 1);
+			if (!(m_wheel_map[level] & (1ULL << slot)))
+				continue;
+
+			m_wheel_map[level] &= ~(1ULL << slot);
+			cascade.AppendItemsFrom(m_wheel[level][slot]);
+			while (!cascade.Empty()) {
+				to = GetContainer(cascade.next,
+						  IndepTimerNotifier, m_links);
+				to->m_links.Unlink();
+				if (to->m_expire > t) {
+					WheelInsert(to);
+					continue;
+				}
+				to->m_level = c_wheel_levels;
+				runlist.AppendItem(to->m_links);
+				assert(m_ntimers);
+				m_ntimers--;
 			}
-			to->m_links.UnlinkOnly();
-			runlist.AppendItem(to->m_links);
-		} else {
-			to->m_msec_delta -= ms_elapsed;
 		}
 	}
 
-	if (m_timers.next != m_timers.prev) {
-		ListItem tlist;
-		tlist.PrependItemsFrom(m_timers);
-		PairTimers(tlist, m_timers, 0);
-		assert(tlist.Empty());
-		assert(m_timers.Length() == 1);
-	}
+	if (now > m_wheel_time)
+		m_wheel_time = now;
 
 	while (!runlist.Empty()) {
-		IndepTimerNotifier *to;
 		to = GetContainer(runlist.next, IndepTimerNotifier, m_links);
 		to->m_links.Unlink();
 		Unlock();
@@ -312,6 +348,7 @@ RunTimers(unsigned int ms_elapsed)
 	}
 }
 
+
 TimerNotifier *IndepEventDispatcher::
 NewTimer(void)
 {
@@ -320,8 +357,10 @@ NewTimer(void)
 
 
 /*
- * Sockets are stored in a simple singly linked list that is traversed
- * every time we wait for events.
+ * Sockets are stored in a simple linked list.  With select(), the list
+ * is traversed every time we wait for events.  With epoll, each socket
+ * is additionally linked to a per-file handle entry, and the kernel
+ * tells us which entries to look at.
  */
 
 namespace libhfp {
@@ -331,6 +370,10 @@ public:
 	IndepEventDispatcher	*m_dispatcher;
 	int			m_fh;
 	bool			m_writable;
+#if defined(USE_EPOLL)
+	ListItem		m_fd_links;
+	unsigned int		m_epoll_gen;
+#endif
 	IndepSocketNotifier(IndepEventDispatcher *disp, int fh, bool writable)
 		: m_dispatcher(disp), m_fh(fh), m_writable(writable) {}
 	virtual void SetEnabled(bool enable) {
@@ -352,6 +395,23 @@ public:
 		m_dispatcher->Unlock();
 	}
 };
+
+#if defined(USE_EPOLL)
+/*
+ * Per-file handle epoll registration.  More than one notifier may be
+ * attached to a file handle, e.g. one for reading and one for writing,
+ * but epoll will only accept one registration per file handle.
+ * Entries are indexed by file handle number and are only freed along
+ * with the dispatcher, so they remain valid across callbacks.
+ */
+class IndepFdEntry {
+public:
+	ListItem		m_notifiers;
+	uint32_t		m_events;
+	bool			m_busy;
+	IndepFdEntry(void) : m_events(0), m_busy(false) {}
+};
+#endif  /* defined(USE_EPOLL) */
 } /* namespace libhfp */
 
 
@@ -360,6 +420,22 @@ AddSocket(IndepSocketNotifier *sockp)
 {
 	assert(sockp->m_links.Empty());
 	m_sockets.AppendItem(sockp->m_links);
+
+#if defined(USE_EPOLL)
+	if (m_epoll_fh >= 0) {
+		IndepFdEntry *entp;
+		assert(sockp->m_fd_links.Empty());
+		entp = EpollEntry(sockp->m_fh);
+		if (!entp) {
+			LogError("Dispatch: Could not allocate epoll entry "
+				 "for file handle %d", sockp->m_fh);
+			return;
+		}
+		sockp->m_epoll_gen = m_epoll_gen;
+		entp->m_notifiers.AppendItem(sockp->m_fd_links);
+		EpollUpdate(sockp->m_fh);
+	}
+#endif
 }
 
 void IndepEventDispatcher::
@@ -371,8 +447,214 @@ RemoveSocket(IndepSocketNotifier *sockp)
 	 */
 	assert(!sockp->m_links.Empty());
 	sockp->m_links.Unlink();
+
+#if defined(USE_EPOLL)
+	if ((m_epoll_fh >= 0) && !sockp->m_fd_links.Empty()) {
+		/* Same deal with the iorun list in EpollDispatch() */
+		sockp->m_fd_links.Unlink();
+		EpollUpdate(sockp->m_fh);
+	}
+#endif
 }
 
+
+#if defined(USE_EPOLL)
+bool IndepEventDispatcher::
+EpollSetup(void)
+{
+	m_epoll_fh = epoll_create(c_epoll_batch);
+	if (m_epoll_fh < 0) {
+		LogWarn("Dispatch: epoll_create: %s, using select()",
+			strerror(errno));
+		return false;
+	}
+	(void) fcntl(m_epoll_fh, F_SETFD, FD_CLOEXEC);
+
+	/*
+	 * epoll_wait() can only sleep in whole milliseconds.
+	 * Timer wakeups are delivered through a timerfd instead.
+	 * It is reprogrammed on every pass, which also clears it.
+	 */
+	m_timer_fh = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	if (m_timer_fh >= 0) {
+		struct epoll_event ev;
+		(void) fcntl(m_timer_fh, F_SETFD, FD_CLOEXEC);
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = m_timer_fh;
+		if (epoll_ctl(m_epoll_fh, EPOLL_CTL_ADD, m_timer_fh, &ev)) {
+			close(m_timer_fh);
+			m_timer_fh = -1;
+		}
+	}
+	if (m_timer_fh < 0)
+		LogWarn("Dispatch: timerfd unavailable, timers will "
+			"be rounded to milliseconds");
+	return true;
+}
+
+void IndepEventDispatcher::
+EpollCleanup(void)
+{
+	int i;
+
+	if (m_timer_fh >= 0) {
+		close(m_timer_fh);
+		m_timer_fh = -1;
+	}
+	if (m_epoll_fh >= 0) {
+		close(m_epoll_fh);
+		m_epoll_fh = -1;
+	}
+	if (m_fdtab) {
+		for (i = 0; i < m_fdtab_size; i++) {
+			if (m_fdtab[i])
+				delete m_fdtab[i];
+		}
+		free(m_fdtab);
+		m_fdtab = 0;
+		m_fdtab_size = 0;
+	}
+}
+
+IndepFdEntry *IndepEventDispatcher::
+EpollEntry(int fh)
+{
+	IndepFdEntry **newtab;
+	int nsize;
+
+	assert(fh >= 0);
+	if (fh >= m_fdtab_size) {
+		nsize = m_fdtab_size ? m_fdtab_size : 16;
+		while (nsize <= fh)
+			nsize *= 2;
+		newtab = (IndepFdEntry **)
+			realloc(m_fdtab, nsize * sizeof(*newtab));
+		if (!newtab)
+			return 0;
+		memset(&newtab[m_fdtab_size], 0,
+		       (nsize - m_fdtab_size) * sizeof(*newtab));
+		m_fdtab = newtab;
+		m_fdtab_size = nsize;
+	}
+
+	if (!m_fdtab[fh])
+		m_fdtab[fh] = new IndepFdEntry;
+	return m_fdtab[fh];
+}
+
+/*
+ * Recompute the event mask of a file handle from its notifiers,
+ * and bring the kernel's registration in line with it.
+ *
+ * The kernel drops registrations of closed file handles on its own,
+ * so a file handle number may be closed and reused before its old
+ * notifiers are destroyed.  ADD and MOD are therefore allowed to
+ * fall back to each other, and DEL failures are ignored.
+ */
+void IndepEventDispatcher::
+EpollUpdate(int fh)
+{
+	IndepFdEntry *entp;
+	IndepSocketNotifier *sp;
+	struct epoll_event ev;
+	ListItem *listp;
+	uint32_t events = 0;
+	int op, res;
+
+	assert((fh >= 0) && (fh < m_fdtab_size) && m_fdtab[fh]);
+	entp = m_fdtab[fh];
+
+	/* EpollDispatch() will catch up once its notifier list is whole */
+	if (entp->m_busy)
+		return;
+
+	ListForEach(listp, &entp->m_notifiers) {
+		sp = GetContainer(listp, IndepSocketNotifier, m_fd_links);
+		events |= sp->m_writable ? EPOLLOUT : EPOLLIN;
+	}
+
+	if (events == entp->m_events)
+		return;
+
+	if (!events) {
+		(void) epoll_ctl(m_epoll_fh, EPOLL_CTL_DEL, fh, &ev);
+		entp->m_events = 0;
+		return;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fh;
+	op = entp->m_events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	res = epoll_ctl(m_epoll_fh, op, fh, &ev);
+	if ((res < 0) && (op == EPOLL_CTL_MOD) && (errno == ENOENT))
+		res = epoll_ctl(m_epoll_fh, EPOLL_CTL_ADD, fh, &ev);
+	else if ((res < 0) && (op == EPOLL_CTL_ADD) && (errno == EEXIST))
+		res = epoll_ctl(m_epoll_fh, EPOLL_CTL_MOD, fh, &ev);
+
+	if (res < 0) {
+		LogWarn("Dispatch: epoll_ctl fh %d: %s",
+			fh, strerror(errno));
+		entp->m_events = 0;
+		return;
+	}
+
+	entp->m_events = events;
+}
+
+void IndepEventDispatcher::
+EpollDispatch(int fh, unsigned int events)
+{
+	IndepFdEntry *entp;
+	IndepSocketNotifier *sp;
+	ListItem iorun, *listp;
+	bool rd, wr;
+
+	if ((fh < 0) || (fh >= m_fdtab_size) || !m_fdtab[fh])
+		return;
+	entp = m_fdtab[fh];
+
+	/* select() reports errors and hangups as both readable and writable */
+	rd = (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0;
+	wr = (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) != 0;
+
+	/*
+	 * Collect the ready notifiers, skipping those that were
+	 * registered after we started waiting.  If a callback destroys
+	 * or disables a notifier still on the run list, RemoveSocket()
+	 * will unlink it from there.
+	 */
+	ListForEach(listp, &entp->m_notifiers) {
+		sp = GetContainer(listp, IndepSocketNotifier, m_fd_links);
+		if ((sp->m_epoll_gen != m_epoll_gen) &&
+		    (sp->m_writable ? wr : rd)) {
+			listp = listp->prev;
+			sp->m_fd_links.UnlinkOnly();
+			iorun.AppendItem(sp->m_fd_links);
+		}
+	}
+
+	if (iorun.Empty())
+		return;
+
+	entp->m_busy = true;
+	while (!iorun.Empty()) {
+		sp = GetContainer(iorun.next, IndepSocketNotifier,
+				  m_fd_links);
+		sp->m_fd_links.UnlinkOnly();
+		entp->m_notifiers.AppendItem(sp->m_fd_links);
+		if (iorun.Empty())
+			entp->m_busy = false;
+		Unlock();
+		(*sp)(sp, sp->m_fh);
+		Lock();
+	}
+	entp->m_busy = false;
+	EpollUpdate(fh);
+}
+#endif  /* defined(USE_EPOLL) */
+
 SocketNotifier *IndepEventDispatcher::
 NewSocket(int fh, bool writable)
 {
@@ -398,10 +680,14 @@ void IndepEventDispatcher::
 RunOnce(int max_sleep_ms)
 {
 	fd_set readi, writei;
-	struct timeval timeout, *top, etime;
+	struct timeval timeout, *top;
 	ListItem iorun;
-	unsigned int ms_elapsed;
+	uint64_t sleep_us, next, now;
 	int maxfh, res;
+#if defined(USE_EPOLL)
+	struct epoll_event events[c_epoll_batch];
+	int i;
+#endif
 
 	FD_ZERO(&readi);
 	FD_ZERO(&writei);
@@ -410,16 +696,22 @@ RunOnce(int max_sleep_ms)
 	assert(!m_sleeping);
 
 	/* Run nonwaiting timers */
-	RunTimers(0);
+	RunTimers();
 
-	if (m_timers.Empty() && m_sockets.Empty() && (max_sleep_ms < 0)) {
+	if (!m_ntimers && m_sockets.Empty() && (max_sleep_ms < 0)) {
 		/* Nothing to wait for, we'll wait forever! */
 		Unlock();
 		return;
 	}
 
-	/* Move sockets to the I/O run list */
+	/*
+	 * Move sockets to the I/O run list
+	 * epoll keeps its interest set in the kernel, skip this.
+	 */
 	maxfh = 0;
+#if defined(USE_EPOLL)
+	if (m_epoll_fh < 0)
+#endif
 	while (!m_sockets.Empty()) {
 		IndepSocketNotifier *sp;
 		sp = GetContainer(m_sockets.next, IndepSocketNotifier,
@@ -436,87 +728,89 @@ RunOnce(int max_sleep_ms)
 		iorun.AppendItem(sp->m_links);
 	}
 
-	if (m_timers.Empty()) {
-		top = NULL;
-		if (max_sleep_ms >= 0) {
-			ms_elapsed = max_sleep_ms;
-			top = &timeout;
-		}
-	} else {
-		IndepTimerNotifier *to;
-		to = GetContainer(m_timers.next, IndepTimerNotifier, m_links);
-
+	top = NULL;
+	sleep_us = 0;
+	if (max_sleep_ms >= 0) {
+		sleep_us = (uint64_t) max_sleep_ms * 1000;
+		top = &timeout;
+	}
+	if (WheelNext(next)) {
 		/*
 		 * We may have spent some time running tasks since
-		 * our last gettimeofday() call.  Figure out how
-		 * long that has been, and don't spend more time
-		 * than that in select().
+		 * RunTimers() looked at the clock.  Don't sleep past
+		 * the next wheel event.
 		 */
-		gettimeofday(&etime, NULL);
-		if (timercmp(&m_last_run, &etime, >)) {
-			/* Time went backwards */
-			m_last_run = etime;
-			ms_elapsed = 0;
-		} else {
-			timersub(&etime, &m_last_run, &timeout);
-			ms_elapsed = ((timeout.tv_sec * 1000) +
-				      (timeout.tv_usec / 1000));
-		}
-
-		ms_elapsed = (to->m_msec_delta > ms_elapsed)
-			? to->m_msec_delta - ms_elapsed : 0;
-
-		if ((max_sleep_ms >= 0) &&
-		    (ms_elapsed > (unsigned int) max_sleep_ms))
-			ms_elapsed = max_sleep_ms;
-
+		now = ClockNow();
+		next = (next > now) ? (next - now) : 0;
+		if (!top || (next < sleep_us))
+			sleep_us = next;
 		top = &timeout;
 	}
 
 	if (top) {
-		timeout.tv_sec = ms_elapsed / 1000;
-		timeout.tv_usec = (ms_elapsed % 1000) * 1000;
+		timeout.tv_sec = sleep_us / 1000000;
+		timeout.tv_usec = sleep_us % 1000000;
 	}
 
 	m_sleeping = true;
 	Unlock();
 
-	res = select(maxfh + 1, &readi, &writei, NULL, top);
-
-	if (res < 0) {
-		if ((errno != EINTR) &&
-		    (errno != ETIMEDOUT)) {
-			LogWarn("Dispatch: select: %s\n", strerror(errno));
+#if defined(USE_EPOLL)
+	if (m_epoll_fh >= 0) {
+		int wait_ms = top ? (int) ((sleep_us + 999) / 1000) : -1;
+		if ((m_timer_fh >= 0) && (wait_ms > 0)) {
+			struct itimerspec its;
+			memset(&its, 0, sizeof(its));
+			its.it_value.tv_sec = sleep_us / 1000000;
+			its.it_value.tv_nsec = (sleep_us % 1000000) * 1000;
+			if (!timerfd_settime(m_timer_fh, 0, &its, NULL)) {
+				m_timer_armed = true;
+				wait_ms = -1;
+			}
+		} else if (m_timer_armed) {
+			struct itimerspec its;
+			memset(&its, 0, sizeof(its));
+			(void) timerfd_settime(m_timer_fh, 0, &its, NULL);
+			m_timer_armed = false;
 		}
+		res = epoll_wait(m_epoll_fh, events, c_epoll_batch, wait_ms);
+		if (res < 0) {
+			if (errno != EINTR)
+				LogWarn("Dispatch: epoll_wait: %s\n",
+					strerror(errno));
+			res = 0;
+		}
+	} else
+#endif
+	{
+		res = select(maxfh + 1, &readi, &writei, NULL, top);
+
+		if (res < 0) {
+			if ((errno != EINTR) &&
+			    (errno != ETIMEDOUT)) {
+				LogWarn("Dispatch: select: %s\n",
+					strerror(errno));
+			}
 
-		FD_ZERO(&readi);
-		FD_ZERO(&writei);
+			FD_ZERO(&readi);
+			FD_ZERO(&writei);
+		}
 	}
 
 	Lock();
 	m_sleeping = false;
-
-	/* Compute elapsed time */
-	gettimeofday(&etime, NULL);
-	if (timercmp(&m_last_run, &etime, >)) {
-		/* Time went backwards */
-		ms_elapsed = 0;
-	} else {
-		timersub(&etime, &m_last_run, &timeout);
-		ms_elapsed = ((timeout.tv_sec * 1000) +
-			      (timeout.tv_usec / 1000));
-	}
-
-	if (ms_elapsed) {
-		/*
-		 * Only store the last run time if the ms_elapsed
-		 * value rounds up to >0.
-		 */
-		m_last_run = etime;
-	}
+#if defined(USE_EPOLL)
+	/* Notifiers registered from here on wait for the next pass */
+	m_epoll_gen++;
+#endif
 
 	/* Run expired timers */
-	RunTimers(ms_elapsed);
+	RunTimers();
+
+#if defined(USE_EPOLL)
+	for (i = 0; i < res && m_epoll_fh >= 0; i++)
+		EpollDispatch(events[i].data.fd, events[i].events);
+#endif
 
 	/* Move sockets from the I/O run list to the socket list */
 	while (!iorun.Empty()) {
@@ -543,7 +837,7 @@ Run(void)
 
 	while (1) {
 		Lock();
-		empty = (m_timers.Empty() && m_sockets.Empty());
+		empty = (!m_ntimers && m_sockets.Empty());
 		Unlock();
 
 		if (empty)
@@ -553,17 +847,42 @@ Run(void)
 	}
 }
 
+IndepEventDispatcher::backend_t IndepEventDispatcher::
+GetBackend(void) const
+{
+#if defined(USE_EPOLL)
+	if (m_epoll_fh >= 0)
+		return DISPATCH_EPOLL;
+#endif
+	return DISPATCH_SELECT;
+}
+
 IndepEventDispatcher::
-IndepEventDispatcher(void)
-	: m_sleeping(false)
+IndepEventDispatcher(backend_t backend)
+	: m_wheel_time(0), m_clock_base(0), m_ntimers(0), m_sleeping(false)
+#if defined(USE_EPOLL)
+	, m_epoll_fh(-1), m_timer_fh(-1), m_timer_armed(false),
+	  m_fdtab(0), m_fdtab_size(0), m_epoll_gen(0)
+#endif
 {
+#if defined(USE_EPOLL)
+	if (backend != DISPATCH_SELECT)
+		(void) EpollSetup();
+#else
+	(void) backend;
+#endif
+	memset(m_wheel_map, 0, sizeof(m_wheel_map));
+	m_clock_base = ClockNow();
+
 	if (!WakeSetup())
 		abort();
-	gettimeofday(&m_last_run, NULL);
 }
 
 IndepEventDispatcher::
 ~IndepEventDispatcher()
 {
 	WakeCleanup();
+#if defined(USE_EPOLL)
+	EpollCleanup();
+#endif
 }
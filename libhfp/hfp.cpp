@@ -29,6 +29,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <signal.h>
 #include <fcntl.h>
 
@@ -38,6 +39,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <time.h>
 
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/sdp.h>
@@ -46,15 +48,56 @@
 
 #include <libhfp/hfp.h>
 
+/*
+ * Socket options for deferred SCO setup and transparent SCO links,
+ * not present in older BlueZ headers
+ */
+#if !defined(SOL_BLUETOOTH)
+#define SOL_BLUETOOTH		274
+#endif
+#if !defined(BT_DEFER_SETUP)
+#define BT_DEFER_SETUP		7
+#endif
+#if !defined(BT_VOICE)
+#define BT_VOICE		11
+struct bt_voice {
+	uint16_t setting;
+};
+#endif
+#if !defined(BT_VOICE_TRANSPARENT)
+#define BT_VOICE_TRANSPARENT	0x0003
+#endif
+#if !defined(BT_VOICE_CVSD_16BIT)
+#define BT_VOICE_CVSD_16BIT	0x0060
+#endif
+
+/* Hands-free and audio gateway codec negotiation feature bits */
+#define HFP_HF_FEAT_CODEC	0x80
+#define HFP_AG_FEAT_CODEC	0x200
+
+/* Wideband speech bit of the SDP supported features attribute */
+#define HFP_SDP_FEAT_WBS	0x20
+
 namespace libhfp {
 
+static bool
+ScoSetVoice(int ssock, uint16_t setting)
+{
+	struct bt_voice voice;
+
+	memset(&voice, 0, sizeof(voice));
+	voice.setting = setting;
+	return (setsockopt(ssock, SOL_BLUETOOTH, BT_VOICE,
+			   &voice, sizeof(voice)) == 0);
+}
+
 
 HfpService::
 HfpService(int caps)
 	: RfcommService(HANDSFREE_AGW_SVCLASS_ID),
 	  m_sco_listen(-1), m_sco_listen_not(0),
 	  m_brsf_my_caps(caps), m_svc_name(0), m_svc_desc(0),
-	  m_sdp_rec(0), m_sco_enable(true),
+	  m_sdp_rec(0), m_sco_enable(true), m_sco_defer(false),
 	  m_complaint_sco_mtu(false), m_complaint_sco_vs(false),
 	  m_complaint_sco_listen(false)
 {
@@ -213,6 +256,23 @@ ScoListen(ErrorInfo *error)
 		goto failed;
 	}
 
+	/*
+	 * mSBC connections from the audio gateway must be accepted in
+	 * transparent mode, which is set per connection, and requires
+	 * deferred setup.  Without it, only CVSD is usable.
+	 */
+	m_sco_defer = false;
+	if (m_brsf_my_caps & HFP_HF_FEAT_CODEC) {
+		res = 1;
+		if (setsockopt(sock, SOL_BLUETOOTH, BT_DEFER_SETUP,
+			       &res, sizeof(res)) < 0)
+			GetDi()->LogWarn("SCO deferred setup unavailable: "
+					 "%s, wideband speech disabled",
+					 strerror(errno));
+		else
+			m_sco_defer = true;
+	}
+
 	if (listen(sock, 1) < 0) {
 		GetDi()->LogWarn(error,
 				 LIBHFP_ERROR_SUBSYS_BT,
@@ -289,7 +349,7 @@ ScoListenNotify(SocketNotifier *notp, int fh)
 		return;
 	}
 
-	res = sessp->ScoAccept(ssock);
+	res = sessp->ScoAccept(ssock, m_sco_defer);
 	sessp->Put();
 
 	if (!res)
@@ -312,6 +372,7 @@ ScoCleanup(void)
 		m_complaint_sco_vs = false;
 		m_complaint_sco_listen = false;
 	}
+	m_sco_defer = false;
 }
 
 /*
@@ -373,6 +434,8 @@ SdpRegister(ErrorInfo *error)
 
 	/* Add one last required attribute */
 	caps = m_brsf_my_caps & 0x1f;
+	if (m_brsf_my_caps & HFP_HF_FEAT_CODEC)
+		caps |= HFP_SDP_FEAT_WBS;
 	if (sdp_attr_add_new(svcrec, SDP_ATTR_SUPPORTED_FEATURES,
 			     SDP_UINT16, &caps) < 0)
 		goto nomem;
@@ -537,7 +600,18 @@ SetCaps(int caps, ErrorInfo *error)
 
 	m_brsf_my_caps = caps;
 
-	if ((m_sdp_rec != 0) && ((old_caps ^ caps) & 0x1f)) {
+	/* Codec negotiation changes how SCO connections are accepted */
+	if ((m_sco_listen >= 0) && ((old_caps ^ caps) & HFP_HF_FEAT_CODEC)) {
+		ScoCleanup();
+		if (!ScoListen(error)) {
+			m_brsf_my_caps = old_caps;
+			(void) ScoListen(0);
+			return false;
+		}
+	}
+
+	if ((m_sdp_rec != 0) &&
+	    ((old_caps ^ caps) & (0x1f | HFP_HF_FEAT_CODEC))) {
 		SdpUnregister();
 		if (!SdpRegister(error)) {
 			/* Now we're just screwed! */
@@ -636,8 +710,14 @@ HfpSession(HfpService *svcp, BtDevice *devp)
 	  m_state_signal(-1), m_state_roam(-1), m_state_battchg(-1),
 	  m_state_bvra(false), m_state_bsir(false), m_state_ecnr(false),
 	  m_state_vgm(-1), m_state_vgs(-1),
-	  m_sco_state(BVS_Invalid), m_sco_sock(-1), m_sco_nonblock(false), 
-	  m_sco_not(0), m_callsetup_presumed(false), m_timer(0),
+	  m_sco_state(BVS_Invalid), m_sco_sock(-1),
+	  m_sco_not(0), m_sco_tx_len(0), m_sco_tx_part(0),
+	  m_sco_jb_start(0), m_sco_jb_window(0), m_sco_jb_rx(0),
+	  m_sco_jb_lag_min(0), m_sco_jb_lag_max(0), m_sco_jb_target(0),
+	  m_sco_jb_stable(0),
+	  m_sco_codec(HFP_CODEC_CVSD), m_sco_msbc(false),
+	  m_msbc(0),
+	  m_callsetup_presumed(false), m_timer(0),
 	  m_clip_timer(0), m_clip_state(CLIP_UNKNOWN), m_clip_value(0),
 	  m_timeout_ring(5000), m_timeout_ring_ccwa(20000),
 	  m_timeout_dial(20000), m_timeout_clip(250), m_timeout_command(30000),
@@ -660,6 +740,10 @@ HfpSession::
 		delete m_command_timer;
 		m_command_timer = 0;
 	}
+	if (m_msbc) {
+		delete m_msbc;
+		m_msbc = 0;
+	}
 	assert(m_conn_state == BTS_Disconnected);
 	assert(m_commands.Empty());
 	assert(!m_inum_names);
@@ -774,6 +858,7 @@ __Disconnect(ErrorInfo *reason, bool voluntary)
 	m_state_signal = m_state_roam = m_state_battchg = -1;
 	m_state_bvra = m_state_bsir = m_state_ecnr = false;
 	m_state_vgm = m_state_vgs = -1;
+	m_sco_codec = HFP_CODEC_CVSD;
 
 	RfcommSession::__Disconnect(reason, voluntary);
 }
@@ -859,7 +944,27 @@ ScoGetParams(int ssock, ErrorInfo *error)
 
 	m_sco_handle = sci.hci_handle;
 	m_sco_mtu = sopts.mtu;
-	m_sco_packet_samps = ((sopts.mtu > 48) ? 48 : sopts.mtu) / 2;
+	m_sco_msbc = (m_sco_codec == HFP_CODEC_MSBC);
+	m_sco_tx_len = 0;
+	m_sco_tx_part = 0;
+
+	if (!m_sco_msbc) {
+		m_sco_packet_samps = ((sopts.mtu > 48) ? 48 : sopts.mtu) / 2;
+		return true;
+	}
+
+	/* mSBC: one packet per frame, encoded and decoded here */
+	if (!m_msbc) {
+		m_msbc = new SoundIoMsbc;
+		if (!m_msbc) {
+			m_sco_msbc = false;
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+	}
+	m_msbc->Reset();
+	m_sco_packet_samps = SoundIoMsbc::MSBC_PCM_SAMPS;
 	return true;
 }
 
@@ -944,6 +1049,18 @@ ScoConnect(ErrorInfo *error)
 		return false;
 	}
 
+	if ((m_sco_codec == HFP_CODEC_MSBC) &&
+	    !ScoSetVoice(ssock, BT_VOICE_TRANSPARENT)) {
+		err = errno;
+		close(ssock);
+		GetDi()->LogWarn(error,
+				 LIBHFP_ERROR_SUBSYS_BT,
+				 LIBHFP_ERROR_BT_SYSCALL,
+				 "Set SCO socket transparent mode: %s",
+				 strerror(err));
+		return false;
+	}
+
 	if (connect(ssock, (struct sockaddr*)&dest, sizeof(dest)) < 0) {
 		if ((errno != EINPROGRESS) && (errno != EAGAIN)) {
 			err = errno;
@@ -963,23 +1080,54 @@ ScoConnect(ErrorInfo *error)
 
 	m_sco_state = BVS_SocketConnecting;
 	m_sco_sock = ssock;
-	m_sco_nonblock = true;
 	BufCancelAbort();
 	return true;
 }
 
 bool HfpSession::
-ScoAccept(int ssock)
+ScoAccept(int ssock, bool deferred)
 {
+	uint8_t c;
+
 	if (!IsConnected()) {
 		return false;
 	}
 	if (IsConnectedAudio() || IsConnectingAudio()) {
 		return false;
 	}
+
+	if (deferred) {
+		/*
+		 * Choose the air mode for the negotiated codec, and
+		 * authorize the connection by reading from the socket.
+		 * The connection completes asynchronously.
+		 */
+		if (!ScoSetVoice(ssock, (m_sco_codec == HFP_CODEC_MSBC) ?
+				 BT_VOICE_TRANSPARENT : BT_VOICE_CVSD_16BIT)) {
+			GetDi()->LogWarn("Set SCO voice setting: %s",
+					 strerror(errno));
+			return false;
+		}
+		if (!SetNonBlock(ssock, true) ||
+		    (read(ssock, &c, 1) < 0)) {
+			GetDi()->LogWarn("Accept deferred SCO: %s",
+					 strerror(errno));
+			return false;
+		}
+
+		assert(m_sco_not == 0);
+		m_sco_not = GetDi()->NewSocket(ssock, true);
+		if (!m_sco_not)
+			return false;
+		m_sco_not->Register(this, &HfpSession::ScoConnectNotify);
+		m_sco_state = BVS_SocketConnecting;
+		m_sco_sock = ssock;
+		BufCancelAbort();
+		return true;
+	}
+
 	m_sco_state = BVS_SocketConnecting;
 	m_sco_sock = ssock;
-	m_sco_nonblock = false;
 	ScoConnectNotify(NULL, ssock);
 	return true;
 }
@@ -1024,6 +1172,17 @@ ScoConnectNotify(SocketNotifier *notp, int /*fh*/)
 		return;
 	}
 
+	/* Transfers never change the file flags, see ScoRecv() */
+	if (!SetNonBlock(m_sco_sock, true)) {
+		GetDi()->LogWarn(&error,
+				 LIBHFP_ERROR_SUBSYS_BT,
+				 LIBHFP_ERROR_BT_SYSCALL,
+				 "Set SCO socket nonblocking: %s",
+				 strerror(errno));
+		__DisconnectSco(true, true, false, error);
+		return;
+	}
+
 	/* Retrieve the connection parameters */
 	if (!ScoGetParams(m_sco_sock, &error)) {
 		/* Both callbacks synchronous */
@@ -1031,7 +1190,11 @@ ScoConnectNotify(SocketNotifier *notp, int /*fh*/)
 		return;
 	}
 
-	BufOpen(m_sco_packet_samps, 2);
+	if (!BufOpen(m_sco_packet_samps, 2)) {
+		error.SetNoMem();
+		__DisconnectSco(true, true, false, error);
+		return;
+	}
 
 	if (cb_NotifyAudioConnection.Registered())
 		cb_NotifyAudioConnection(this, 0);
@@ -1040,29 +1203,16 @@ ScoConnectNotify(SocketNotifier *notp, int /*fh*/)
 void HfpSession::
 ScoDataNotify(SocketNotifier *notp, int fh)
 {
-	int outq = 0;
 	assert(fh == m_sco_sock);
 	assert(notp == m_sco_not);
 	assert(IsConnectedAudio());
 
-	SndPushInput(true);
+	BufPushInput(true);
 
 	if (!IsConnectedAudio())
 		return;
 
-	if (m_sco_use_tiocoutq) {
-		if (ioctl(m_sco_sock, TIOCOUTQ, &outq)) {
-			GetDi()->LogWarn("SCO TIOCOUTQ: %s",
-					 strerror(errno));
-			outq = m_hw_outq;
-		} else {
-			outq /= 2;
-		}
-	} else {
-		outq = m_hw_outq;
-	}
-
-	BufProcess(outq, false, false);
+	BufProcess(ScoInFlight(), false, false);
 }
 
 
@@ -1137,7 +1287,7 @@ __DisconnectSco(bool notifyvs, bool notifyp, bool async, ErrorInfo &error)
 		close(m_sco_sock);
 		m_sco_sock = -1;
 		m_sco_state = BVS_Invalid;
-		m_sco_nonblock = false;
+		m_sco_msbc = false;
 	}
 
 	/*
@@ -1200,8 +1350,8 @@ SndGetProps(SoundIoProps &props) const
 void HfpSession::
 SndGetFormat(SoundIoFormat &format) const
 {
-	/* This is the Bluetooth audio format */
-	format.samplerate = 8000;
+	/* This is the Bluetooth audio format, after mSBC decoding */
+	format.samplerate = m_sco_msbc ? SoundIoMsbc::MSBC_SAMPLERATE : 8000;
 	format.sampletype = SIO_PCM_S16_LE;
 	format.nchannels = 1;
 	format.bytes_per_record = 2;
@@ -1211,45 +1361,318 @@ SndGetFormat(SoundIoFormat &format) const
 bool HfpSession::
 SndSetFormat(SoundIoFormat &format, ErrorInfo *error)
 {
+	SoundIoFormat myfmt;
+
+	SndGetFormat(myfmt);
 	if (!IsConnectedAudio() ||
-	    (format.samplerate != 8000) ||
+	    (format.samplerate != myfmt.samplerate) ||
 	    (format.sampletype != SIO_PCM_S16_LE) ||
 	    (format.nchannels != 1) ||
 	    (format.packet_samps != m_sco_packet_samps)) {
 		if (error)
 			error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
 				   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
-				   "Device requires 8KHz, S16_LE, 1ch");
+				   "Device requires %uKHz, S16_LE, 1ch",
+				   myfmt.samplerate / 1000);
 		return false;
 	}
 	return true;
 }
 
+/*
+ * Copy received samples into the input queue, which may hand out its
+ * space in pieces
+ */
 void HfpSession::
-SndPushInput(bool nonblock)
+ScoInputAppend(const uint8_t *data, sio_sampnum_t nsamples)
+{
+	sio_sampnum_t count;
+	uint8_t *buf;
+
+	while (nsamples) {
+		count = nsamples;
+		m_input.GetUnfilled(buf, count);
+		if (!count) {
+			GetDi()->LogWarn("SCO input buffer is zero-length?");
+			return;
+		}
+		memcpy(buf, data, count * 2);
+		m_input.PutUnfilled(count);
+		data += (count * 2);
+		nsamples -= count;
+	}
+}
+
+/*
+ * Decode a chunk of the mSBC packet stream into the input queue,
+ * returning the number of samples produced
+ */
+size_t HfpSession::
+MsbcDecodeInput(const uint8_t *data, size_t len)
+{
+	int16_t pcm[SoundIoMsbc::MSBC_PCM_SAMPS];
+	size_t total = 0;
+
+	while (m_msbc->Decode(data, len, pcm)) {
+		ScoInputAppend((const uint8_t *) pcm,
+			       SoundIoMsbc::MSBC_PCM_SAMPS);
+		total += SoundIoMsbc::MSBC_PCM_SAMPS;
+	}
+	return total;
+}
+
+/*
+ * Encode one frame from the output queue and append its packet to the
+ * transmit buffer
+ */
+bool HfpSession::
+MsbcEncodeOutput(void)
 {
 	unsigned int nsamples;
 	uint8_t *buf;
-	ssize_t res;
-	int err;
 
-	if (!IsConnectedAudio()) { return; }
+	nsamples = 0;
+	m_output.Peek(buf, nsamples);
+	if (nsamples < SoundIoMsbc::MSBC_PCM_SAMPS)
+		return false;
+
+	assert((m_sco_tx_len + SoundIoMsbc::MSBC_PACKET_SIZE) <=
+	       sizeof(m_sco_tx));
+	m_msbc->Encode((const int16_t *) buf, &m_sco_tx[m_sco_tx_len]);
+	m_sco_tx_len += SoundIoMsbc::MSBC_PACKET_SIZE;
+	m_output.Dequeue(SoundIoMsbc::MSBC_PCM_SAMPS);
+	if (!m_sco_use_tiocoutq)
+		m_hw_outq += SoundIoMsbc::MSBC_PCM_SAMPS;
+	return true;
+}
+
+void HfpSession::
+ScoJitterReset(void)
+{
+	m_sco_jb_start = 0;
+	m_sco_jb_window = 0;
+	m_sco_jb_rx = 0;
+	m_sco_jb_lag_min = 0;
+	m_sco_jb_lag_max = 0;
+	m_sco_jb_target = 2 * m_sco_packet_samps;
+	m_sco_jb_stable = 0;
+}
+
+/*
+ * Account for input samples that have just arrived.
+ *
+ * The arrival lag is the number of samples that a steady clock would
+ * have delivered since the stream started, less the number actually
+ * received.  Its spread within a window, from just before the latest
+ * arrivals to just after the earliest, is the depth needed to ride
+ * out the jitter of the link.  Measuring over short windows keeps
+ * clock drift between the device and the host out of the estimate.
+ */
+void HfpSession::
+ScoJitterUpdate(sio_sampnum_t nsamples)
+{
+	struct timespec ts;
+	uint64_t now;
+	int64_t lag;
+	sio_sampnum_t rate, packet, need, limit;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	if (!now)
+		now = 1;
+
+	rate = m_sco_msbc ? SoundIoMsbc::MSBC_SAMPLERATE : 8000;
+	packet = m_sco_packet_samps;
+	limit = (SCO_JB_MAX_MS * rate) / 1000;
+	if (limit < (2 * packet))
+		limit = 2 * packet;
+
+	lag = (int64_t) (((now - m_sco_jb_start) * rate) / 1000000) -
+		(int64_t) m_sco_jb_rx;
+
+	if (!m_sco_jb_start || (lag > (int64_t) (2 * limit))) {
+		/*
+		 * First arrival, or a dropout long enough that the
+		 * device must have discarded packets: start over.
+		 */
+		m_sco_jb_start = now;
+		m_sco_jb_window = now;
+		m_sco_jb_rx = 0;
+		lag = 0;
+		m_sco_jb_lag_max = 0;
+		m_sco_jb_lag_min = 0;
+	}
+
+	if (lag > m_sco_jb_lag_max)
+		m_sco_jb_lag_max = lag;
+	m_sco_jb_rx += nsamples;
+	lag -= nsamples;
+	if (lag < m_sco_jb_lag_min)
+		m_sco_jb_lag_min = lag;
+
+	need = (sio_sampnum_t) (m_sco_jb_lag_max - m_sco_jb_lag_min) +
+		packet;
+	need = ((need + packet - 1) / packet) * packet;
+	if (need < (2 * packet))
+		need = 2 * packet;
+	if (need > limit)
+		need = limit;
+
+	if (need > m_sco_jb_target) {
+		GetDi()->LogDebug("SCO jitter target: %d -> %d samples",
+				  m_sco_jb_target, need);
+		m_sco_jb_target = need;
+		m_sco_jb_stable = 0;
+	}
+
+	if ((now - m_sco_jb_window) < (SCO_JB_WINDOW_MS * 1000ULL))
+		return;
+
+	if (need >= m_sco_jb_target) {
+		m_sco_jb_stable = 0;
+	} else if (++m_sco_jb_stable >= SCO_JB_STABLE_WINDOWS) {
+		GetDi()->LogDebug("SCO jitter target: %d -> %d samples",
+				  m_sco_jb_target,
+				  m_sco_jb_target - packet);
+		m_sco_jb_target -= packet;
+		m_sco_jb_stable = 0;
+	}
+
+	m_sco_jb_window = now;
+	m_sco_jb_lag_max = lag;
+	m_sco_jb_lag_min = lag;
+}
+
+/*
+ * Wait for the nonblocking SCO socket to become ready, for transfers
+ * that were asked to block
+ */
+bool HfpSession::
+ScoWait(short events)
+{
+	struct pollfd pfd;
+	int res;
+
+	pfd.fd = m_sco_sock;
+	pfd.events = events;
+	pfd.revents = 0;
+	do {
+		res = poll(&pfd, 1, -1);
+	} while ((res < 0) && (errno == EINTR));
+	return (res > 0);
+}
+
+/*
+ * Receive up to count packets, one per iovec, returning the number
+ * received with their lengths in lens, or -1 with errno set.  A
+ * zero-length packet marks the end of the connection.  Fewer than
+ * count packets are returned only when the socket queue is empty.
+ */
+int HfpSession::
+ScoRecv(struct iovec *iov, size_t *lens, int count, bool nonblock)
+{
+#if defined(HAVE_RECVMMSG)
+	struct mmsghdr msgs[SCO_BATCH];
+#else
+	ssize_t len;
+#endif
+	int i, res;
+
+	assert((count > 0) && (count <= SCO_BATCH));
 
-	if (m_sco_nonblock != nonblock) {
-		if (!SetNonBlock(m_sco_sock, nonblock)) {
-			GetDi()->LogWarn("SCO set nonblock failed");
+	while (1) {
+#if defined(HAVE_RECVMMSG)
+		memset(msgs, 0, count * sizeof(msgs[0]));
+		for (i = 0; i < count; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 		}
-		m_sco_nonblock = nonblock;
+		res = recvmmsg(m_sco_sock, msgs, count, 0, NULL);
+		for (i = 0; i < res; i++)
+			lens[i] = msgs[i].msg_len;
+#else
+		for (i = 0; i < count; i++) {
+			len = read(m_sco_sock, iov[i].iov_base, iov[i].iov_len);
+			if (len < 0)
+				break;
+			lens[i] = len;
+			if (!len) {
+				i++;
+				break;
+			}
+		}
+		res = i ? i : -1;
+#endif
+		if ((res >= 0) || (errno != EAGAIN) || nonblock)
+			return res;
+		if (!ScoWait(POLLIN))
+			return -1;
 	}
+}
+
+/*
+ * Send up to count packets, one per iovec, returning the number sent
+ * with their lengths in lens, or -1 with errno set.  Fewer than count
+ * packets are sent only when the socket queue is full.
+ */
+int HfpSession::
+ScoSend(struct iovec *iov, size_t *lens, int count, bool nonblock)
+{
+#if defined(HAVE_SENDMMSG)
+	struct mmsghdr msgs[SCO_BATCH];
+#else
+	ssize_t len;
+#endif
+	int i, res;
+
+	assert((count > 0) && (count <= SCO_BATCH));
 
 	while (1) {
-		nsamples = 0;
-		m_input.GetUnfilled(buf, nsamples);
-		if (!nsamples) {
-			GetDi()->LogWarn("SCO input buffer is zero-length?");
-			return;
+#if defined(HAVE_SENDMMSG)
+		memset(msgs, 0, count * sizeof(msgs[0]));
+		for (i = 0; i < count; i++) {
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
 		}
-		res = read(m_sco_sock, buf, nsamples * 2);
+		res = sendmmsg(m_sco_sock, msgs, count, MSG_NOSIGNAL);
+		for (i = 0; i < res; i++)
+			lens[i] = msgs[i].msg_len;
+#else
+		for (i = 0; i < count; i++) {
+			len = send(m_sco_sock, iov[i].iov_base, iov[i].iov_len,
+				   MSG_NOSIGNAL);
+			if (len < 0)
+				break;
+			lens[i] = len;
+		}
+		res = i ? i : -1;
+#endif
+		if ((res >= 0) || (errno != EAGAIN) || nonblock)
+			return res;
+		if (!ScoWait(POLLOUT))
+			return -1;
+	}
+}
+
+void HfpSession::
+SndPushInput(bool nonblock)
+{
+	uint8_t rxbuf[SCO_BATCH][SCO_MAX_PKTSIZE];
+	struct iovec iov[SCO_BATCH];
+	size_t lens[SCO_BATCH];
+	sio_sampnum_t total;
+	int i, res, err;
+	bool reset;
+
+	if (!IsConnectedAudio()) { return; }
+
+	for (i = 0; i < SCO_BATCH; i++) {
+		iov[i].iov_base = rxbuf[i];
+		iov[i].iov_len = sizeof(rxbuf[i]);
+	}
+
+	while (1) {
+		res = ScoRecv(iov, lens, SCO_BATCH, nonblock);
 		if (res < 0) {
 			err = errno;
 			if ((err != EAGAIN) &&
@@ -1257,74 +1680,208 @@ SndPushInput(bool nonblock)
 				GetDi()->LogWarn("Read SCO data: %s",
 						 strerror(err));
 			}
-			if (ReadErrorFatal(err)) {
-				/* Connection is lost */
-				res = 0;
-			} else {
+			if (!ReadErrorFatal(err)) {
 				/* Just ignore it */
 				return;
 			}
+			/* Connection is lost */
+			res = 0;
 		}
-		if (res == 0) {
-			ErrorInfo error;
-
-			error.Set(LIBHFP_ERROR_SUBSYS_BT,
-				  LIBHFP_ERROR_BT_SYSCALL,
-				  "SCO Connection reset");
 
-			/* Connection lost: both callbacks asynchronous */
-			__DisconnectSco(true, true, true, error);
-			return;
-		} else if (res != (ssize_t) (nsamples * 2)) {
-			GetDi()->LogWarn("SCO short read: expected:%d "
-					 "got:%zd", (nsamples*2), res);
+		total = 0;
+		reset = !res;
+		for (i = 0; i < res; i++) {
+			if (!lens[i]) {
+				reset = true;
+				break;
+			}
+			if (m_sco_msbc) {
+				/* Packet boundaries are found by the decoder */
+				total += MsbcDecodeInput(rxbuf[i], lens[i]);
+				continue;
+			}
+			if (lens[i] != (size_t) (m_sco_packet_samps * 2)) {
+				GetDi()->LogWarn("SCO short read: expected:%d "
+						 "got:%zd",
+						 m_sco_packet_samps * 2,
+						 lens[i]);
+			}
+			ScoInputAppend(rxbuf[i], lens[i] / 2);
+			total += (lens[i] / 2);
 		}
 
-		m_input.PutUnfilled(res / 2);
+		if (total && SndIsAsyncStarted())
+			ScoJitterUpdate(total);
 
 		/*
-		 * HACK: BlueZ support for SIOCOUTQ is not universally present.
+		 * BlueZ support for SIOCOUTQ is not universally present.
 		 *
 		 * To improvise, we assume that the queue grows every time we
 		 * submit a packet, and shrinks symmetrically each time we
-		 * receive a packet.
-		 *
-		 * This might cause growing latency that does not self-correct.
+		 * receive a packet.  The estimate can only drift low when
+		 * the device is late, and SndPushOutput() never lets it
+		 * exceed the jitter target, so the true queue stays bounded.
 		 */
 		if (!m_sco_use_tiocoutq) {
-			if ((ssize_t) m_hw_outq < (res / 2))
+			if (m_hw_outq < total)
 				m_hw_outq = 0;
 			else
-				m_hw_outq -= (res / 2);
+				m_hw_outq -= total;
 		}
+
+		if (reset) {
+			ErrorInfo error;
+
+			error.Set(LIBHFP_ERROR_SUBSYS_BT,
+				  LIBHFP_ERROR_BT_SYSCALL,
+				  "SCO Connection reset");
+
+			/* Connection lost: both callbacks asynchronous */
+			__DisconnectSco(true, true, true, error);
+			return;
+		}
+
+		/* A short batch means the socket has been drained */
+		if (res < SCO_BATCH)
+			return;
+
+		/* Having received something, don't wait for more */
+		nonblock = true;
+	}
+}
+
+/* Convert a count of bytes bound for the socket to samples */
+sio_sampnum_t HfpSession::
+ScoTxSamples(size_t bytes) const
+{
+	if (m_sco_msbc)
+		return (bytes * SoundIoMsbc::MSBC_PCM_SAMPS) /
+			SoundIoMsbc::MSBC_PACKET_SIZE;
+	return bytes / 2;
+}
+
+/*
+ * Samples that have left m_output and not yet been played
+ */
+sio_sampnum_t HfpSession::
+ScoInFlight(void)
+{
+	int outq = 0;
+
+	/* The estimate counts output as it is staged */
+	if (!m_sco_use_tiocoutq)
+		return m_hw_outq;
+
+	/*
+	 * Output staged in m_sco_tx has left m_output, but has
+	 * not reached the socket, so it is counted here.
+	 */
+	if (ioctl(m_sco_sock, TIOCOUTQ, &outq)) {
+		GetDi()->LogWarn("SCO TIOCOUTQ: %s", strerror(errno));
+		return m_hw_outq;
+	}
+	return ScoTxSamples(outq + m_sco_tx_len);
+}
+
+/*
+ * Move output into m_sco_tx until a batch of pieces is staged, the
+ * output queue runs dry, or pacing holds the rest back.  While
+ * streaming, output is released in step with input, staging at most
+ * room samples, so that no more than the jitter target is in
+ * flight.
+ */
+void HfpSession::
+ScoStageOutput(size_t piece, bool paced, sio_sampnum_t room)
+{
+	sio_sampnum_t packet, nsamples, count;
+	size_t limit;
+	uint8_t *buf = 0;
+
+	limit = SCO_BATCH * piece;
+	if (limit > sizeof(m_sco_tx))
+		limit = sizeof(m_sco_tx) - (sizeof(m_sco_tx) % piece);
+
+	if (m_sco_msbc) {
+		packet = SoundIoMsbc::MSBC_PCM_SAMPS;
+		while ((m_sco_tx_len < limit) &&
+		       ((m_sco_tx_len + SoundIoMsbc::MSBC_PACKET_SIZE) <=
+			sizeof(m_sco_tx))) {
+			if (paced && (packet > room))
+				break;
+			if (!MsbcEncodeOutput())
+				break;
+			room -= packet;
+		}
+		return;
+	}
+
+	packet = m_sco_packet_samps;
+	while ((m_sco_tx_len + piece) <= limit) {
+		if (paced && (packet > room))
+			break;
+		if ((sio_sampnum_t) m_output.TotalFill() < packet)
+			break;
+		room -= packet;
+
+		for (count = 0; count < packet; count += nsamples) {
+			nsamples = packet - count;
+			m_output.Peek(buf, nsamples);
+			memcpy(&m_sco_tx[m_sco_tx_len], buf, nsamples * 2);
+			m_output.Dequeue(nsamples);
+			m_sco_tx_len += (nsamples * 2);
+		}
+		if (!m_sco_use_tiocoutq)
+			m_hw_outq += packet;
 	}
 }
 
 void HfpSession::
 SndPushOutput(bool nonblock)
 {
-	unsigned int nsamples;
-	uint8_t *buf;
-	ssize_t res;
-	int err;
+	struct iovec iov[SCO_BATCH];
+	size_t lens[SCO_BATCH];
+	size_t piece, len, off, part;
+	sio_sampnum_t inflight, room;
+	uint8_t *keep;
+	int count, i, res, err;
+	bool paced;
 
 	if (!IsConnectedAudio()) { return; }
 
-	if (m_sco_nonblock != nonblock) {
-		if (!SetNonBlock(m_sco_sock, nonblock)) {
-			GetDi()->LogWarn("SCO set nonblock failed");
-		}
-		m_sco_nonblock = nonblock;
+	paced = (nonblock && SndIsAsyncStarted());
+
+	if (m_sco_msbc) {
+		/*
+		 * The packet stream is written in MTU-sized
+		 * pieces, regardless of packet boundaries.
+		 */
+		piece = SoundIoMsbc::MSBC_PACKET_SIZE;
+		if (m_sco_mtu < piece)
+			piece = m_sco_mtu;
+	} else {
+		piece = m_sco_packet_samps * 2;
 	}
 
 	while (1) {
-		nsamples = 0;
-		m_output.Peek(buf, nsamples);
-		nsamples -= (nsamples % m_sco_packet_samps);
-		if (!nsamples) { return; }
-
-		res = send(m_sco_sock, buf, nsamples * 2, MSG_NOSIGNAL);
+		room = 0;
+		if (paced) {
+			inflight = ScoInFlight();
+			if (inflight < m_sco_jb_target)
+				room = m_sco_jb_target - inflight;
+		}
+		ScoStageOutput(piece, paced, room);
+
+		/* The remainder of a short send goes first */
+		len = m_sco_tx_part ? m_sco_tx_part : piece;
+		for (off = 0, count = 0;
+		     (count < SCO_BATCH) && ((off + len) <= m_sco_tx_len);
+		     count++, off += len, len = piece) {
+			iov[count].iov_base = &m_sco_tx[off];
+			iov[count].iov_len = len;
+		}
+		if (!count) { return; }
 
+		res = ScoSend(iov, lens, count, nonblock);
 		if (res < 0) {
 			err = errno;
 			if (err != EAGAIN) {
@@ -1344,13 +1901,38 @@ SndPushOutput(bool nonblock)
 			}
 			return;
 		}
-		if (res != (ssize_t) (nsamples * 2)) {
-			GetDi()->LogWarn("SCO short write: expected:%d "
-					 "got:%zd", (nsamples*2), res);
+
+		/*
+		 * Keep the rest of a short piece queued, to go out ahead
+		 * of what follows it.  If later pieces of the batch were
+		 * sent after it anyway, sending it now would only reorder
+		 * the stream, so it is dropped.
+		 */
+		keep = 0;
+		part = 0;
+		for (i = 0; i < res; i++) {
+			if (lens[i] == iov[i].iov_len)
+				continue;
+			GetDi()->LogWarn("SCO short write: "
+					 "expected:%zd got:%zd",
+					 iov[i].iov_len, lens[i]);
+			if (i == (res - 1)) {
+				keep = (uint8_t *) iov[i].iov_base + lens[i];
+				part = iov[i].iov_len - lens[i];
+			}
 		}
-		m_output.Dequeue(res / 2);
-		if (!m_sco_use_tiocoutq)
-			m_hw_outq += (res / 2);
+
+		off = ((uint8_t *) iov[res - 1].iov_base - m_sco_tx) +
+			iov[res - 1].iov_len;
+		if (part)
+			memmove(m_sco_tx, keep, part);
+		memmove(&m_sco_tx[part], &m_sco_tx[off], m_sco_tx_len - off);
+		m_sco_tx_len = part + (m_sco_tx_len - off);
+		m_sco_tx_part = part;
+
+		/* A short batch or piece means the socket queue is full */
+		if ((res < count) || part)
+			return;
 	}
 }
 
@@ -1381,6 +1963,7 @@ SndAsyncStart(bool play, bool capture, ErrorInfo *error)
 
 	m_sco_not->Register(this, &HfpSession::ScoDataNotify);
 	m_hw_outq = 0;
+	ScoJitterReset();
 	return true;
 }
 
@@ -1391,6 +1974,7 @@ SndAsyncStop(void)
 		delete m_sco_not;
 		m_sco_not = 0;
 	}
+	m_sco_jb_target = 0;
 	BufStop();
 
 	/* Cancel a potential pending SoundIo abort notification */
@@ -2134,6 +2718,18 @@ ResponseDefault(char *buf)
 		}
 	}
 
+	else if (!strncmp(buf, "+BCS:", 5) && IsConnected()) {
+		/* Codec selection by the AG, which we must confirm */
+		buf += 5;
+		while (buf[0] && IsWS(buf[0])) { buf++; }
+		indnum = strtol(buf, &end, 0);
+		if (end == buf) {
+			GetDi()->LogWarn("Parse error on BCS");
+		} else {
+			ConfirmCodec(indnum);
+		}
+	}
+
 	else if (!strncmp(buf, "+BSIR:", 6) && IsConnected()) {
 		buf += 6;
 		while (buf[0] && IsWS(buf[0])) { buf++; }
@@ -2437,6 +3033,54 @@ public:
 	}
 };
 
+/* Bluetooth Available Codecs */
+class BacCommand : public AtCommand {
+public:
+	BacCommand(HfpSession *sessp) : AtCommand(sessp, "AT+BAC=1,2") {}
+	/* If this fails, the AG will presumably stick with CVSD */
+};
+
+/* Bluetooth Codec Selection, confirming the choice of the AG */
+class BcsCommand : public AtCommand {
+	int		m_codec;
+
+public:
+	BcsCommand(HfpSession *sessp, int codec)
+		: AtCommand(sessp), m_codec(codec) {
+		char tmpbuf[32];
+		sprintf(tmpbuf, "AT+BCS=%d", codec);
+		SetText(tmpbuf);
+	}
+
+	bool OK(void) {
+		GetSession()->m_sco_codec = m_codec;
+		GetDi()->LogDebug("Selected %s voice codec",
+				  (m_codec == HFP_CODEC_MSBC) ?
+				  "mSBC" : "CVSD");
+		return AtCommand::OK();
+	}
+};
+
+bool HfpSession::
+CodecNegotiation(void) const
+{
+	return ((GetService()->m_brsf_my_caps & HFP_HF_FEAT_CODEC) &&
+		(m_brsf & HFP_AG_FEAT_CODEC));
+}
+
+void HfpSession::
+ConfirmCodec(int codec)
+{
+	if ((codec == HFP_CODEC_CVSD) ||
+	    ((codec == HFP_CODEC_MSBC) && CodecNegotiation())) {
+		(void) AddCommand(new BcsCommand(this, codec), true, 0);
+		return;
+	}
+
+	/* Unsupported, restate the codecs we do support */
+	(void) AddCommand(new BacCommand(this), true, 0);
+}
+
 /* Bluetooth Read Supported Features */
 class BrsfCommand : public AtCommand {
 	int		m_brsf;
@@ -2462,6 +3106,11 @@ public:
 
 	bool OK(void) {
 		GetSession()->SetSupportedFeatures(m_brsf);
+		if (GetSession()->CodecNegotiation()) {
+			/* Available codecs must be sent immediately */
+			(void) GetSession()->AddCommand(
+				new BacCommand(GetSession()), true, 0);
+		}
 		if (GetSession()->FeatureThreeWayCalling()) {
 			(void) GetSession()->AddCommand(
 				new ChldTCommand(GetSession()), false, 0);
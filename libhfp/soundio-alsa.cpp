@@ -866,9 +866,14 @@ protected:
 	bool			m_play_nonblock;
 	bool			m_rec_nonblock;
 
-	void OpenBuf(void) {
-		this->BufOpen(m_alsa.GetPacketSize(),
-			      m_alsa.m_format.bytes_per_record);
+	bool OpenBuf(ErrorInfo *error) {
+		if (!this->BufOpen(m_alsa.GetPacketSize(),
+				   m_alsa.m_format.bytes_per_record)) {
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+		return true;
 	}
 
 public:
@@ -887,8 +892,9 @@ public:
 				      play, capture, error)) {
 			m_play_nonblock = false;
 			m_rec_nonblock = false;
-			OpenBuf();
-			return true;
+			if (OpenBuf(error))
+				return true;
+			m_alsa.CloseDevice();
 		}
 		return false;
 	}
@@ -910,10 +916,9 @@ public:
 		if (m_alsa.m_rec_handle)
 			m_alsa.m_rec_props.bufsize = 0;
 		if (m_alsa.Reconfigure(&format,
-				       SND_PCM_ACCESS_RW_INTERLEAVED, error)) {
-			OpenBuf();
+				       SND_PCM_ACCESS_RW_INTERLEAVED, error) &&
+		    OpenBuf(error))
 			return true;
-		}
 		return false;
 	}
 
@@ -1092,7 +1097,7 @@ public:
 				 * We will read as much input as we can
 				 * into our buffer
 				 */
-				SndPushInput(true);
+				BufPushInput(true);
 				if (m_abort)
 					goto do_abort;
 			}
@@ -1199,15 +1204,25 @@ public:
 	}
 };
 
-typedef SoundIoBufferBaseSync<PthreadLock> SoundIoBufferBaseThread;
+/*
+ * The threaded backend moves samples between the ALSA threads and the
+ * dispatcher through SoundIoRing queues.  The record thread is the
+ * only producer of m_input and the playback thread the only consumer
+ * of m_output, so neither takes m_lock to move data.  m_lock is left
+ * to guard the abort state, and to let an idle playback thread sleep.
+ */
+typedef SoundIoBufferBaseSync<PthreadLock, SoundIoRing>
+	SoundIoBufferBaseThread;
 typedef SoundIoAlsaProcBase<SoundIoBufferBaseThread> SoundIoAlsaProcBaseThread;
 
 class SoundIoAlsaProcThread : public SoundIoAlsaProcBaseThread {
 	pthread_t	m_play_thread;
 	pthread_t	m_rec_thread;
 	TimerNotifier	*m_async_not;
+	bool		m_threads_run;
 	bool		m_play_idle;
 	TimerNotifier	*m_play_wake;
+	uint8_t		*m_rec_spill;
 
 	static void *PlayThreadHelper(void *arg) {
 		SoundIoAlsaProcThread *objp = (SoundIoAlsaProcThread *) arg;
@@ -1220,6 +1235,16 @@ class SoundIoAlsaProcThread : public SoundIoAlsaProcBaseThread {
 		return 0;
 	}
 
+	bool ThreadsRun(void) const {
+		return __atomic_load_n(&m_threads_run, __ATOMIC_ACQUIRE);
+	}
+	bool PlayIdle(void) const {
+		return __atomic_load_n(&m_play_idle, __ATOMIC_SEQ_CST);
+	}
+	void SetPlayIdle(bool idle) {
+		__atomic_store_n(&m_play_idle, idle, __ATOMIC_SEQ_CST);
+	}
+
 public:
 	SoundIoAlsaProcThread(DispatchInterface *eip,
 			      const char *output_devspec,
@@ -1227,7 +1252,8 @@ public:
 		: SoundIoAlsaProcBaseThread(eip, output_devspec,
 					    input_devspec),
 		  m_play_thread(0), m_rec_thread(0),
-		  m_async_not(0), m_play_wake(0) {}
+		  m_async_not(0), m_threads_run(false), m_play_idle(false),
+		  m_play_wake(0), m_rec_spill(0) {}
 	virtual ~SoundIoAlsaProcThread() {}
 
 	void RecThread(void) {
@@ -1235,6 +1261,7 @@ public:
 		uint8_t *buf;
 		snd_pcm_sframes_t err;
 		int res;
+		bool spill;
 		ErrorInfo error;
 
 		m_lock.Lock();
@@ -1251,15 +1278,22 @@ public:
 			}
 			m_rec_nonblock = false;
 		}
+		m_lock.Unlock();
 
-		while (m_async_not) {
+		while (ThreadsRun()) {
 			nsamples = m_alsa.m_format.packet_samps;
-			m_input.GetUnfilled(buf, nsamples);
-			assert(nsamples);
+			spill = !m_input.GetUnfilled(buf, nsamples);
+			if (spill) {
+				/*
+				 * The master thread isn't keeping up.
+				 * Keep the device running, drop the
+				 * packet, and report an overrun.
+				 */
+				buf = m_rec_spill;
+				nsamples = m_alsa.m_format.packet_samps;
+			}
 
-			m_lock.Unlock();
 			err = snd_pcm_readi(m_alsa.m_rec_handle, buf,nsamples);
-			m_lock.Lock();
 
 			if (err < 0) {
 				assert(err != -EAGAIN);
@@ -1268,7 +1302,6 @@ public:
 					    &error)) {
 					continue;
 				}
-				m_lock.Unlock();
 				BufAbort(m_alsa.m_ei, error);
 				return;
 			}
@@ -1276,14 +1309,15 @@ public:
 			if (!err)
 				continue;
 
-			m_input.PutUnfilled(err);
+			if (spill)
+				__atomic_store_n(&m_alsa.m_rec_xrun, true,
+						 __ATOMIC_RELEASE);
+			else
+				m_input.PutUnfilled(err);
 
 			/* Wake up the master thread */
-			if (m_async_not)
-				m_async_not->Set(0);
+			m_async_not->Set(0);
 		}
-
-		m_lock.Unlock();
 	}
 
 	void PlayThread(void) {
@@ -1291,7 +1325,7 @@ public:
 		uint8_t *buf;
 		int res;
 		snd_pcm_sframes_t err;
-		bool underrun;
+		bool underrun, idled = false;
 		ErrorInfo error;
 		unsigned int msec;
 
@@ -1309,22 +1343,26 @@ public:
 			}
 			m_play_nonblock = false;
 		}
+		m_lock.Unlock();
 
 		msec = (m_alsa.m_format.packet_samps * 1000) /
 			m_alsa.m_format.samplerate;
 
-		while (m_async_not) {
+		while (ThreadsRun()) {
 			m_async_not->Set(0);
 			(void) snd_pcm_avail_update(m_alsa.m_play_handle);
 			if (!m_alsa.CheckXrun(m_alsa.m_play_handle,
 					      underrun,
 					      &error)) {
-				m_lock.Unlock();
 				BufAbort(m_alsa.m_ei, error);
 				return;
 			}
-			m_alsa.m_play_xrun = underrun;
-			m_hw_outq = m_alsa.GetPlaybackQueue();
+			if (underrun)
+				__atomic_store_n(&m_alsa.m_play_xrun, true,
+						 __ATOMIC_RELEASE);
+			__atomic_store_n(&m_hw_outq,
+					 m_alsa.GetPlaybackQueue(),
+					 __ATOMIC_RELAXED);
 			nsamples = m_alsa.m_format.packet_samps;
 			m_output.Peek(buf, nsamples);
 			if (!nsamples) {
@@ -1332,22 +1370,30 @@ public:
 				 * Wait for the master thread
 				 * to submit more samples, or to
 				 * wake us up via PlayThreadWakeup.
+				 * Publish m_play_idle before looking
+				 * at the queue again, SndPushOutput()
+				 * does the same in the other order.
 				 */
-				m_play_idle = true;
-				m_play_wake->Set(msec / 2);
-				m_lock.Wait();
+				m_lock.Lock();
+				SetPlayIdle(true);
+				__atomic_thread_fence(__ATOMIC_SEQ_CST);
+				if (m_output.Empty() && ThreadsRun()) {
+					m_play_wake->Set(msec / 2);
+					m_lock.Wait();
+					idled = true;
+				}
+				SetPlayIdle(false);
+				m_lock.Unlock();
 				continue;
 			}
 
-			if (m_play_idle) {
+			if (idled) {
 				m_play_wake->Cancel();
-				m_play_idle = false;
+				idled = false;
 			}
 
-			m_lock.Unlock();
 			err = snd_pcm_writei(m_alsa.m_play_handle,
 					     buf, nsamples);
-			m_lock.Lock();
 
 			if (err < 0) {
 				assert(err != -EAGAIN);
@@ -1356,12 +1402,10 @@ public:
 					    &error))
 					continue;
 
-				m_lock.Unlock();
 				BufAbort(m_alsa.m_ei, error);
 				return;
 			}
 			if (!err) {
-				m_lock.Unlock();
 				error.Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
 					  LIBHFP_ERROR_SOUNDIO_SYSCALL,
 					  "ALSA pcm_writei result is 0?");
@@ -1371,16 +1415,12 @@ public:
 
 			m_output.Dequeue(err);
 		}
-
-		m_lock.Unlock();
 	}
 
 	void PlayThreadWakeup(TimerNotifier *notp) {
 		m_lock.Lock();
-		if (m_play_idle) {
-			m_play_idle = false;
+		if (PlayIdle())
 			m_lock.Signal();
-		}
 		m_lock.Unlock();
 	}
 
@@ -1391,12 +1431,15 @@ public:
 	virtual void SndPushOutput(bool nonblock) {
 		/*
 		 * Wake up the output thread if it's sleeping and
-		 * there's something for it to do
+		 * there's something for it to do.  The lock is only
+		 * taken in that case.
 		 */
-		m_lock.Lock();
-		if (m_play_idle && m_output.TotalFill())
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (PlayIdle() && !m_output.Empty()) {
+			m_lock.Lock();
 			m_lock.Signal();
-		m_lock.Unlock();
+			m_lock.Unlock();
+		}
 	}
 
 	void AsyncProcess(TimerNotifier *notp) {
@@ -1408,17 +1451,19 @@ public:
 		if (m_abort)
 			goto do_abort;
 
-		if (m_rec_thread) {
-			overrun = m_alsa.m_rec_xrun;
-			m_alsa.m_rec_xrun = false;
-		}
+		if (m_rec_thread)
+			overrun = __atomic_exchange_n(&m_alsa.m_rec_xrun,
+						      false,
+						      __ATOMIC_ACQ_REL);
 
-		if (m_play_thread) {
-			underrun = m_alsa.m_play_xrun;
-			m_alsa.m_play_xrun = false;
-		}
+		if (m_play_thread)
+			underrun = __atomic_exchange_n(&m_alsa.m_play_xrun,
+						       false,
+						       __ATOMIC_ACQ_REL);
 
-		if (!BufProcess(m_hw_outq, overrun, underrun))
+		if (!BufProcess(__atomic_load_n(&m_hw_outq,
+						__ATOMIC_RELAXED),
+				overrun, underrun))
 			return;
 
 		m_lock.Unlock();
@@ -1444,8 +1489,19 @@ public:
 
 		m_async_not->Register(this,
 				      &SoundIoAlsaProcThread::AsyncProcess);
+		m_threads_run = true;
 
 		if (capture) {
+			m_rec_spill = (uint8_t *)
+				malloc(m_alsa.m_format.packet_samps *
+				       m_alsa.m_format.bytes_per_record);
+			if (!m_rec_spill) {
+				if (error)
+					error->SetNoMem();
+				SndAsyncStop();
+				return false;
+			}
+
 			res = pthread_create(&m_rec_thread, 0,
 				     &SoundIoAlsaProcThread::RecThreadHelper,
 					     this);
@@ -1471,7 +1527,6 @@ public:
 			m_play_wake->Register(this,
 				&SoundIoAlsaProcThread::PlayThreadWakeup);
 
-			m_play_idle = true;
 			res = pthread_create(&m_play_thread, 0,
 				     &SoundIoAlsaProcThread::PlayThreadHelper,
 					     this);
@@ -1498,8 +1553,11 @@ public:
 			return;
 		}
 
-		delete m_async_not;
-		m_async_not = 0;
+		/*
+		 * The threads use m_async_not without holding m_lock,
+		 * so it may only be deleted once they have exited.
+		 */
+		__atomic_store_n(&m_threads_run, false, __ATOMIC_RELEASE);
 		m_lock.Signal();
 		m_lock.Unlock();
 
@@ -1513,12 +1571,20 @@ public:
 			assert(!res);
 			m_play_thread = 0;
 		}
+
+		delete m_async_not;
+		m_async_not = 0;
+
 		BufClose();
 
 		if (m_play_wake) {
 			delete m_play_wake;
 			m_play_wake = 0;
 		}
+		if (m_rec_spill) {
+			free(m_rec_spill);
+			m_rec_spill = 0;
+		}
 	}
 
 	virtual bool SndIsAsyncStarted(void) const {
@@ -0,0 +1,476 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-dsp.h>
+
+namespace libhfp {
+
+/*
+ * SoundIoConverter implementation
+ *
+ * The native endpoint runs in its own format, and the converter
+ * presents the outer format to its client.  Each direction is a path
+ * of stages over S16 records: decode, down-mix, resample, up-mix, and
+ * encode, skipping the stages that are not needed.
+ *
+ * Captured records are converted as they are requested, into m_in,
+ * in the outer format.  Records to be played are staged in m_obuf in
+ * the outer format, and converted into the native endpoint's output
+ * buffer when queued.
+ *
+ * The outer rate times m_down equals the native rate times m_up, and
+ * at least one of the two is one.
+ */
+
+class SoundIoConverter : public SoundIo {
+	enum {
+		/* Records converted per pass, in the source format */
+		c_chunk = 256,
+	};
+
+	struct Path {
+		sio_sampletype_t	stype, dtype;
+		unsigned int		snch, dnch;
+		bool			resample;
+		SoundIoDspResampler	rs;
+
+		sio_sampnum_t OutputCount(sio_sampnum_t nrecs) const {
+			return resample ? rs.OutputCount(nrecs) : nrecs;
+		}
+	};
+
+	SoundIo		*m_native;
+	SoundIoFormat	m_fmt;
+	SoundIoFormat	m_nfmt;
+	unsigned int	m_up;
+	unsigned int	m_down;
+	Path		m_in_path;
+	Path		m_out_path;
+	int16_t		*m_work[2];
+	VarBuf		m_in;
+	uint8_t		*m_obuf;
+	sio_sampnum_t	m_obuf_size;
+	uint8_t		*m_nbuf;
+
+	static unsigned int SampleSize(sio_sampletype_t type) {
+		switch (type) {
+		case SIO_PCM_U8:
+		case SIO_PCM_A_LAW:
+		case SIO_PCM_MU_LAW:
+			return 1;
+		case SIO_PCM_S16_LE:
+			return 2;
+		default:
+			return 0;
+		}
+	}
+
+	static bool SameFormat(SoundIoFormat const &a,
+			       SoundIoFormat const &b) {
+		return ((a.sampletype == b.sampletype) &&
+			(a.samplerate == b.samplerate) &&
+			(a.nchannels == b.nchannels));
+	}
+
+	/*
+	 * Native record counts to outer record counts, rounding down.
+	 * Unclocked sinks may report nearly unlimited space.
+	 */
+	sio_sampnum_t ToOuter(sio_sampnum_t nrecs) const {
+		if (nrecs > (~(sio_sampnum_t) 0 / m_up))
+			return ~(sio_sampnum_t) 0;
+		return (nrecs * m_up) / m_down;
+	}
+
+	int16_t *Other(const int16_t *buf) {
+		return (buf == m_work[0]) ? m_work[1] : m_work[0];
+	}
+
+	size_t Convert(Path &p, uint8_t *dest, const uint8_t *src,
+		       size_t nrecs) {
+		const int16_t *a;
+		int16_t *b;
+		unsigned int nch = p.snch;
+
+		if (p.stype == SIO_PCM_S16_LE)
+			a = (const int16_t *) src;
+		else {
+			SoundIoDspConvert(SIO_PCM_S16_LE,
+					  (uint8_t *) m_work[0],
+					  p.stype, src, nrecs * nch);
+			a = m_work[0];
+		}
+
+		if (p.dnch < nch) {
+			b = Other(a);
+			SoundIoDspRemix(b, p.dnch, a, nch, nrecs);
+			a = b;
+			nch = p.dnch;
+		}
+
+		if (p.resample) {
+			b = Other(a);
+			nrecs = p.rs.Process(b, a, nrecs);
+			a = b;
+		}
+
+		if (p.dnch > nch) {
+			b = Other(a);
+			SoundIoDspRemix(b, p.dnch, a, nch, nrecs);
+			a = b;
+			nch = p.dnch;
+		}
+
+		SoundIoDspConvert(p.dtype, dest, SIO_PCM_S16_LE,
+				  (const uint8_t *) a, nrecs * nch);
+		return nrecs;
+	}
+
+	void FreeBuffers(void) {
+		free(m_work[0]);
+		free(m_work[1]);
+		free(m_obuf);
+		free(m_nbuf);
+		m_work[0] = m_work[1] = 0;
+		m_obuf = m_nbuf = 0;
+		m_obuf_size = 0;
+		m_in.FreeBuffer();
+	}
+
+	void Reset(void) {
+		m_in.m_start = m_in.m_end = 0;
+		if (m_in_path.resample)
+			m_in_path.rs.Reset();
+		if (m_out_path.resample)
+			m_out_path.rs.Reset();
+	}
+
+	bool Setup(SoundIoFormat &fmt, ErrorInfo *error) {
+		SoundIoFormat nfmt;
+		unsigned int size, nsize, up, down, nch, maxnch;
+		size_t work;
+
+		m_native->SndGetFormat(nfmt);
+		size = SampleSize(fmt.sampletype);
+		nsize = SampleSize(nfmt.sampletype);
+		if (!size || !nsize || !fmt.nchannels || !nfmt.nchannels ||
+		    !fmt.samplerate || !nfmt.samplerate) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_UNKNOWN,
+					   "Format not recognized by "
+					   "converter");
+			return false;
+		}
+
+		if ((fmt.nchannels != nfmt.nchannels) &&
+		    (fmt.nchannels != 1) && (nfmt.nchannels != 1)) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+					   "Cannot convert between %d and %d "
+					   "channels",
+					   nfmt.nchannels, fmt.nchannels);
+			return false;
+		}
+
+		up = down = 1;
+		if (!(nfmt.samplerate % fmt.samplerate))
+			down = nfmt.samplerate / fmt.samplerate;
+		else if (!(fmt.samplerate % nfmt.samplerate))
+			up = fmt.samplerate / nfmt.samplerate;
+		if ((up > SoundIoDspResampler::MAX_RATIO) ||
+		    (down > SoundIoDspResampler::MAX_RATIO) ||
+		    ((up == 1) && (down == 1) &&
+		     (fmt.samplerate != nfmt.samplerate))) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+					   "Cannot convert between %u and "
+					   "%u Hz",
+					   nfmt.samplerate, fmt.samplerate);
+			return false;
+		}
+
+		nch = (fmt.nchannels < nfmt.nchannels) ?
+			fmt.nchannels : nfmt.nchannels;
+		maxnch = (fmt.nchannels > nfmt.nchannels) ?
+			fmt.nchannels : nfmt.nchannels;
+
+		m_in_path.stype = nfmt.sampletype;
+		m_in_path.snch = nfmt.nchannels;
+		m_in_path.dtype = fmt.sampletype;
+		m_in_path.dnch = fmt.nchannels;
+		m_in_path.resample = (up != down);
+		m_out_path.stype = fmt.sampletype;
+		m_out_path.snch = fmt.nchannels;
+		m_out_path.dtype = nfmt.sampletype;
+		m_out_path.dnch = nfmt.nchannels;
+		m_out_path.resample = (up != down);
+		if (m_in_path.resample &&
+		    (!m_in_path.rs.Configure(up, down, nch) ||
+		     !m_out_path.rs.Configure(down, up, nch)))
+			goto nomem;
+
+		fmt.bytes_per_record = size * fmt.nchannels;
+		FreeBuffers();
+
+		/* The largest intermediate result of one pass */
+		work = c_chunk * ((up > down) ? up : down) * maxnch;
+		m_work[0] = (int16_t *) malloc(work * sizeof(int16_t));
+		m_work[1] = (int16_t *) malloc(work * sizeof(int16_t));
+		m_obuf_size = c_chunk;
+		m_obuf = (uint8_t *) malloc(m_obuf_size *
+					    fmt.bytes_per_record);
+		m_nbuf = (uint8_t *) malloc(c_chunk * down *
+					    nfmt.bytes_per_record);
+		if (!m_work[0] || !m_work[1] || !m_obuf || !m_nbuf ||
+		    !m_in.AllocateBuffer(4 * c_chunk * up *
+					 fmt.bytes_per_record) ||
+		    !m_in.m_buf)
+			goto nomem;
+
+		m_up = up;
+		m_down = down;
+		m_nfmt = nfmt;
+		m_fmt = fmt;
+		SndGetFormat(fmt);
+		return true;
+
+	nomem:
+		FreeBuffers();
+		if (error)
+			error->SetNoMem();
+		return false;
+	}
+
+	/* Convert captured records until m_in holds want, or runs out */
+	void Pull(sio_sampnum_t want) {
+		SoundIoBuffer buf;
+		sio_sampnum_t space, n;
+		uint8_t *dest;
+
+		while ((m_in.SpaceUsed() / m_fmt.bytes_per_record) < want) {
+			space = m_in.SpaceFree() / m_fmt.bytes_per_record;
+			n = (m_up > 1) ? (space / m_up) : (space * m_down);
+			if (n > c_chunk)
+				n = c_chunk;
+			if (!n)
+				break;
+
+			buf.m_size = n;
+			m_native->SndGetIBuf(buf);
+			if (!buf.m_size)
+				break;
+
+			dest = m_in.GetSpace(m_in_path.OutputCount(buf.m_size) *
+					     m_fmt.bytes_per_record);
+			assert(dest);
+			n = Convert(m_in_path, dest, buf.m_data, buf.m_size);
+			m_in.m_end += (n * m_fmt.bytes_per_record);
+			m_native->SndDequeueIBuf(buf.m_size);
+		}
+	}
+
+public:
+	SoundIoConverter(SoundIo *native)
+		: m_native(native), m_up(1), m_down(1),
+		  m_obuf(0), m_obuf_size(0), m_nbuf(0) {
+		memset(&m_fmt, 0, sizeof(m_fmt));
+		memset(&m_nfmt, 0, sizeof(m_nfmt));
+		m_in_path.resample = m_out_path.resample = false;
+		m_work[0] = m_work[1] = 0;
+	}
+
+	virtual ~SoundIoConverter() {
+		FreeBuffers();
+	}
+
+	virtual bool SndOpen(bool sink, bool source, ErrorInfo *error) {
+		Reset();
+		return m_native->SndOpen(sink, source, error);
+	}
+
+	virtual void SndClose(void) {
+		m_native->SndClose();
+		Reset();
+	}
+
+	virtual void SndGetProps(SoundIoProps &props) const {
+		m_native->SndGetProps(props);
+		props.outbuf_size = ToOuter(props.outbuf_size);
+	}
+
+	virtual void SndGetFormat(SoundIoFormat &format) const {
+		SoundIoFormat nfmt;
+
+		m_native->SndGetFormat(nfmt);
+		format = m_fmt;
+		format.packet_samps = ToOuter(nfmt.packet_samps);
+		if (!format.packet_samps)
+			format.packet_samps = 1;
+	}
+
+	virtual bool SndSetFormat(SoundIoFormat &format, ErrorInfo *error) {
+		SoundIoFormat nfmt;
+
+		m_native->SndGetFormat(nfmt);
+		if (SameFormat(format, m_fmt) && SameFormat(nfmt, m_nfmt)) {
+			SndGetFormat(format);
+			return true;
+		}
+
+		if (m_native->SndIsAsyncStarted()) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			   LIBHFP_ERROR_SOUNDIO_CANNOT_CHANGE_WHILE_STREAMING,
+					   "Cannot change converter format "
+					   "while streaming");
+			return false;
+		}
+
+		if (!Setup(format, error))
+			return false;
+		Reset();
+		return true;
+	}
+
+	virtual void SndGetIBuf(SoundIoBuffer &fillme) {
+		sio_sampnum_t avail;
+
+		Pull(fillme.m_size ? fillme.m_size :
+		     (m_in.m_size / m_fmt.bytes_per_record));
+		avail = m_in.SpaceUsed() / m_fmt.bytes_per_record;
+		if (!fillme.m_size || (fillme.m_size > avail))
+			fillme.m_size = avail;
+		fillme.m_data = m_in.GetStart();
+	}
+
+	virtual void SndDequeueIBuf(sio_sampnum_t nsamples) {
+		SoundIoQueueState nqs;
+		sio_sampnum_t avail, nin;
+
+		avail = m_in.SpaceUsed() / m_fmt.bytes_per_record;
+		if (nsamples <= avail) {
+			m_in.m_start += (nsamples * m_fmt.bytes_per_record);
+			return;
+		}
+
+		/* Drop the rest from the native endpoint, unconverted */
+		m_in.m_start = m_in.m_end;
+		nsamples -= avail;
+		nin = (nsamples * m_down) + (m_up - 1);
+		nin /= m_up;
+		m_native->SndGetQueueState(nqs);
+		assert(nin <= (nqs.in_queued + m_down));
+		if (nin > nqs.in_queued)
+			nin = nqs.in_queued;
+		if (nin)
+			m_native->SndDequeueIBuf(nin);
+	}
+
+	virtual void SndGetOBuf(SoundIoBuffer &fillme) {
+		if (!fillme.m_size || (fillme.m_size > m_obuf_size))
+			fillme.m_size = m_obuf_size;
+		fillme.m_data = m_obuf;
+	}
+
+	virtual void SndQueueOBuf(sio_sampnum_t nsamples) {
+		SoundIoBuffer buf;
+		sio_sampnum_t n;
+		uint8_t *src;
+
+		assert(nsamples <= m_obuf_size);
+		n = Convert(m_out_path, m_nbuf, m_obuf, nsamples);
+		src = m_nbuf;
+		while (n) {
+			buf.m_size = n;
+			m_native->SndGetOBuf(buf);
+			if (!buf.m_size)
+				/* Native queue is full, drop the rest */
+				break;
+			memcpy(buf.m_data, src,
+			       buf.m_size * m_nfmt.bytes_per_record);
+			m_native->SndQueueOBuf(buf.m_size);
+			src += (buf.m_size * m_nfmt.bytes_per_record);
+			n -= buf.m_size;
+		}
+	}
+
+	virtual void SndGetQueueState(SoundIoQueueState &qs) {
+		m_native->SndGetQueueState(qs);
+		qs.in_queued = (m_in.SpaceUsed() / m_fmt.bytes_per_record) +
+			m_in_path.OutputCount(qs.in_queued);
+		qs.out_queued = ToOuter(qs.out_queued);
+	}
+
+	virtual bool SndAsyncStart(bool sink, bool source, ErrorInfo *error) {
+		Reset();
+		return m_native->SndAsyncStart(sink, source, error);
+	}
+
+	virtual void SndAsyncStop(void) {
+		m_native->SndAsyncStop();
+	}
+
+	virtual bool SndIsAsyncStarted(void) const {
+		return m_native->SndIsAsyncStarted();
+	}
+
+	virtual bool SndGetLatency(SoundIoLatencyHist *&in,
+				   SoundIoLatencyHist *&out) {
+		return m_native->SndGetLatency(in, out);
+	}
+
+	bool Init(SoundIoFormat const &fmt, ErrorInfo *error) {
+		SoundIoFormat fmt_copy(fmt);
+		return Setup(fmt_copy, error);
+	}
+};
+
+SoundIo *
+SoundIoCreateConverter(SoundIo *native, SoundIoFormat const &fmt,
+		       ErrorInfo *error)
+{
+	SoundIoConverter *convp;
+
+	assert(native);
+	convp = new SoundIoConverter(native);
+	if (!convp) {
+		if (error)
+			error->SetNoMem();
+		return 0;
+	}
+
+	if (!convp->Init(fmt, error)) {
+		delete convp;
+		return 0;
+	}
+
+	return convp;
+}
+
+} /* namespace libhfp */
@@ -0,0 +1,1293 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Sample processing kernels, see libhfp/soundio-dsp.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(USE_PTHREADS)
+#include <pthread.h>
+#endif
+
+#include <libhfp/soundio-dsp.h>
+
+#if defined(USE_SIMD_DSP) && defined(__GNUC__) && \
+	(defined(__x86_64__) || defined(__i386__))
+#define SIO_DSP_X86
+#include <immintrin.h>
+#endif
+
+#if defined(USE_SIMD_DSP) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define SIO_DSP_NEON
+#include <arm_neon.h>
+#endif
+
+namespace libhfp {
+
+unsigned int SoundIoDspLevel::
+Rms(void) const
+{
+	uint64_t mean, root, bit;
+
+	if (!count)
+		return 0;
+
+	/* Integer square root, to avoid dragging in libm */
+	mean = sum_sq / count;
+	root = 0;
+	bit = ((uint64_t) 1) << 62;
+	while (bit > mean)
+		bit >>= 2;
+	while (bit) {
+		if (mean >= (root + bit)) {
+			mean -= (root + bit);
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return (unsigned int) root;
+}
+
+
+/*
+ * Scalar kernels, used as the fallback and as the reference for the
+ * vectorized versions, which must produce identical results.
+ */
+
+static void
+MixS16Scalar(int16_t *dest, const int16_t *src, size_t count)
+{
+	int32_t tmp;
+	while (count--) {
+		tmp = (int32_t) *dest + *(src++);
+		if (tmp < -32768)
+			tmp = -32768;
+		else if (tmp > 32767)
+			tmp = 32767;
+		*(dest++) = tmp;
+	}
+}
+
+static void
+MixU8Scalar(uint8_t *dest, const uint8_t *src, size_t count)
+{
+	int32_t tmp;
+	while (count--) {
+		tmp = ((int) *(src++) - 128) + ((int) *dest - 128);
+		if (tmp < -128)
+			tmp = -128;
+		else if (tmp > 127)
+			tmp = 127;
+		*(dest++) = tmp + 128;
+	}
+}
+
+static void
+GainS16Scalar(int16_t *buf, size_t count, unsigned int gain)
+{
+	int32_t tmp;
+	while (count--) {
+		tmp = ((int32_t) *buf * (int32_t) gain + 2048) >> 12;
+		if (tmp < -32768)
+			tmp = -32768;
+		else if (tmp > 32767)
+			tmp = 32767;
+		*(buf++) = tmp;
+	}
+}
+
+static void
+LevelS16Scalar(const int16_t *src, size_t count, SoundIoDspLevel &lev)
+{
+	uint32_t peak = lev.peak, mag;
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		mag = (src[i] < 0) ? -(int32_t) src[i] : src[i];
+		if (mag > peak)
+			peak = mag;
+		sum += mag * mag;
+	}
+	lev.peak = peak;
+	lev.sum_sq += sum;
+	lev.count += count;
+}
+
+static const SoundIoDspKernels s_dsp_scalar = {
+	"scalar",
+	MixS16Scalar,
+	MixU8Scalar,
+	GainS16Scalar,
+	LevelS16Scalar,
+};
+
+
+#if defined(SIO_DSP_X86)
+
+/*
+ * The SSE2 and AVX2 kernels are built with per-function target
+ * attributes so that the rest of the library keeps the baseline
+ * instruction set, and are only selected if the CPU has them.
+ */
+
+#define SIO_SSE2 __attribute__((target("sse2")))
+#define SIO_AVX2 __attribute__((target("avx2")))
+
+static SIO_SSE2 void
+MixS16Sse2(int16_t *dest, const int16_t *src, size_t count)
+{
+	__m128i a, b;
+	for (; count >= 8; count -= 8, dest += 8, src += 8) {
+		a = _mm_loadu_si128((const __m128i *) dest);
+		b = _mm_loadu_si128((const __m128i *) src);
+		_mm_storeu_si128((__m128i *) dest, _mm_adds_epi16(a, b));
+	}
+	MixS16Scalar(dest, src, count);
+}
+
+static SIO_SSE2 void
+MixU8Sse2(uint8_t *dest, const uint8_t *src, size_t count)
+{
+	const __m128i bias = _mm_set1_epi8((char) 0x80);
+	__m128i a, b;
+	for (; count >= 16; count -= 16, dest += 16, src += 16) {
+		a = _mm_xor_si128(_mm_loadu_si128((const __m128i *) dest),
+				  bias);
+		b = _mm_xor_si128(_mm_loadu_si128((const __m128i *) src),
+				  bias);
+		_mm_storeu_si128((__m128i *) dest,
+				 _mm_xor_si128(_mm_adds_epi8(a, b), bias));
+	}
+	MixU8Scalar(dest, src, count);
+}
+
+static SIO_SSE2 void
+GainS16Sse2(int16_t *buf, size_t count, unsigned int gain)
+{
+	const __m128i g = _mm_set1_epi16((short) gain);
+	const __m128i rnd = _mm_set1_epi32(2048);
+	__m128i x, lo, hi, p0, p1;
+	for (; count >= 8; count -= 8, buf += 8) {
+		x = _mm_loadu_si128((const __m128i *) buf);
+		lo = _mm_mullo_epi16(x, g);
+		hi = _mm_mulhi_epi16(x, g);
+		p0 = _mm_add_epi32(_mm_unpacklo_epi16(lo, hi), rnd);
+		p1 = _mm_add_epi32(_mm_unpackhi_epi16(lo, hi), rnd);
+		p0 = _mm_srai_epi32(p0, 12);
+		p1 = _mm_srai_epi32(p1, 12);
+		_mm_storeu_si128((__m128i *) buf, _mm_packs_epi32(p0, p1));
+	}
+	GainS16Scalar(buf, count, gain);
+}
+
+static SIO_SSE2 void
+LevelS16Sse2(const int16_t *src, size_t count, SoundIoDspLevel &lev)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i x, sq, vmax, vmin, sum;
+	int16_t mx[8], mn[8];
+	uint64_t sums[2];
+	size_t done;
+	int i;
+
+	vmax = zero;
+	vmin = zero;
+	sum = zero;
+	for (done = 0; (count - done) >= 8; done += 8) {
+		x = _mm_loadu_si128((const __m128i *) &src[done]);
+		vmax = _mm_max_epi16(vmax, x);
+		vmin = _mm_min_epi16(vmin, x);
+		/* Pair sums are at most 2^31, so they fit unsigned */
+		sq = _mm_madd_epi16(x, x);
+		sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(sq, zero));
+		sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(sq, zero));
+	}
+
+	_mm_storeu_si128((__m128i *) mx, vmax);
+	_mm_storeu_si128((__m128i *) mn, vmin);
+	_mm_storeu_si128((__m128i *) sums, sum);
+	for (i = 0; i < 8; i++) {
+		if ((uint32_t) mx[i] > lev.peak)
+			lev.peak = mx[i];
+		if ((uint32_t) -(int32_t) mn[i] > lev.peak)
+			lev.peak = -(int32_t) mn[i];
+	}
+	lev.sum_sq += sums[0] + sums[1];
+	lev.count += done;
+	LevelS16Scalar(&src[done], count - done, lev);
+}
+
+static const SoundIoDspKernels s_dsp_sse2 = {
+	"sse2",
+	MixS16Sse2,
+	MixU8Sse2,
+	GainS16Sse2,
+	LevelS16Sse2,
+};
+
+static SIO_AVX2 void
+MixS16Avx2(int16_t *dest, const int16_t *src, size_t count)
+{
+	__m256i a, b;
+	for (; count >= 16; count -= 16, dest += 16, src += 16) {
+		a = _mm256_loadu_si256((const __m256i *) dest);
+		b = _mm256_loadu_si256((const __m256i *) src);
+		_mm256_storeu_si256((__m256i *) dest,
+				    _mm256_adds_epi16(a, b));
+	}
+	MixS16Scalar(dest, src, count);
+}
+
+static SIO_AVX2 void
+MixU8Avx2(uint8_t *dest, const uint8_t *src, size_t count)
+{
+	const __m256i bias = _mm256_set1_epi8((char) 0x80);
+	__m256i a, b;
+	for (; count >= 32; count -= 32, dest += 32, src += 32) {
+		a = _mm256_xor_si256(
+			_mm256_loadu_si256((const __m256i *) dest), bias);
+		b = _mm256_xor_si256(
+			_mm256_loadu_si256((const __m256i *) src), bias);
+		_mm256_storeu_si256((__m256i *) dest,
+			_mm256_xor_si256(_mm256_adds_epi8(a, b), bias));
+	}
+	MixU8Scalar(dest, src, count);
+}
+
+static SIO_AVX2 void
+GainS16Avx2(int16_t *buf, size_t count, unsigned int gain)
+{
+	const __m256i g = _mm256_set1_epi16((short) gain);
+	const __m256i rnd = _mm256_set1_epi32(2048);
+	__m256i x, lo, hi, p0, p1;
+
+	/* Unpack and pack both work within lanes, preserving order */
+	for (; count >= 16; count -= 16, buf += 16) {
+		x = _mm256_loadu_si256((const __m256i *) buf);
+		lo = _mm256_mullo_epi16(x, g);
+		hi = _mm256_mulhi_epi16(x, g);
+		p0 = _mm256_add_epi32(_mm256_unpacklo_epi16(lo, hi), rnd);
+		p1 = _mm256_add_epi32(_mm256_unpackhi_epi16(lo, hi), rnd);
+		p0 = _mm256_srai_epi32(p0, 12);
+		p1 = _mm256_srai_epi32(p1, 12);
+		_mm256_storeu_si256((__m256i *) buf,
+				    _mm256_packs_epi32(p0, p1));
+	}
+	GainS16Scalar(buf, count, gain);
+}
+
+static SIO_AVX2 void
+LevelS16Avx2(const int16_t *src, size_t count, SoundIoDspLevel &lev)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i x, sq, vmax, vmin, sum;
+	int16_t mx[16], mn[16];
+	uint64_t sums[4];
+	size_t done;
+	int i;
+
+	vmax = zero;
+	vmin = zero;
+	sum = zero;
+	for (done = 0; (count - done) >= 16; done += 16) {
+		x = _mm256_loadu_si256((const __m256i *) &src[done]);
+		vmax = _mm256_max_epi16(vmax, x);
+		vmin = _mm256_min_epi16(vmin, x);
+		sq = _mm256_madd_epi16(x, x);
+		sum = _mm256_add_epi64(sum,
+				       _mm256_unpacklo_epi32(sq, zero));
+		sum = _mm256_add_epi64(sum,
+				       _mm256_unpackhi_epi32(sq, zero));
+	}
+
+	_mm256_storeu_si256((__m256i *) mx, vmax);
+	_mm256_storeu_si256((__m256i *) mn, vmin);
+	_mm256_storeu_si256((__m256i *) sums, sum);
+	for (i = 0; i < 16; i++) {
+		if ((uint32_t) mx[i] > lev.peak)
+			lev.peak = mx[i];
+		if ((uint32_t) -(int32_t) mn[i] > lev.peak)
+			lev.peak = -(int32_t) mn[i];
+	}
+	lev.sum_sq += sums[0] + sums[1] + sums[2] + sums[3];
+	lev.count += done;
+	LevelS16Scalar(&src[done], count - done, lev);
+}
+
+static const SoundIoDspKernels s_dsp_avx2 = {
+	"avx2",
+	MixS16Avx2,
+	MixU8Avx2,
+	GainS16Avx2,
+	LevelS16Avx2,
+};
+
+#endif /* defined(SIO_DSP_X86) */
+
+
+#if defined(SIO_DSP_NEON)
+
+static void
+MixS16Neon(int16_t *dest, const int16_t *src, size_t count)
+{
+	for (; count >= 8; count -= 8, dest += 8, src += 8)
+		vst1q_s16(dest, vqaddq_s16(vld1q_s16(dest), vld1q_s16(src)));
+	MixS16Scalar(dest, src, count);
+}
+
+static void
+MixU8Neon(uint8_t *dest, const uint8_t *src, size_t count)
+{
+	const uint8x16_t bias = vdupq_n_u8(0x80);
+	int8x16_t a, b;
+	for (; count >= 16; count -= 16, dest += 16, src += 16) {
+		a = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(dest), bias));
+		b = vreinterpretq_s8_u8(veorq_u8(vld1q_u8(src), bias));
+		vst1q_u8(dest, veorq_u8(vreinterpretq_u8_s8(vqaddq_s8(a, b)),
+					bias));
+	}
+	MixU8Scalar(dest, src, count);
+}
+
+static void
+GainS16Neon(int16_t *buf, size_t count, unsigned int gain)
+{
+	const int16x4_t g = vdup_n_s16((int16_t) gain);
+	int16x8_t x;
+	int32x4_t p0, p1;
+	for (; count >= 8; count -= 8, buf += 8) {
+		x = vld1q_s16(buf);
+		p0 = vrshrq_n_s32(vmull_s16(vget_low_s16(x), g), 12);
+		p1 = vrshrq_n_s32(vmull_s16(vget_high_s16(x), g), 12);
+		vst1q_s16(buf, vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1)));
+	}
+	GainS16Scalar(buf, count, gain);
+}
+
+static void
+LevelS16Neon(const int16_t *src, size_t count, SoundIoDspLevel &lev)
+{
+	int16x8_t x, vmax, vmin;
+	uint64x2_t sum;
+	int16_t mx[8], mn[8];
+	uint64_t sums[2];
+	size_t done;
+	int i;
+
+	vmax = vdupq_n_s16(0);
+	vmin = vdupq_n_s16(0);
+	sum = vdupq_n_u64(0);
+	for (done = 0; (count - done) >= 8; done += 8) {
+		x = vld1q_s16(&src[done]);
+		vmax = vmaxq_s16(vmax, x);
+		vmin = vminq_s16(vmin, x);
+		sum = vpadalq_u32(sum, vreinterpretq_u32_s32(
+				vmull_s16(vget_low_s16(x), vget_low_s16(x))));
+		sum = vpadalq_u32(sum, vreinterpretq_u32_s32(
+				vmull_s16(vget_high_s16(x),
+					  vget_high_s16(x))));
+	}
+
+	vst1q_s16(mx, vmax);
+	vst1q_s16(mn, vmin);
+	vst1q_u64(sums, sum);
+	for (i = 0; i < 8; i++) {
+		if ((uint32_t) mx[i] > lev.peak)
+			lev.peak = mx[i];
+		if ((uint32_t) -(int32_t) mn[i] > lev.peak)
+			lev.peak = -(int32_t) mn[i];
+	}
+	lev.sum_sq += sums[0] + sums[1];
+	lev.count += done;
+	LevelS16Scalar(&src[done], count - done, lev);
+}
+
+static const SoundIoDspKernels s_dsp_neon = {
+	"neon",
+	MixS16Neon,
+	MixU8Neon,
+	GainS16Neon,
+	LevelS16Neon,
+};
+
+#endif /* defined(SIO_DSP_NEON) */
+
+
+/*
+ * Kernel selection
+ */
+
+static void LawTablesInit(void);
+
+static bool
+KernelsSupported(SoundIoDspKernels const *kp)
+{
+#if defined(SIO_DSP_X86)
+	if (kp == &s_dsp_sse2)
+		return __builtin_cpu_supports("sse2");
+	if (kp == &s_dsp_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return true;
+}
+
+/* In order of preference */
+static SoundIoDspKernels const *s_dsp_all[] = {
+#if defined(SIO_DSP_X86)
+	&s_dsp_avx2,
+	&s_dsp_sse2,
+#endif
+#if defined(SIO_DSP_NEON)
+	&s_dsp_neon,
+#endif
+	&s_dsp_scalar,
+};
+
+static SoundIoDspKernels const *s_dsp_active;
+
+static SoundIoDspKernels const *
+FindKernels(const char *name)
+{
+	SoundIoDspKernels const *kp;
+	size_t i;
+
+	for (i = 0; i < (sizeof(s_dsp_all) / sizeof(s_dsp_all[0])); i++) {
+		kp = s_dsp_all[i];
+		if (name && strcmp(name, kp->name))
+			continue;
+		if (!KernelsSupported(kp)) {
+			if (name)
+				return 0;
+			continue;
+		}
+		return kp;
+	}
+	return 0;
+}
+
+/*
+ * The kernels and law tables are used from the dispatcher, the pump
+ * and snoop threads and the wavproc workers, so the one-time setup
+ * has to be serialized.
+ */
+static void
+DspInitOnce(void)
+{
+	LawTablesInit();
+#if defined(SIO_DSP_X86)
+	__builtin_cpu_init();
+#endif
+	s_dsp_active = FindKernels(0);
+}
+
+#if defined(USE_PTHREADS)
+static pthread_once_t s_dsp_once = PTHREAD_ONCE_INIT;
+#else
+static bool s_dsp_ready;
+#endif
+
+static inline void
+DspInit(void)
+{
+#if defined(USE_PTHREADS)
+	(void) pthread_once(&s_dsp_once, DspInitOnce);
+#else
+	if (!s_dsp_ready) {
+		DspInitOnce();
+		s_dsp_ready = true;
+	}
+#endif
+}
+
+SoundIoDspKernels const *
+SoundIoDspSelect(const char *name)
+{
+	SoundIoDspKernels const *kp;
+
+	DspInit();
+	kp = FindKernels(name);
+	if (kp)
+		s_dsp_active = kp;
+	return kp;
+}
+
+SoundIoDspKernels const *
+SoundIoDspGetKernels(void)
+{
+	DspInit();
+	return s_dsp_active;
+}
+
+
+/*
+ * G.711 companding, after the public domain Sun reference code.
+ * Decoding uses 256 entry tables.  Encoding uses tables indexed by the
+ * significant bits of the linear sample: 13 for A-law, 14 for Mu-law.
+ */
+
+static int
+SegSearch(int val, const int16_t *table, int size)
+{
+	int i;
+	for (i = 0; i < size; i++) {
+		if (val <= table[i])
+			return i;
+	}
+	return size;
+}
+
+static const int16_t s_seg_aend[8] = {
+	0x1f, 0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff
+};
+static const int16_t s_seg_uend[8] = {
+	0x3f, 0x7f, 0xff, 0x1ff, 0x3ff, 0x7ff, 0xfff, 0x1fff
+};
+
+static uint8_t
+LinearToAlaw(int pcm)
+{
+	int mask, seg;
+	uint8_t aval;
+
+	pcm >>= 3;
+	if (pcm >= 0) {
+		mask = 0xd5;
+	} else {
+		mask = 0x55;
+		pcm = -pcm - 1;
+	}
+
+	seg = SegSearch(pcm, s_seg_aend, 8);
+	if (seg >= 8)
+		return 0x7f ^ mask;
+	aval = seg << 4;
+	if (seg < 2)
+		aval |= (pcm >> 1) & 0xf;
+	else
+		aval |= (pcm >> seg) & 0xf;
+	return aval ^ mask;
+}
+
+static int
+AlawToLinear(uint8_t aval)
+{
+	int t, seg;
+
+	aval ^= 0x55;
+	t = (aval & 0xf) << 4;
+	seg = (aval & 0x70) >> 4;
+	switch (seg) {
+	case 0:
+		t += 8;
+		break;
+	case 1:
+		t += 0x108;
+		break;
+	default:
+		t += 0x108;
+		t <<= seg - 1;
+	}
+	return (aval & 0x80) ? t : -t;
+}
+
+static uint8_t
+LinearToUlaw(int pcm)
+{
+	int mask, seg;
+
+	pcm >>= 2;
+	if (pcm < 0) {
+		pcm = -pcm;
+		mask = 0x7f;
+	} else {
+		mask = 0xff;
+	}
+	if (pcm > 8159)
+		pcm = 8159;
+	pcm += (0x84 >> 2);
+
+	seg = SegSearch(pcm, s_seg_uend, 8);
+	if (seg >= 8)
+		return 0x7f ^ mask;
+	return ((seg << 4) | ((pcm >> (seg + 1)) & 0xf)) ^ mask;
+}
+
+static int
+UlawToLinear(uint8_t uval)
+{
+	int t;
+
+	uval = ~uval;
+	t = ((uval & 0xf) << 3) + 0x84;
+	t <<= (uval & 0x70) >> 4;
+	return (uval & 0x80) ? (0x84 - t) : (t - 0x84);
+}
+
+static int16_t s_alaw_dec[256];
+static int16_t s_ulaw_dec[256];
+static uint8_t s_alaw_enc[1 << 13];
+static uint8_t s_ulaw_enc[1 << 14];
+
+static void
+LawTablesInit(void)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		s_alaw_dec[i] = AlawToLinear(i);
+		s_ulaw_dec[i] = UlawToLinear(i);
+	}
+	for (i = 0; i < (1 << 13); i++)
+		s_alaw_enc[i] = LinearToAlaw((int16_t) (i << 3));
+	for (i = 0; i < (1 << 14); i++)
+		s_ulaw_enc[i] = LinearToUlaw((int16_t) (i << 2));
+}
+
+static void
+DecodeS16(sio_sampletype_t type, int16_t *dest, const uint8_t *src,
+	  size_t count)
+{
+	const int16_t *table;
+
+	switch (type) {
+	case SIO_PCM_S16_LE:
+		memcpy(dest, src, count * sizeof(*dest));
+		return;
+	case SIO_PCM_U8:
+		while (count--)
+			*(dest++) = ((int) *(src++) - 128) * 256;
+		return;
+	case SIO_PCM_A_LAW:
+		table = s_alaw_dec;
+		break;
+	case SIO_PCM_MU_LAW:
+		table = s_ulaw_dec;
+		break;
+	default:
+		abort();
+	}
+
+	DspInit();
+	while (count--)
+		*(dest++) = table[*(src++)];
+}
+
+static void
+EncodeS16(sio_sampletype_t type, uint8_t *dest, const int16_t *src,
+	  size_t count)
+{
+	switch (type) {
+	case SIO_PCM_S16_LE:
+		memcpy(dest, src, count * sizeof(*src));
+		return;
+	case SIO_PCM_U8:
+		while (count--)
+			*(dest++) = (*(src++) >> 8) + 128;
+		return;
+	case SIO_PCM_A_LAW:
+		DspInit();
+		while (count--)
+			*(dest++) = s_alaw_enc[((uint16_t) *(src++)) >> 3];
+		return;
+	case SIO_PCM_MU_LAW:
+		DspInit();
+		while (count--)
+			*(dest++) = s_ulaw_enc[((uint16_t) *(src++)) >> 2];
+		return;
+	default:
+		abort();
+	}
+}
+
+static bool
+TypeKnown(sio_sampletype_t type)
+{
+	switch (type) {
+	case SIO_PCM_U8:
+	case SIO_PCM_S16_LE:
+	case SIO_PCM_A_LAW:
+	case SIO_PCM_MU_LAW:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned int
+TypeSize(sio_sampletype_t type)
+{
+	return (type == SIO_PCM_S16_LE) ? 2 : 1;
+}
+
+/* Companded formats are processed through S16 in chunks of this size */
+#define SIO_DSP_CHUNK	256
+
+
+void
+SoundIoDspFill(uint8_t *dest, const uint8_t *rec, unsigned int bpr,
+	       size_t nrecs)
+{
+	size_t len = bpr * nrecs, done, copy;
+
+	if (!len)
+		return;
+	if (dest != rec)
+		memcpy(dest, rec, bpr);
+
+	/* Double the filled region with each copy */
+	for (done = bpr; done < len; done += copy) {
+		copy = len - done;
+		if (copy > done)
+			copy = done;
+		memcpy(&dest[done], dest, copy);
+	}
+}
+
+bool
+SoundIoDspSilence(sio_sampletype_t type, uint8_t *dest, size_t count)
+{
+	switch (type) {
+	case SIO_PCM_U8:
+		memset(dest, 0x80, count);
+		return true;
+	case SIO_PCM_S16_LE:
+		memset(dest, 0, 2 * count);
+		return true;
+	case SIO_PCM_A_LAW:
+		memset(dest, 0xd5, count);
+		return true;
+	case SIO_PCM_MU_LAW:
+		memset(dest, 0xff, count);
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+/*
+ * Record kernels
+ * The templates below are instantiated for each record size and channel
+ * count, so that the compiler sees constant strides and can unroll and
+ * vectorize the loops.  NCH = 0 instantiates the generic versions.
+ */
+
+/* Replicate the record across a block, then store whole blocks */
+template <typename T> static void
+FillRecs(uint8_t *dest, const uint8_t *rec, unsigned int /*bpr*/,
+	 size_t nrecs)
+{
+	enum { c_block = 64 / sizeof(T) };
+	T val, block[c_block];
+	size_t i;
+
+	memcpy(&val, rec, sizeof(val));
+	for (i = 0; i < c_block; i++)
+		block[i] = val;
+	for (; nrecs >= c_block; nrecs -= c_block) {
+		memcpy(dest, block, sizeof(block));
+		dest += sizeof(block);
+	}
+	memcpy(dest, block, nrecs * sizeof(val));
+}
+
+template <typename T, unsigned int NCH> static void
+InterpRecs(uint8_t *dest, const uint8_t *src, size_t nrecs,
+	   uint32_t pos, uint32_t step, unsigned int nchannels)
+{
+	const T *sp, *s = (const T *) src;
+	T *d = (T *) dest;
+	const unsigned int nch = NCH ? NCH : nchannels;
+	uint64_t p = pos;
+	unsigned int ch;
+	int32_t frac, a, b;
+
+	while (nrecs--) {
+		sp = &s[(p >> SIO_DSP_INTERP_SHIFT) * nch];
+		frac = (p & ((1 << SIO_DSP_INTERP_SHIFT) - 1)) >>
+			(SIO_DSP_INTERP_SHIFT - 15);
+		for (ch = 0; ch < nch; ch++) {
+			a = sp[ch];
+			b = sp[ch + nch];
+			*(d++) = (T) (a + (((b - a) * frac) >> 15));
+		}
+		p += step;
+	}
+}
+
+/* Indexed by channel count, 0 for generic */
+static const SoundIoDspRecordKernels s_rec_u8[] = {
+	{ 0, SoundIoDspFill, InterpRecs<uint8_t, 0> },
+	{ 1, FillRecs<uint8_t>, InterpRecs<uint8_t, 1> },
+	{ 2, FillRecs<uint16_t>, InterpRecs<uint8_t, 2> },
+};
+
+static const SoundIoDspRecordKernels s_rec_s16[] = {
+	{ 0, SoundIoDspFill, InterpRecs<int16_t, 0> },
+	{ 1, FillRecs<uint16_t>, InterpRecs<int16_t, 1> },
+	{ 2, FillRecs<uint32_t>, InterpRecs<int16_t, 2> },
+};
+
+static const SoundIoDspRecordKernels s_rec_law[] = {
+	{ 0, SoundIoDspFill, 0 },
+	{ 1, FillRecs<uint8_t>, 0 },
+	{ 2, FillRecs<uint16_t>, 0 },
+};
+
+SoundIoDspRecordKernels const *
+SoundIoDspGetRecordKernels(sio_sampletype_t type, unsigned int nchannels,
+			   bool generic)
+{
+	SoundIoDspRecordKernels const *tab;
+
+	switch (type) {
+	case SIO_PCM_U8:
+		tab = s_rec_u8;
+		break;
+	case SIO_PCM_S16_LE:
+		tab = s_rec_s16;
+		break;
+	case SIO_PCM_A_LAW:
+	case SIO_PCM_MU_LAW:
+		tab = s_rec_law;
+		break;
+	default:
+		return 0;
+	}
+
+	if (generic || (nchannels > 2))
+		return &tab[0];
+	return &tab[nchannels];
+}
+
+bool
+SoundIoDspMix(sio_sampletype_t type, uint8_t *dest, const uint8_t *src,
+	      size_t count)
+{
+	int16_t d16[SIO_DSP_CHUNK], s16[SIO_DSP_CHUNK];
+	size_t n;
+
+	switch (type) {
+	case SIO_PCM_U8:
+		SoundIoDspGetKernels()->mix_u8(dest, src, count);
+		return true;
+	case SIO_PCM_S16_LE:
+		SoundIoDspGetKernels()->mix_s16((int16_t *) dest,
+						(const int16_t *) src,
+						count);
+		return true;
+	case SIO_PCM_A_LAW:
+	case SIO_PCM_MU_LAW:
+		break;
+	default:
+		return false;
+	}
+
+	while (count) {
+		n = (count > SIO_DSP_CHUNK) ? SIO_DSP_CHUNK : count;
+		DecodeS16(type, d16, dest, n);
+		DecodeS16(type, s16, src, n);
+		SoundIoDspGetKernels()->mix_s16(d16, s16, n);
+		EncodeS16(type, dest, d16, n);
+		dest += n;
+		src += n;
+		count -= n;
+	}
+	return true;
+}
+
+bool
+SoundIoDspGain(sio_sampletype_t type, uint8_t *buf, size_t count,
+	       unsigned int gain)
+{
+	int16_t b16[SIO_DSP_CHUNK];
+	size_t n;
+
+	assert(gain <= SIO_DSP_GAIN_MAX);
+
+	if (type == SIO_PCM_S16_LE) {
+		SoundIoDspGetKernels()->gain_s16((int16_t *) buf, count,
+						 gain);
+		return true;
+	}
+	if (!TypeKnown(type))
+		return false;
+
+	while (count) {
+		n = (count > SIO_DSP_CHUNK) ? SIO_DSP_CHUNK : count;
+		DecodeS16(type, b16, buf, n);
+		SoundIoDspGetKernels()->gain_s16(b16, n, gain);
+		EncodeS16(type, buf, b16, n);
+		buf += n;
+		count -= n;
+	}
+	return true;
+}
+
+bool
+SoundIoDspConvert(sio_sampletype_t dtype, uint8_t *dest,
+		  sio_sampletype_t stype, const uint8_t *src, size_t count)
+{
+	int16_t b16[SIO_DSP_CHUNK];
+	size_t n;
+
+	if (!TypeKnown(dtype) || !TypeKnown(stype))
+		return false;
+
+	if (dtype == stype) {
+		if (dest != src)
+			memmove(dest, src, count * TypeSize(stype));
+		return true;
+	}
+	if (stype == SIO_PCM_S16_LE) {
+		EncodeS16(dtype, dest, (const int16_t *) src, count);
+		return true;
+	}
+	if (dtype == SIO_PCM_S16_LE) {
+		DecodeS16(stype, (int16_t *) dest, src, count);
+		return true;
+	}
+
+	while (count) {
+		n = (count > SIO_DSP_CHUNK) ? SIO_DSP_CHUNK : count;
+		DecodeS16(stype, b16, src, n);
+		EncodeS16(dtype, dest, b16, n);
+		dest += n;
+		src += n;
+		count -= n;
+	}
+	return true;
+}
+
+bool
+SoundIoDspRemix(int16_t *dest, unsigned int dnch, const int16_t *src,
+		unsigned int snch, size_t nrecs)
+{
+	unsigned int i;
+	int32_t sum;
+
+	if (dnch == snch) {
+		memcpy(dest, src, nrecs * dnch * sizeof(*dest));
+		return true;
+	}
+
+	if ((dnch == 1) && (snch == 2)) {
+		while (nrecs--) {
+			*(dest++) = ((int32_t) src[0] + src[1]) >> 1;
+			src += 2;
+		}
+		return true;
+	}
+
+	if ((dnch == 2) && (snch == 1)) {
+		while (nrecs--) {
+			dest[0] = dest[1] = *(src++);
+			dest += 2;
+		}
+		return true;
+	}
+
+	if (dnch == 1) {
+		while (nrecs--) {
+			sum = 0;
+			for (i = 0; i < snch; i++)
+				sum += *(src++);
+			*(dest++) = sum / (int32_t) snch;
+		}
+		return true;
+	}
+
+	if (snch == 1) {
+		while (nrecs--) {
+			for (i = 0; i < dnch; i++)
+				*(dest++) = *src;
+			src++;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+
+/*
+ * Polyphase resampler
+ *
+ * Coefficients are fixed point with 14 fractional bits, so that the
+ * center taps of an interpolator phase, which approach unity, fit.
+ * The filter is designed once per Configure() call, with a local
+ * sine approximation, again to avoid dragging in libm.
+ */
+
+#define SIO_DSP_RS_SHIFT	14
+
+static double
+DspSine(double x)
+{
+	const double pi = 3.14159265358979323846;
+	double x2;
+
+	/* Reduce to [-pi, pi], then to [-pi/2, pi/2] */
+	x -= (2 * pi) * (double) (long) (x / (2 * pi));
+	if (x > pi)
+		x -= 2 * pi;
+	else if (x < -pi)
+		x += 2 * pi;
+	if (x > (pi / 2))
+		x = pi - x;
+	else if (x < -(pi / 2))
+		x = -pi - x;
+
+	x2 = x * x;
+	return x * (1 - x2 / 6 * (1 - x2 / 20 * (1 - x2 / 42 *
+		   (1 - x2 / 72 * (1 - x2 / 110 * (1 - x2 / 156))))));
+}
+
+static int16_t
+DspRound(double v)
+{
+	return (v >= 0) ? (int16_t) (v + 0.5) : -(int16_t) (-v + 0.5);
+}
+
+template <unsigned int NCH>
+static inline void
+ResampleDot(int16_t *dest, const int16_t *coef, const int16_t *win,
+	    unsigned int ntaps, unsigned int nch)
+{
+	const unsigned int n = NCH ? NCH : nch;
+	int32_t acc[NCH ? NCH : 8];
+	unsigned int i, c;
+
+	for (c = 0; c < n; c++)
+		acc[c] = 1 << (SIO_DSP_RS_SHIFT - 1);
+	for (i = 0; i < ntaps; i++) {
+		for (c = 0; c < n; c++)
+			acc[c] += (int32_t) coef[i] * win[c];
+		win += n;
+	}
+	for (c = 0; c < n; c++) {
+		acc[c] >>= SIO_DSP_RS_SHIFT;
+		if (acc[c] < -32768)
+			acc[c] = -32768;
+		else if (acc[c] > 32767)
+			acc[c] = 32767;
+		dest[c] = acc[c];
+	}
+}
+
+/*
+ * Resample one block, whose records follow ntaps - 1 records of
+ * history in hist.  The window ending at block record i begins at
+ * history record i.
+ */
+template <unsigned int NCH>
+static int16_t *
+ResampleBlock(int16_t *dest, const int16_t *hist, size_t nrecs,
+	      unsigned int up, unsigned int down, unsigned int &skip,
+	      const int16_t *coef, unsigned int ntaps, unsigned int nch)
+{
+	const unsigned int n = NCH ? NCH : nch;
+	unsigned int p;
+	size_t i;
+
+	if (up > 1) {
+		for (i = 0; i < nrecs; i++) {
+			for (p = 0; p < up; p++) {
+				ResampleDot<NCH>(dest, coef + (p * ntaps),
+						 hist + (i * n), ntaps, n);
+				dest += n;
+			}
+		}
+		return dest;
+	}
+
+	for (i = skip; i < nrecs; i += down) {
+		ResampleDot<NCH>(dest, coef, hist + (i * n), ntaps, n);
+		dest += n;
+	}
+	skip = i - nrecs;
+	return dest;
+}
+
+SoundIoDspResampler::
+SoundIoDspResampler(void)
+	: m_up(1), m_down(1), m_nch(0), m_ntaps(0), m_skip(0),
+	  m_coef(0), m_hist(0)
+{
+}
+
+SoundIoDspResampler::
+~SoundIoDspResampler()
+{
+	free(m_coef);
+	free(m_hist);
+}
+
+bool SoundIoDspResampler::
+Configure(unsigned int up, unsigned int down, unsigned int nchannels)
+{
+	const double pi = 3.14159265358979323846;
+	unsigned int ratio, len, i, j, p;
+	double *proto, fc, t, w, sum, scale;
+	int16_t *coef, *hist;
+
+	if (!up || !down || ((up > 1) && (down > 1)) ||
+	    (up > MAX_RATIO) || (down > MAX_RATIO) ||
+	    !nchannels || (nchannels > 8))
+		return false;
+
+	/* The prototype filter runs at the higher rate */
+	ratio = (up > 1) ? up : down;
+	len = ratio * c_phase_taps;
+	proto = (double *) malloc(len * sizeof(*proto));
+	coef = (int16_t *) malloc(len * sizeof(*coef));
+	hist = (int16_t *) malloc((len + c_block) * nchannels *
+				  sizeof(*hist));
+	if (!proto || !coef || !hist) {
+		free(proto);
+		free(coef);
+		free(hist);
+		return false;
+	}
+
+	/* Blackman windowed sinc, cut off at 90% of the lower Nyquist */
+	fc = 0.45 / ratio;
+	sum = 0;
+	for (i = 0; i < len; i++) {
+		t = (double) i - ((double) (len - 1) / 2);
+		w = (2 * pi * i) / (len - 1);
+		proto[i] = (t == 0) ? (2 * fc) :
+			(DspSine(2 * pi * fc * t) / (pi * t));
+		proto[i] *= (0.42 - 0.5 * DspSine(w + (pi / 2)) +
+			     0.08 * DspSine((2 * w) + (pi / 2)));
+		sum += proto[i];
+	}
+
+	/* Unity gain, an interpolator owes each phase a factor of up */
+	scale = (double) up * (1 << SIO_DSP_RS_SHIFT) / sum;
+
+	if (up > 1) {
+		/* Phase-major, each phase ordered oldest record first */
+		m_ntaps = c_phase_taps;
+		for (p = 0; p < up; p++) {
+			for (j = 0; j < c_phase_taps; j++)
+				coef[(p * c_phase_taps) + j] =
+					DspRound(proto[p + ((c_phase_taps -
+							     1 - j) * up)] *
+						 scale);
+		}
+	} else {
+		/* Symmetric, so order does not matter */
+		m_ntaps = len;
+		for (i = 0; i < len; i++)
+			coef[i] = DspRound(proto[i] * scale);
+	}
+	free(proto);
+
+	free(m_coef);
+	free(m_hist);
+	m_coef = coef;
+	m_hist = hist;
+	m_up = up;
+	m_down = down;
+	m_nch = nchannels;
+	Reset();
+	return true;
+}
+
+void SoundIoDspResampler::
+Reset(void)
+{
+	m_skip = 0;
+	if (m_hist)
+		memset(m_hist, 0, (m_ntaps - 1) * m_nch * sizeof(*m_hist));
+}
+
+size_t SoundIoDspResampler::
+Process(int16_t *dest, const int16_t *src, size_t nrecs)
+{
+	const unsigned int hlen = m_ntaps - 1;
+	int16_t *start = dest;
+	size_t n;
+
+	assert(m_coef);
+	while (nrecs) {
+		n = (nrecs > c_block) ? c_block : nrecs;
+		memcpy(m_hist + (hlen * m_nch), src,
+		       n * m_nch * sizeof(*src));
+
+		switch (m_nch) {
+		case 1:
+			dest = ResampleBlock<1>(dest, m_hist, n, m_up, m_down,
+						m_skip, m_coef, m_ntaps, 1);
+			break;
+		case 2:
+			dest = ResampleBlock<2>(dest, m_hist, n, m_up, m_down,
+						m_skip, m_coef, m_ntaps, 2);
+			break;
+		default:
+			dest = ResampleBlock<0>(dest, m_hist, n, m_up, m_down,
+						m_skip, m_coef, m_ntaps,
+						m_nch);
+			break;
+		}
+
+		memmove(m_hist, m_hist + (n * m_nch),
+			hlen * m_nch * sizeof(*m_hist));
+		src += (n * m_nch);
+		nrecs -= n;
+	}
+
+	return (dest - start) / m_nch;
+}
+
+bool
+SoundIoDspMeasure(sio_sampletype_t type, const uint8_t *src, size_t count,
+		  SoundIoDspLevel &lev)
+{
+	int16_t b16[SIO_DSP_CHUNK];
+	size_t n;
+
+	if (type == SIO_PCM_S16_LE) {
+		SoundIoDspGetKernels()->level_s16((const int16_t *) src,
+						  count, lev);
+		return true;
+	}
+	if (!TypeKnown(type))
+		return false;
+
+	while (count) {
+		n = (count > SIO_DSP_CHUNK) ? SIO_DSP_CHUNK : count;
+		DecodeS16(type, b16, src, n);
+		SoundIoDspGetKernels()->level_s16(b16, n, lev);
+		src += n;
+		count -= n;
+	}
+	return true;
+}
+
+} /* namespace libhfp */
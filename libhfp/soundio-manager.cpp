@@ -22,9 +22,19 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <errno.h>
+#include <unistd.h>
+
+#if defined(USE_PTHREADS)
+#include <pthread.h>
+#endif
+#if defined(HAVE_SYS_INOTIFY_H)
+#include <sys/inotify.h>
+#endif
 
 #include <libhfp/soundio.h>
 #include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-dsp.h>
 
 #include "oplatency.h"
 
@@ -62,10 +72,318 @@ static SoundIoDriver sound_drivers[] = {
 	  "Open Sound System back-end (deprecated)",
 	  SoundIoCreateOss,
 	  SoundIoGetDeviceListOss },
+#endif
+#if defined(HAVE_SYS_TIMERFD_H)
+	{ "Virtual",
+	  "Timer-clocked virtual sound card, for systems without one",
+	  SoundIoCreateVirtual,
+	  SoundIoGetDeviceListVirtual },
 #endif
 	{ "","",0,0 }
 };
 
+#if defined(USE_PTHREADS)
+/*
+ * Driver enumeration functions aren't reentrant, and may be run by
+ * the device cache's helper thread while the dispatcher thread runs
+ * one synchronously.
+ */
+static pthread_mutex_t s_enum_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static SoundIoDeviceList *
+EnumDevices(sound_driver_device_enum_t enumfun, ErrorInfo *error)
+{
+	SoundIoDeviceList *listp;
+
+#if defined(USE_PTHREADS)
+	pthread_mutex_lock(&s_enum_lock);
+#endif
+	listp = enumfun(error);
+#if defined(USE_PTHREADS)
+	pthread_mutex_unlock(&s_enum_lock);
+#endif
+	return listp;
+}
+
+
+#if defined(USE_PTHREADS)
+
+/*
+ * Device enumeration can take hundreds of milliseconds -- ALSA's
+ * snd_device_name_hint() loads and walks the whole configuration
+ * tree -- so it is done for all drivers at once on a helper thread.
+ * The helper hands its results back through a pipe, and they are
+ * only ever touched by the dispatcher thread after that.
+ *
+ * Device nodes tend to come and go in bursts, so changes under
+ * /dev/snd arm a short timer, and enumeration is redone when it
+ * expires.
+ */
+class SoundIoDeviceCache {
+public:
+	enum {
+		c_ndrivers = sizeof(sound_drivers) / sizeof(sound_drivers[0]),
+		c_settle_ms = 500,
+	};
+
+	DispatchInterface	*m_ei;
+	SoundIoDeviceList	*m_lists[c_ndrivers];
+	SoundIoDeviceList	*m_next[c_ndrivers];
+	bool			m_have;
+	bool			m_busy;
+	bool			m_again;
+	pthread_t		m_thread;
+	int			m_pipe[2];
+	SocketNotifier		*m_done_not;
+	int			m_inotify;
+	SocketNotifier		*m_inotify_not;
+	TimerNotifier		*m_settle;
+
+	SoundIoDeviceCache(DispatchInterface *eip)
+		: m_ei(eip), m_have(false), m_busy(false), m_again(false),
+		  m_done_not(0), m_inotify(-1), m_inotify_not(0),
+		  m_settle(0) {
+		memset(m_lists, 0, sizeof(m_lists));
+		memset(m_next, 0, sizeof(m_next));
+		m_pipe[0] = m_pipe[1] = -1;
+	}
+	~SoundIoDeviceCache();
+
+	bool Init(ErrorInfo *error);
+	void Watch(void);
+	bool Refresh(ErrorInfo *error = 0);
+	void Collect(void);
+	SoundIoDeviceList *Get(int index, ErrorInfo *error);
+
+	static void *ThreadHelper(void *arg);
+	void EnumDone(SocketNotifier *notp, int fh);
+	void DevChanged(SocketNotifier *notp, int fh);
+	void Settled(TimerNotifier *notp);
+};
+
+SoundIoDeviceCache::
+~SoundIoDeviceCache()
+{
+	int i;
+
+	if (m_busy)
+		(void) pthread_join(m_thread, 0);
+	if (m_settle)
+		delete m_settle;
+	if (m_inotify_not)
+		delete m_inotify_not;
+	if (m_inotify >= 0)
+		close(m_inotify);
+	if (m_done_not)
+		delete m_done_not;
+	if (m_pipe[0] >= 0) {
+		close(m_pipe[0]);
+		close(m_pipe[1]);
+	}
+	for (i = 0; i < c_ndrivers; i++) {
+		if (m_lists[i])
+			delete m_lists[i];
+		if (m_next[i])
+			delete m_next[i];
+	}
+}
+
+bool SoundIoDeviceCache::
+Init(ErrorInfo *error)
+{
+	if (pipe(m_pipe) < 0) {
+		m_ei->LogWarn(error,
+			      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+			      "Create device probe pipe: %s",
+			      strerror(errno));
+		m_pipe[0] = m_pipe[1] = -1;
+		return false;
+	}
+	(void) SetNonBlock(m_pipe[0], true);
+
+	m_done_not = m_ei->NewSocket(m_pipe[0], false);
+	m_settle = m_ei->NewTimer();
+	if (!m_done_not || !m_settle) {
+		if (error)
+			error->SetNoMem();
+		return false;
+	}
+	m_done_not->Register(this, &SoundIoDeviceCache::EnumDone);
+	m_settle->Register(this, &SoundIoDeviceCache::Settled);
+
+	Watch();
+	return true;
+}
+
+/*
+ * Without inotify, or without /dev/snd, the cache is never
+ * invalidated.  That is no worse than the lists never changing
+ * until the next restart, which is what OSS users see anyway.
+ */
+void SoundIoDeviceCache::
+Watch(void)
+{
+#if defined(HAVE_SYS_INOTIFY_H)
+	m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotify < 0) {
+		m_ei->LogDebug("SoundIo: inotify: %s", strerror(errno));
+		return;
+	}
+	if (inotify_add_watch(m_inotify, "/dev/snd",
+			      IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+		m_ei->LogDebug("SoundIo: watch /dev/snd: %s",
+			       strerror(errno));
+		goto failed;
+	}
+	m_inotify_not = m_ei->NewSocket(m_inotify, false);
+	if (!m_inotify_not)
+		goto failed;
+	m_inotify_not->Register(this, &SoundIoDeviceCache::DevChanged);
+	return;
+
+failed:
+	close(m_inotify);
+	m_inotify = -1;
+#endif /* defined(HAVE_SYS_INOTIFY_H) */
+}
+
+bool SoundIoDeviceCache::
+Refresh(ErrorInfo *error)
+{
+	int res;
+
+	if (m_busy) {
+		m_again = true;
+		return true;
+	}
+
+	res = pthread_create(&m_thread, 0, ThreadHelper, this);
+	if (res) {
+		m_ei->LogWarn(error,
+			      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+			      "Create device probe thread: %s",
+			      strerror(res));
+		return false;
+	}
+	m_busy = true;
+	return true;
+}
+
+void *SoundIoDeviceCache::
+ThreadHelper(void *arg)
+{
+	SoundIoDeviceCache *cachep = (SoundIoDeviceCache *) arg;
+	int i;
+	char c = 0;
+
+	for (i = 0; i < c_ndrivers; i++) {
+		if (sound_drivers[i].deviceenum)
+			cachep->m_next[i] =
+				EnumDevices(sound_drivers[i].deviceenum, 0);
+	}
+
+	(void) write(cachep->m_pipe[1], &c, 1);
+	return 0;
+}
+
+/* Wait for the helper, and take its results */
+void SoundIoDeviceCache::
+Collect(void)
+{
+	char buf[16];
+	int i;
+
+	assert(m_busy);
+	(void) pthread_join(m_thread, 0);
+	m_busy = false;
+
+	/* Drain the completion byte, EnumDone() may not have seen it */
+	while (read(m_pipe[0], buf, sizeof(buf)) > 0);
+
+	for (i = 0; i < c_ndrivers; i++) {
+		if (m_lists[i])
+			delete m_lists[i];
+		m_lists[i] = m_next[i];
+		m_next[i] = 0;
+	}
+	m_have = true;
+	m_ei->LogDebug("SoundIo: device lists updated");
+}
+
+void SoundIoDeviceCache::
+EnumDone(SocketNotifier *notp, int fh)
+{
+	char buf[16];
+
+	assert(notp == m_done_not);
+	assert(fh == m_pipe[0]);
+	if (read(m_pipe[0], buf, sizeof(buf)) <= 0)
+		return;
+
+	Collect();
+	if (m_again) {
+		m_again = false;
+		(void) Refresh();
+	}
+}
+
+void SoundIoDeviceCache::
+DevChanged(SocketNotifier *notp, int fh)
+{
+	char buf[1024];
+
+	assert(notp == m_inotify_not);
+	assert(fh == m_inotify);
+	while (read(m_inotify, buf, sizeof(buf)) > 0);
+	m_settle->Set(c_settle_ms);
+}
+
+void SoundIoDeviceCache::
+Settled(TimerNotifier *notp)
+{
+	assert(notp == m_settle);
+	(void) Refresh();
+}
+
+SoundIoDeviceList *SoundIoDeviceCache::
+Get(int index, ErrorInfo *error)
+{
+	SoundIoDeviceList *listp;
+
+	/*
+	 * Answer from the cache even while the helper is refreshing it.
+	 * EnumDone() picks up the new lists when the helper finishes.
+	 */
+	if (!m_have || !m_lists[index]) {
+		/*
+		 * Nothing cached.  If the helper is running, wait for its
+		 * results rather than enumerating the same driver again.
+		 */
+		if (m_busy) {
+			Collect();
+			if (m_again) {
+				m_again = false;
+				(void) Refresh();
+			}
+		}
+
+		/* The helper failed, or never ran: do it the slow way */
+		if (!m_have || !m_lists[index])
+			return EnumDevices(sound_drivers[index].deviceenum,
+					   error);
+	}
+
+	listp = m_lists[index]->Copy();
+	if (!listp && error)
+		error->SetNoMem();
+	return listp;
+}
+
+#endif /* defined(USE_PTHREADS) */
+
 
 /*
  * SoundIoLoop and SoundIoNull are used by the SoundIoManager
@@ -264,10 +582,17 @@ public:
 		}
 	}
 
+	virtual const char *FltGetName(void) const { return "mute"; }
+
+	virtual unsigned int FltGetFlags(bool up) const {
+		/* Silence is copied over the samples, in place is fine */
+		return (up ? m_mute_up : m_mute_dn)
+			? SIO_FLT_INPLACE : SIO_FLT_PASSTHRU;
+	}
+
 	virtual SoundIoBuffer const *FltProcess(bool up,
 						SoundIoBuffer const &src,
 						SoundIoBuffer &dest) {
-		uint8_t *buf, *end;
 		uint8_t *silence = 0;
 
 		if (up) {
@@ -275,9 +600,8 @@ public:
 				return &src;
 			silence = m_silence_up;
 			if (!m_init_up) {
-				end = &silence[m_bpr * m_pktsize];
-				for (buf = silence; buf < end; buf += m_bpr)
-					memcpy(buf, src.m_data, m_bpr);
+				SoundIoDspFill(silence, src.m_data, m_bpr,
+					       m_pktsize);
 				m_init_up = true;
 			}
 		} else {
@@ -285,9 +609,8 @@ public:
 				return &src;
 			silence = m_silence_dn;
 			if (!m_init_dn) {
-				end = &silence[m_bpr * m_pktsize];
-				for (buf = silence; buf < end; buf += m_bpr)
-					memcpy(buf, src.m_data, m_bpr);
+				SoundIoDspFill(silence, src.m_data, m_bpr,
+					       m_pktsize);
 				m_init_dn = true;
 			}
 		}
@@ -311,7 +634,10 @@ SoundIoManager(DispatchInterface *di)
 	  m_mute_swap(false), m_mute_soft_up(false), m_mute_soft_dn(false),
 	  m_mute_soft(0), m_top_loop(false), m_primary_open(false),
 	  m_dsp(0), m_dsp_enabled(true), m_dsp_installed(false),
-	  m_driver_name(0), m_driver_opts(0)
+	  m_dsp_budget(0), m_dsp_level(0), m_dsp_calm(0), m_dsp_timer(0),
+	  m_standby(false), m_standby_active(false), m_standby_rate(8000),
+	  m_standby_ep(0), m_standby_sec(0),
+	  m_driver_name(0), m_driver_opts(0), m_devcache(0)
 {
 	m_pump.cb_NotifyAsyncState.Register(this,
 					    &SoundIoManager::PumpStopped);
@@ -320,8 +646,21 @@ SoundIoManager(DispatchInterface *di)
 SoundIoManager::
 ~SoundIoManager()
 {
+	m_standby = false;
 	if (IsStarted())
 		Stop();
+	if (m_standby_active) {
+		StandbyStop();
+		ClosePrimary();
+	}
+	if (m_standby_ep)
+		delete m_standby_ep;
+	if (m_dsp_timer)
+		delete m_dsp_timer;
+#if defined(USE_PTHREADS)
+	if (m_devcache)
+		delete m_devcache;
+#endif
 	if (m_primary)
 		delete m_primary;
 	SetSecondary(0);
@@ -337,6 +676,14 @@ PumpStopped(SoundIoPump *pumpp, SoundIo *offender, ErrorInfo &error)
 	assert(pumpp == &m_pump);
 	assert(m_primary);
 
+	if (m_standby_active) {
+		/* No stream to abort, just leave the sound card alone */
+		GetDi()->LogWarn("SoundIo: standby failed: %s", error.Desc());
+		StandbyStop();
+		ClosePrimary();
+		return;
+	}
+
 	StopStats();
 
 	if (offender == m_primary) {
@@ -505,15 +852,20 @@ DoStatistics(SoundIoPump *pumpp, SoundIoPumpStatistics &stat, bool /*loss*/)
 	 * to operate in batches, and deliver a period at a time.
 	 *
 	 * So we don't use production counters to estimate cross-endpoint
-	 * skew, and rely instead on the pad/drop counters.
+	 * skew, and rely instead on the pad/drop counters, and the
+	 * stretch/shrink counters of the pump's drift compensator.
 	 *
-	 * In/drop, out/pad imply a faster clock,
-	 * in/pad, out/drop imply a slower clock
+	 * In/drop, out/pad, in/shrink, out/stretch imply a faster clock,
+	 * in/pad, out/drop, in/stretch, out/shrink imply a slower clock
 	 */
-	tmpb = (int) (stat.bottom.in.drop + stat.bottom.out.pad);
-	tmpb -= (int) (stat.bottom.in.pad + stat.bottom.out.pad);
-	tmpt = (int) (stat.top.in.drop + stat.top.out.pad);
-	tmpt -= (int) (stat.top.in.pad + stat.top.out.drop);
+	tmpb = (int) (stat.bottom.in.drop + stat.bottom.out.pad +
+		      stat.bottom.in.shrink + stat.bottom.out.stretch);
+	tmpb -= (int) (stat.bottom.in.pad + stat.bottom.out.drop +
+		       stat.bottom.in.stretch + stat.bottom.out.shrink);
+	tmpt = (int) (stat.top.in.drop + stat.top.out.pad +
+		      stat.top.in.shrink + stat.top.out.stretch);
+	tmpt -= (int) (stat.top.in.pad + stat.top.out.drop +
+		       stat.top.in.stretch + stat.top.out.shrink);
 
 	histp->endpoint_skew = (tmpt - tmpb) / 2;
 
@@ -638,6 +990,102 @@ done_zap:
 }
 
 
+void SoundIoManager::
+DspSetLevel(unsigned int level, unsigned int load)
+{
+	assert(m_dsp);
+
+	if (!m_dsp->FltSetDegradeLevel(level)) {
+		GetDi()->LogWarn("SoundIo: could not set DSP level %u", level);
+		return;
+	}
+
+	GetDi()->LogInfo("SoundIo: DSP load %u%%, %s to level %u",
+			 load, (level > m_dsp_level) ? "degraded" : "restored",
+			 level);
+	m_dsp_level = level;
+	if (cb_NotifyDspLevel.Registered())
+		cb_NotifyDspLevel(this, level, load);
+}
+
+/*
+ * The governor samples the load of the DSP filter from its own timer,
+ * so that it doesn't depend on the stream statistics, which are only
+ * collected for cb_NotifySkew.  Changing the DSP level allocates, and
+ * the timer also keeps that out of the pump's processing path.
+ */
+void SoundIoManager::
+DspGovernUpdate(void)
+{
+	unsigned int avg, peak;
+
+	if (!m_dsp_budget || !m_dsp_installed) {
+		if (m_dsp_timer)
+			m_dsp_timer->Cancel();
+		return;
+	}
+
+	if (!m_dsp_timer) {
+		m_dsp_timer = GetDi()->NewTimer();
+		if (!m_dsp_timer) {
+			GetDi()->LogWarn("SoundIo: could not start the "
+					 "DSP governor");
+			return;
+		}
+		m_dsp_timer->Register(this, &SoundIoManager::DspGovern);
+	}
+
+	/* Start a fresh measurement window */
+	(void) m_pump.GetFilterLoad(m_dsp, avg, peak);
+	m_dsp_calm = 0;
+	m_dsp_timer->Set(c_dsp_period_ms);
+}
+
+void SoundIoManager::
+DspGovern(TimerNotifier *notp)
+{
+	unsigned int avg, peak, level;
+
+	assert(notp == m_dsp_timer);
+	assert(m_dsp && m_dsp_installed && m_dsp_budget);
+
+	m_dsp_timer->Set(c_dsp_period_ms);
+
+	/* Nothing measured if the pump is stopped or the filter idle */
+	if (!m_pump.GetFilterLoad(m_dsp, avg, peak))
+		return;
+
+	level = m_dsp_level;
+	if ((avg > m_dsp_budget) || (peak >= 100)) {
+		m_dsp_calm = 0;
+		if (level >= m_dsp->FltGetDegradeLevels())
+			return;
+		level++;
+
+	} else if (level && ((avg * 2) < m_dsp_budget)) {
+		/* Restore slowly, a level at a time */
+		if (++m_dsp_calm < c_dsp_calm_periods)
+			return;
+		m_dsp_calm = 0;
+		level--;
+
+	} else {
+		m_dsp_calm = 0;
+		return;
+	}
+
+	DspSetLevel(level, avg);
+}
+
+void SoundIoManager::
+SetDspBudget(unsigned int percent)
+{
+	m_dsp_budget = percent;
+	if (!percent && m_dsp && m_dsp_level)
+		DspSetLevel(0, 0);
+	DspGovernUpdate();
+}
+
 /* This is only non-static for GetDi() */
 SoundIo *SoundIoManager::
 CreatePrimary(const char *name, const char *opts, ErrorInfo *error)
@@ -690,6 +1138,7 @@ DspInstall(ErrorInfo *error)
 	if (!m_pump.AddBottom(m_dsp, error))
 		return false;
 	m_dsp_installed = true;
+	DspGovernUpdate();
 
 	/*
 	 * Assume the DSP filter implements an NLMS echo canceler.
@@ -711,6 +1160,7 @@ DspRemove(void)
 		assert(fltp == m_dsp);
 		m_dsp_installed = false;
 		m_pump.SetLossMode(true, true);
+		DspGovernUpdate();
 	}
 }
 
@@ -746,19 +1196,66 @@ GetDriverInfo(int index, const char **name, const char **desc,
 	if (desc)
 		*desc = sound_drivers[index].descr;
 	if (devlist) {
-		*devlist = enumfun(error);
+		*devlist = EnumDevices(enumfun, error);
 		if (!*devlist)
 			return false;
 	}
 	return true;
 }
 
+bool SoundIoManager::
+GetDeviceList(int index, SoundIoDeviceList **devlist, ErrorInfo *error)
+{
+	if (!GetDriverInfo(index, 0, 0, 0, error))
+		return false;
+
+	if (!sound_drivers[index].deviceenum) {
+		if (error)
+			error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_NO_DRIVER,
+				   "No more drivers");
+		return false;
+	}
+
+#if defined(USE_PTHREADS)
+	if (m_devcache || PrefetchDevices()) {
+		*devlist = m_devcache->Get(index, error);
+		return *devlist != 0;
+	}
+#endif
+	return GetDriverInfo(index, 0, 0, devlist, error);
+}
+
+bool SoundIoManager::
+PrefetchDevices(ErrorInfo *error)
+{
+#if defined(USE_PTHREADS)
+	SoundIoDeviceCache *cachep;
+
+	if (m_devcache)
+		return true;
+
+	cachep = new SoundIoDeviceCache(GetDi());
+	if (!cachep) {
+		if (error)
+			error->SetNoMem();
+		return false;
+	}
+	if (!cachep->Init(error) || !cachep->Refresh(error)) {
+		delete cachep;
+		return false;
+	}
+	m_devcache = cachep;
+#endif
+	return true;
+}
+
 bool SoundIoManager::
 SetDriver(const char *drivername, const char *driveropts, ErrorInfo *error)
 {
 	SoundIo *driverp = 0;
 	char *nd = 0, *od = 0;
-	bool res;
+	bool res, was_standby;
 
 	assert(!IsStarted());
 
@@ -789,6 +1286,10 @@ SetDriver(const char *drivername, const char *driveropts, ErrorInfo *error)
 	if (!driverp)
 		goto failed;
 
+	was_standby = m_standby_active;
+	if (was_standby)
+		StandbyStop();
+
 	res = m_pump.SetBottom(driverp);
 	assert(res);
 
@@ -805,6 +1306,9 @@ SetDriver(const char *drivername, const char *driveropts, ErrorInfo *error)
 	if (m_driver_opts)
 		free(m_driver_opts);
 	m_driver_opts = od;
+
+	if (was_standby)
+		StandbyCheck();
 	return true;
 
 failed:
@@ -855,6 +1359,12 @@ SetSecondary(SoundIo *secp, ErrorInfo *error)
 	SoundIoFormat fmt;
 	SoundIo *oldtop;
 
+	if (m_standby_active) {
+		/* Attached by Start() */
+		m_standby_sec = secp;
+		return true;
+	}
+
 	oldtop = m_pump.GetTop();
 
 	if (IsStarted()) {
@@ -871,6 +1381,8 @@ SetSecondary(SoundIo *secp, ErrorInfo *error)
 		m_top_loop = false;
 	}
 
+	if (!IsStarted())
+		StandbyCheck();
 	return true;
 }
 
@@ -883,6 +1395,11 @@ Loopback(ErrorInfo *error)
 	if (m_top_loop)
 		return true;
 
+	if (m_standby_active) {
+		StandbyStop();
+		ClosePrimary();
+	}
+
 	siop = new SoundIoLoop;
 	if (!siop) {
 		if (error)
@@ -922,6 +1439,11 @@ SetHardMute(bool state, bool closepri, ErrorInfo *error)
 	if (m_mute_swap == state)
 		return true;
 
+	if (state && m_standby_active) {
+		StandbyStop();
+		ClosePrimary();
+	}
+
 	if (!state) {
 		siop = m_pump.GetBottom();
 		assert(siop);
@@ -945,6 +1467,8 @@ SetHardMute(bool state, bool closepri, ErrorInfo *error)
 
 		delete siop;
 		m_mute_swap = false;
+		if (!IsStarted())
+			StandbyCheck();
 		return true;
 	}
 
@@ -1034,6 +1558,11 @@ SetDsp(SoundIoFilter *dspp, ErrorInfo *error)
 			DspRemove();
 			do_install = true;
 		}
+		if (m_dsp_level) {
+			/* Hand it back at full quality */
+			(void) m_dsp->FltSetDegradeLevel(0);
+			m_dsp_level = 0;
+		}
 		m_dsp = 0;
 	} else {
 		do_install = IsStarted() && !m_top_loop && !m_mute_swap;
@@ -1094,6 +1623,68 @@ ClosePrimary(void)
 	DspRemove();
 }
 
+/*
+ * Set the format of the primary.  If the card rejects the format of
+ * the stream, as cards opened without a plug layer will, try the
+ * formats that cards commonly support natively and that the pump can
+ * convert to.  On success, fmt is left as requested for the rest of
+ * the stream.
+ */
+bool SoundIoManager::
+SetPrimaryFormat(SoundIoFormat &fmt, ErrorInfo *error)
+{
+	static const unsigned int rates[] = {
+		48000, 16000, 8000, 32000, 24000, 96000,
+	};
+	unsigned int chans[3] = { fmt.nchannels, 2, 1 };
+	SoundIoFormat nfmt, req(fmt);
+	unsigned int i, j, lo, hi;
+
+	if (m_primary->SndSetFormat(fmt, 0))
+		return true;
+
+	for (i = 0; i < (sizeof(chans) / sizeof(chans[0])); i++) {
+		/* Skip repeats, and counts that cannot be remixed */
+		if ((i && (chans[i] == chans[0])) ||
+		    ((chans[i] != req.nchannels) && (chans[i] != 1) &&
+		     (req.nchannels != 1)))
+			continue;
+
+		for (j = 0; j < (sizeof(rates) / sizeof(rates[0])); j++) {
+			if ((chans[i] == req.nchannels) &&
+			    (rates[j] == req.samplerate) &&
+			    (req.sampletype == SIO_PCM_S16_LE))
+				continue;
+			lo = (rates[j] < req.samplerate) ?
+				rates[j] : req.samplerate;
+			hi = (rates[j] < req.samplerate) ?
+				req.samplerate : rates[j];
+			if ((hi % lo) ||
+			    ((hi / lo) > SoundIoDspResampler::MAX_RATIO))
+				continue;
+
+			nfmt.sampletype = SIO_PCM_S16_LE;
+			nfmt.samplerate = rates[j];
+			nfmt.nchannels = chans[i];
+			nfmt.bytes_per_record = 2 * chans[i];
+			nfmt.packet_samps = (req.packet_samps * rates[j]) /
+				req.samplerate;
+			if (m_primary->SndSetFormat(nfmt, 0)) {
+				GetDi()->LogInfo("SoundIo: primary runs at "
+						 "%uHz/%uch, converting",
+						 nfmt.samplerate,
+						 nfmt.nchannels);
+				fmt = req;
+				return true;
+			}
+		}
+	}
+
+	/* Report the failure of the requested format */
+	fmt = req;
+	return m_primary->SndSetFormat(fmt, error);
+}
+
 bool SoundIoManager::
 Start(bool up, bool down, ErrorInfo *error)
 {
@@ -1106,6 +1697,12 @@ Start(bool up, bool down, ErrorInfo *error)
 	if (IsStarted())
 		return false;
 
+	if (m_standby_active) {
+		if (StandbyAttach(up, down))
+			return true;
+		StandbyStop();
+	}
+
 	if (!m_primary) {
 		GetDi()->LogDebug("SoundIo: no driver set, using default");
 		if (!SetDriver(NULL, NULL, error))
@@ -1175,7 +1772,7 @@ Start(bool up, bool down, ErrorInfo *error)
 			fmt.packet_samps = pkt;
 		}
 	}
-	if (!m_primary->SndSetFormat(fmt, error)) {
+	if (!SetPrimaryFormat(fmt, error)) {
 		GetDi()->LogWarn("SoundIo: primary rejected format");
 		goto failed;
 	}
@@ -1208,6 +1805,7 @@ failed:
 
 	StopStats();
 
+	StandbyCheck();
 	return false;
 }
 
@@ -1217,6 +1815,9 @@ Stop(void)
 	if (!IsStarted())
 		return;
 
+	if (StandbyDetach())
+		return;
+
 	m_pump.Stop();
 
 	StopStats();
@@ -1225,6 +1826,231 @@ Stop(void)
 	m_stream_dn = false;
 
 	ClosePrimary();
+	StandbyCheck();
+}
+
+bool SoundIoManager::
+SetStandby(bool enable, sio_sampnum_t samplerate, ErrorInfo *error)
+{
+	if (!enable) {
+		m_standby = false;
+		if (m_standby_active) {
+			StandbyStop();
+			ClosePrimary();
+		}
+		return true;
+	}
+
+	if (!m_standby_ep) {
+		m_standby_ep = new SoundIoNull;
+		if (!m_standby_ep) {
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+	}
+
+	if (m_standby_active && (samplerate != m_standby_rate)) {
+		StandbyStop();
+		ClosePrimary();
+	}
+
+	m_standby = true;
+	m_standby_rate = samplerate;
+
+	if (m_standby_active || IsStarted() || m_top_loop || m_mute_swap)
+		return true;
+	return StandbyStart(error);
+}
+
+/*
+ * Open the primary for playback and capture, and stream silence
+ * between it and the null endpoint, holding the client's secondary
+ * aside until Start() attaches it.
+ */
+bool SoundIoManager::
+StandbyStart(ErrorInfo *error)
+{
+	SoundIoFormat fmt;
+	SoundIo *secp;
+
+	assert(m_standby);
+	assert(m_standby_ep);
+	assert(!m_standby_active);
+	assert(!m_pump.IsStarted());
+	assert(!m_top_loop && !m_mute_swap);
+
+	if (!m_primary) {
+		GetDi()->LogDebug("SoundIo: no driver set, using default");
+		if (!SetDriver(NULL, NULL, error))
+			return false;
+	}
+
+	if (m_primary_open && (!m_stream_up || !m_stream_dn))
+		ClosePrimary();
+
+	if (!m_primary_open) {
+		if (!OpenPrimary(true, true, error)) {
+			GetDi()->LogWarn("SoundIo: could not open primary");
+			return false;
+		}
+		m_primary_open = true;
+		m_stream_up = true;
+		m_stream_dn = true;
+	}
+
+	fmt.samplerate = m_standby_rate;
+	fmt.sampletype = SIO_PCM_S16_LE;
+	fmt.nchannels = 1;
+	fmt.bytes_per_record = 2;
+	fmt.packet_samps = ((m_config_packet_ms ? m_config_packet_ms : 20) *
+			    m_standby_rate) / 1000;
+	if (!SetPrimaryFormat(fmt, error)) {
+		GetDi()->LogWarn("SoundIo: primary rejected format");
+		goto failed;
+	}
+	m_standby_ep->SndSetFormat(fmt);
+
+	DspRemove();
+	secp = m_pump.GetTop();
+	if (!m_pump.SetTop(m_standby_ep, error))
+		goto failed;
+
+	if (!m_pump.Start(error)) {
+		GetDi()->LogWarn("SoundIo: could not start standby");
+		(void) m_pump.SetTop(secp);
+		goto failed;
+	}
+
+	m_standby_sec = secp;
+	m_standby_active = true;
+	GetDi()->LogDebug("SoundIo: standby at %uHz", m_standby_rate);
+	return true;
+
+failed:
+	ClosePrimary();
+	return false;
+}
+
+/* Stop the standby stream, leaving the primary open */
+void SoundIoManager::
+StandbyStop(void)
+{
+	ErrorInfo error;
+
+	if (!m_standby_active)
+		return;
+
+	m_pump.Stop();
+	if (!m_pump.SetTop(m_standby_sec, &error))
+		GetDi()->LogWarn("SoundIo: could not restore top endpoint: %s",
+				 error.Desc());
+	m_standby_sec = 0;
+	m_standby_active = false;
+}
+
+/* Enter standby if it is configured and nothing is in the way */
+void SoundIoManager::
+StandbyCheck(void)
+{
+	ErrorInfo error;
+
+	if (!m_standby || m_standby_active || m_pump.IsStarted() ||
+	    m_top_loop || m_mute_swap)
+		return;
+
+	if (!StandbyStart(&error))
+		GetDi()->LogWarn("SoundIo: could not enter standby: %s",
+				 error.Desc());
+}
+
+/* Swap the client's secondary into the running standby stream */
+bool SoundIoManager::
+StandbyAttach(bool up, bool down)
+{
+	SoundIoProps secprops;
+	SoundIoFormat fmt, pfmt;
+	SoundIo *secp = m_standby_sec;
+	ErrorInfo error;
+
+	assert(m_standby_active);
+
+	if (!secp || m_mute_swap)
+		return false;
+
+	secp->SndGetProps(secprops);
+	if (!up && !down) {
+		up = secprops.does_sink;
+		down = secprops.does_source;
+	}
+	if (!up || !down)
+		return false;
+
+	secp->SndGetFormat(fmt);
+	m_standby_ep->SndGetFormat(pfmt);
+	if ((fmt.samplerate != pfmt.samplerate) ||
+	    (fmt.sampletype != pfmt.sampletype) ||
+	    (fmt.nchannels != pfmt.nchannels)) {
+		GetDi()->LogDebug("SoundIo: secondary format does not "
+				  "match standby");
+		return false;
+	}
+
+	if (m_dsp && m_dsp_enabled && !m_dsp_installed &&
+	    !DspInstall(&error))
+		goto failed;
+
+	if (cb_NotifySkew.Registered() &&
+	    !StartStats(pfmt, secprops, &error))
+		goto failed;
+
+	if (!m_pump.SetTop(secp, &error))
+		goto failed;
+
+	m_standby_sec = 0;
+	m_standby_active = false;
+	GetDi()->LogDebug("SoundIo: attached to standby stream");
+	return true;
+
+failed:
+	GetDi()->LogWarn("SoundIo: could not attach to standby: %s",
+			 error.Desc());
+	StopStats();
+	DspRemove();
+	return false;
+}
+
+/* Swap the null endpoint back in for the client's secondary */
+bool SoundIoManager::
+StandbyDetach(void)
+{
+	SoundIoFormat fmt;
+	SoundIo *secp;
+	ErrorInfo error;
+
+	if (!m_standby || m_top_loop || m_mute_swap ||
+	    !m_stream_up || !m_stream_dn)
+		return false;
+
+	m_pump.GetTop()->SndGetFormat(fmt);
+	if (fmt.samplerate != m_standby_rate)
+		return false;
+	m_standby_ep->SndSetFormat(fmt);
+
+	StopStats();
+	DspRemove();
+
+	secp = m_pump.GetTop();
+	if (!m_pump.SetTop(m_standby_ep, &error)) {
+		GetDi()->LogWarn("SoundIo: could not return to standby: %s",
+				 error.Desc());
+		return false;
+	}
+
+	m_standby_sec = secp;
+	m_standby_active = true;
+	GetDi()->LogDebug("SoundIo: returned to standby");
+	return true;
 }
 
 SoundIoFilter *SoundIoManager::
@@ -0,0 +1,756 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/list.h>
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-dsp.h>
+
+namespace libhfp {
+
+/*
+ * SoundIoMixer implementation
+ *
+ * Each member has a pair of rings.  m_in receives the member's input
+ * as its clock delivers it, and is drained into the mix.  m_out holds
+ * fanned-out output until the member's output queue has room for it.
+ *
+ * The lead member clocks the mixer: its input is mixed as soon as it
+ * arrives, and output is written straight to it, as the pump manages
+ * its fill level.  The other members are held near their own fill
+ * level, m_fill, by the corrections described in soundio.h.
+ */
+
+struct SoundIoMixerMember {
+	ListItem		m_links;
+	SoundIo			*m_sio;
+	SoundIoRing		m_in;
+	SoundIoRing		m_out;
+	sio_sampnum_t		m_packet;
+	sio_sampnum_t		m_fill;
+	bool			m_async;
+	bool			m_primed;
+	SoundIoMixerStatistics	m_stat;
+
+	SoundIoMixerMember(SoundIo *siop)
+		: m_sio(siop), m_packet(0), m_fill(0),
+		  m_async(false), m_primed(false) {
+		memset(&m_stat, 0, sizeof(m_stat));
+	}
+};
+
+class SoundIoMixerImpl : public SoundIoMixer {
+	ListItem		m_members;
+	unsigned int		m_nmembers;
+	SoundIoMixerMember	*m_lead;
+	SoundIoFormat		m_fmt;
+	bool			m_sink, m_source;
+	bool			m_async;
+	bool			m_async_sink, m_async_source;
+	bool			m_in_overflow;
+
+	/* Mixed input, and output staging, each m_buf_size records */
+	uint8_t			*m_mix;
+	uint8_t			*m_obuf;
+	sio_sampnum_t		m_buf_size;
+	sio_sampnum_t		m_mix_start, m_mix_end;
+
+	SoundIoMixerMember *FindMember(SoundIo *siop) const {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+		ListForEach(listp, &m_members) {
+			memberp = GetContainer(listp, SoundIoMixerMember,
+					       m_links);
+			if (memberp->m_sio == siop)
+				return memberp;
+		}
+		return 0;
+	}
+
+	/* Choose the first streaming member as the lead */
+	void ElectLead(void) {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+		m_lead = 0;
+		ListForEach(listp, &m_members) {
+			memberp = GetContainer(listp, SoundIoMixerMember,
+					       m_links);
+			if (!m_async || memberp->m_async) {
+				m_lead = memberp;
+				break;
+			}
+		}
+		if (m_lead)
+			m_fmt.packet_samps = m_lead->m_packet;
+	}
+
+	bool AllocBuffers(sio_sampnum_t nsamps) {
+		uint8_t *mix, *obuf;
+		size_t nbytes;
+
+		if (nsamps <= m_buf_size)
+			return true;
+		nbytes = nsamps * m_fmt.bytes_per_record;
+		mix = (uint8_t *) malloc(nbytes);
+		obuf = (uint8_t *) malloc(nbytes);
+		if (!mix || !obuf) {
+			if (mix)
+				free(mix);
+			if (obuf)
+				free(obuf);
+			return false;
+		}
+		if (m_mix_end > m_mix_start)
+			memcpy(mix,
+			       &m_mix[m_mix_start * m_fmt.bytes_per_record],
+			       (m_mix_end - m_mix_start) *
+			       m_fmt.bytes_per_record);
+		m_mix_end -= m_mix_start;
+		m_mix_start = 0;
+		if (m_mix)
+			free(m_mix);
+		if (m_obuf)
+			free(m_obuf);
+		m_mix = mix;
+		m_obuf = obuf;
+		m_buf_size = nsamps;
+		return true;
+	}
+
+	static sio_sampnum_t RingCapacity(SoundIoRing const &ring) {
+		return ring.m_size / ring.m_bpr;
+	}
+
+	static void Trim(SoundIoRing &ring, sio_sampnum_t level,
+			 sio_sampnum_t &counter) {
+		sio_sampnum_t fill;
+		fill = ring.TotalFill();
+		if (fill > level) {
+			ring.Dequeue(fill - level);
+			counter += (fill - level);
+		}
+	}
+
+	/* Copy into a ring, discarding its oldest samples to make room */
+	void RingAppend(SoundIoRing &ring, const uint8_t *src,
+			sio_sampnum_t nsamps, sio_sampnum_t &dropped) {
+		sio_sampnum_t count, full;
+		uint8_t *dest;
+
+		while (nsamps) {
+			count = nsamps;
+			if (!ring.GetUnfilled(dest, count)) {
+				full = ring.TotalFill();
+				if (!full)
+					break;
+				if (full > nsamps)
+					full = nsamps;
+				ring.Dequeue(full);
+				dropped += full;
+				continue;
+			}
+			memcpy(dest, src, count * m_fmt.bytes_per_record);
+			ring.PutUnfilled(count);
+			src += (count * m_fmt.bytes_per_record);
+			nsamps -= count;
+		}
+	}
+
+	/* Write to a member's output queue, returning the count accepted */
+	sio_sampnum_t MemberWrite(SoundIoMixerMember *memberp,
+				  const uint8_t *src, sio_sampnum_t nsamps) {
+		SoundIoBuffer buf;
+		sio_sampnum_t total = 0;
+
+		while (nsamps) {
+			buf.m_size = nsamps;
+			memberp->m_sio->SndGetOBuf(buf);
+			if (!buf.m_size)
+				break;
+			if (src)
+				memcpy(buf.m_data, src,
+				       buf.m_size * m_fmt.bytes_per_record);
+			else
+				SoundIoDspSilence(m_fmt.sampletype,
+						  buf.m_data,
+						  buf.m_size *
+						  m_fmt.nchannels);
+			memberp->m_sio->SndQueueOBuf(buf.m_size);
+			if (src)
+				src += (buf.m_size * m_fmt.bytes_per_record);
+			nsamps -= buf.m_size;
+			total += buf.m_size;
+		}
+		return total;
+	}
+
+	void MemberInput(SoundIoMixerMember *memberp,
+			 SoundIoBuffer const &buf) {
+		sio_sampnum_t dropped = 0;
+
+		RingAppend(memberp->m_in, buf.m_data, buf.m_size, dropped);
+		memberp->m_stat.in_dropped += dropped;
+		if (dropped && (memberp == m_lead))
+			m_in_overflow = true;
+	}
+
+	/*
+	 * Move whatever input the member has into its ring, or discard
+	 * it if the mixer isn't open for input
+	 */
+	void PullInput(SoundIoMixerMember *memberp) {
+		SoundIoBuffer buf;
+
+		while (1) {
+			buf.m_size = 0;
+			memberp->m_sio->SndGetIBuf(buf);
+			if (!buf.m_size)
+				break;
+			if (m_source)
+				MemberInput(memberp, buf);
+			memberp->m_sio->SndDequeueIBuf(buf.m_size);
+		}
+
+		if (m_source && (memberp != m_lead) &&
+		    (memberp->m_in.TotalFill() >
+		     (int) (2 * memberp->m_fill)))
+			Trim(memberp->m_in, memberp->m_fill,
+			     memberp->m_stat.in_dropped);
+	}
+
+	/* Top up the output queue of a non-lead member from its ring */
+	void PushOutput(SoundIoMixerMember *memberp, sio_sampnum_t queued,
+			bool pad) {
+		sio_sampnum_t want, count, done;
+		uint8_t *src;
+
+		if (queued >= memberp->m_fill)
+			return;
+		want = memberp->m_fill - queued;
+		while (want) {
+			count = want;
+			memberp->m_out.Peek(src, count);
+			if (!count)
+				break;
+			done = MemberWrite(memberp, src, count);
+			memberp->m_out.Dequeue(done);
+			want -= done;
+			queued += done;
+			if (done < count)
+				return;
+		}
+
+		if (pad && (queued < memberp->m_packet)) {
+			count = memberp->m_packet - queued;
+			memberp->m_stat.out_padded +=
+				MemberWrite(memberp, 0, count);
+		}
+	}
+
+	void BuildMix(void) {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+		sio_sampnum_t nsamps, take, count, fill;
+		uint8_t *dest, *src = 0;
+		bool first;
+
+		assert(m_mix_start == m_mix_end);
+		m_mix_start = m_mix_end = 0;
+		if (!m_lead)
+			return;
+
+		nsamps = m_lead->m_in.TotalFill();
+		if (nsamps > m_buf_size)
+			nsamps = m_buf_size;
+		if (!nsamps)
+			return;
+
+		/*
+		 * The lead member is copied in first, the others are
+		 * mixed over it, as far as their buffered input goes.
+		 */
+		first = true;
+		memberp = m_lead;
+		listp = &m_members;
+		while (1) {
+			take = nsamps;
+			if (memberp != m_lead) {
+				fill = memberp->m_in.TotalFill();
+				if (!memberp->m_primed &&
+				    (fill >= memberp->m_fill))
+					memberp->m_primed = true;
+				if (!memberp->m_primed)
+					take = 0;
+				else if (fill < take) {
+					memberp->m_stat.in_padded +=
+						(take - fill);
+					take = fill;
+					if (!fill)
+						memberp->m_primed = false;
+				}
+			}
+
+			dest = m_mix;
+			while (take) {
+				count = take;
+				memberp->m_in.Peek(src, count);
+				assert(count);
+				if (first)
+					memcpy(dest, src, count *
+					       m_fmt.bytes_per_record);
+				else
+					SoundIoDspMix(m_fmt.sampletype,
+						      dest, src, count *
+						      m_fmt.nchannels);
+				memberp->m_in.Dequeue(count);
+				dest += (count * m_fmt.bytes_per_record);
+				take -= count;
+			}
+			first = false;
+
+			do {
+				listp = listp->next;
+				if (listp == &m_members)
+					goto done;
+				memberp = GetContainer(listp,
+						       SoundIoMixerMember,
+						       m_links);
+			} while ((memberp == m_lead) || !memberp->m_async);
+		}
+
+	done:
+		m_mix_end = nsamps;
+	}
+
+	bool StartMember(SoundIoMixerMember *memberp, ErrorInfo *error) {
+		SoundIo *siop = memberp->m_sio;
+
+		assert(!memberp->m_async);
+		memberp->m_in.Clear();
+		memberp->m_out.Clear();
+		memberp->m_primed = false;
+		assert(!siop->cb_NotifyPacket.Registered());
+		siop->cb_NotifyPacket.Register(this,
+					       &SoundIoMixerImpl::MemberNotify);
+		assert(!siop->cb_NotifyAsyncStop.Registered());
+		siop->cb_NotifyAsyncStop.Register(this,
+					  &SoundIoMixerImpl::MemberStopped);
+		if (!siop->SndAsyncStart(m_async_sink, m_async_source,
+					 error)) {
+			siop->cb_NotifyPacket.Unregister();
+			siop->cb_NotifyAsyncStop.Unregister();
+			return false;
+		}
+		memberp->m_async = true;
+		return true;
+	}
+
+	void StopMember(SoundIoMixerMember *memberp) {
+		SoundIo *siop = memberp->m_sio;
+
+		if (memberp->m_async) {
+			siop->SndAsyncStop();
+			memberp->m_async = false;
+		}
+		siop->cb_NotifyPacket.Unregister();
+		siop->cb_NotifyAsyncStop.Unregister();
+		memberp->m_in.Clear();
+		memberp->m_out.Clear();
+		memberp->m_primed = false;
+	}
+
+	void MemberNotify(SoundIo *siop, SoundIoQueueState &qs) {
+		SoundIoMixerMember *memberp;
+		SoundIoQueueState myqs;
+
+		memberp = FindMember(siop);
+		assert(memberp);
+		assert(memberp->m_async);
+
+		PullInput(memberp);
+
+		if (memberp != m_lead) {
+			if (m_sink)
+				PushOutput(memberp, qs.out_queued, true);
+			return;
+		}
+
+		if (cb_NotifyPacket.Registered()) {
+			SndGetQueueState(myqs);
+			myqs.in_overflow |= qs.in_overflow;
+			cb_NotifyPacket(this, myqs);
+		}
+	}
+
+	void MemberStopped(SoundIo *siop, ErrorInfo &reason) {
+		SoundIoMixerMember *memberp;
+
+		memberp = FindMember(siop);
+		assert(memberp);
+		StopMember(memberp);
+		if (memberp == m_lead) {
+			m_mix_start = m_mix_end = 0;
+			ElectLead();
+		}
+
+		/* The target may remove the member, or stop the mixer */
+		if (cb_NotifyMemberStop.Registered())
+			cb_NotifyMemberStop(this, siop, reason);
+
+		if (m_async && !m_lead) {
+			SndAsyncStop();
+			if (cb_NotifyAsyncStop.Registered())
+				cb_NotifyAsyncStop(this, reason);
+		}
+	}
+
+public:
+	SoundIoMixerImpl(void)
+		: m_nmembers(0), m_lead(0), m_sink(false), m_source(false),
+		  m_async(false), m_async_sink(false), m_async_source(false),
+		  m_in_overflow(false), m_mix(0), m_obuf(0), m_buf_size(0),
+		  m_mix_start(0), m_mix_end(0) {
+		memset(&m_fmt, 0, sizeof(m_fmt));
+	}
+
+	virtual ~SoundIoMixerImpl() {
+		SndClose();
+		while (!m_members.Empty())
+			RemoveMember(GetContainer(m_members.next,
+						  SoundIoMixerMember,
+						  m_links)->m_sio);
+		if (m_mix)
+			free(m_mix);
+		if (m_obuf)
+			free(m_obuf);
+	}
+
+	virtual bool AddMember(SoundIo *siop, ErrorInfo *error) {
+		SoundIoMixerMember *memberp;
+		SoundIoProps props;
+		SoundIoFormat fmt;
+
+		assert(siop);
+		assert(siop != this);
+		assert(!FindMember(siop));
+
+		siop->SndGetProps(props);
+		if (!props.has_clock) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_NO_CLOCK,
+					   "Mixer members must be clocked");
+			return false;
+		}
+
+		siop->SndGetFormat(fmt);
+		if (!fmt.packet_samps || !fmt.bytes_per_record) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_UNKNOWN,
+					   "Member format is not configured");
+			return false;
+		}
+		if (m_nmembers &&
+		    ((fmt.sampletype != m_fmt.sampletype) ||
+		     (fmt.samplerate != m_fmt.samplerate) ||
+		     (fmt.nchannels != m_fmt.nchannels))) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+					   "Member format does not match "
+					   "the mixer");
+			return false;
+		}
+		if (!m_nmembers) {
+			m_fmt = fmt;
+			if (m_mix)
+				free(m_mix);
+			if (m_obuf)
+				free(m_obuf);
+			m_mix = m_obuf = 0;
+			m_buf_size = 0;
+			m_mix_start = m_mix_end = 0;
+		}
+
+		memberp = new SoundIoMixerMember(siop);
+		if (!memberp) {
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+		memberp->m_packet = fmt.packet_samps;
+		memberp->m_fill = 2 * fmt.packet_samps;
+		if (!memberp->m_in.SetPacketSize(fmt.packet_samps,
+						 fmt.bytes_per_record) ||
+		    !memberp->m_out.SetPacketSize(fmt.packet_samps,
+						  fmt.bytes_per_record) ||
+		    !AllocBuffers(RingCapacity(memberp->m_in))) {
+			delete memberp;
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+
+		m_members.AppendItem(memberp->m_links);
+		m_nmembers++;
+
+		if (m_async && !StartMember(memberp, error)) {
+			memberp->m_links.Unlink();
+			m_nmembers--;
+			delete memberp;
+			return false;
+		}
+
+		if (!m_lead)
+			ElectLead();
+		return true;
+	}
+
+	virtual void RemoveMember(SoundIo *siop) {
+		SoundIoMixerMember *memberp;
+
+		memberp = FindMember(siop);
+		assert(memberp);
+		StopMember(memberp);
+		memberp->m_links.Unlink();
+		m_nmembers--;
+		if (memberp == m_lead) {
+			m_mix_start = m_mix_end = 0;
+			ElectLead();
+		}
+		delete memberp;
+	}
+
+	virtual unsigned int GetMemberCount(void) const { return m_nmembers; }
+
+	virtual bool SetMemberFill(SoundIo *siop, sio_sampnum_t fill) {
+		SoundIoMixerMember *memberp;
+
+		memberp = FindMember(siop);
+		if (!memberp)
+			return false;
+		if (!fill)
+			fill = 2 * memberp->m_packet;
+		if (fill > (RingCapacity(memberp->m_in) / 2))
+			fill = RingCapacity(memberp->m_in) / 2;
+		memberp->m_fill = fill;
+		return true;
+	}
+
+	virtual bool GetMemberStatistics(SoundIo *siop,
+					 SoundIoMixerStatistics &stat) const {
+		SoundIoMixerMember *memberp;
+
+		memberp = FindMember(siop);
+		if (!memberp)
+			return false;
+		stat = memberp->m_stat;
+		return true;
+	}
+
+	virtual bool SndOpen(bool sink, bool source, ErrorInfo *error) {
+		if (!source && !sink) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_DUPLEX_MISMATCH,
+					   "Neither source nor sink mode set");
+			return false;
+		}
+		m_sink = sink;
+		m_source = source;
+		m_mix_start = m_mix_end = 0;
+		m_in_overflow = false;
+		return true;
+	}
+
+	virtual void SndClose(void) {
+		SndAsyncStop();
+		m_sink = false;
+		m_source = false;
+		m_mix_start = m_mix_end = 0;
+	}
+
+	virtual void SndGetProps(SoundIoProps &props) const {
+		props.has_clock = (m_lead != 0);
+		props.does_source = m_source && m_nmembers;
+		props.does_sink = m_sink && m_nmembers;
+		props.does_loop = false;
+		props.remove_on_exhaust = false;
+		props.outbuf_size = 0;
+	}
+
+	virtual void SndGetFormat(SoundIoFormat &format) const {
+		format = m_fmt;
+	}
+
+	virtual bool SndSetFormat(SoundIoFormat &format, ErrorInfo *error) {
+		if (!m_nmembers)
+			return true;
+		if ((format.sampletype != m_fmt.sampletype) ||
+		    (format.samplerate != m_fmt.samplerate) ||
+		    (format.nchannels != m_fmt.nchannels)) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+					   "Format does not match members");
+			return false;
+		}
+		return true;
+	}
+
+	virtual void SndGetIBuf(SoundIoBuffer &fillme) {
+		sio_sampnum_t avail;
+
+		if (!m_source) {
+			fillme.m_size = 0;
+			return;
+		}
+		if (m_mix_start == m_mix_end)
+			BuildMix();
+		avail = m_mix_end - m_mix_start;
+		if (!fillme.m_size || (fillme.m_size > avail))
+			fillme.m_size = avail;
+		fillme.m_data = &m_mix[m_mix_start * m_fmt.bytes_per_record];
+	}
+
+	virtual void SndDequeueIBuf(sio_sampnum_t nsamps) {
+		assert(nsamps <= (m_mix_end - m_mix_start));
+		m_mix_start += nsamps;
+		m_in_overflow = false;
+	}
+
+	virtual void SndGetOBuf(SoundIoBuffer &fillme) {
+		if (!m_sink || !m_nmembers) {
+			fillme.m_size = 0;
+			return;
+		}
+		if (!fillme.m_size || (fillme.m_size > m_buf_size))
+			fillme.m_size = m_buf_size;
+		fillme.m_data = m_obuf;
+	}
+
+	virtual void SndQueueOBuf(sio_sampnum_t nsamps) {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+		SoundIoQueueState qs;
+		sio_sampnum_t done;
+
+		assert(nsamps <= m_buf_size);
+		ListForEach(listp, &m_members) {
+			memberp = GetContainer(listp, SoundIoMixerMember,
+					       m_links);
+			if (!memberp->m_async)
+				continue;
+			if (memberp == m_lead) {
+				done = MemberWrite(memberp, m_obuf, nsamps);
+				memberp->m_stat.out_dropped += (nsamps - done);
+				continue;
+			}
+			RingAppend(memberp->m_out, m_obuf, nsamps,
+				   memberp->m_stat.out_dropped);
+			if (memberp->m_out.TotalFill() >
+			    (int) (2 * memberp->m_fill))
+				Trim(memberp->m_out, memberp->m_fill,
+				     memberp->m_stat.out_dropped);
+			memberp->m_sio->SndGetQueueState(qs);
+			PushOutput(memberp, qs.out_queued, false);
+		}
+	}
+
+	virtual void SndGetQueueState(SoundIoQueueState &qs) {
+		SoundIoQueueState lqs;
+
+		qs.in_queued = 0;
+		qs.out_queued = 0;
+		qs.in_overflow = m_in_overflow;
+		qs.out_underflow = false;
+		if (!m_lead)
+			return;
+		if (m_source)
+			qs.in_queued = (m_mix_end - m_mix_start) +
+				m_lead->m_in.TotalFill();
+		if (m_sink) {
+			m_lead->m_sio->SndGetQueueState(lqs);
+			qs.out_queued = lqs.out_queued;
+			qs.out_underflow = lqs.out_underflow;
+		}
+	}
+
+	virtual bool SndAsyncStart(bool sink, bool source, ErrorInfo *error) {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+
+		assert(!m_async);
+		if (!m_lead) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_NO_CLOCK,
+					   "Mixer has no members");
+			return false;
+		}
+
+		m_async_sink = sink;
+		m_async_source = source;
+		ListForEach(listp, &m_members) {
+			memberp = GetContainer(listp, SoundIoMixerMember,
+					       m_links);
+			if (!StartMember(memberp, error)) {
+				SndAsyncStop();
+				return false;
+			}
+		}
+		m_async = true;
+		ElectLead();
+		return true;
+	}
+
+	virtual void SndAsyncStop(void) {
+		ListItem *listp;
+		SoundIoMixerMember *memberp;
+
+		ListForEach(listp, &m_members) {
+			memberp = GetContainer(listp, SoundIoMixerMember,
+					       m_links);
+			StopMember(memberp);
+		}
+		m_async = false;
+		ElectLead();
+	}
+
+	virtual bool SndIsAsyncStarted(void) const { return m_async; }
+};
+
+SoundIoMixer *
+SoundIoCreateMixer(ErrorInfo *error)
+{
+	SoundIoMixer *mixp;
+
+	mixp = new SoundIoMixerImpl;
+	if (!mixp && error)
+		error->SetNoMem();
+	return mixp;
+}
+
+} /* namespace libhfp */
@@ -0,0 +1,540 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * mSBC codec, see libhfp/soundio-msbc.h
+ *
+ * The filter banks and bit allocation follow the A2DP specification's
+ * description of SBC, restricted to the parameters used by mSBC.
+ */
+
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/soundio-msbc.h>
+
+namespace libhfp {
+
+/*
+ * First half of the 80 tap prototype filter for 8 subbands.
+ * The second half is the mirror image of the first.
+ */
+static const float s_msbc_proto[41] = {
+	 0.00000000e+00f,  1.56575398e-04f,  3.43256425e-04f,
+	 5.54620202e-04f,  8.23919506e-04f,  1.13992507e-03f,
+	 1.47640169e-03f,  1.78371725e-03f,  2.01182542e-03f,
+	 2.10371989e-03f,  1.99454554e-03f,  1.61656283e-03f,
+	 9.02154502e-04f, -1.78805361e-04f, -1.64973098e-03f,
+	-3.49717454e-03f, -5.65949473e-03f, -8.02941163e-03f,
+	-1.04584443e-02f, -1.27472335e-02f, -1.46525263e-02f,
+	-1.59045603e-02f, -1.62208471e-02f, -1.53184106e-02f,
+	-1.29371806e-02f, -8.85757540e-03f, -2.92408442e-03f,
+	 4.91578024e-03f,  1.46404076e-02f,  2.61098752e-02f,
+	 3.90751381e-02f,  5.31873032e-02f,  6.79989431e-02f,
+	 8.29847578e-02f,  9.75753918e-02f,  1.11196689e-01f,
+	 1.23264548e-01f,  1.33264415e-01f,  1.40753505e-01f,
+	 1.45389847e-01f,  1.46955068e-01f,
+};
+
+/* cos(n * pi / 16) for n = 0..8 */
+static const float s_msbc_cos16[9] = {
+	1.00000000f, 0.98078528f, 0.92387953f, 0.83146961f, 0.70710678f,
+	0.55557023f, 0.38268343f, 0.19509032f, 0.00000000f,
+};
+
+/* Loudness allocation offsets for 16KHz, 8 subbands */
+static const int s_msbc_offset[8] = { -2, 0, 0, 0, 0, 0, 0, 1 };
+
+/* H2 synchronization header second bytes, by sequence number */
+static const uint8_t s_msbc_h2[4] = { 0x08, 0x38, 0xc8, 0xf8 };
+
+/* Concealment gain by consecutive lost frames, 12 fractional bits */
+static const int s_msbc_plc_gain[] = { 3686, 2458, 1229, 410, 0 };
+
+static float s_msbc_c[80];		/* Analysis window */
+static float s_msbc_d[80];		/* Synthesis window */
+static float s_msbc_m[8][16];		/* Analysis matrix */
+static float s_msbc_n[16][8];		/* Synthesis matrix */
+static bool s_msbc_tables;
+
+static float
+Cos16(int n)
+{
+	n %= 32;
+	if (n < 0)
+		n += 32;
+	if (n > 16)
+		n = 32 - n;
+	if (n > 8)
+		return -s_msbc_cos16[16 - n];
+	return s_msbc_cos16[n];
+}
+
+static void
+MsbcTablesInit(void)
+{
+	int i, k;
+	float v;
+
+	if (s_msbc_tables)
+		return;
+
+	for (i = 0; i < 80; i++) {
+		v = s_msbc_proto[(i <= 40) ? i : (80 - i)];
+		/* Alternate 16 tap blocks are sign-inverted */
+		if ((i / 16) & 1)
+			v = -v;
+		s_msbc_c[i] = v;
+		s_msbc_d[i] = -8.0f * v;
+	}
+
+	for (k = 0; k < 8; k++)
+		for (i = 0; i < 16; i++)
+			s_msbc_m[k][i] = Cos16((2 * k + 1) * (i - 4));
+	for (k = 0; k < 16; k++)
+		for (i = 0; i < 8; i++)
+			s_msbc_n[k][i] = Cos16((2 * i + 1) * (k + 4));
+
+	s_msbc_tables = true;
+}
+
+static uint8_t
+MsbcCrc(uint8_t crc, const uint8_t *buf, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *(buf++);
+		for (i = 0; i < 8; i++)
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x1d) : (crc << 1);
+	}
+	return crc;
+}
+
+/*
+ * The frame CRC covers the second and third header bytes, and the
+ * scale factors.
+ */
+static uint8_t
+MsbcFrameCrc(const uint8_t *frame)
+{
+	uint8_t crc;
+	crc = MsbcCrc(0x0f, &frame[1], 2);
+	return MsbcCrc(crc, &frame[4], 4);
+}
+
+/* Loudness bit allocation, mono */
+static void
+MsbcBitAlloc(const int *sf, int *bits, int bitpool)
+{
+	int bitneed[8];
+	int maxneed, bitcount, slicecount, bitslice, loudness, sb;
+
+	maxneed = 0;
+	for (sb = 0; sb < 8; sb++) {
+		if (!sf[sb]) {
+			bitneed[sb] = -5;
+		} else {
+			loudness = sf[sb] - s_msbc_offset[sb];
+			bitneed[sb] = (loudness > 0) ?
+				(loudness / 2) : loudness;
+		}
+		if (bitneed[sb] > maxneed)
+			maxneed = bitneed[sb];
+	}
+
+	bitcount = 0;
+	slicecount = 0;
+	bitslice = maxneed + 1;
+	do {
+		bitslice--;
+		bitcount += slicecount;
+		slicecount = 0;
+		for (sb = 0; sb < 8; sb++) {
+			if ((bitneed[sb] > (bitslice + 1)) &&
+			    (bitneed[sb] < (bitslice + 16)))
+				slicecount++;
+			else if (bitneed[sb] == (bitslice + 1))
+				slicecount += 2;
+		}
+	} while ((bitcount + slicecount) < bitpool);
+
+	if ((bitcount + slicecount) == bitpool) {
+		bitcount += slicecount;
+		bitslice--;
+	}
+
+	for (sb = 0; sb < 8; sb++) {
+		if (bitneed[sb] < (bitslice + 2))
+			bits[sb] = 0;
+		else if ((bitneed[sb] - bitslice) > 16)
+			bits[sb] = 16;
+		else
+			bits[sb] = bitneed[sb] - bitslice;
+	}
+
+	for (sb = 0; (bitcount < bitpool) && (sb < 8); sb++) {
+		if ((bits[sb] >= 2) && (bits[sb] < 16)) {
+			bits[sb]++;
+			bitcount++;
+		} else if ((bitneed[sb] == (bitslice + 1)) &&
+			   (bitpool > (bitcount + 1))) {
+			bits[sb] = 2;
+			bitcount += 2;
+		}
+	}
+
+	for (sb = 0; (bitcount < bitpool) && (sb < 8); sb++) {
+		if (bits[sb] < 16) {
+			bits[sb]++;
+			bitcount++;
+		}
+	}
+}
+
+static void
+PutBits(uint8_t *buf, unsigned int &pos, unsigned int val, int nbits)
+{
+	while (nbits--) {
+		if ((val >> nbits) & 1)
+			buf[pos >> 3] |= (0x80 >> (pos & 7));
+		pos++;
+	}
+}
+
+static unsigned int
+GetBits(const uint8_t *buf, unsigned int &pos, int nbits)
+{
+	unsigned int val = 0;
+	while (nbits--) {
+		val = (val << 1) | ((buf[pos >> 3] >> (7 - (pos & 7))) & 1);
+		pos++;
+	}
+	return val;
+}
+
+static int
+H2SeqNum(uint8_t val)
+{
+	int i;
+	for (i = 0; i < 4; i++)
+		if (s_msbc_h2[i] == val)
+			return i;
+	return -1;
+}
+
+
+SoundIoMsbc::
+SoundIoMsbc()
+{
+	MsbcTablesInit();
+	Reset();
+}
+
+void SoundIoMsbc::
+Reset(void)
+{
+	memset(m_enc_x, 0, sizeof(m_enc_x));
+	m_enc_seq = 0;
+	memset(m_dec_v, 0, sizeof(m_dec_v));
+	m_rx_len = 0;
+	m_rx_skip = 0;
+	m_rx_held = false;
+	m_rx_seq = -1;
+	m_lost_pending = 0;
+	m_plc_count = 0;
+	m_plc_valid = false;
+	m_conceal_total = 0;
+}
+
+void SoundIoMsbc::
+Analyze(const int16_t *pcm, float *sb)
+{
+	float y[16];
+	int i, j, k;
+
+	memmove(&m_enc_x[NSUBBANDS], &m_enc_x[0],
+		(sizeof(m_enc_x) - (NSUBBANDS * sizeof(m_enc_x[0]))));
+	for (i = 0; i < NSUBBANDS; i++)
+		m_enc_x[i] = pcm[NSUBBANDS - 1 - i];
+
+	for (i = 0; i < 16; i++) {
+		y[i] = 0;
+		for (j = 0; j < 80; j += 16)
+			y[i] += s_msbc_c[i + j] * m_enc_x[i + j];
+	}
+
+	for (k = 0; k < NSUBBANDS; k++) {
+		sb[k] = 0;
+		for (i = 0; i < 16; i++)
+			sb[k] += s_msbc_m[k][i] * y[i];
+	}
+}
+
+void SoundIoMsbc::
+Synthesize(const float *sb, int16_t *pcm)
+{
+	float *v = m_dec_v, s;
+	int i, j, k, val;
+
+	memmove(&v[16], &v[0], sizeof(m_dec_v) - (16 * sizeof(v[0])));
+	for (k = 0; k < 16; k++) {
+		v[k] = 0;
+		for (i = 0; i < NSUBBANDS; i++)
+			v[k] += s_msbc_n[k][i] * sb[i];
+	}
+
+	/*
+	 * Window the even 8-sample groups of V from its first half, and
+	 * the odd groups from its second half, and sum the ten taps that
+	 * fall on each output sample.
+	 */
+	for (j = 0; j < NSUBBANDS; j++) {
+		s = 0;
+		for (i = 0; i < 10; i++) {
+			k = ((i >> 1) * 32) + ((i & 1) * 24) + j;
+			s += s_msbc_d[(i * 8) + j] * v[k];
+		}
+		val = (int) ((s < 0) ? (s - 0.5f) : (s + 0.5f));
+		if (val > 32767)
+			val = 32767;
+		else if (val < -32768)
+			val = -32768;
+		pcm[j] = val;
+	}
+}
+
+void SoundIoMsbc::
+Encode(const int16_t *pcm, uint8_t *packet)
+{
+	float sb[NBLOCKS][NSUBBANDS], maxval, v, scale;
+	int sf[NSUBBANDS], bits[NSUBBANDS], levels, q;
+	uint8_t *frame;
+	unsigned int pos;
+	int blk, i;
+
+	for (blk = 0; blk < NBLOCKS; blk++)
+		Analyze(&pcm[blk * NSUBBANDS], sb[blk]);
+
+	for (i = 0; i < NSUBBANDS; i++) {
+		maxval = 0;
+		for (blk = 0; blk < NBLOCKS; blk++) {
+			v = sb[blk][i];
+			if (v < 0)
+				v = -v;
+			if (v > maxval)
+				maxval = v;
+		}
+		sf[i] = 0;
+		while ((sf[i] < 15) && (maxval >= (float) (2 << sf[i])))
+			sf[i]++;
+	}
+
+	MsbcBitAlloc(sf, bits, BITPOOL);
+
+	memset(packet, 0, MSBC_PACKET_SIZE);
+	packet[0] = 0x01;
+	packet[1] = s_msbc_h2[m_enc_seq];
+	m_enc_seq = (m_enc_seq + 1) & 3;
+
+	frame = &packet[2];
+	frame[0] = 0xad;
+	pos = 32;
+	for (i = 0; i < NSUBBANDS; i++)
+		PutBits(frame, pos, sf[i], 4);
+	frame[3] = MsbcFrameCrc(frame);
+
+	for (blk = 0; blk < NBLOCKS; blk++) {
+		for (i = 0; i < NSUBBANDS; i++) {
+			if (!bits[i])
+				continue;
+			levels = (1 << bits[i]) - 1;
+			scale = (float) (2 << sf[i]);
+			v = ((sb[blk][i] / scale) + 1.0f) * levels / 2;
+			q = (v > 0) ? (int) v : 0;
+			if (q > levels)
+				q = levels;
+			PutBits(frame, pos, q, bits[i]);
+		}
+	}
+
+	assert(pos <= (MSBC_FRAME_SIZE * 8));
+}
+
+bool SoundIoMsbc::
+DecodeFrame(const uint8_t *frame, int16_t *pcm)
+{
+	float sb[NSUBBANDS], scale;
+	int sf[NSUBBANDS], bits[NSUBBANDS], levels;
+	unsigned int pos;
+	int blk, i;
+
+	if ((frame[0] != 0xad) || frame[1] || frame[2] ||
+	    (frame[3] != MsbcFrameCrc(frame)))
+		return false;
+
+	pos = 32;
+	for (i = 0; i < NSUBBANDS; i++)
+		sf[i] = GetBits(frame, pos, 4);
+
+	MsbcBitAlloc(sf, bits, BITPOOL);
+
+	for (blk = 0; blk < NBLOCKS; blk++) {
+		for (i = 0; i < NSUBBANDS; i++) {
+			if (!bits[i]) {
+				sb[i] = 0;
+				continue;
+			}
+			levels = (1 << bits[i]) - 1;
+			scale = (float) (2 << sf[i]);
+			sb[i] = scale *
+				((((GetBits(frame, pos, bits[i]) * 2) + 1) /
+				  (float) levels) - 1.0f);
+		}
+		Synthesize(sb, &pcm[blk * NSUBBANDS]);
+	}
+
+	return true;
+}
+
+int SoundIoMsbc::
+PlcGain(void) const
+{
+	unsigned int gi = m_plc_count;
+
+	if (gi >= (sizeof(s_msbc_plc_gain) / sizeof(s_msbc_plc_gain[0])))
+		gi = (sizeof(s_msbc_plc_gain) / sizeof(s_msbc_plc_gain[0])) - 1;
+	return s_msbc_plc_gain[gi];
+}
+
+void SoundIoMsbc::
+Conceal(int16_t *pcm)
+{
+	int i, gain;
+
+	m_conceal_total++;
+	if (!m_plc_valid) {
+		m_plc_count++;
+		memset(pcm, 0, MSBC_PCM_SAMPS * sizeof(*pcm));
+		return;
+	}
+
+	/* Repeat the last good frame, fading out */
+	gain = PlcGain();
+	m_plc_count++;
+	for (i = 0; i < MSBC_PCM_SAMPS; i++)
+		pcm[i] = (m_plc_last[i] * gain) >> 12;
+}
+
+void SoundIoMsbc::
+GoodFrame(int16_t *pcm)
+{
+	int i, gain, fill;
+
+	if (m_plc_count && m_plc_valid) {
+		/*
+		 * Cross-fade from what the next concealment frame would
+		 * have been, to smooth over the synthesis filter's
+		 * disturbed state.
+		 */
+		gain = PlcGain();
+		for (i = 0; i < XFADE_SAMPS; i++) {
+			fill = (m_plc_last[i] * gain) >> 12;
+			pcm[i] = ((fill * (XFADE_SAMPS - i)) +
+				  (pcm[i] * i)) / XFADE_SAMPS;
+		}
+	}
+
+	m_plc_count = 0;
+	m_plc_valid = true;
+	memcpy(m_plc_last, pcm, sizeof(m_plc_last));
+}
+
+bool SoundIoMsbc::
+Decode(const uint8_t *&data, size_t &len, int16_t *pcm)
+{
+	uint8_t c;
+	int seq;
+
+	while (1) {
+		if (m_lost_pending) {
+			m_lost_pending--;
+			Conceal(pcm);
+			return true;
+		}
+
+		if (m_rx_held) {
+			m_rx_held = false;
+			if (DecodeFrame(&m_rx[2], pcm))
+				GoodFrame(pcm);
+			else
+				Conceal(pcm);
+			return true;
+		}
+
+		if (!len)
+			return false;
+
+		/* Hunt for the H2 header and the mSBC sync word */
+		c = *data;
+		if (((m_rx_len == 0) && (c != 0x01)) ||
+		    ((m_rx_len == 1) && (H2SeqNum(c) < 0)) ||
+		    ((m_rx_len == 2) && (c != 0xad))) {
+			if (m_rx_len) {
+				/* Retry this byte as the start of a packet */
+				m_rx_skip += m_rx_len;
+				m_rx_len = 0;
+			} else {
+				data++;
+				len--;
+				m_rx_skip++;
+			}
+
+			/*
+			 * Account for a packet's worth of garbage as a
+			 * lost frame, to keep the output clocked.
+			 */
+			if (m_rx_skip >= MSBC_PACKET_SIZE) {
+				m_rx_skip -= MSBC_PACKET_SIZE;
+				if (m_rx_seq >= 0)
+					m_rx_seq = (m_rx_seq + 1) & 3;
+				m_lost_pending++;
+			}
+			continue;
+		}
+
+		m_rx[m_rx_len++] = c;
+		data++;
+		len--;
+		if (m_rx_len < MSBC_PACKET_SIZE)
+			continue;
+
+		/* Complete packet, check for skipped sequence numbers */
+		m_rx_len = 0;
+		m_rx_skip = 0;
+		seq = H2SeqNum(m_rx[1]);
+		if (m_rx_seq >= 0)
+			m_lost_pending = (seq - m_rx_seq - 1) & 3;
+		m_rx_seq = seq;
+		m_rx_held = true;
+	}
+}
+
+} /* namespace libhfp */
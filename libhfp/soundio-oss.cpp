@@ -284,8 +284,13 @@ public:
 
 		m_play_nonblock = false;
 		m_rec_nonblock = false;
-		BufOpen(m_format.packet_samps,
-			m_format.bytes_per_record);
+		if (!BufOpen(m_format.packet_samps,
+			     m_format.bytes_per_record)) {
+			if (error)
+				error->SetNoMem();
+			SndClose();
+			return false;
+		}
 		return true;
 	}
 
@@ -336,8 +341,13 @@ public:
 				return false;
 			}
 
-			BufOpen(format.packet_samps,
-				format.bytes_per_record);
+			if (!BufOpen(format.packet_samps,
+				     format.bytes_per_record)) {
+				if (error)
+					error->SetNoMem();
+				SndClose();
+				return false;
+			}
 		}
 		m_format = format;
 		return true;
@@ -468,7 +478,7 @@ public:
 		}
 
 		if (m_rec_fh >= 0)
-			SndPushInput(true);
+			BufPushInput(true);
 
 		m_no_interrupts = false;
 		BufProcess(delay, rec_xrun, play_xrun);
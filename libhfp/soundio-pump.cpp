@@ -25,9 +25,15 @@
 #include <errno.h>
 
 #include <libhfp/soundio.h>
+#include <libhfp/soundio-dsp.h>
 
 #include "oplatency.h"
 
+/* Drift positions go to the interp kernel unscaled */
+#if SIO_DRIFT_SHIFT != SIO_DSP_INTERP_SHIFT
+#error "SIO_DRIFT_SHIFT must match SIO_DSP_INTERP_SHIFT"
+#endif
+
 /*
  * This file contains the implementation for SoundIoPump, the
  * asynchronous streaming audio pump class.
@@ -40,16 +46,17 @@ namespace libhfp {
 void SoundIoPump::
 FillSilence(SoundIoFormat &fmt, uint8_t *dest)
 {
-	switch (fmt.sampletype) {
-	case SIO_PCM_U8:
-		memset(dest, 0x7f, fmt.nchannels);
-		break;
-	case SIO_PCM_S16_LE:
-		memset(dest, 0, 2 * fmt.nchannels);
-		break;
-	default:
+	if (!SoundIoDspSilence(fmt.sampletype, dest, fmt.nchannels))
 		abort();
-	}
+}
+
+/* Formats that carry the same samples, regardless of packet size */
+bool SoundIoPump::
+SameFormat(SoundIoFormat const &a, SoundIoFormat const &b)
+{
+	return ((a.sampletype == b.sampletype) &&
+		(a.samplerate == b.samplerate) &&
+		(a.nchannels == b.nchannels));
 }
 
 /*
@@ -84,7 +91,6 @@ sio_sampnum_t SoundIoPump::
 CopyIn(uint8_t *dest, SoundIoWorkingState *swsp, sio_sampnum_t nsamps)
 {
 	sio_sampnum_t rem;
-	uint8_t *end;
 	uint8_t bps = swsp->bpr;
 
 	assert(nsamps);
@@ -147,11 +153,7 @@ CopyIn(uint8_t *dest, SoundIoWorkingState *swsp, sio_sampnum_t nsamps)
 	return 0;
 
 do_silencepad:
-	end = &dest[nsamps * bps];
-	while (dest < end) {
-		memcpy(dest, swsp->in_silence, bps);
-		dest += bps;
-	}
+	swsp->rec->fill(dest, swsp->in_silence, bps, nsamps);
 	swsp->in_silencepad += nsamps;
 	return nsamps;
 }
@@ -335,10 +337,7 @@ OutputSilence(SoundIoWorkingState *dwsp, sio_sampnum_t nsamps)
 
 		buf = dwsp->out_buf.m_data;
 		end = &buf[rem * bps];
-		while (buf < end) {
-			memcpy(buf, dwsp->out_silence, bps);
-			buf += bps;
-		}
+		dwsp->rec->fill(buf, dwsp->out_silence, bps, rem);
 		nsamps -= rem;
 		dwsp->siop->SndQueueOBuf(dwsp->out_buf_used + rem);
 		dwsp->out_buf.m_size -= rem;
@@ -360,12 +359,8 @@ OutputSilence(SoundIoWorkingState *dwsp, sio_sampnum_t nsamps)
 		if (nsamps < rem)
 			rem = nsamps;
 
-		buf = dwsp->out_buf.m_data;
-		end = &buf[rem * bps];
-		while (buf < end) {
-			memcpy(buf, dwsp->out_silence, bps);
-			buf += bps;
-		}
+		dwsp->rec->fill(dwsp->out_buf.m_data, dwsp->out_silence,
+				bps, rem);
 		nsamps -= rem;
 		dwsp->siop->SndQueueOBuf(rem);
 		dwsp->out_buf.m_size = 0;
@@ -374,18 +369,348 @@ OutputSilence(SoundIoWorkingState *dwsp, sio_sampnum_t nsamps)
 	return 0;
 }
 
+/*
+ * Drift compensation
+ *
+ * The drift compensator is a linear interpolating resampler with a
+ * fixed-point position and step, expressed in input samples with
+ * c_drift_shift fractional bits.  It always works with two records of
+ * history preceding the new input samples, so that the first output
+ * may be interpolated from the tail of the previous packet:
+ *
+ * [hist0][hist1][input0][input1]...
+ *
+ * Positions are measured from hist0.  Output k is interpolated
+ * between the records at floor(pos + k*step) and the one after it.
+ * After each packet, the position is rebased to the new history.
+ *
+ * DriftFwd() computes the number of outputs that can be produced from
+ * a number of new input samples.  DriftRev() computes the number of new
+ * input samples that are consumed in producing a number of outputs.
+ * These are exact, and the packet-at-a-time processing done by
+ * DriftIn() and DriftOut() consumes and produces exactly the counts
+ * that they predict for the whole transfer.
+ */
+
+sio_sampnum_t SoundIoPump::
+DriftFwd(SoundIoDriftState const &ds, sio_sampnum_t nsamps)
+{
+	uint64_t lim = ((uint64_t) nsamps + 1) << c_drift_shift;
+	if (lim <= ds.pos)
+		return 0;
+	return (sio_sampnum_t) ((lim - ds.pos + ds.step - 1) / ds.step);
+}
+
+sio_sampnum_t SoundIoPump::
+DriftRev(SoundIoDriftState const &ds, sio_sampnum_t nsamps)
+{
+	if (!nsamps)
+		return 0;
+	return (sio_sampnum_t)
+		((ds.pos + (((uint64_t) nsamps - 1) * ds.step)) >>
+		 c_drift_shift);
+}
+
+/*
+ * Convert an endpoint fill level constraint to filter samples.
+ * src = true: the endpoint can supply nsamps samples to the compensator.
+ * src = false: the endpoint can accept nsamps samples from it.
+ */
+sio_sampnum_t SoundIoPump::
+DriftLimit(SoundIoDriftState const &ds, sio_sampnum_t nsamps, bool src)
+{
+	if (src)
+		return DriftFwd(ds, nsamps);
+	if (!nsamps)
+		return 0;
+	nsamps = DriftRev(ds, nsamps + 1);
+	return nsamps ? (nsamps - 1) : 0;
+}
+
+/*
+ * Steer the step of a compensator with a PI controller on the fill
+ * level of the buffer at the compensated endpoint.  A level above the
+ * target increases the step, causing more input samples to be consumed,
+ * or fewer output samples to be produced, per filter sample.  The
+ * weight is the number of samples moved by the endpoint since its last
+ * callback, so that the integral term is independent of the callback
+ * rate.
+ */
+void SoundIoPump::
+DriftUpdate(SoundIoDriftState &ds, sio_sampnum_t level, sio_sampnum_t target,
+	    sio_sampnum_t weight)
+{
+	const int32_t ilim = c_drift_max_adj << c_drift_ki_shift;
+	int32_t err, adj;
+
+	err = (int32_t) level - (int32_t) target;
+	ds.integ += err * (int32_t) weight;
+	if (ds.integ > ilim)
+		ds.integ = ilim;
+	else if (ds.integ < -ilim)
+		ds.integ = -ilim;
+
+	adj = (err * (1 << c_drift_kp_shift)) +
+		(ds.integ / (1 << c_drift_ki_shift));
+	if (adj > c_drift_max_adj)
+		adj = c_drift_max_adj;
+	else if (adj < -c_drift_max_adj)
+		adj = -c_drift_max_adj;
+
+	ds.step = c_drift_one + adj;
+}
+
+void SoundIoPump::
+DriftResample(SoundIoDriftState *dsp, const uint8_t *src, uint8_t *dest,
+	      sio_sampnum_t nsamps) const
+{
+	assert(m_rec->interp);
+	m_rec->interp(dest, src, nsamps, dsp->pos, dsp->step,
+		      m_config.fmt.nchannels);
+}
+
+/*
+ * DriftIn: Fill a filter packet from a compensated source endpoint
+ */
+void SoundIoPump::
+DriftIn(SoundIoWorkingState *swsp, SoundIoBuffer &dest)
+{
+	SoundIoDriftState *dsp = swsp->in_drift;
+	uint8_t bps = swsp->bpr;
+	sio_sampnum_t nin;
+
+	nin = DriftRev(*dsp, dest.m_size);
+	memcpy(m_drift_buf, dsp->hist, 2 * bps);
+	if (nin)
+		(void) CopyIn(&m_drift_buf[2 * bps], swsp, nin);
+
+	DriftResample(dsp, m_drift_buf, dest.m_data, dest.m_size);
+	dsp->pos = (uint32_t) (dsp->pos +
+			       ((uint64_t) dest.m_size * dsp->step) -
+			       ((uint64_t) nin << c_drift_shift));
+	memcpy(dsp->hist, &m_drift_buf[nin * bps], 2 * bps);
+}
+
+/*
+ * DriftOut: Send a filter packet to a compensated sink endpoint
+ */
+void SoundIoPump::
+DriftOut(SoundIoWorkingState *dwsp, SoundIoBuffer const &src)
+{
+	SoundIoDriftState *dsp = dwsp->out_drift;
+	uint8_t bps = dwsp->bpr;
+	uint8_t *outp;
+	sio_sampnum_t nout;
+
+	nout = DriftFwd(*dsp, src.m_size);
+	memcpy(m_drift_buf, dsp->hist, 2 * bps);
+	memcpy(&m_drift_buf[2 * bps], src.m_data, src.m_size * bps);
+	outp = &m_drift_buf[(src.m_size + 2) * bps];
+
+	DriftResample(dsp, m_drift_buf, outp, nout);
+	dsp->pos = (uint32_t) (dsp->pos +
+			       ((uint64_t) nout * dsp->step) -
+			       ((uint64_t) src.m_size << c_drift_shift));
+	memcpy(dsp->hist, &m_drift_buf[src.m_size * bps], 2 * bps);
+
+	if (nout)
+		(void) CopyOut(dwsp, outp, nout);
+}
+
+void SoundIoPump::
+DriftReset(SoundIoPumpConfig &cfg)
+{
+	m_drift_up.pos = c_drift_one;
+	m_drift_up.step = c_drift_one;
+	m_drift_up.integ = 0;
+	FillSilence(cfg.fmt, &m_drift_up.hist[0]);
+	FillSilence(cfg.fmt, &m_drift_up.hist[cfg.fmt.bytes_per_record]);
+	m_drift_dn = m_drift_up;
+}
+
+/*
+ * Working memory layout of the streaming path for a configuration.
+ *
+ * The processor loop needs two filter packets.  The drift compensator
+ * needs the history, one filter packet, and the largest number of
+ * outputs that may be produced from one packet at the maximum step
+ * adjustment.
+ */
+void SoundIoPump::
+ScratchLayout(SoundIoPumpConfig const &cfg, size_t &proc_size,
+	      size_t &drift_size)
+{
+	proc_size = 2 * cfg.filter_packet_samps * cfg.fmt.bytes_per_record;
+	drift_size = 0;
+	if (cfg.drift_comp)
+		drift_size = ((2 * cfg.filter_packet_samps) +
+			      (cfg.filter_packet_samps / 32) + 8) *
+			c_sampsize;
+}
+
+/*
+ * Size the working memory of the streaming path for a configuration,
+ * before any endpoint is started with it.  AsyncProcess() only uses
+ * memory set up here, and never allocates.
+ *
+ * This may run while the pump is streaming with its current
+ * configuration, which stays in effect until CommitScratch() is
+ * called for the new one.  The region only grows, and if it moves,
+ * the current layout is carried over.
+ */
+bool SoundIoPump::
+PrepareScratch(SoundIoPumpConfig &cfg, ErrorInfo *error)
+{
+	size_t proc_size, drift_size, drift_off = 0;
+	uint8_t *newbuf;
+
+	ScratchLayout(cfg, proc_size, drift_size);
+	if ((proc_size + drift_size) <= m_scratch_size)
+		return true;
+
+	/* The streaming path must never get here */
+	assert(!m_async_entered);
+	newbuf = (uint8_t *) malloc(proc_size + drift_size);
+	if (!newbuf) {
+		if (error)
+			error->SetNoMem();
+		return false;
+	}
+
+	if (m_drift_buf)
+		drift_off = m_drift_buf - m_scratch;
+	if (m_scratch)
+		free(m_scratch);
+	m_scratch = newbuf;
+	m_scratch_size = proc_size + drift_size;
+	if (m_proc_buf)
+		m_proc_buf = m_scratch;
+	if (m_drift_buf)
+		m_drift_buf = &m_scratch[drift_off];
+	return true;
+}
+
+/*
+ * Switch the streaming path to the layout of a configuration that
+ * PrepareScratch() has sized for, as it becomes m_config
+ */
+void SoundIoPump::
+CommitScratch(SoundIoPumpConfig &cfg)
+{
+	size_t proc_size, drift_size;
+
+	ScratchLayout(cfg, proc_size, drift_size);
+	assert((proc_size + drift_size) <= m_scratch_size);
+	m_proc_buf = m_scratch;
+	m_drift_buf = drift_size ? &m_scratch[proc_size] : 0;
+
+	if (cfg.drift_comp)
+		DriftReset(cfg);
+}
+
+void SoundIoPump::
+FreeScratch(void)
+{
+	if (m_scratch) {
+		free(m_scratch);
+		m_scratch = 0;
+		m_scratch_size = 0;
+	}
+	m_proc_buf = 0;
+	m_drift_buf = 0;
+}
+
+/*
+ * Choose, for each direction, the last filter that may change sample
+ * data.  Filters above it in the processing order only look at the
+ * samples, so it may as well write its result straight into the output
+ * buffer of the destination endpoint.
+ */
+void SoundIoPump::
+BuildBufferPlan(void)
+{
+	SoundIoFilter *fltp;
+
+	m_up_sink_flt = 0;
+	m_dn_sink_flt = 0;
+
+	for (fltp = m_bottom_flt; fltp != NULL; fltp = fltp->m_up) {
+		fltp->m_flags_up = m_config.pump_up
+			? fltp->FltGetFlags(true) : 0;
+		fltp->m_flags_dn = m_config.pump_down
+			? fltp->FltGetFlags(false) : 0;
+
+		if (m_config.pump_up &&
+		    !(fltp->m_flags_up & SoundIoFilter::SIO_FLT_PASSTHRU))
+			m_up_sink_flt = fltp;
+		if (m_config.pump_down && !m_dn_sink_flt &&
+		    !(fltp->m_flags_dn & SoundIoFilter::SIO_FLT_PASSTHRU))
+			m_dn_sink_flt = fltp;
+	}
+}
+
+/*
+ * Reserve a full packet of space in the output buffer of the
+ * destination endpoint.  If the endpoint can't provide it contiguously,
+ * the caller falls back to CopyOut().
+ */
+bool SoundIoPump::
+GetSinkBuf(SoundIoWorkingState *dwsp, sio_sampnum_t nsamps,
+	   SoundIoBuffer &dest)
+{
+	if (dwsp->out_xfer < nsamps)
+		return false;
+
+	if (!dwsp->out_buf.m_size) {
+		dwsp->out_buf.m_size = nsamps;
+		dwsp->siop->SndGetOBuf(dwsp->out_buf);
+		assert(dwsp->out_buf.m_size <= dwsp->out_xfer);
+		dwsp->out_buf_used = 0;
+	}
+
+	if (dwsp->out_buf.m_size < nsamps)
+		return false;
+
+	dest.m_data = dwsp->out_buf.m_data;
+	dest.m_size = nsamps;
+	return true;
+}
+
+void SoundIoPump::
+CommitSinkBuf(SoundIoWorkingState *dwsp, sio_sampnum_t nsamps)
+{
+	assert(dwsp->out_xfer >= nsamps);
+	assert(dwsp->out_buf.m_size >= nsamps);
+	dwsp->out_xfer -= nsamps;
+	dwsp->out_buf_used += nsamps;
+	dwsp->out_buf.m_data += (nsamps * dwsp->bpr);
+	dwsp->out_buf.m_size -= nsamps;
+	SaveOutSilence(dwsp, dwsp->out_buf.m_data, dwsp->bpr);
+	if (!dwsp->out_buf.m_size) {
+		dwsp->siop->SndQueueOBuf(dwsp->out_buf_used);
+		dwsp->out_buf_used = 0;
+	}
+}
+
 void SoundIoPump::
 ProcessOneWay(SoundIoWorkingState *swsp, SoundIoWorkingState *dwsp,
 	      bool up, SoundIoBuffer &buf1, SoundIoBuffer &buf2)
 {
 	SoundIoBuffer bufs, bufd, *bufp;
-	SoundIoFilter *fltp;
-	uint8_t *dibuf = NULL;
+	SoundIoFilter *fltp, *sinkp;
+	uint8_t *dibuf = NULL, *dobuf = NULL;
+	unsigned int flags;
+	uint64_t flt_start, flt_end;
 	uint8_t bps = dwsp->bpr;
 
 	/* Acquire a buffer from the source */
 	bufs.m_size = 0;
-	if (swsp->in_xfer >= buf1.m_size) {
+	if (swsp->in_drift) {
+		/* Compensated sources always go through buf1 */
+		DriftIn(swsp, buf1);
+		bufs = buf1;
+	}
+	else if (swsp->in_xfer >= buf1.m_size) {
 		bufs.m_size = buf1.m_size;
 		swsp->siop->SndGetIBuf(bufs);
 		assert(bufs.m_size <= buf1.m_size);
@@ -399,13 +724,39 @@ ProcessOneWay(SoundIoWorkingState *swsp, SoundIoWorkingState *dwsp,
 		CopyIn(bufs.m_data, swsp, bufs.m_size);
 	}
 
-	bufd = buf2;
+	/* A compensated sink has its own intermediate buffer */
+	sinkp = dwsp->out_drift ? 0 : (up ? m_up_sink_flt : m_dn_sink_flt);
+
+	/*
+	 * Each filter's time is measured from the end of the previous
+	 * one, so that a clock read is saved per filter.
+	 */
+	fltp = up ? m_bottom_flt : m_top_flt;
+	if (fltp)
+		flt_start = SoundIoLatencyHist::Now();
+
+	for (; fltp != NULL; fltp = (up ? fltp->m_up : fltp->m_down)) {
+		flags = up ? fltp->m_flags_up : fltp->m_flags_dn;
+
+		if ((fltp == sinkp) && GetSinkBuf(dwsp, buf1.m_size, bufd)) {
+			/* Last filter to change samples, write to sink */
+			dobuf = bufd.m_data;
+		}
+		else if ((flags & SoundIoFilter::SIO_FLT_INPLACE) &&
+			 (bufs.m_data != dibuf)) {
+			/* Endpoint input buffers are never written */
+			bufd = bufs;
+		}
+		else {
+			bufd = (bufs.m_data == buf1.m_data) ? buf2 : buf1;
+		}
 
-	for (fltp = (up ? m_bottom_flt : m_top_flt);
-	     fltp != (up ? m_top_flt : m_bottom_flt);
-	     fltp = (up ? fltp->m_up : fltp->m_down)) {
 		bufp = const_cast<SoundIoBuffer*>
 			(fltp->FltProcess(up, bufs, bufd));
+		flt_end = SoundIoLatencyHist::Now();
+		fltp->m_lat.Add(flt_end - flt_start);
+		AddFilterCost(fltp, up, flt_end - flt_start);
+		flt_start = flt_end;
 
 		if (dibuf && (bufp->m_data != dibuf)) {
 			/* Mark it consumed when filters stop returning it */
@@ -416,49 +767,14 @@ ProcessOneWay(SoundIoWorkingState *swsp, SoundIoWorkingState *dwsp,
 		}
 
 		bufs = *bufp;
-		bufd = (bufs.m_data == buf1.m_data) ? buf2 : buf1;
 	}
 
-	bufd.m_size = 0;
-	if (dwsp->out_xfer >= buf1.m_size) {
-		if (dwsp->out_buf.m_size &&
-		    (dwsp->out_buf.m_size >= bufd.m_size)) {
-			bufd = dwsp->out_buf;
-			bufd.m_size = buf1.m_size;
-		} else {
-			if (dwsp->out_buf.m_size)
-				dwsp->siop->SndQueueOBuf(dwsp->out_buf_used);
-			dwsp->out_buf.m_size = buf1.m_size;
-			dwsp->siop->SndGetOBuf(dwsp->out_buf);
-			assert(dwsp->out_buf.m_size <= dwsp->out_xfer);
-			bufd = dwsp->out_buf;
-			dwsp->out_buf_used = 0;
-		}
-	}
-	if (bufd.m_size == buf1.m_size) {
-		bufp = const_cast<SoundIoBuffer*>
-			(fltp->FltProcess(up, bufs, bufd));
-		if (bufp->m_data == bufd.m_data) {
-			assert(dwsp->out_xfer >= bufp->m_size);
-			dwsp->out_xfer -= bufp->m_size;
-			dwsp->out_buf_used += bufp->m_size;
-			dwsp->out_buf.m_data +=
-				(bufp->m_size * dwsp->bpr);
-			dwsp->out_buf.m_size -= bufp->m_size;
-			SaveOutSilence(dwsp, dwsp->out_buf.m_data, bps);
-			if (!dwsp->out_buf.m_size) {
-				dwsp->siop->SndQueueOBuf(dwsp->out_buf_used);
-				dwsp->out_buf_used = 0;
-			}
-		} else {
-			(void) CopyOut(dwsp, bufp->m_data, bufp->m_size);
-		}
-	} else {
-		bufd = (bufs.m_data == buf1.m_data) ? buf2 : buf1;
-		bufp = const_cast<SoundIoBuffer*>
-			(fltp->FltProcess(up, bufs, bufd));
-		(void) CopyOut(dwsp, bufp->m_data, bufp->m_size);
-	}
+	if (dwsp->out_drift)
+		DriftOut(dwsp, bufs);
+	else if (dobuf && (bufs.m_data == dobuf))
+		CommitSinkBuf(dwsp, bufs.m_size);
+	else
+		(void) CopyOut(dwsp, bufs.m_data, bufs.m_size);
 
 	if (dibuf) {
 		swsp->siop->SndDequeueIBuf(buf1.m_size);
@@ -473,11 +789,13 @@ ProcessorLoop(SoundIoWorkingState &bws, SoundIoWorkingState &tws,
 {
 	SoundIoBuffer buf1, buf2;
 
-	assert(m_top_flt && m_bottom_flt);
+	assert((m_top_flt && m_bottom_flt) || m_config.drift_comp);
+	assert(m_proc_buf);
+	assert((2 * m_config.filter_packet_samps * bws.bpr) <=
+	       m_scratch_size);
 
 	buf1.m_size = m_config.filter_packet_samps;
-	buf1.m_data = (uint8_t *) malloc(m_config.filter_packet_samps *
-					 bws.bpr * 2);
+	buf1.m_data = m_proc_buf;
 	buf2.m_size = m_config.filter_packet_samps;
 	buf2.m_data = buf1.m_data + (m_config.filter_packet_samps * bws.bpr);
 
@@ -494,8 +812,6 @@ ProcessorLoop(SoundIoWorkingState &bws, SoundIoWorkingState &tws,
 		if (m_config.pump_up)
 			ProcessOneWay(&bws, &tws, true, buf1, buf2);
 	}
-
-	free(buf1.m_data);
 }
 
 struct xfer_bound {
@@ -596,6 +912,51 @@ DumpQueueState(bool start, bool top) const
 			  m_top_qs.in_queued, m_top_qs.out_queued);
 }
 
+/*
+ * Wakeup lag window length and the offset beyond which the timeline
+ * is assumed to be broken, e.g. by a stall, and is restarted
+ */
+#define WAKEUP_WINDOW_NS	1000000000LL
+#define WAKEUP_RESET_NS		1000000000LL
+
+void SoundIoPump::
+WakeupUpdate(SoundIoWakeupState &ws, SoundIoLatencyHist &hist,
+	     uint64_t now, sio_sampnum_t nsamps)
+{
+	int64_t offset, best;
+
+	if (!m_config.fmt.samplerate)
+		return;
+
+	if (ws.start) {
+		ws.samps += nsamps;
+		offset = (int64_t) (now - ws.start) -
+			(int64_t) ((ws.samps * 1000000000ULL) /
+				   m_config.fmt.samplerate);
+		if ((offset < -WAKEUP_RESET_NS) ||
+		    (offset > WAKEUP_RESET_NS))
+			ws.start = 0;
+	}
+
+	if (!ws.start) {
+		ws.start = ws.window = now;
+		ws.samps = 0;
+		ws.min_cur = ws.min_prev = 0;
+		return;
+	}
+
+	if ((now - ws.window) >= WAKEUP_WINDOW_NS) {
+		ws.window = now;
+		ws.min_prev = ws.min_cur;
+		ws.min_cur = offset;
+	}
+	else if (offset < ws.min_cur)
+		ws.min_cur = offset;
+
+	best = (ws.min_cur < ws.min_prev) ? ws.min_cur : ws.min_prev;
+	hist.Add(offset - best);
+}
+
 void SoundIoPump::
 AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 {
@@ -607,11 +968,16 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 	const bool query_other_ep = false;
 
 	OpLatencyMonitor lat(GetDi(), "async process overall");
-	sio_sampnum_t ncopy, nadj, todo;
+	uint64_t start = SoundIoLatencyHist::Now();
+	sio_sampnum_t ncopy, nadj, todo, filled, drained;
+	sio_sampnum_t bot_in, bot_out, top_in, top_out;
 	xfer_bound bounds[4];
 	SoundIoWorkingState bws, tws;
+	SoundIoQueueState bstate;
 	bool did_loss = false, did_state_dump = false;
 
+	filled = drained = 0;
+
 	/* This function is not reenterant, catch attempts to do so */
 	assert(!m_async_entered);
 	m_async_entered = true;
@@ -624,10 +990,21 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 	}
 
 	if (subp == m_bottom) {
-		assert(m_config.bottom_async);
+		assert(m_config.bottom_async || m_config.offline);
 
-		ncopy = (state.in_queued - m_bottom_qs.in_queued);
-		nadj = (m_bottom_qs.out_queued - state.out_queued);
+		/* A converter reports the queues in the pump's format */
+		if (m_bottom_cv)
+			m_bottom_cv->SndGetQueueState(bstate);
+		else
+			bstate = state;
+
+		ncopy = (bstate.in_queued - m_bottom_qs.in_queued);
+		nadj = (m_bottom_qs.out_queued - bstate.out_queued);
+		filled = ncopy;
+		drained = nadj;
+		if (!m_config.offline)
+			WakeupUpdate(m_wake_bottom, m_lat_wake_bottom, start,
+				     (filled > drained) ? filled : drained);
 		m_bottom_in_count += ncopy;
 		m_bottom_out_count += nadj;
 
@@ -637,7 +1014,7 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 		}
 
 		m_bottom_strikes = 0;
-		m_bottom_qs = state;
+		m_bottom_qs = bstate;
 
 		if (query_other_ep || !m_config.top_async) {
 			ncopy = m_top_qs.in_queued;
@@ -667,6 +1044,10 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 
 		ncopy = (state.in_queued - m_top_qs.in_queued);
 		nadj = (m_top_qs.out_queued - state.out_queued);
+		filled = ncopy;
+		drained = nadj;
+		WakeupUpdate(m_wake_top, m_lat_wake_top, start,
+			     (filled > drained) ? filled : drained);
 		m_top_in_count += ncopy;
 		m_top_out_count += nadj;
 
@@ -682,7 +1063,7 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 			ncopy = m_bottom_qs.in_queued;
 			nadj = m_bottom_qs.out_queued;
 
-			m_bottom->SndGetQueueState(m_bottom_qs);
+			m_bottom_io->SndGetQueueState(m_bottom_qs);
 		}
 
 		if (m_config.bottom_loop) {
@@ -708,6 +1089,42 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 		did_state_dump = true;
 	}
 
+	/*
+	 * Steer the drift compensators.  Transfers are symmetric, so the
+	 * filter packets are effectively clocked by the uncompensated
+	 * endpoint, and the rate mismatch accumulates at the compensated
+	 * endpoint: in its output buffer, or in its input buffer.
+	 *
+	 * The compensated endpoint reports fresh levels through its own
+	 * packet callback, so they are only sampled then.  At that point
+	 * the output has just drained a packet and the input has just
+	 * received one, and the targets are the middle of what remains
+	 * of the output window and the input allowance, respectively.
+	 */
+	if (m_config.drift_comp && (subp == m_top) && m_config.drift_top) {
+		if (m_config.pump_up)
+			DriftUpdate(m_drift_up, m_top_qs.out_queued,
+				    (m_config.top_out_min +
+				     m_config.top_out_max - drained) / 2,
+				    drained);
+		if (m_config.pump_down)
+			DriftUpdate(m_drift_dn, m_top_qs.in_queued,
+				    (m_config.top_in_max + filled) / 2,
+				    filled);
+	}
+	else if (m_config.drift_comp && (subp == m_bottom) &&
+		 !m_config.drift_top) {
+		if (m_config.pump_up)
+			DriftUpdate(m_drift_up, m_bottom_qs.in_queued,
+				    (m_config.bottom_in_max + filled) / 2,
+				    filled);
+		if (m_config.pump_down)
+			DriftUpdate(m_drift_dn, m_bottom_qs.out_queued,
+				    (m_config.bottom_out_min +
+				     m_config.bottom_out_max - drained) / 2,
+				    drained);
+	}
+
 	ncopy = 0;
 
 	/*
@@ -780,9 +1197,44 @@ AsyncProcess(SoundIo *subp, SoundIoQueueState &state)
 		bounds[ncopy++].over_cost = 1;
 	}
 
+	if (m_config.drift_comp) {
+		/*
+		 * Bounds are computed in filter samples.  Convert those
+		 * of the compensated endpoint.
+		 */
+		todo = 0;
+		if (m_config.pump_up) {
+			nadj = m_config.drift_top ? 1 : 0;
+			bounds[nadj].lower = DriftLimit(m_drift_up,
+							bounds[nadj].lower,
+							!m_config.drift_top);
+			bounds[nadj].upper = DriftLimit(m_drift_up,
+							bounds[nadj].upper,
+							!m_config.drift_top);
+			todo = 2;
+		}
+		if (m_config.pump_down) {
+			nadj = todo + (m_config.drift_top ? 0 : 1);
+			bounds[nadj].lower = DriftLimit(m_drift_dn,
+							bounds[nadj].lower,
+							m_config.drift_top);
+			bounds[nadj].upper = DriftLimit(m_drift_dn,
+							bounds[nadj].upper,
+							m_config.drift_top);
+		}
+	}
+
 	assert(ncopy);
 	ncopy = BestXfer(bounds, ncopy, m_config.filter_packet_samps);
 
+	/*
+	 * Unclocked endpoints would let the whole stream through at
+	 * once.  Keep offline passes bounded, like a clocked one.
+	 */
+	if (m_config.offline &&
+	    (ncopy > (m_config.filter_packet_samps * c_offline_packets)))
+		ncopy = m_config.filter_packet_samps * c_offline_packets;
+
 dont_copy:
 	assert(!(ncopy % m_config.filter_packet_samps));
 
@@ -800,15 +1252,59 @@ dont_copy:
 	/* Initialize the working states */
 	memset(&bws, 0, sizeof(bws));
 	memset(&tws, 0, sizeof(tws));
-	bws.siop = m_bottom;
+	bws.siop = m_bottom_io;
 	bws.bpr = m_config.fmt.bytes_per_record;
+	bws.rec = m_rec;
 	memcpy(bws.in_silence, m_bi_last, sizeof(bws.in_silence));
 	memcpy(bws.out_silence, m_bo_last, sizeof(bws.out_silence));
 	tws.siop = m_top;
 	tws.bpr = m_config.fmt.bytes_per_record;
+	tws.rec = m_rec;
 	memcpy(tws.in_silence, m_ti_last, sizeof(tws.in_silence));
 	memcpy(tws.out_silence, m_to_last, sizeof(tws.out_silence));
 
+	/*
+	 * Determine the number of samples to be moved at each endpoint.
+	 * These only differ from ncopy at a drift compensated endpoint.
+	 */
+	bot_in = bot_out = top_in = top_out = ncopy;
+	if (m_config.drift_comp) {
+		if (m_config.drift_top) {
+			tws.out_drift = &m_drift_up;
+			tws.in_drift = &m_drift_dn;
+			top_out = DriftFwd(m_drift_up, ncopy);
+			top_in = DriftRev(m_drift_dn, ncopy);
+		} else {
+			bws.in_drift = &m_drift_up;
+			bws.out_drift = &m_drift_dn;
+			bot_in = DriftRev(m_drift_up, ncopy);
+			bot_out = DriftFwd(m_drift_dn, ncopy);
+		}
+
+		if (m_stat && m_config.pump_up) {
+			if (bot_in > ncopy)
+				m_stat->bottom.in.shrink += (bot_in - ncopy);
+			else
+				m_stat->bottom.in.stretch += (ncopy - bot_in);
+			if (top_out > ncopy)
+				m_stat->top.out.stretch += (top_out - ncopy);
+			else
+				m_stat->top.out.shrink += (ncopy - top_out);
+		}
+		if (m_stat && m_config.pump_down) {
+			if (top_in > ncopy)
+				m_stat->top.in.shrink += (top_in - ncopy);
+			else
+				m_stat->top.in.stretch += (ncopy - top_in);
+			if (bot_out > ncopy)
+				m_stat->bottom.out.stretch +=
+					(bot_out - ncopy);
+			else
+				m_stat->bottom.out.shrink +=
+					(ncopy - bot_out);
+		}
+	}
+
 	if (m_stat) {
 		m_stat->process_count += ncopy;
 
@@ -832,9 +1328,9 @@ dont_copy:
 
 	/* Some imbalances need to be corrected immediately */
 	if (m_config.pump_up) {
-		bws.in_xfer = ncopy;
-		nadj = m_bottom_qs.in_queued - ncopy;
-		if (ncopy > m_bottom_qs.in_queued) {
+		bws.in_xfer = bot_in;
+		nadj = m_bottom_qs.in_queued - bot_in;
+		if (bot_in > m_bottom_qs.in_queued) {
 			bws.in_xfer = m_bottom_qs.in_queued;
 		} else if (m_config.bottom_async &&
 			   (nadj > m_config.bottom_in_max)) {
@@ -851,14 +1347,14 @@ dont_copy:
 			if (m_stat)
 				m_stat->bottom.in.drop +=
 					(nadj - m_config.bottom_in_max);
-			m_bottom->SndDequeueIBuf(nadj -
-						 m_config.bottom_in_max);
+			m_bottom_io->SndDequeueIBuf(nadj -
+						    m_config.bottom_in_max);
 			m_bottom_qs.in_queued -= (nadj -
 						  m_config.bottom_in_max);
 			did_loss = true;
 		}
-		tws.out_xfer = ncopy;
-		nadj = m_top_qs.out_queued + ncopy;
+		tws.out_xfer = top_out;
+		nadj = m_top_qs.out_queued + top_out;
 		if (nadj > m_config.top_out_max) {
 			if (loss_debug && m_config.warn_loss) {
 				if (!did_state_dump) {
@@ -879,9 +1375,9 @@ dont_copy:
 		}
 	}
 	if (m_config.pump_down) {
-		tws.in_xfer = ncopy;
-		nadj = m_top_qs.in_queued - ncopy;
-		if (ncopy > m_top_qs.in_queued) {
+		tws.in_xfer = top_in;
+		nadj = m_top_qs.in_queued - top_in;
+		if (top_in > m_top_qs.in_queued) {
 			tws.in_xfer = m_top_qs.in_queued;
 		} else if (m_config.top_async &&
 			   (nadj > m_config.top_in_max)) {
@@ -901,8 +1397,8 @@ dont_copy:
 			m_top_qs.in_queued -= (nadj - m_config.top_in_max);
 			did_loss = true;
 		}
-		bws.out_xfer = ncopy;
-		nadj = m_bottom_qs.out_queued + ncopy;
+		bws.out_xfer = bot_out;
+		nadj = m_bottom_qs.out_queued + bot_out;
 		if (nadj > m_config.bottom_out_max) {
 			if (loss_debug && m_config.warn_loss) {
 				if (!did_state_dump) {
@@ -936,7 +1432,9 @@ dont_copy:
 	if (!ncopy)
 		goto done_copyback;
 
-	if (!m_top_flt) {
+	m_offline_count += ncopy;
+
+	if (!m_top_flt && !m_config.drift_comp) {
 		if (!m_config.bottom_loop && !m_config.top_loop) {
 			/* No filters, just send it all through */
 			if (m_config.pump_down)
@@ -1025,7 +1523,7 @@ done_copyback:
 
 	/* Flush pending output buffers */
 	if (bws.out_buf.m_size) {
-		m_bottom->SndQueueOBuf(bws.out_buf_used);
+		m_bottom_io->SndQueueOBuf(bws.out_buf_used);
 		bws.out_buf.m_size = 0;
 	}
 	if (tws.out_buf.m_size) {
@@ -1035,7 +1533,9 @@ done_copyback:
 
 	/*
 	 * If we have a static endpoint that has become exhausted
-	 * in all of its relevant directions, halt.
+	 * in all of its relevant directions, halt.  Offline, there
+	 * is no clocked endpoint to underflow, so an empty source is
+	 * the end of the stream.
 	 */
 	if (m_config.bottom_roe &&
 	    (bws.out_xfer || (m_bottom_qs.out_queued ==
@@ -1049,10 +1549,12 @@ done_copyback:
 	if ((m_config.top_roe &&
 	     (!m_config.pump_up || m_top_out_exhaust) &&
 	     (!m_config.pump_down ||
-	      (!m_top_qs.in_queued && m_bottom_qs.out_underflow))) ||
+	      (!m_top_qs.in_queued &&
+	       (m_bottom_qs.out_underflow || m_config.offline)))) ||
 	    (m_config.bottom_roe &&
 	     (!m_config.pump_up ||
-	      (!m_bottom_qs.in_queued && m_top_qs.out_underflow)) &&
+	      (!m_bottom_qs.in_queued &&
+	       (m_top_qs.out_underflow || m_config.offline))) &&
 	     (!m_config.pump_down || m_bottom_out_exhaust))) {
 		ErrorInfo error;
 		error.Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
@@ -1060,6 +1562,7 @@ done_copyback:
 			  "Static Endpoint Exhausted");
 		assert(m_async_entered);
 		m_async_entered = false;
+		m_lat_process.AddSince(start);
 		__Stop(&error, m_config.top_async ? m_bottom : m_top);
 		return;
 	}
@@ -1103,7 +1606,7 @@ done_copyback:
 
 	if (fill_debug || (loss_debug && did_state_dump)) {
 		SoundIoQueueState qs;
-		m_bottom->SndGetQueueState(qs);
+		m_bottom_io->SndGetQueueState(qs);
 		assert(qs.in_queued >= m_bottom_qs.in_queued);
 		assert(qs.out_queued <= m_bottom_qs.out_queued);
 		GetDi()->LogDebug("<-[%c]Bot: In %d Out %d",
@@ -1148,6 +1651,7 @@ done_copyback:
 done:
 	assert(m_async_entered);
 	m_async_entered = false;
+	m_lat_process.AddSince(start);
 }
 
 void SoundIoPump::
@@ -1370,12 +1874,22 @@ ConfigureEndpoints(SoundIo *bottom, SoundIo *top, SoundIoPumpConfig &cfg,
 	cfg.warn_loss = ((cfg.bottom_async || cfg.bottom_roe) &&
 			 (cfg.top_async || cfg.top_roe));
 
-	if (!cfg.bottom_async && !cfg.top_async) {
-		/* Offline processing mode isn't supported yet */
+	if (cfg.offline && (cfg.bottom_async || cfg.top_async)) {
 		GetDi()->LogWarn(error,
 				 LIBHFP_ERROR_SUBSYS_SOUNDIO,
 				 LIBHFP_ERROR_SOUNDIO_BAD_PUMP_CONFIG,
-				 "Config fail: Offline mode not supported");
+				 "Config fail: Offline mode requires "
+				 "unclocked endpoints");
+		return false;
+	}
+
+	if (!cfg.offline && !cfg.bottom_async && !cfg.top_async) {
+		/* Unclocked pairs can only be run by RunOffline() */
+		GetDi()->LogWarn(error,
+				 LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				 LIBHFP_ERROR_SOUNDIO_NO_CLOCK,
+				 "Config fail: Neither endpoint has a "
+				 "clock, use offline mode");
 		return false;
 	}
 
@@ -1607,7 +2121,13 @@ ConfigureEndpoints(SoundIo *bottom, SoundIo *top, SoundIoPumpConfig &cfg,
 	cfg.bottom_in_max = cfg.bottom_out_max - cfg.bottom_out_min;
 	cfg.top_in_max = cfg.top_out_max - cfg.bottom_out_min;
 
-	if (!fixed_fps) {
+	if (!fixed_fps && cfg.offline) {
+		/* No clock to follow, use telephony sized packets */
+		cfg.filter_packet_samps = cfg.fmt.samplerate / 50;
+		if (!cfg.filter_packet_samps)
+			cfg.filter_packet_samps = 1;
+	}
+	else if (!fixed_fps) {
 		/* Find a good filter packet size */
 		cfg.filter_packet_samps = cfg.fmt.packet_samps;
 		if (!cfg.bottom_async ||
@@ -1635,6 +2155,18 @@ ConfigureEndpoints(SoundIo *bottom, SoundIo *top, SoundIoPumpConfig &cfg,
 		cfg.filter_packet_samps /= 2;
 	}
 
+	/*
+	 * Drift compensation is only useful between two clocks, and
+	 * the interpolator only understands linear PCM.
+	 */
+	cfg.drift_comp = (m_config_drift_comp &&
+			  cfg.bottom_async && cfg.top_async &&
+			  !cfg.bottom_loop && !cfg.top_loop &&
+			  !cfg.bottom_roe && !cfg.top_roe &&
+			  ((cfg.fmt.sampletype == SIO_PCM_U8) ||
+			   (cfg.fmt.sampletype == SIO_PCM_S16_LE)));
+	cfg.drift_top = m_top_loss_tolerate;
+
 	/*
 	 * Pick a timeout value for the watchdog timer that is
 	 * watchdog_packets number of milliseconds for the largest
@@ -1673,6 +2205,10 @@ ConfigureEndpoints(SoundIo *bottom, SoundIo *top, SoundIoPumpConfig &cfg,
 	cfg.watchdog_min_progress = nsamps / 4;
 	cfg.watchdog_max_progress = nsamps * 2;
 
+	/* Offline passes are not held to the system clock */
+	if (cfg.offline)
+		cfg.watchdog_to = 0;
+
 	/*
 	 * The working configuration of the pump is delicate,
 	 * and useful for debugging.
@@ -1690,10 +2226,98 @@ ConfigureEndpoints(SoundIo *bottom, SoundIo *top, SoundIoPumpConfig &cfg,
 	GetDi()->LogDebug("Pump: top min fill = %u", cfg.top_out_min);
 	GetDi()->LogDebug("Pump: top max fill = %u", cfg.top_out_max);
 	GetDi()->LogDebug("Pump: watchdog timeout = %u", cfg.watchdog_to);
+	GetDi()->LogDebug("Pump: drift compensation = %s",
+			  !cfg.drift_comp ? "off" :
+			  (cfg.drift_top ? "top" : "bottom"));
 
 	return true;
 }
 
+/*
+ * Choose the SoundIo that the pump will move bottom data through.
+ * If the bottom endpoint's format differs from the top's, that is a
+ * converter, and reuse is tried before a new one is constructed.
+ * Loops adopt the format of the other endpoint in ConfigureEndpoints().
+ */
+bool SoundIoPump::
+ConfigureConverter(SoundIo *bottom, SoundIo *top, SoundIo *reuse,
+		   SoundIo *&io, ErrorInfo *error)
+{
+	SoundIoProps bottom_props, top_props;
+	SoundIoFormat bottom_fmt, top_fmt;
+
+	io = bottom;
+	if (!bottom || !top)
+		return true;
+
+	bottom->SndGetProps(bottom_props);
+	top->SndGetProps(top_props);
+	if (bottom_props.does_loop || top_props.does_loop)
+		return true;
+
+	bottom->SndGetFormat(bottom_fmt);
+	top->SndGetFormat(top_fmt);
+	if (SameFormat(top_fmt, bottom_fmt))
+		return true;
+
+	if (reuse) {
+		if (!reuse->SndSetFormat(top_fmt, error))
+			return false;
+		io = reuse;
+		return true;
+	}
+
+	io = SoundIoCreateConverter(bottom, top_fmt, error);
+	if (!io) {
+		GetDi()->LogWarn("Config fail: Cannot convert bottom format");
+		return false;
+	}
+
+	GetDi()->LogDebug("Pump: converting bottom %uHz/%uch to "
+			  "%uHz/%uch",
+			  bottom_fmt.samplerate, bottom_fmt.nchannels,
+			  top_fmt.samplerate, top_fmt.nchannels);
+	return true;
+}
+
+/*
+ * Filters are prepared for the format chosen at start, so a running
+ * pump cannot switch to another
+ */
+bool SoundIoPump::
+CheckRunningFormat(SoundIoPumpConfig const &cfg, ErrorInfo *error)
+{
+	if (SameFormat(cfg.fmt, m_config.fmt))
+		return true;
+
+	GetDi()->LogWarn(error,
+			 LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			 LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+			 "Config fail: Replacement endpoint would change "
+			 "the pump format");
+	return false;
+}
+
+/* Adopt the result of ConfigureConverter() for m_bottom */
+void SoundIoPump::
+SetBottomIo(SoundIo *io)
+{
+	if (io != m_bottom_cv) {
+		if (m_bottom_cv)
+			delete m_bottom_cv;
+		m_bottom_cv = (io != m_bottom) ? io : 0;
+	}
+	m_bottom_io = io;
+}
+
+/* Back out the result of ConfigureConverter() for m_bottom */
+void SoundIoPump::
+DiscardBottomIo(SoundIo *io)
+{
+	if (io && (io != m_bottom) && (io != m_bottom_cv))
+		delete io;
+}
+
 
 bool SoundIoPump::
 SetBottom(SoundIo *newep, ErrorInfo *error)
@@ -1719,12 +2343,14 @@ SetBottom(SoundIo *newep, ErrorInfo *error)
 
 	if (IsStarted() && newep) {
 		SoundIoPumpConfig newcfg;
+		SoundIo *io;
 
 		assert(oldep);
 
 		memset(&newcfg, 0, sizeof(newcfg));
 		newcfg.pump_up = m_config.pump_up;
 		newcfg.pump_down = m_config.pump_down;
+		newcfg.offline = m_config.offline;
 
 		/*
 		 * We could choose enforce this only when a filter is
@@ -1733,16 +2359,23 @@ SetBottom(SoundIo *newep, ErrorInfo *error)
 		newcfg.filter_packet_samps = m_config.filter_packet_samps;
 
 
-		if (!ConfigureEndpoints(newep, m_top, newcfg, error))
+		if (!ConfigureConverter(newep, m_top, 0, io, error))
 			goto failed;
+		if (!ConfigureEndpoints(io, m_top, newcfg, error) ||
+		    !CheckRunningFormat(newcfg, error) ||
+		    !PrepareScratch(newcfg, error)) {
+			DiscardBottomIo(io);
+			goto failed;
+		}
 
 		if (newcfg.bottom_async) {
 			OpLatencyMonitor lat(GetDi(), "new bottom EP start");
-			if (!newep->SndAsyncStart(newcfg.pump_down,
-						  newcfg.pump_up,
-						  error)) {
+			if (!io->SndAsyncStart(newcfg.pump_down,
+					       newcfg.pump_up,
+					       error)) {
 				GetDi()->LogWarn("SoundIo: Could not start "
 						 "new bottom EP");
+				DiscardBottomIo(io);
 				goto failed;
 			}
 		}
@@ -1752,7 +2385,9 @@ SetBottom(SoundIo *newep, ErrorInfo *error)
 			oldep->SndAsyncStop();
 		}
 
+		SetBottomIo(io);
 		m_bottom_async_started = newcfg.bottom_async;
+		CommitScratch(newcfg);
 		m_config = newcfg;
 		m_bottom_strikes = 0;
 
@@ -1762,8 +2397,10 @@ SetBottom(SoundIo *newep, ErrorInfo *error)
 		 * sample buffers!
 		 */
 	}
-	else if (IsStarted()) {
-		__Stop();
+	else {
+		if (IsStarted())
+			__Stop();
+		SetBottomIo(newep);
 	}
 
 	if (oldep) {
@@ -1772,6 +2409,7 @@ SetBottom(SoundIo *newep, ErrorInfo *error)
 	}
 
 	m_bottom_out_exhaust = false;
+	m_wake_bottom.start = 0;
 	return true;
 
 failed:
@@ -1805,13 +2443,22 @@ SetTop(SoundIo *newep, ErrorInfo *error)
 
 	if (IsStarted() && newep) {
 		SoundIoPumpConfig newcfg;
+		SoundIo *io;
 		assert(oldep);
 		memset(&newcfg, 0, sizeof(newcfg));
 		newcfg.pump_up = m_config.pump_up;
 		newcfg.pump_down = m_config.pump_down;
+		newcfg.offline = m_config.offline;
 		newcfg.filter_packet_samps = m_config.filter_packet_samps;
-		if (!ConfigureEndpoints(newep, m_top, newcfg, error))
+		if (!ConfigureConverter(m_bottom, newep, m_bottom_cv, io,
+					error))
 			goto failed;
+		if (!ConfigureEndpoints(io, newep, newcfg, error) ||
+		    !CheckRunningFormat(newcfg, error) ||
+		    !PrepareScratch(newcfg, error)) {
+			DiscardBottomIo(io);
+			goto failed;
+		}
 
 		if (newcfg.top_async) {
 			OpLatencyMonitor lat(GetDi(), "new top EP start");
@@ -1820,6 +2467,7 @@ SetTop(SoundIo *newep, ErrorInfo *error)
 						  error)) {
 				GetDi()->LogWarn("SoundIo: Could not start "
 						 "new top EP");
+				DiscardBottomIo(io);
 				goto failed;
 			}
 		}
@@ -1829,7 +2477,9 @@ SetTop(SoundIo *newep, ErrorInfo *error)
 			oldep->SndAsyncStop();
 		}
 
+		SetBottomIo(io);
 		m_top_async_started = newcfg.top_async;
+		CommitScratch(newcfg);
 		m_config = newcfg;
 		m_top_strikes = 0;
 	}
@@ -1844,6 +2494,7 @@ SetTop(SoundIo *newep, ErrorInfo *error)
 	}
 
 	m_top_out_exhaust = false;
+	m_wake_top.start = 0;
 	return true;
 
 failed:
@@ -1854,11 +2505,12 @@ failed:
 }
 
 bool SoundIoPump::
-Start(ErrorInfo *error)
+__Start(bool offline, ErrorInfo *error)
 {
 	SoundIoFilter *fltp;
 	SoundIoFormat fltfmt;
 	SoundIoPumpConfig cfg;
+	SoundIo *io;
 
 	if (IsStarted()) {
 		if (error)
@@ -1881,16 +2533,26 @@ Start(ErrorInfo *error)
 
 	/* Blank slate, let ConfigureEndpoints figure everything out */
 	memset(&cfg, 0, sizeof(cfg));
+	cfg.offline = offline;
 
 	/*
 	 * Run the configuration function
 	 */
-	if (!ConfigureEndpoints(m_bottom, m_top, cfg, error))
+	if (!ConfigureConverter(m_bottom, m_top, m_bottom_cv, io, error))
+		return false;
+	if (!ConfigureEndpoints(io, m_top, cfg, error) ||
+	    !PrepareScratch(cfg, error)) {
+		DiscardBottomIo(io);
 		return false;
+	}
+	SetBottomIo(io);
 
 	/*
-	 * Reset the silence buffers
+	 * Pick the record kernels, and reset the silence buffers
 	 */
+	m_rec = SoundIoDspGetRecordKernels(cfg.fmt.sampletype,
+					   cfg.fmt.nchannels);
+	assert(m_rec);
 	FillSilence(cfg.fmt, m_bi_last);
 	FillSilence(cfg.fmt, m_bo_last);
 	FillSilence(cfg.fmt, m_ti_last);
@@ -1901,10 +2563,11 @@ Start(ErrorInfo *error)
 		if (error)
 			error->SetNoMem();
 		GetDi()->LogWarn("Could not create watchdog");
-		return false;
+		goto failed_scratch;
 	}
 	m_watchdog->Register(this, &SoundIoPump::Watchdog);
 
+	CommitScratch(cfg);
 	m_config = cfg;
 
 	fltfmt = cfg.fmt;
@@ -1915,6 +2578,7 @@ Start(ErrorInfo *error)
 	 */
 
 	for (fltp = m_bottom_flt; fltp != NULL; fltp = fltp->m_up) {
+		ResetFilterCost(fltp);
 		if (!fltp->FltPrepare(fltfmt, cfg.pump_up, cfg.pump_down,
 				      error)) {
 			GetDi()->LogDebug("Filter prepare failed, "
@@ -1929,10 +2593,12 @@ Start(ErrorInfo *error)
 				delete m_watchdog;
 				m_watchdog = 0;
 			}
-			return false;
+			goto failed_scratch;
 		}
 	}
 
+	BuildBufferPlan();
+
 	/*
 	 * Start the various devices.
 	 * Hereafter we use __Stop() to clean up
@@ -1941,12 +2607,12 @@ Start(ErrorInfo *error)
 
 	if (cfg.bottom_async) {
 		OpLatencyMonitor lat(GetDi(), "bottom EP start");
-		if (!m_bottom->SndAsyncStart(cfg.pump_down, cfg.pump_up,
-					     error))
+		if (!m_bottom_io->SndAsyncStart(cfg.pump_down, cfg.pump_up,
+						error))
 			goto failed;
 		m_bottom_async_started = true;
 	}
-	m_bottom->SndGetQueueState(m_bottom_qs);
+	m_bottom_io->SndGetQueueState(m_bottom_qs);
 
 	if (cfg.top_async) {
 		OpLatencyMonitor lat(GetDi(), "top EP start");
@@ -1959,6 +2625,9 @@ Start(ErrorInfo *error)
 
 	m_bottom_out_exhaust = false;
 	m_top_out_exhaust = false;
+	m_wake_bottom.start = 0;
+	m_wake_top.start = 0;
+	m_offline_count = 0;
 
 	/*
 	 * Start the watchdog timer
@@ -1981,6 +2650,42 @@ Start(ErrorInfo *error)
 failed:
 	__Stop();
 	return false;
+
+failed_scratch:
+	FreeScratch();
+	return false;
+}
+
+bool SoundIoPump::
+RunOffline(ErrorInfo *error)
+{
+	SoundIoQueueState qs;
+	sio_sampnum_t last;
+
+	if (!__Start(true, error))
+		return false;
+
+	/*
+	 * The bottom endpoint stands in for a clock that is always
+	 * ready.  Each pass moves what the endpoints will take, and
+	 * the pump stops itself when a source is exhausted.
+	 */
+	while (IsStarted()) {
+		last = m_offline_count;
+		m_bottom_io->SndGetQueueState(qs);
+		AsyncProcess(m_bottom, qs);
+
+		if (IsStarted() && (m_offline_count == last)) {
+			GetDi()->LogWarn(error,
+					 LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					 LIBHFP_ERROR_SOUNDIO_BAD_PUMP_CONFIG,
+					 "Offline pump made no progress");
+			__Stop();
+			return false;
+		}
+	}
+
+	return true;
 }
 
 void SoundIoPump::
@@ -2010,6 +2715,8 @@ __Stop(ErrorInfo *reason, SoundIo *offender)
 			fltp->FltCleanup();
 		}
 
+		FreeScratch();
+
 		/* Clear the remembered queue sizes */
 		m_bottom_qs.in_queued = 0;
 		m_bottom_qs.out_queued = 0;
@@ -2043,6 +2750,7 @@ AddBelow(SoundIoFilter *fltp, SoundIoFilter *targp, ErrorInfo *error)
 	if (IsStarted() && !PrepareFilter(fltp, m_config, error))
 		return false;
 
+	ResetFilterCost(fltp);
 	fltp->m_up = targp;
 	if (targp) {
 		fltp->m_down = targp->m_down;
@@ -2064,6 +2772,9 @@ AddBelow(SoundIoFilter *fltp, SoundIoFilter *targp, ErrorInfo *error)
 			m_bottom_flt = fltp;
 		}
 	}
+
+	if (IsStarted())
+		BuildBufferPlan();
 	return true;
 }
 
@@ -2089,8 +2800,10 @@ RemoveFilter(SoundIoFilter *fltp)
 	fltp->m_up = 0;
 	fltp->m_down = 0;
 
-	if (IsStarted())
+	if (IsStarted()) {
 		fltp->FltCleanup();
+		BuildBufferPlan();
+	}
 }
 
 void SoundIoPump::
@@ -2128,15 +2841,113 @@ GetJitterWindow(bool top)
 	return (val * 1000) / m_config.fmt.samplerate;
 }
 
+bool SoundIoPump::
+GetLatency(int index, const char *&stage, const char *&name,
+	   SoundIoLatencyHist *&histp)
+{
+	SoundIoLatencyHist *inp, *outp;
+	SoundIoFilter *fltp;
+	SoundIo *eps[2] = { m_bottom, m_top };
+	const char *epnames[2] = { "bottom", "top" };
+	int i;
+
+	if (index < 0)
+		return false;
+
+	switch (index) {
+	case 0:
+		stage = "process";
+		name = "pump";
+		histp = &m_lat_process;
+		return true;
+	case 1:
+		stage = "wakeup";
+		name = "bottom";
+		histp = &m_lat_wake_bottom;
+		return true;
+	case 2:
+		stage = "wakeup";
+		name = "top";
+		histp = &m_lat_wake_top;
+		return true;
+	}
+	index -= 3;
+
+	/* Endpoints that don't time their transfers are skipped */
+	for (i = 0; i < 2; i++) {
+		if (!eps[i] || !eps[i]->SndGetLatency(inp, outp))
+			continue;
+		if (index < 2) {
+			stage = index ? "push-out" : "push-in";
+			name = epnames[i];
+			histp = index ? outp : inp;
+			return true;
+		}
+		index -= 2;
+	}
+
+	for (fltp = m_bottom_flt; fltp != NULL; fltp = fltp->m_up) {
+		if (!index--) {
+			stage = "filter";
+			name = fltp->FltGetName();
+			histp = &fltp->m_lat;
+			return true;
+		}
+	}
+	return false;
+}
+
+void SoundIoPump::
+ResetLatency(void)
+{
+	const char *stage, *name;
+	SoundIoLatencyHist *histp;
+	int i;
+
+	for (i = 0; GetLatency(i, stage, name, histp); i++)
+		histp->Clear();
+}
+
+bool SoundIoPump::
+GetFilterLoad(SoundIoFilter *fltp, unsigned int &avg_pct,
+	      unsigned int &peak_pct)
+{
+	uint64_t packet_ns;
+	SoundIoFilter *xfltp;
+
+	if (!IsStarted())
+		return false;
+	for (xfltp = m_bottom_flt; xfltp != NULL; xfltp = xfltp->m_up) {
+		if (xfltp == fltp)
+			break;
+	}
+	if (!xfltp || !fltp->m_cost_packets)
+		return false;
+
+	packet_ns = ((uint64_t) m_config.filter_packet_samps * 1000000000) /
+		m_config.fmt.samplerate;
+	avg_pct = (fltp->m_cost_ns * 100) /
+		(fltp->m_cost_packets * packet_ns);
+	peak_pct = ((uint64_t) fltp->m_cost_max_ns * 100) / packet_ns;
+	ResetFilterCost(fltp);
+	return true;
+}
+
 SoundIoPump::
 SoundIoPump(DispatchInterface *eip, SoundIo *bottom)
-	: m_ei(eip), m_bottom(0), m_top(0), m_running(false),
+	: m_ei(eip), m_bottom(0), m_top(0), m_bottom_cv(0), m_bottom_io(0),
+	  m_running(false),
 	  m_bottom_flt(0), m_top_flt(0),
 	  m_bottom_async_started(false), m_top_async_started(false),
 	  m_bottom_loss_tolerate(true), m_top_loss_tolerate(true),
-	  m_async_entered(false), m_watchdog(0),
-	  m_config_out_min_ms(0), m_config_out_window_ms(0), m_stat(0)
+	  m_async_entered(false), m_offline_count(0), m_watchdog(0),
+	  m_config_out_min_ms(0), m_config_out_window_ms(0),
+	  m_config_drift_comp(true), m_rec(0), m_scratch(0), m_scratch_size(0),
+	  m_proc_buf(0), m_drift_buf(0), m_up_sink_flt(0), m_dn_sink_flt(0),
+	  m_stat(0)
 {
+	m_wake_bottom.start = 0;
+	m_wake_top.start = 0;
 	SetBottom(bottom);
 }
 
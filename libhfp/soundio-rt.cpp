@@ -0,0 +1,446 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#if defined(USE_PTHREADS)
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-rt.h>
+
+namespace libhfp {
+
+static bool
+SetPipeFlags(int fh)
+{
+	int flags;
+
+	flags = fcntl(fh, F_GETFL);
+	if ((flags < 0) || (fcntl(fh, F_SETFL, flags | O_NONBLOCK) < 0))
+		return false;
+	flags = fcntl(fh, F_GETFD);
+	if ((flags < 0) || (fcntl(fh, F_SETFD, flags | FD_CLOEXEC) < 0))
+		return false;
+	return true;
+}
+
+bool SoundIoRtThread::CommandQueue::
+Open(DispatchInterface *dip, ErrorInfo *error)
+{
+	assert(m_pipe[0] < 0);
+	m_head = m_tail = 0;
+	if (pipe(m_pipe) < 0) {
+		dip->LogWarn(error,
+			     LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			     LIBHFP_ERROR_SOUNDIO_SYSCALL,
+			     "Create command pipe: %s", strerror(errno));
+		m_pipe[0] = m_pipe[1] = -1;
+		return false;
+	}
+	if (!SetPipeFlags(m_pipe[0]) || !SetPipeFlags(m_pipe[1])) {
+		dip->LogWarn(error,
+			     LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			     LIBHFP_ERROR_SOUNDIO_SYSCALL,
+			     "Set command pipe flags: %s", strerror(errno));
+		Close();
+		return false;
+	}
+	m_not = dip->NewSocket(m_pipe[0], false);
+	if (!m_not) {
+		if (error)
+			error->SetNoMem();
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void SoundIoRtThread::CommandQueue::
+Close(void)
+{
+	if (m_not) {
+		delete m_not;
+		m_not = 0;
+	}
+	if (m_pipe[0] >= 0) {
+		close(m_pipe[0]);
+		close(m_pipe[1]);
+		m_pipe[0] = m_pipe[1] = -1;
+	}
+}
+
+/*
+ * The producer owns m_tail and the consumer owns m_head.  Each slot is
+ * written before m_tail is advanced past it, and read before m_head
+ * is advanced past it.  The consumer empties the pipe before it
+ * empties the ring, so a command pushed while the consumer is running
+ * is always followed by another wakeup.
+ */
+bool SoundIoRtThread::CommandQueue::
+Push(Callback<void> const &cmd)
+{
+	unsigned int head, tail;
+	char c = 0;
+
+	tail = m_tail;
+	head = __atomic_load_n(&m_head, __ATOMIC_ACQUIRE);
+	if ((tail - head) >= c_queue_size)
+		return false;
+	m_cmds[tail % c_queue_size].Register(cmd);
+	__atomic_store_n(&m_tail, tail + 1, __ATOMIC_RELEASE);
+
+	/* A full pipe already guarantees a wakeup */
+	(void) write(m_pipe[1], &c, 1);
+	return true;
+}
+
+bool SoundIoRtThread::CommandQueue::
+Pop(Callback<void> &cmd)
+{
+	unsigned int head, tail;
+
+	head = m_head;
+	tail = __atomic_load_n(&m_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return false;
+	cmd.Register(m_cmds[head % c_queue_size]);
+	__atomic_store_n(&m_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+void SoundIoRtThread::CommandQueue::
+Drain(void)
+{
+	char buf[64];
+
+	while (read(m_pipe[0], buf, sizeof(buf)) > 0);
+}
+
+
+/*
+ * Set by the audio thread itself, as it may log before pthread_create()
+ * has returned its ID to the main thread.
+ */
+static __thread SoundIoRtThread *s_audio_thread;
+
+void SoundIoRtThread::RtDispatcher::
+LogVa(DispatchInterface::logtype_t lt, const char *fmt, va_list ap)
+{
+	if (s_audio_thread == m_rt)
+		m_rt->LogPush(lt, fmt, ap);
+	else
+		m_rt->m_main_di->LogVa(lt, fmt, ap);
+}
+
+
+SoundIoRtThread::
+SoundIoRtThread(DispatchInterface *mainp)
+	: m_main_di(mainp), m_rt_di(this), m_started(false), m_run(false),
+	  m_mlocked(false), m_log_head(0), m_log_tail(0), m_log_dropped(0),
+	  m_log_reported(0)
+{
+	sem_init(&m_call_done, 0, 0);
+}
+
+SoundIoRtThread::
+~SoundIoRtThread()
+{
+	Stop();
+	sem_destroy(&m_call_done);
+}
+
+void *SoundIoRtThread::
+ThreadHelper(void *arg)
+{
+	((SoundIoRtThread *) arg)->ThreadLoop();
+	return 0;
+}
+
+void SoundIoRtThread::
+ThreadLoop(void)
+{
+	s_audio_thread = this;
+	while (m_run)
+		m_rt_di.RunOnce();
+}
+
+void SoundIoRtThread::
+Quit(void)
+{
+	m_run = false;
+}
+
+void SoundIoRtThread::
+CommandNotify(SocketNotifier *notp, int fh)
+{
+	Callback<void> cmd;
+
+	assert(notp == m_cmdq.m_not);
+	assert(fh == m_cmdq.m_pipe[0]);
+	m_cmdq.Drain();
+	while (m_cmdq.Pop(cmd))
+		cmd();
+}
+
+void SoundIoRtThread::
+MainNotify(SocketNotifier *notp, int fh)
+{
+	Callback<void> cmd;
+
+	assert(notp == m_mainq.m_not);
+	assert(fh == m_mainq.m_pipe[0]);
+	m_mainq.Drain();
+	while (m_mainq.Pop(cmd))
+		cmd();
+}
+
+void SoundIoRtThread::
+CallHelper(void)
+{
+	m_call();
+	sem_post(&m_call_done);
+}
+
+/*
+ * Logging goes through stdio and whatever the application's main
+ * dispatcher does with it, neither of which the audio thread may
+ * wait on.  Messages are formatted into a ring of their own, which
+ * the main thread is told to empty with PostMain().  If the ring is
+ * full, the message is dropped and counted.  If the notification
+ * queue is full, the message waits for the next LogDeliver().
+ */
+void SoundIoRtThread::
+LogPush(DispatchInterface::logtype_t lt, const char *fmt, va_list ap)
+{
+	LogEntry *entp;
+	unsigned int head, tail;
+	Callback<void> cmd;
+
+	tail = m_log_tail;
+	head = __atomic_load_n(&m_log_head, __ATOMIC_ACQUIRE);
+	if ((tail - head) >= c_queue_size) {
+		__atomic_add_fetch(&m_log_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	entp = &m_log[tail % c_queue_size];
+	entp->lt = lt;
+	vsnprintf(entp->text, sizeof(entp->text), fmt, ap);
+	__atomic_store_n(&m_log_tail, tail + 1, __ATOMIC_RELEASE);
+
+	cmd.Register(this, &SoundIoRtThread::LogDeliver);
+	(void) m_mainq.Push(cmd);
+}
+
+static void
+LogMain(DispatchInterface *dip, DispatchInterface::logtype_t lt,
+	const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	dip->LogVa(lt, fmt, ap);
+	va_end(ap);
+}
+
+void SoundIoRtThread::
+LogDeliver(void)
+{
+	LogEntry *entp;
+	unsigned int head, tail, dropped;
+
+	head = m_log_head;
+	tail = __atomic_load_n(&m_log_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		entp = &m_log[head % c_queue_size];
+		LogMain(m_main_di, entp->lt, "%s", entp->text);
+		__atomic_store_n(&m_log_head, ++head, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&m_log_dropped, __ATOMIC_RELAXED);
+	if (dropped != m_log_reported) {
+		m_main_di->LogWarn("Audio thread dropped %u log messages",
+				   dropped - m_log_reported);
+		m_log_reported = dropped;
+	}
+}
+
+bool SoundIoRtThread::
+Start(SoundIoRtConfig const &cfg, ErrorInfo *error)
+{
+	pthread_attr_t attr;
+	struct sched_param sp;
+	cpu_set_t cpus;
+	unsigned int i;
+	int res;
+
+	if (m_started)
+		return true;
+
+	if (cfg.mlock) {
+		if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+			m_main_di->LogWarn(error,
+					   LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_SYSCALL,
+					   "Lock audio thread memory: %s",
+					   strerror(errno));
+			return false;
+		}
+		m_mlocked = true;
+	}
+
+	if (!m_cmdq.Open(&m_rt_di, error) ||
+	    !m_mainq.Open(m_main_di, error))
+		goto failed;
+	m_cmdq.m_not->Register(this, &SoundIoRtThread::CommandNotify);
+	m_mainq.m_not->Register(this, &SoundIoRtThread::MainNotify);
+
+	pthread_attr_init(&attr);
+	if (cfg.priority) {
+		memset(&sp, 0, sizeof(sp));
+		sp.sched_priority = cfg.priority;
+		pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+		pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+		pthread_attr_setschedparam(&attr, &sp);
+	}
+	if (cfg.cpu_mask) {
+		CPU_ZERO(&cpus);
+		for (i = 0; i < (8 * sizeof(cfg.cpu_mask)); i++) {
+			if (cfg.cpu_mask & (1UL << i))
+				CPU_SET(i, &cpus);
+		}
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+
+	m_run = true;
+	res = pthread_create(&m_thread, &attr, ThreadHelper, this);
+	pthread_attr_destroy(&attr);
+	if (res) {
+		m_run = false;
+		m_main_di->LogWarn(error,
+				   LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_SYSCALL,
+				   "Create audio thread: %s",
+				   strerror(res));
+		goto failed;
+	}
+
+	m_started = true;
+	return true;
+
+failed:
+	m_cmdq.Close();
+	m_mainq.Close();
+	if (m_mlocked) {
+		munlockall();
+		m_mlocked = false;
+	}
+	return false;
+}
+
+void SoundIoRtThread::
+Stop(void)
+{
+	Callback<void> cmd;
+
+	if (!m_started)
+		return;
+
+	assert(!IsAudioThread());
+	cmd.Register(this, &SoundIoRtThread::Quit);
+	while (!m_cmdq.Push(cmd))
+		sched_yield();
+	pthread_join(m_thread, 0);
+	m_started = false;
+
+	/* Deliver whatever the audio thread left for us */
+	while (m_mainq.Pop(cmd))
+		cmd();
+	LogDeliver();
+
+	m_cmdq.Close();
+	m_mainq.Close();
+	if (m_mlocked) {
+		munlockall();
+		m_mlocked = false;
+	}
+}
+
+bool SoundIoRtThread::
+Post(Callback<void> const &cmd)
+{
+	Callback<void> now;
+
+	if (!m_started) {
+		now.Register(cmd);
+		now();
+		return true;
+	}
+
+	assert(!IsAudioThread());
+	if (!m_cmdq.Push(cmd)) {
+		m_main_di->LogWarn("Audio thread command queue full");
+		return false;
+	}
+	return true;
+}
+
+void SoundIoRtThread::
+Call(Callback<void> const &cmd)
+{
+	Callback<void> wrap;
+
+	if (!m_started || IsAudioThread()) {
+		wrap.Register(cmd);
+		wrap();
+		return;
+	}
+
+	m_call.Register(cmd);
+	wrap.Register(this, &SoundIoRtThread::CallHelper);
+	while (!m_cmdq.Push(wrap))
+		sched_yield();
+	while (sem_wait(&m_call_done) && (errno == EINTR));
+}
+
+bool SoundIoRtThread::
+PostMain(Callback<void> const &cmd)
+{
+	Callback<void> now;
+
+	if (!m_started) {
+		now.Register(cmd);
+		now();
+		return true;
+	}
+
+	assert(IsAudioThread());
+	return m_mainq.Push(cmd);
+}
+
+} /* namespace libhfp */
+
+#endif /* defined(USE_PTHREADS) */
@@ -22,6 +22,13 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#if defined(USE_PTHREADS)
+#include <pthread.h>
+#endif
 
 #if defined(USE_SPEEXDSP)
 #include <speex/speex_echo.h>
@@ -34,10 +41,139 @@
 
 #include <libhfp/soundio.h>
 #include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-dsp.h>
 
 namespace libhfp {
 
 
+/*
+ * Set up the storage of a SoundIoRing.  The size is rounded up to a
+ * multiple of both the page size and the record size, so that records
+ * never straddle the end of the storage, and so that the storage can
+ * be mapped twice, back to back.  If that can't be done, fall back to
+ * plain memory, and Peek()/GetUnfilled() will stop at the wrap point.
+ */
+bool SoundIoRing::
+Allocate(size_t nbytes)
+{
+	size_t unit, size;
+	uint8_t *base;
+	int fh;
+
+	Free();
+
+	unit = sysconf(_SC_PAGESIZE);
+	while (unit % m_bpr)
+		unit += sysconf(_SC_PAGESIZE);
+	size = ((nbytes + unit - 1) / unit) * unit;
+	if (!size)
+		return false;
+
+#if defined(HAVE_MEMFD_CREATE)
+	fh = memfd_create("libhfp-ring", MFD_CLOEXEC);
+	if ((fh >= 0) && !ftruncate(fh, size)) {
+		base = (uint8_t *) mmap(NULL, 2 * size, PROT_NONE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base != MAP_FAILED) {
+			if ((mmap(base, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED, fh, 0) == base) &&
+			    (mmap(base + size, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_FIXED, fh, 0) ==
+			     base + size)) {
+				close(fh);
+				m_buf = base;
+				m_size = size;
+				m_mirrored = true;
+				return true;
+			}
+			munmap(base, 2 * size);
+		}
+	}
+	if (fh >= 0)
+		close(fh);
+#else
+	(void) fh;
+#endif
+
+	base = (uint8_t *) malloc(size);
+	if (!base)
+		return false;
+	m_buf = base;
+	m_size = size;
+	m_mirrored = false;
+	return true;
+}
+
+void SoundIoRing::
+Free(void)
+{
+	if (m_buf) {
+		if (m_mirrored)
+			munmap(m_buf, 2 * m_size);
+		else
+			free(m_buf);
+		m_buf = NULL;
+		m_size = 0;
+		m_mirrored = false;
+	}
+	Clear();
+}
+
+
+void SoundIoLatencyHist::
+Clear(void)
+{
+	memset(m_buckets, 0, sizeof(m_buckets));
+	m_count = 0;
+	m_max = 0;
+}
+
+uint32_t SoundIoLatencyHist::
+Percentile(unsigned int per_mille) const
+{
+	uint64_t rank, seen;
+	uint32_t upper;
+	unsigned int idx, shift;
+
+	if (!m_count)
+		return 0;
+	if (per_mille > 1000)
+		per_mille = 1000;
+
+	/* The sample at the requested rank, counting from 1 */
+	rank = ((m_count * per_mille) + 999) / 1000;
+	if (!rank)
+		rank = 1;
+
+	seen = 0;
+	for (idx = 0; idx < (c_buckets - 1); idx++) {
+		seen += m_buckets[idx];
+		if (seen >= rank)
+			break;
+	}
+
+	if (idx < c_sub_count)
+		upper = idx;
+	else {
+		shift = (idx >> c_sub_bits) - 1;
+		upper = ((c_sub_count + (idx & (c_sub_count - 1))) << shift) +
+			((1U << shift) - 1);
+	}
+
+	/* The top bucket is wide, don't report more than was seen */
+	return (upper > m_max) ? m_max : upper;
+}
+
+uint64_t SoundIoLatencyHist::
+Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+
 SoundIoDeviceList::
 ~SoundIoDeviceList()
 {
@@ -51,6 +187,25 @@ SoundIoDeviceList::
 }
 
 
+SoundIoDeviceList *SoundIoDeviceList::
+Copy(void) const
+{
+	SoundIoDeviceList *listp;
+	const InfoNode *nodep;
+
+	listp = new SoundIoDeviceList;
+	if (!listp)
+		return 0;
+
+	for (nodep = m_first; nodep; nodep = nodep->m_next) {
+		if (!listp->Add(nodep->m_name, nodep->m_desc)) {
+			delete listp;
+			return 0;
+		}
+	}
+	return listp;
+}
+
 bool SoundIoDeviceList::
 Add(const char *name, const char *desc)
 {
@@ -601,19 +756,190 @@ SoundIoCreateFileHandler(DispatchInterface *ei,
 }
 
 
-class SoundIoSnooper : public SoundIoFilter {
+class SoundIoSnooper : public SoundIoFltSnoop {
 	SoundIo		*m_output;
 	uint8_t		*m_buf;
 	bool		m_half;
 	SoundIoFormat	m_fmt;
 	bool		m_open;
 	bool		m_no_up, m_no_dn;
+	bool		m_async;
+	unsigned int	m_queue_ms;
+
+	/*
+	 * queued, dropped and max_level are updated by the pump thread.
+	 * written and failed are updated by whichever thread writes to
+	 * the slave, the writer thread in asynchronous mode.
+	 */
+	SoundIoSnoopStatistics	m_stat;
+
+#if defined(USE_PTHREADS)
+	/*
+	 * Asynchronous mode: packets are copied into m_ring on the
+	 * pump thread, and a writer thread drains it into the slave.
+	 * The pump thread never takes m_lock, the writer thread polls.
+	 */
+	SoundIoRing	m_ring;
+	pthread_t	m_thread;
+	pthread_mutex_t	m_lock;
+	pthread_cond_t	m_cond;
+	bool		m_thread_run;
+	bool		m_thread_started;
+	unsigned int	m_poll_ms;
+#endif
+
+	static void Bump(sio_sampnum_t &ctr, sio_sampnum_t count) {
+		__atomic_store_n(&ctr, ctr + count, __ATOMIC_RELAXED);
+	}
 
 public:
-	SoundIoSnooper(SoundIo *target, bool up, bool dn)
+	SoundIoSnooper(SoundIo *target, bool up, bool dn, bool async,
+		       unsigned int queue_ms)
 		: m_output(target), m_buf(0), m_half(false),
-		  m_open(false), m_no_up(!up), m_no_dn(!dn) {}
-	~SoundIoSnooper() {}
+		  m_open(false), m_no_up(!up), m_no_dn(!dn),
+		  m_async(async), m_queue_ms(queue_ms) {
+		memset(&m_stat, 0, sizeof(m_stat));
+#if defined(USE_PTHREADS)
+		m_thread_run = false;
+		m_thread_started = false;
+		m_poll_ms = 0;
+		pthread_mutex_init(&m_lock, 0);
+		pthread_cond_init(&m_cond, 0);
+#endif
+	}
+	~SoundIoSnooper() {
+#if defined(USE_PTHREADS)
+		assert(!m_thread_started);
+		pthread_mutex_destroy(&m_lock);
+		pthread_cond_destroy(&m_cond);
+#endif
+	}
+
+	virtual void GetStatistics(SoundIoSnoopStatistics &stat) const {
+		stat.queued = __atomic_load_n(&m_stat.queued,
+					      __ATOMIC_RELAXED);
+		stat.dropped = __atomic_load_n(&m_stat.dropped,
+					       __ATOMIC_RELAXED);
+		stat.written = __atomic_load_n(&m_stat.written,
+					       __ATOMIC_RELAXED);
+		stat.failed = __atomic_load_n(&m_stat.failed,
+					      __ATOMIC_RELAXED);
+		stat.max_level = __atomic_load_n(&m_stat.max_level,
+						 __ATOMIC_RELAXED);
+	}
+
+#if defined(USE_PTHREADS)
+	bool StartWriter(SoundIoFormat const &fmt, ErrorInfo *error) {
+		sio_sampnum_t npackets;
+
+		npackets = ((fmt.samplerate * m_queue_ms / 1000) +
+			    fmt.packet_samps - 1) / fmt.packet_samps;
+		if (npackets < 4)
+			npackets = 4;
+		if (!m_ring.SetQueueSize(fmt.packet_samps, npackets,
+					 fmt.bytes_per_record)) {
+			if (error)
+				error->SetNoMem();
+			return false;
+		}
+
+		/* Visit the queue four times per queue length */
+		m_poll_ms = m_queue_ms / 4;
+		if (m_poll_ms < 5)
+			m_poll_ms = 5;
+
+		m_thread_run = true;
+		if (pthread_create(&m_thread, 0, WriterThread, this)) {
+			/* Fall back to writing on the pump thread */
+			m_thread_run = false;
+			m_ring.Free();
+			return true;
+		}
+		m_thread_started = true;
+		return true;
+	}
+
+	void StopWriter(void) {
+		if (!m_thread_started)
+			return;
+		pthread_mutex_lock(&m_lock);
+		m_thread_run = false;
+		pthread_cond_signal(&m_cond);
+		pthread_mutex_unlock(&m_lock);
+		pthread_join(m_thread, 0);
+		m_thread_started = false;
+		m_ring.Free();
+	}
+
+	static void *WriterThread(void *arg) {
+		((SoundIoSnooper *) arg)->WriterLoop();
+		return 0;
+	}
+
+	void WriterLoop(void) {
+		struct timespec ts;
+
+		pthread_mutex_lock(&m_lock);
+		while (m_thread_run) {
+			pthread_mutex_unlock(&m_lock);
+			Drain();
+			pthread_mutex_lock(&m_lock);
+			if (!m_thread_run)
+				break;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += (m_poll_ms % 1000) * 1000000;
+			ts.tv_sec += (m_poll_ms / 1000) +
+				(ts.tv_nsec / 1000000000);
+			ts.tv_nsec %= 1000000000;
+			(void) pthread_cond_timedwait(&m_cond, &m_lock, &ts);
+		}
+		pthread_mutex_unlock(&m_lock);
+
+		/* Whatever made it into the queue goes to the file */
+		Drain();
+	}
+
+	void Drain(void) {
+		uint8_t *buf;
+		sio_sampnum_t nsamps, done;
+
+		while (1) {
+			nsamps = 0;
+			m_ring.Peek(buf, nsamps);
+			if (!nsamps)
+				break;
+			done = OutputBuffer(buf, nsamps);
+			Bump(m_stat.written, done);
+			Bump(m_stat.failed, nsamps - done);
+			m_ring.Dequeue(nsamps);
+		}
+	}
+
+	void QueueBuffer(const uint8_t *buf, sio_sampnum_t size) {
+		uint8_t *dest;
+		unsigned int nsamps;
+		sio_sampnum_t level;
+
+		while (size) {
+			nsamps = size;
+			if (!m_ring.GetUnfilled(dest, nsamps))
+				break;
+			memcpy(dest, buf, nsamps * m_fmt.bytes_per_record);
+			m_ring.PutUnfilled(nsamps);
+			Bump(m_stat.queued, nsamps);
+			buf += (nsamps * m_fmt.bytes_per_record);
+			size -= nsamps;
+		}
+
+		if (size)
+			Bump(m_stat.dropped, size);
+
+		level = m_ring.TotalFill();
+		if (level > m_stat.max_level)
+			__atomic_store_n(&m_stat.max_level, level,
+					 __ATOMIC_RELAXED);
+	}
+#endif /* defined(USE_PTHREADS) */
 
 	virtual bool FltPrepare(SoundIoFormat const &fmt,
 				bool up, bool dn, ErrorInfo *error) {
@@ -623,6 +949,8 @@ public:
 			switch (fmt.sampletype) {
 			case SIO_PCM_U8:
 			case SIO_PCM_S16_LE:
+			case SIO_PCM_A_LAW:
+			case SIO_PCM_MU_LAW:
 				break;
 			default:
 				if (error)
@@ -652,6 +980,13 @@ public:
 				return false;
 			}
 			m_open = true;
+
+#if defined(USE_PTHREADS)
+			if (m_async && !StartWriter(fmt, error)) {
+				FltCleanup();
+				return false;
+			}
+#endif
 		}
 
 		m_fmt = fmt;
@@ -659,6 +994,9 @@ public:
 	}
 
 	virtual void FltCleanup(void) {
+#if defined(USE_PTHREADS)
+		StopWriter();
+#endif
 		if (m_open) {
 			m_output->SndClose();
 			m_open = false;
@@ -669,62 +1007,52 @@ public:
 		}
 	}
 
+	virtual const char *FltGetName(void) const { return "snoop"; }
+
+	virtual unsigned int FltGetFlags(bool /*up*/) const {
+		return SIO_FLT_PASSTHRU;
+	}
+
 	void MixBuffer(const uint8_t *buf, sio_sampnum_t size) {
-		size *= m_fmt.nchannels;
-
-		switch (m_fmt.sampletype) {
-		case SIO_PCM_U8: {
-			uint8_t *src = (uint8_t *) buf;
-			uint8_t *dest = (uint8_t *) m_buf;
-			int32_t tmp;
-			while (size) {
-				tmp = (((int) (*(src++)) - 128) +
-				       ((int) (*dest) - 128));
-				if (tmp < -128)
-					tmp = -128;
-				if (tmp > 127)
-					tmp = 127;
-				*(dest++) = tmp + 128;
-				size--;
-			}
-			break;
-		}
-		case SIO_PCM_S16_LE: {
-			int16_t *src = (int16_t *) buf;
-			int16_t *dest = (int16_t *) m_buf;
-			int32_t tmp;
-			while (size) {
-				tmp = *(src++) + *dest;
-				if (tmp < -32768)
-					tmp = -32768;
-				if (tmp > 32767)
-					tmp = -32767;
-				*(dest++) = tmp;
-				size--;
-			}
-			break;
-		}
-		default:
+		if (!SoundIoDspMix(m_fmt.sampletype, m_buf, buf,
+				   size * m_fmt.nchannels))
 			abort();
-		}
 	}
 
-	void OutputBuffer(const uint8_t *buf, sio_sampnum_t size) {
+	sio_sampnum_t OutputBuffer(const uint8_t *buf, sio_sampnum_t size) {
 		SoundIoBuffer xbuf;
+		sio_sampnum_t done = 0;
 		while (size) {
 			xbuf.m_size = size;
 			m_output->SndGetOBuf(xbuf);
 			if (!xbuf.m_size)
 				/* Uh-oh! */
-				return;
+				break;
 
 			memcpy(xbuf.m_data,
 			       buf,
 			       xbuf.m_size * m_fmt.bytes_per_record);
 			m_output->SndQueueOBuf(xbuf.m_size);
 			size -= xbuf.m_size;
+			done += xbuf.m_size;
 			buf += (xbuf.m_size * m_fmt.bytes_per_record);
 		}
+		return done;
+	}
+
+	void EmitBuffer(const uint8_t *buf, sio_sampnum_t size) {
+		sio_sampnum_t done;
+
+#if defined(USE_PTHREADS)
+		if (m_thread_started) {
+			QueueBuffer(buf, size);
+			return;
+		}
+#endif
+		done = OutputBuffer(buf, size);
+		Bump(m_stat.queued, size);
+		Bump(m_stat.written, done);
+		Bump(m_stat.failed, size - done);
 	}
 
 	virtual SoundIoBuffer const *FltProcess(bool up,
@@ -733,7 +1061,7 @@ public:
 		if (!m_buf) {
 			if ((up && !m_no_up) || (!up && !m_no_dn)) {
 				assert(m_open);
-				OutputBuffer(src.m_data, src.m_size);
+				EmitBuffer(src.m_data, src.m_size);
 			}
 			return &src;
 		}
@@ -752,7 +1080,7 @@ public:
 		assert(m_half);
 		m_half = 0;
 		MixBuffer(src.m_data, src.m_size);
-		OutputBuffer(m_buf, src.m_size);
+		EmitBuffer(m_buf, src.m_size);
 		return &src;
 	}
 };
@@ -764,7 +1092,22 @@ SoundIoCreateSnooper(SoundIo *target, bool up, bool dn, ErrorInfo *error)
 
 	assert(target);
 	assert(up || dn);
-	fltp = new SoundIoSnooper(target, up, dn);
+	fltp = new SoundIoSnooper(target, up, dn, false, 0);
+	if (!fltp && error)
+		error->SetNoMem();
+	return fltp;
+}
+
+SoundIoFltSnoop *
+SoundIoCreateAsyncSnooper(SoundIo *target, bool up, bool dn,
+			  unsigned int queue_ms, ErrorInfo *error)
+{
+	SoundIoFltSnoop *fltp;
+
+	assert(target);
+	assert(up || dn);
+	fltp = new SoundIoSnooper(target, up, dn, true,
+				  queue_ms ? queue_ms : 1000);
 	if (!fltp && error)
 		error->SetNoMem();
 	return fltp;
@@ -774,40 +1117,335 @@ SoundIoCreateSnooper(SoundIo *target, bool up, bool dn, ErrorInfo *error)
 
 #if defined(USE_SPEEXDSP)
 class SoundIoFltSpeexImpl : public SoundIoFltSpeex {
+	/*
+	 * Everything the Speex DSP functions need to process a packet.
+	 * Sets are built and freed by Configure() and FltPrepare(),
+	 * never by FltProcess(), which only swaps pointers.
+	 */
+	enum {
+		c_key_len = 64,
+		c_pool_size = 4,
+		c_pool_spares = 2,
+	};
+
+	struct SpeexState {
+		SpeexState			*next;
+		SpeexPreprocessState		*spsp;
+		SpeexEchoState			*sesp;
+		uint8_t				*downpkt;
+		sio_sampnum_t			echotail;
+		sio_sampnum_t			packetsize;
+		int				rate;
+		char				key[c_key_len];
+
+		/* Voice activity gate, see ApplyGate() */
+		uint64_t			gate_sq;
+		unsigned int			gate_hang;
+		bool				denoise;
+	};
+
 	DispatchInterface		*m_ei;
-	SpeexPreprocessState		*m_spsp;
-	SpeexEchoState			*m_sesp;
-	uint8_t				*m_downpkt;
+	SpeexState			*m_cur;
 	bool				m_downpkt_ready;
 
+	/*
+	 * Configure() publishes a new set in m_pending, and FltProcess()
+	 * picks it up at the next packet boundary, pushing the set it
+	 * replaces onto m_retired.  Retired sets are freed by the next
+	 * call to Configure(), or by FltCleanup().
+	 */
+	SpeexState			*m_pending;
+	SpeexState			*m_retired;
+
+	/*
+	 * States of finished streams, most recently used first.  Keyed
+	 * entries are resumed by streams started with the same key.
+	 * Unkeyed entries are spares, reset and reused by any stream
+	 * of the same geometry, so that starting one needn't allocate.
+	 * With no spare at hand, the least recently used keyed entry of
+	 * the same geometry is taken over instead.
+	 */
+	SpeexState			*m_pool;
+	char				m_key[c_key_len];
+	char				m_prep_key[c_key_len];
+
 	sio_sampnum_t			m_packetsize;
-	sio_sampnum_t			m_echotail;
 	int				m_rate;
 	int				m_bps;
+	bool				m_up, m_dn;
 	bool				m_running;
 	SoundIoSpeexProps		m_props;
+	unsigned int			m_degrade;
+
+	/* Consecutive quiet packets in each direction */
+	unsigned int			m_dn_quiet;
+	unsigned int			m_up_quiet;
+	SoundIoSpeexGateStats		m_stats;
 
 public:
 	SoundIoFltSpeexImpl(DispatchInterface *ei)
-		: m_ei(ei), m_spsp(NULL), m_sesp(NULL), m_downpkt(NULL),
-		  m_downpkt_ready(false), m_running(false) {
+		: m_ei(ei), m_cur(NULL), m_downpkt_ready(false),
+		  m_pending(NULL), m_retired(NULL), m_pool(NULL),
+		  m_running(false), m_degrade(0), m_dn_quiet(0),
+		  m_up_quiet(0) {
+
+		m_key[0] = '\0';
+		m_prep_key[0] = '\0';
 
 		m_props.noisereduce = false;
 		m_props.echocancel_ms = 0;
 		m_props.agc_level = 0;
 		m_props.dereverb_level = 0.0;
 		m_props.dereverb_decay = 0.0;
+		m_props.gate_level = 0;
+		memset(&m_stats, 0, sizeof(m_stats));
 	}
 
 	virtual ~SoundIoFltSpeexImpl() {
+		SpeexState *stp;
+
 		assert(!m_running);
+		while (m_pool) {
+			stp = m_pool;
+			m_pool = stp->next;
+			FreeState(stp);
+		}
 	}
 
-	bool InitSpeex(bool do_dn) {
+	/*
+	 * Settings as reduced by FltSetDegradeLevel(), cheapest last:
+	 * 1: no dereverb, 2: no noise reduction, 3: half the echo tail.
+	 * Only the last one discards the converged echo canceler.
+	 */
+	SoundIoSpeexProps Degraded(SoundIoSpeexProps const &props) const {
+		SoundIoSpeexProps res = props;
+
+		if (m_degrade >= 1) {
+			res.dereverb_level = 0.0;
+			res.dereverb_decay = 0.0;
+		}
+		if (m_degrade >= 2)
+			res.noisereduce = false;
+		if (m_degrade >= 3)
+			res.echocancel_ms /= 2;
+		return res;
+	}
+
+	sio_sampnum_t EchoTail(SoundIoSpeexProps const &props) const {
+		sio_sampnum_t echotail = 0;
+
+		if (m_dn && props.echocancel_ms) {
+			echotail = (m_rate * props.echocancel_ms) / 1000;
+			if (echotail < m_packetsize)
+				echotail = m_packetsize;
+		}
+		return echotail;
+	}
+
+	static bool NeedPreprocess(SoundIoSpeexProps const &props,
+				   sio_sampnum_t echotail) {
+		return (props.noisereduce ||
+			props.agc_level ||
+			props.dereverb_level ||
+			echotail);
+	}
+
+	static void ApplyProps(SpeexState *stp,
+			       SoundIoSpeexProps const &props) {
 		int val;
 		float fval;
 
-		assert(!m_spsp && !m_sesp);
+		val = props.noisereduce ? 1 : 0;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_DENOISE,
+				     &val);
+		val = props.agc_level ? 1 : 0;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_AGC,
+				     &val);
+		fval = props.agc_level ?
+			props.agc_level : 8000;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_AGC_LEVEL,
+				     &fval);
+		val = props.dereverb_level ? 1 : 0;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_DEREVERB,
+				     &val);
+		fval = props.dereverb_level;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_DEREVERB_DECAY,
+				     &fval);
+		fval = props.dereverb_decay;
+		speex_preprocess_ctl(stp->spsp,
+				     SPEEX_PREPROCESS_SET_DEREVERB_LEVEL,
+				     &fval);
+	}
+
+	/*
+	 * A packet is quiet if its RMS level is at or below gate_level,
+	 * which is compared as a sum of squares to avoid the square root.
+	 * A direction is gated once it has been quiet for gate_hang
+	 * packets: the echo tail, so that the echo canceler's history
+	 * is all silence when it is skipped, plus 200ms, so that the
+	 * ends of words aren't clipped.
+	 */
+	void ApplyGate(SpeexState *stp, SoundIoSpeexProps const &props) {
+		stp->gate_sq = 0;
+		stp->gate_hang = 0;
+		stp->denoise = props.noisereduce;
+		if (props.gate_level <= 0)
+			return;
+
+		stp->gate_sq = ((uint64_t) props.gate_level *
+				props.gate_level * m_packetsize);
+		stp->gate_hang = (((stp->echotail + m_packetsize - 1) /
+				   m_packetsize) +
+				  (((m_rate / 5) + m_packetsize - 1) /
+				   m_packetsize));
+	}
+
+	static bool UpdateGate(SpeexState *stp, unsigned int &quiet,
+			       uint8_t *data, sio_sampnum_t count) {
+		SoundIoDspLevel lev;
+
+		if (!stp->gate_sq) {
+			quiet = 0;
+			return false;
+		}
+
+		memset(&lev, 0, sizeof(lev));
+		SoundIoDspMeasure(SIO_PCM_S16_LE, data, count, lev);
+		if (lev.sum_sq > stp->gate_sq)
+			quiet = 0;
+		else if (quiet <= stp->gate_hang)
+			quiet++;
+		return quiet > stp->gate_hang;
+	}
+
+	/*
+	 * Forget what a pooled state learned, for use by another stream.
+	 * Speex has no call to reset a preprocessor, but it is cheap to
+	 * rebuild next to the echo canceler, which is reset in place.
+	 */
+	bool ResetState(SpeexState *stp) {
+		if (stp->sesp)
+			speex_echo_state_reset(stp->sesp);
+		if (stp->spsp) {
+			speex_preprocess_state_destroy(stp->spsp);
+			stp->spsp = speex_preprocess_state_init(m_packetsize,
+								m_rate);
+			if (!stp->spsp) {
+				m_ei->LogWarn("Speex: could not allocate "
+					      "preprocess state");
+				return false;
+			}
+		}
+		stp->key[0] = '\0';
+		return true;
+	}
+
+	/*
+	 * Find a pooled state for a stream starting with m_prep_key.
+	 * A saved state for the key is preferred, then a spare, then
+	 * the least recently used state saved for another key.
+	 */
+	SpeexState *PoolGet(SoundIoSpeexProps const &props) {
+		SpeexState *stp, **prevp, **sparep = NULL, **lrup = NULL;
+		sio_sampnum_t echotail = EchoTail(props);
+		bool need_pp = NeedPreprocess(props, echotail);
+		bool resume;
+
+		for (prevp = &m_pool; (stp = *prevp) != NULL;
+		     prevp = &stp->next) {
+			if ((stp->rate != m_rate) ||
+			    (stp->packetsize != m_packetsize) ||
+			    (stp->echotail != echotail) ||
+			    ((stp->spsp != NULL) != need_pp))
+				continue;
+			if (m_prep_key[0] && !strcmp(stp->key, m_prep_key))
+				break;
+			if (!stp->key[0]) {
+				if (!sparep)
+					sparep = prevp;
+			} else {
+				lrup = prevp;
+			}
+		}
+
+		resume = (stp != NULL);
+		if (!stp) {
+			if (!sparep)
+				sparep = lrup;
+			if (!sparep)
+				return NULL;
+			prevp = sparep;
+			stp = *prevp;
+		}
+
+		*prevp = stp->next;
+		stp->next = NULL;
+		if (!resume && !ResetState(stp)) {
+			FreeState(stp);
+			return NULL;
+		}
+		if (stp->spsp)
+			ApplyProps(stp, props);
+		ApplyGate(stp, props);
+		m_ei->LogDebug("Speex: %s pooled state",
+			       resume ? "resuming" : "reusing");
+		return stp;
+	}
+
+	/*
+	 * Save the state of a finished stream under m_prep_key.  States
+	 * it displaces are kept as spares, up to c_pool_spares of them.
+	 */
+	void PoolPut(SpeexState *stp) {
+		SpeexState *oldp, **prevp;
+		int count, spares;
+
+		strcpy(stp->key, m_prep_key);
+
+		/* Only the most recent state for a key is kept */
+		if (stp->key[0]) {
+			for (oldp = m_pool; oldp != NULL; oldp = oldp->next) {
+				if (!strcmp(oldp->key, stp->key))
+					oldp->key[0] = '\0';
+			}
+		}
+
+		stp->next = m_pool;
+		m_pool = stp;
+
+		/* Demote the least recently used, then trim the spares */
+		count = spares = 0;
+		for (prevp = &m_pool; (oldp = *prevp) != NULL; ) {
+			if (oldp->key[0] && (++count > c_pool_size))
+				oldp->key[0] = '\0';
+			if (!oldp->key[0] && (++spares > c_pool_spares)) {
+				*prevp = oldp->next;
+				FreeState(oldp);
+				continue;
+			}
+			prevp = &oldp->next;
+		}
+	}
+
+	bool SetStateKey(const char *key, ErrorInfo *error) {
+		if (key && (strlen(key) >= sizeof(m_key))) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_INTERNAL,
+					   "DSP state key too long");
+			return false;
+		}
+		strcpy(m_key, key ? key : "");
+		return true;
+	}
+
+	SpeexState *NewState(SoundIoSpeexProps const &props) {
+		SpeexState *stp;
 
 		/*
 		 * Intelligent default Values:
@@ -818,102 +1456,134 @@ public:
 		 * dereverb_decay = 0.3 (when enabled)
 		 */
 
-		if (do_dn && m_props.echocancel_ms) {
-			m_echotail = (m_rate * m_props.echocancel_ms) / 1000;
-			if (m_echotail < m_packetsize)
-				m_echotail = m_packetsize;
+		stp = (SpeexState *) malloc(sizeof(*stp));
+		if (!stp) {
+			m_ei->LogWarn("Speex: could not allocate state");
+			return NULL;
 		}
-
-		if (m_props.noisereduce ||
-		    m_props.agc_level ||
-		    m_props.dereverb_level ||
-		    m_echotail) {
-			m_spsp = speex_preprocess_state_init(m_packetsize,
-							     m_rate);
-			if (!m_spsp) {
+		memset(stp, 0, sizeof(*stp));
+		stp->rate = m_rate;
+		stp->packetsize = m_packetsize;
+		stp->echotail = EchoTail(props);
+
+		if (NeedPreprocess(props, stp->echotail)) {
+			stp->spsp = speex_preprocess_state_init(m_packetsize,
+								m_rate);
+			if (!stp->spsp) {
 				m_ei->LogWarn("Speex: could not allocate "
 					      "preprocess state");
-				CleanupSpeex();
-				return false;
+				FreeState(stp);
+				return NULL;
 			}
-
-			val = m_props.noisereduce ? 1 : 0;
-			speex_preprocess_ctl(m_spsp,
-					     SPEEX_PREPROCESS_SET_DENOISE,
-					     &val);
-			val = m_props.agc_level ? 1 : 0;
-			speex_preprocess_ctl(m_spsp,
-					     SPEEX_PREPROCESS_SET_AGC,
-					     &val);
-			fval = m_props.agc_level ?
-				m_props.agc_level : 8000;
-			speex_preprocess_ctl(m_spsp,
-					     SPEEX_PREPROCESS_SET_AGC_LEVEL,
-					     &fval);
-			val = m_props.dereverb_level ? 1 : 0;
-			speex_preprocess_ctl(m_spsp,
-					     SPEEX_PREPROCESS_SET_DEREVERB,
-					     &val);
-			fval = m_props.dereverb_level;
-			speex_preprocess_ctl(m_spsp,
-				     SPEEX_PREPROCESS_SET_DEREVERB_DECAY,
-					     &fval);
-			fval = m_props.dereverb_decay;
-			speex_preprocess_ctl(m_spsp,
-				     SPEEX_PREPROCESS_SET_DEREVERB_LEVEL,
-					     &fval);
+			ApplyProps(stp, props);
 		}
 
-		if (m_echotail) {
-			m_sesp = speex_echo_state_init(m_packetsize,
-						       m_echotail);
-			if (!m_sesp) {
+		if (stp->echotail) {
+			stp->sesp = speex_echo_state_init(m_packetsize,
+							  stp->echotail);
+			if (!stp->sesp) {
 				m_ei->LogWarn("Speex: could not allocate "
 					      "echo cancel state");
-				CleanupSpeex();
-				return false;
+				FreeState(stp);
+				return NULL;
 			}
-			speex_echo_ctl(m_sesp, SPEEX_ECHO_SET_SAMPLING_RATE,
+			speex_echo_ctl(stp->sesp, SPEEX_ECHO_SET_SAMPLING_RATE,
 				       &m_rate);
 
-			m_downpkt = (uint8_t *) malloc(m_packetsize * m_bps);
-			if (!m_downpkt) {
+			stp->downpkt = (uint8_t *) malloc(m_packetsize * m_bps);
+			if (!stp->downpkt) {
 				m_ei->LogWarn("Speex: Could not allocate "
 					      "saved packet buffer");
-				CleanupSpeex();
-				return false;
+				FreeState(stp);
+				return NULL;
 			}
 		}
 
-		m_ei->LogDebug("Echo tail: %i", m_echotail);
-		return true;
+		ApplyGate(stp, props);
+		m_ei->LogDebug("Echo tail: %i", stp->echotail);
+		return stp;
+	}
+
+	static void FreeState(SpeexState *stp) {
+		if (stp->sesp)
+			speex_echo_state_destroy(stp->sesp);
+		if (stp->spsp)
+			speex_preprocess_state_destroy(stp->spsp);
+		if (stp->downpkt)
+			free(stp->downpkt);
+		free(stp);
 	}
 
-	void CleanupSpeex(void) {
-		if (m_sesp) {
-			speex_echo_state_destroy(m_sesp);
-			m_sesp = NULL;
+	void FreeRetired(void) {
+		SpeexState *stp, *nextp;
+
+		stp = __atomic_exchange_n(&m_retired, (SpeexState *) NULL,
+					  __ATOMIC_ACQUIRE);
+		while (stp) {
+			nextp = stp->next;
+			FreeState(stp);
+			stp = nextp;
 		}
-		if (m_spsp) {
-			speex_preprocess_state_destroy(m_spsp);
-			m_spsp = NULL;
+	}
+
+	/* Only called from FltProcess(), at a packet boundary */
+	void SwapState(void) {
+		SpeexState *stp;
+		SpeexEchoState *sesp;
+
+		stp = __atomic_exchange_n(&m_pending, (SpeexState *) NULL,
+					  __ATOMIC_ACQUIRE);
+		if (!stp)
+			return;
+
+		/*
+		 * Keep a converged echo canceler if the tail length
+		 * didn't change.  The fresh one is retired instead.
+		 */
+		if (m_cur && m_cur->sesp &&
+		    (m_cur->echotail == stp->echotail)) {
+			sesp = stp->sesp;
+			stp->sesp = m_cur->sesp;
+			m_cur->sesp = sesp;
 		}
-		if (m_downpkt) {
-			free(m_downpkt);
-			m_downpkt = NULL;
+
+		if (m_cur) {
+			m_cur->next = __atomic_load_n(&m_retired,
+						      __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n(&m_retired,
+							    &m_cur->next,
+							    m_cur, true,
+							    __ATOMIC_RELEASE,
+							    __ATOMIC_RELAXED));
 		}
+		m_cur = stp;
 	}
 
 	bool Configure(SoundIoSpeexProps const &props, ErrorInfo *error) {
-		if (m_running) {
+		SpeexState *stp;
+
+		if (!m_running || !m_up) {
+			m_props = props;
+			return true;
+		}
+
+		/*
+		 * Build the new state here, off the audio path, and let
+		 * FltProcess() swap it in at the next packet boundary.
+		 */
+		FreeRetired();
+		stp = NewState(Degraded(props));
+		if (!stp) {
 			if (error)
-				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
-			LIBHFP_ERROR_SOUNDIO_CANNOT_CHANGE_WHILE_STREAMING,
-					   "Cannot change DSP parameters "
-					   "while streaming");
+				error->SetNoMem();
 			return false;
 		}
 
+		stp = __atomic_exchange_n(&m_pending, stp, __ATOMIC_RELEASE);
+		if (stp)
+			/* Superseded before it was picked up */
+			FreeState(stp);
+
 		m_props = props;
 		return true;
 	}
@@ -945,12 +1615,24 @@ public:
 
 		/* There is no sample rate requirement, so we won't check */
 
+		m_up = up;
+		m_dn = dn;
 		m_downpkt_ready = false;
-		m_echotail = 0;
-
-		if (up && !InitSpeex(dn)) {
-			error->SetNoMem();
-			return false;
+		m_dn_quiet = 0;
+		m_up_quiet = 0;
+		memset(&m_stats, 0, sizeof(m_stats));
+		assert(!m_cur && !m_pending && !m_retired);
+
+		if (up) {
+			strcpy(m_prep_key, m_key);
+			m_cur = PoolGet(Degraded(m_props));
+			if (!m_cur)
+				m_cur = NewState(Degraded(m_props));
+			if (!m_cur) {
+				if (error)
+					error->SetNoMem();
+				return false;
+			}
 		}
 
 		m_running = true;
@@ -958,48 +1640,138 @@ public:
 	}
 
 	void FltCleanup(void) {
+		SpeexState *stp;
+
 		assert(m_running);
 		assert(!m_downpkt_ready);
-		CleanupSpeex();
+
+		if (m_cur) {
+			PoolPut(m_cur);
+			m_cur = NULL;
+		}
+		stp = __atomic_exchange_n(&m_pending, (SpeexState *) NULL,
+					  __ATOMIC_ACQUIRE);
+		if (stp)
+			FreeState(stp);
+		FreeRetired();
 
 		m_running = false;
 	}
 
+	unsigned int FltGetDegradeLevels(void) const { return 3; }
+
+	bool FltSetDegradeLevel(unsigned int level) {
+		unsigned int old = m_degrade;
+
+		if (level > FltGetDegradeLevels())
+			return false;
+		if (level == m_degrade)
+			return true;
+
+		m_degrade = level;
+		if (!Configure(m_props, 0)) {
+			m_degrade = old;
+			return false;
+		}
+		return true;
+	}
+
+	void GetGateStats(SoundIoSpeexGateStats &stats) const {
+		stats = m_stats;
+	}
+
+	const char *FltGetName(void) const { return "speex"; }
+
+	unsigned int FltGetFlags(bool up) const {
+		/*
+		 * Downward packets are only stashed for the echo canceler.
+		 * speex_echo_cancellation() filters its input into its own
+		 * state before producing output, and the preprocessor
+		 * always works in place.
+		 */
+		return up ? SIO_FLT_INPLACE : SIO_FLT_PASSTHRU;
+	}
+
 	SoundIoBuffer const *FltProcess(bool up, SoundIoBuffer const &src,
 					SoundIoBuffer &dest) {
+		SoundIoBuffer const *outp = &src;
+		SpeexState *stp;
+		bool echo_gated;
+		uint64_t start;
+
 		assert(src.m_size == m_packetsize);
 
+		/*
+		 * A downward packet starts a pair in a bidirectional
+		 * stream, and the echo canceler wants both halves to be
+		 * seen by the same state.
+		 */
+		if ((!up || !m_dn) &&
+		    __atomic_load_n(&m_pending, __ATOMIC_RELAXED))
+			SwapState();
+		stp = m_cur;
+
 		if (!up) {
 			/* Stash the output packet */
 			assert(!m_downpkt_ready);
-			if (m_echotail) {
-				memcpy(m_downpkt, src.m_data,
-				       src.m_size * m_bps);
+			if (stp && stp->echotail) {
+				if (!UpdateGate(stp, m_dn_quiet, src.m_data,
+						src.m_size))
+					memcpy(stp->downpkt, src.m_data,
+					       src.m_size * m_bps);
 				m_downpkt_ready = true;
 			}
 
 			return &src;
 		}
 
+		m_stats.packets++;
+
 		/* Run the input packet through Speex */
-		if (m_echotail) {
+		if (stp->echotail) {
 			assert(m_downpkt_ready);
-			speex_echo_cancellation(m_sesp,
+			m_downpkt_ready = false;
+			echo_gated = (stp->gate_sq &&
+				      (m_dn_quiet > stp->gate_hang));
+			if (echo_gated) {
+				m_stats.echo_skipped++;
+			} else {
+				start = SoundIoLatencyHist::Now();
+				speex_echo_cancellation(stp->sesp,
 						(spx_int16_t*) src.m_data,
-						(spx_int16_t*) m_downpkt,
+						(spx_int16_t*) stp->downpkt,
 						(spx_int16_t*) dest.m_data);
-			m_downpkt_ready = false;
-				
-		} else if (m_spsp) {
-			memcpy(dest.m_data, src.m_data, dest.m_size * m_bps);
+				m_stats.echo_ns +=
+					SoundIoLatencyHist::Now() - start;
+				m_stats.echo_run++;
+				outp = &dest;
+			}
 		}
 
-		if (m_spsp) {
-			(void) speex_preprocess_run(m_spsp,
-						    (spx_int16_t*)dest.m_data);
+		if (!stp->spsp)
+			return outp;
+
+		if (UpdateGate(stp, m_up_quiet, outp->m_data, outp->m_size)) {
+			m_stats.preprocess_skipped++;
+			if (!stp->denoise)
+				return outp;
+
+			/* Keep the noise estimate current, and mute */
+			speex_preprocess_estimate_update(stp->spsp,
+						(spx_int16_t*) outp->m_data);
+			memset(dest.m_data, 0, dest.m_size * m_bps);
+			return &dest;
 		}
 
-		return (!m_echotail && !m_spsp) ? &src : &dest;
+		if (outp != &dest)
+			memcpy(dest.m_data, src.m_data, dest.m_size * m_bps);
+
+		start = SoundIoLatencyHist::Now();
+		(void) speex_preprocess_run(stp->spsp,
+					    (spx_int16_t*)dest.m_data);
+		m_stats.preprocess_ns += SoundIoLatencyHist::Now() - start;
+		m_stats.preprocess_run++;
+		return &dest;
 	}
 };
 #endif /* defined(USE_SPEEXDSP) */
@@ -1052,6 +1824,12 @@ public:
 		m_started = false;
 	}
 
+	const char *FltGetName(void) const { return "dummy"; }
+
+	unsigned int FltGetFlags(bool /*up*/) const {
+		return SIO_FLT_PASSTHRU;
+	}
+
 	SoundIoBuffer const *FltProcess(bool up, SoundIoBuffer const &src,
 					SoundIoBuffer &dest) {
 		assert(m_started);
@@ -0,0 +1,793 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2006-2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(HAVE_SYS_TIMERFD_H)
+#include <sys/timerfd.h>
+#endif
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-dsp.h>
+
+namespace libhfp {
+
+/*
+ * Virtual clocked sound card
+ */
+
+#if defined(HAVE_SYS_TIMERFD_H)
+
+/*
+ * A full-duplex sound card with no hardware behind it, for running
+ * on machines without sound devices and for repeatable benchmarks of
+ * the whole audio pipeline.
+ *
+ * The "interrupt" is a timerfd armed once per packet period.  Each
+ * period that elapses captures one packet of input, from a file or
+ * silence, and plays one packet out of a simulated hardware buffer,
+ * into a file or nowhere.  Both buffers are a fixed number of periods
+ * deep, and overrunning or draining them is reported as an xrun just
+ * as a real card would.
+ *
+ * Clock drift stretches the period relative to CLOCK_MONOTONIC.
+ * Jitter delays each timer expiration by a pseudo-random amount, but
+ * the tick schedule is absolute, so jitter never accumulates into
+ * drift.  The jitter sequence is seeded, so runs are reproducible.
+ */
+class SoundIoVirtual : public SoundIoBufferBase {
+	enum {
+		c_hw_periods = 4,
+		c_default_packet = 128,
+	};
+
+	DispatchInterface		*m_ei;
+
+	/* Configuration */
+	sio_sampnum_t			m_rate;
+	sio_sampnum_t			m_packet;
+	unsigned int			m_jitter_us;
+	int				m_drift_ppm;
+	unsigned int			m_seed;
+	char				*m_in_path;
+	char				*m_out_path;
+
+	SoundIoFormat			m_format;
+	bool				m_open;
+	bool				m_play;
+	bool				m_rec;
+	SoundIo				*m_in_file;
+	SoundIo				*m_out_file;
+	bool				m_in_eof;
+
+	/* Simulated hardware state */
+	sio_sampnum_t			m_obuf_size;
+	sio_sampnum_t			m_hw_fill;
+	sio_sampnum_t			m_in_pend;
+	bool				m_rec_xrun;
+
+	/* Clock state */
+	int				m_timer_fh;
+	SocketNotifier			*m_not;
+	uint64_t			m_start_ns;
+	double				m_period_ns;
+	uint64_t			m_ticks;
+	unsigned int			m_rand;
+
+	static uint64_t NowNs(void) {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+	}
+
+public:
+	SoundIoVirtual(DispatchInterface *eip, sio_sampnum_t rate,
+		       sio_sampnum_t packet, unsigned int jitter_us,
+		       int drift_ppm, unsigned int seed,
+		       char *in_path, char *out_path)
+		: m_ei(eip), m_rate(rate), m_packet(packet),
+		  m_jitter_us(jitter_us), m_drift_ppm(drift_ppm),
+		  m_seed(seed), m_in_path(in_path), m_out_path(out_path),
+		  m_open(false), m_play(false), m_rec(false),
+		  m_in_file(0), m_out_file(0), m_in_eof(false),
+		  m_obuf_size(0), m_hw_fill(0), m_in_pend(0),
+		  m_rec_xrun(false), m_timer_fh(-1), m_not(0) {
+		/* Set a default format */
+		memset(&m_format, 0, sizeof(m_format));
+		m_format.sampletype = SIO_PCM_S16_LE;
+		m_format.samplerate = m_rate ? m_rate : 8000;
+		m_format.packet_samps = c_default_packet;
+		m_format.nchannels = 1;
+		m_format.bytes_per_record = 2;
+		if (m_packet)
+			m_format.packet_samps = m_packet;
+	}
+
+	virtual ~SoundIoVirtual() {
+		SndClose();
+		if (m_in_path)
+			free(m_in_path);
+		if (m_out_path)
+			free(m_out_path);
+	}
+
+	bool CheckFormat(SoundIoFormat &format, ErrorInfo *error) {
+		switch (format.sampletype) {
+		case SIO_PCM_U8:
+		case SIO_PCM_A_LAW:
+		case SIO_PCM_MU_LAW:
+			format.bytes_per_record = format.nchannels;
+			break;
+		case SIO_PCM_S16_LE:
+			format.bytes_per_record = 2 * format.nchannels;
+			break;
+		default:
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_FORMAT_UNKNOWN,
+				      "Unrecognized sample format %d",
+				      format.sampletype);
+			return false;
+		}
+
+		if (!format.nchannels || !format.samplerate) {
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+				      "Virtual: invalid format");
+			return false;
+		}
+
+		if (m_rate && (format.samplerate != m_rate)) {
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+				      "Virtual: sample rate fixed at %u",
+				      m_rate);
+			return false;
+		}
+
+		/* Like real hardware, we may override the packet size */
+		if (m_packet)
+			format.packet_samps = m_packet;
+		else if (!format.packet_samps)
+			format.packet_samps = c_default_packet;
+		return true;
+	}
+
+	void CloseFiles(void) {
+		if (m_in_file) {
+			delete m_in_file;
+			m_in_file = 0;
+		}
+		if (m_out_file) {
+			delete m_out_file;
+			m_out_file = 0;
+		}
+	}
+
+	bool OpenInFile(ErrorInfo *error) {
+		SoundIoFormat ffmt;
+
+		assert(!m_in_file);
+		m_in_file = SoundIoCreateFileHandler(m_ei, m_in_path,
+						     false, error);
+		if (!m_in_file)
+			return false;
+		if (!m_in_file->SndOpen(false, true, error))
+			goto failed;
+
+		m_in_file->SndGetFormat(ffmt);
+		if ((ffmt.sampletype != m_format.sampletype) ||
+		    (ffmt.samplerate != m_format.samplerate) ||
+		    (ffmt.nchannels != m_format.nchannels)) {
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
+				      "Virtual: format of \"%s\" does not "
+				      "match the card", m_in_path);
+			goto failed;
+		}
+		m_in_eof = false;
+		return true;
+
+	failed:
+		delete m_in_file;
+		m_in_file = 0;
+		return false;
+	}
+
+	bool OpenFiles(ErrorInfo *error) {
+		SoundIoFormat fmt;
+
+		if (m_rec && m_in_path && !OpenInFile(error))
+			return false;
+
+		if (m_play && m_out_path) {
+			m_out_file = SoundIoCreateFileHandler(m_ei, m_out_path,
+							      true, error);
+			if (!m_out_file)
+				goto failed;
+			fmt = m_format;
+			if (!m_out_file->SndSetFormat(fmt, error) ||
+			    !m_out_file->SndOpen(true, false, error))
+				goto failed;
+		}
+		return true;
+
+	failed:
+		CloseFiles();
+		return false;
+	}
+
+	virtual bool SndOpen(bool play, bool capture, ErrorInfo *error) {
+		if (m_open) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_ALREADY_OPEN,
+					   "Device already open");
+			return false;
+		}
+		if (!play && !capture) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_DUPLEX_MISMATCH,
+					   "Neither playback nor capture "
+					   "requested");
+			return false;
+		}
+
+		if (!CheckFormat(m_format, error))
+			return false;
+
+		m_play = play;
+		m_rec = capture;
+		if (!OpenFiles(error)) {
+			m_ei->LogWarn("Virtual: could not open files");
+			m_play = m_rec = false;
+			return false;
+		}
+
+		if (!BufOpen(m_format.packet_samps,
+			     m_format.bytes_per_record)) {
+			if (error)
+				error->SetNoMem();
+			CloseFiles();
+			m_play = m_rec = false;
+			return false;
+		}
+
+		m_open = true;
+		m_obuf_size = c_hw_periods * m_format.packet_samps;
+		return true;
+	}
+
+	virtual void SndClose(void) {
+		SndAsyncStop();
+		BufClose();
+		CloseFiles();
+		m_open = m_play = m_rec = false;
+		m_obuf_size = 0;
+		m_hw_fill = 0;
+		m_in_pend = 0;
+	}
+
+	virtual void SndGetProps(SoundIoProps &props) const {
+		props.has_clock = true;
+		props.does_source = m_open && m_rec;
+		props.does_sink = m_open && m_play;
+		props.does_loop = false;
+		props.remove_on_exhaust = false;
+		props.outbuf_size = m_obuf_size;
+	}
+
+	virtual void SndGetFormat(SoundIoFormat &format) const {
+		format = m_format;
+	}
+
+	virtual bool SndSetFormat(SoundIoFormat &format, ErrorInfo *error) {
+		SoundIoFormat old;
+		bool reopen;
+
+		if (!CheckFormat(format, error))
+			return false;
+
+		if (m_open) {
+			SndAsyncStop();
+
+			/*
+			 * The files are bound to a format, so they are
+			 * reopened -- and the output truncated -- only if
+			 * more than the packet size changed.
+			 */
+			reopen = ((format.sampletype != m_format.sampletype) ||
+				  (format.samplerate != m_format.samplerate) ||
+				  (format.nchannels != m_format.nchannels));
+			if (reopen) {
+				old = m_format;
+				CloseFiles();
+				m_format = format;
+				if (!OpenFiles(error)) {
+					m_format = old;
+					(void) OpenFiles(0);
+					return false;
+				}
+			}
+
+			m_hw_fill = 0;
+			m_in_pend = 0;
+			if (!BufOpen(format.packet_samps,
+				     format.bytes_per_record)) {
+				if (error)
+					error->SetNoMem();
+				SndClose();
+				return false;
+			}
+			m_obuf_size = c_hw_periods * format.packet_samps;
+		}
+		m_format = format;
+		return true;
+	}
+
+	/*
+	 * Capture from the input file, looping back to the beginning
+	 * when it is exhausted, or produce silence.
+	 */
+	void Capture(uint8_t *buf, sio_sampnum_t nsamples) {
+		SoundIoBuffer fbuf;
+		unsigned int bpr = m_format.bytes_per_record;
+
+		while (nsamples && m_in_file && !m_in_eof) {
+			fbuf.m_size = nsamples;
+			m_in_file->SndGetIBuf(fbuf);
+			if (!fbuf.m_size) {
+				/* Rewind, give up if the file is empty */
+				delete m_in_file;
+				m_in_file = 0;
+				if (!OpenInFile(0)) {
+					m_ei->LogWarn("Virtual: could not "
+						      "rewind \"%s\"",
+						      m_in_path);
+					break;
+				}
+				m_in_file->SndGetIBuf(fbuf);
+				if (!fbuf.m_size) {
+					m_in_eof = true;
+					break;
+				}
+			}
+			memcpy(buf, fbuf.m_data, fbuf.m_size * bpr);
+			m_in_file->SndDequeueIBuf(fbuf.m_size);
+			buf += (fbuf.m_size * bpr);
+			nsamples -= fbuf.m_size;
+		}
+
+		if (nsamples)
+			(void) SoundIoDspSilence(m_format.sampletype, buf,
+						 nsamples * m_format.nchannels);
+	}
+
+	virtual void SndPushInput(bool /*nonblock*/) {
+		unsigned int nsamples, space;
+		uint8_t *buf;
+
+		if (!m_rec)
+			return;
+
+		while (m_in_pend) {
+			space = m_obuf_size - m_input.TotalFill();
+			if ((int) space <= 0) {
+				/* Nobody is reading, drop the rest */
+				m_rec_xrun = true;
+				m_in_pend = 0;
+				break;
+			}
+			nsamples = (m_in_pend < space) ? m_in_pend : space;
+			m_input.GetUnfilled(buf, nsamples);
+			Capture(buf, nsamples);
+			m_input.PutUnfilled(nsamples);
+			m_in_pend -= nsamples;
+		}
+	}
+
+	virtual void SndPushOutput(bool /*nonblock*/) {
+		SoundIoBuffer fbuf;
+		sio_sampnum_t nsamples, count;
+		unsigned int bpr = m_format.bytes_per_record;
+		uint8_t *buf;
+
+		if (!m_play)
+			return;
+
+		while (m_hw_fill < m_obuf_size) {
+			nsamples = m_obuf_size - m_hw_fill;
+			m_output.Peek(buf, nsamples);
+			if (!nsamples) { break; }
+
+			count = 0;
+			while (m_out_file && (count < nsamples)) {
+				fbuf.m_size = nsamples - count;
+				m_out_file->SndGetOBuf(fbuf);
+				if (!fbuf.m_size)
+					break;
+				memcpy(fbuf.m_data, buf + (count * bpr),
+				       fbuf.m_size * bpr);
+				m_out_file->SndQueueOBuf(fbuf.m_size);
+				count += fbuf.m_size;
+			}
+
+			m_output.Dequeue(nsamples);
+			m_hw_fill += nsamples;
+		}
+	}
+
+	bool ArmTimer(void) {
+		struct itimerspec its;
+		uint64_t when;
+
+		when = m_start_ns + (uint64_t) ((m_ticks + 1) * m_period_ns);
+		if (m_jitter_us)
+			when += (uint64_t) (rand_r(&m_rand) %
+					    (m_jitter_us + 1)) * 1000;
+
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = when / 1000000000ULL;
+		its.it_value.tv_nsec = when % 1000000000ULL;
+		return !timerfd_settime(m_timer_fh, TFD_TIMER_ABSTIME,
+					&its, NULL);
+	}
+
+	void AsyncProcess(SocketNotifier */*notp*/, int /*fh*/) {
+		uint64_t expirations, now, periods;
+		bool play_xrun = false;
+		bool rec_xrun;
+		ErrorInfo error;
+
+		if (read(m_timer_fh, &expirations, sizeof(expirations)) < 0) {
+			if (errno == EAGAIN)
+				return;
+			m_ei->LogWarn(&error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+				      "Virtual: read timer: %s",
+				      strerror(errno));
+			BufAbort(m_ei, error);
+			return;
+		}
+
+		/*
+		 * Count whole periods, as a card interrupts once per
+		 * period.  A late wakeup catches up on all of them.
+		 */
+		now = NowNs();
+		periods = (uint64_t) ((now - m_start_ns) / m_period_ns);
+		if (periods > m_ticks) {
+			periods -= m_ticks;
+			m_ticks += periods;
+		} else {
+			periods = 0;
+		}
+
+		if (!ArmTimer()) {
+			m_ei->LogWarn(&error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+				      "Virtual: arm timer: %s",
+				      strerror(errno));
+			BufAbort(m_ei, error);
+			return;
+		}
+
+		if (!periods)
+			return;
+
+		if (m_play) {
+			if ((periods * m_format.packet_samps) > m_hw_fill) {
+				/* Only report running dry, not staying dry */
+				if (m_hw_fill) {
+					m_ei->LogWarn("*** Virtual playback "
+						      "xrun ***");
+					play_xrun = true;
+				}
+				m_hw_fill = 0;
+			} else {
+				m_hw_fill -= (periods * m_format.packet_samps);
+			}
+		}
+
+		if (m_rec) {
+			m_in_pend += (periods * m_format.packet_samps);
+			BufPushInput(true);
+		}
+
+		rec_xrun = m_rec_xrun;
+		m_rec_xrun = false;
+		BufProcess(m_hw_fill, rec_xrun, play_xrun);
+	}
+
+	virtual bool SndAsyncStart(bool playback, bool capture,
+				   ErrorInfo *error) {
+		if (m_not) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_ALREADY_OPEN,
+					   "Streaming already in progress");
+			return false;
+		}
+		if (!playback && !capture) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_DUPLEX_MISMATCH,
+					   "Neither source nor sink mode "
+					   "requested");
+			return false;
+		}
+		if (playback && !m_play) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_DUPLEX_MISMATCH,
+					   "Device not open for playback");
+			return false;
+		}
+		if (capture && !m_rec) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_DUPLEX_MISMATCH,
+					   "Device not open for capture");
+			return false;
+		}
+
+		m_timer_fh = timerfd_create(CLOCK_MONOTONIC,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+		if (m_timer_fh < 0) {
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+				      "Virtual: create timer: %s",
+				      strerror(errno));
+			return false;
+		}
+
+		/* A fast clock (positive drift) has a shorter period */
+		m_period_ns = ((double) m_format.packet_samps * 1000000000.0) /
+			((double) m_format.samplerate *
+			 (1.0 + ((double) m_drift_ppm / 1000000.0)));
+		m_start_ns = NowNs();
+		m_ticks = 0;
+		m_in_pend = 0;
+		m_rec_xrun = false;
+		m_rand = m_seed;
+
+		if (!ArmTimer()) {
+			m_ei->LogWarn(error,
+				      LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				      LIBHFP_ERROR_SOUNDIO_SYSCALL,
+				      "Virtual: arm timer: %s",
+				      strerror(errno));
+			goto failed;
+		}
+
+		m_not = m_ei->NewSocket(m_timer_fh, false);
+		if (!m_not) {
+			if (error)
+				error->SetNoMem();
+			goto failed;
+		}
+		m_not->Register(this, &SoundIoVirtual::AsyncProcess);
+		return true;
+
+	failed:
+		close(m_timer_fh);
+		m_timer_fh = -1;
+		return false;
+	}
+
+	virtual void SndAsyncStop(void) {
+		BufStop();
+		BufClose();
+		if (m_not) {
+			delete m_not;
+			m_not = 0;
+		}
+		if (m_timer_fh >= 0) {
+			close(m_timer_fh);
+			m_timer_fh = -1;
+		}
+		m_hw_fill = 0;
+		m_in_pend = 0;
+	}
+
+	virtual bool SndIsAsyncStarted(void) const {
+		return (m_not != 0);
+	}
+};
+
+#define trim_leading_ws(X) do { 					\
+	while (*(X) && ((*(X) == ' ') || (*(X) == '\t'))) { (X)++; }	\
+	} while (0)
+
+#define trim_trailing_ws(X) do {					\
+		size_t siz = strlen(X);					\
+		while (siz && (((X)[siz - 1] == ' ') ||			\
+			       ((X)[siz - 1] == '\t'))) {		\
+			(X)[--siz] = '\0';				\
+		} } while(0)
+
+SoundIo *
+SoundIoCreateVirtual(DispatchInterface *dip, const char *driveropts,
+		     ErrorInfo *error)
+{
+	char *opts = 0, *tok, *save = 0, *tmp, *end;
+	const char *ind = 0, *outd = 0;
+	char *inp = 0, *outp = 0;
+	unsigned long rate = 0, packet = 0, jitter = 0, seed = 1;
+	long drift = 0;
+	SoundIo *vp = 0;
+
+	if (driveropts && driveropts[0]) {
+		opts = strdup(driveropts);
+		if (!opts) {
+			if (error)
+				error->SetNoMem();
+			return 0;
+		}
+	}
+
+	tok = opts ? strtok_r(opts, "&", &save) : 0;
+	while (tok) {
+		trim_leading_ws(tok);
+		tmp = strchr(tok, '=');
+		if (!tmp) {
+			dip->LogWarn("Virtual: unrecognized option \"%s\"",
+				     tok);
+			tok = strtok_r(NULL, "&", &save);
+			continue;
+		}
+		*(tmp++) = '\0';
+		trim_trailing_ws(tok);
+		trim_leading_ws(tmp);
+		trim_trailing_ws(tmp);
+
+		end = 0;
+		if (!strcmp(tok, "in"))
+			ind = tmp;
+		else if (!strcmp(tok, "out"))
+			outd = tmp;
+		else if (!strcmp(tok, "rate"))
+			rate = strtoul(tmp, &end, 0);
+		else if (!strcmp(tok, "packet"))
+			packet = strtoul(tmp, &end, 0);
+		else if (!strcmp(tok, "jitter"))
+			jitter = strtoul(tmp, &end, 0);
+		else if (!strcmp(tok, "drift"))
+			drift = strtol(tmp, &end, 0);
+		else if (!strcmp(tok, "seed"))
+			seed = strtoul(tmp, &end, 0);
+		else {
+			dip->LogWarn("Virtual: unrecognized option \"%s\"",
+				     tok);
+			tok = strtok_r(NULL, "&", &save);
+			continue;
+		}
+
+		if (end && (!*tmp || *end)) {
+			if (error)
+				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+					   LIBHFP_ERROR_SOUNDIO_INVALID,
+					   "Virtual: invalid value for "
+					   "\"%s\"", tok);
+			goto failed;
+		}
+
+		tok = strtok_r(NULL, "&", &save);
+	}
+
+	/* Beyond 10% the pump's drift compensation gives up anyway */
+	if ((drift > 100000) || (drift < -100000)) {
+		if (error)
+			error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+				   LIBHFP_ERROR_SOUNDIO_INVALID,
+				   "Virtual: drift of %ld ppm out of range",
+				   drift);
+		goto failed;
+	}
+
+	if ((ind && ind[0] && !(inp = strdup(ind))) ||
+	    (outd && outd[0] && !(outp = strdup(outd)))) {
+		if (error)
+			error->SetNoMem();
+		goto failed;
+	}
+
+	vp = new SoundIoVirtual(dip, rate, packet, jitter, drift, seed,
+				inp, outp);
+	if (!vp) {
+		if (error)
+			error->SetNoMem();
+		goto failed;
+	}
+	inp = outp = 0;
+
+failed:
+	if (inp)
+		free(inp);
+	if (outp)
+		free(outp);
+	if (opts)
+		free(opts);
+	return vp;
+}
+
+SoundIoDeviceList *
+SoundIoGetDeviceListVirtual(ErrorInfo *error)
+{
+	SoundIoDeviceList *infop;
+
+	infop = new SoundIoDeviceList;
+	if (!infop) {
+		if (error)
+			error->SetNoMem();
+		return 0;
+	}
+
+	if (!infop->Add("", "Silence, output discarded") ||
+	    !infop->Add("jitter=2000&drift=100",
+			"Silence, with timer jitter and clock drift")) {
+		delete infop;
+		if (error)
+			error->SetNoMem();
+		return 0;
+	}
+
+	return infop;
+}
+
+#else  /* defined(HAVE_SYS_TIMERFD_H) */
+SoundIo *
+SoundIoCreateVirtual(DispatchInterface *dip, const char *driveropts,
+		     ErrorInfo *error)
+{
+	if (error)
+		error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			   LIBHFP_ERROR_SOUNDIO_NOT_SUPPORTED,
+			   "Support for virtual sound card omitted");
+	return 0;
+}
+SoundIoDeviceList *
+SoundIoGetDeviceListVirtual(ErrorInfo *error)
+{
+	if (error)
+		error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			   LIBHFP_ERROR_SOUNDIO_NOT_SUPPORTED,
+			   "Support for virtual sound card omitted");
+	return 0;
+}
+#endif  /* defined(HAVE_SYS_TIMERFD_H) */
+
+} /* namespace libhfp */
@@ -1531,6 +1531,8 @@ public:
 			cs.readDoubleEntry("/nh/signalproc/dereverb_level", 0);
 		m_sigproc_props.dereverb_decay =
 			cs.readDoubleEntry("/nh/signalproc/dereverb_decay", 0);
+		m_sigproc_props.gate_level =
+			cs.readNumEntry("/nh/signalproc/gate_level", 64);
 
 		/* Alerting */
 		m_ringtone_filename =
@@ -1592,6 +1594,8 @@ public:
 			      m_sigproc_props.dereverb_level);
 		cs.writeEntry("/nh/signalproc/dereverb_decay",
 			      m_sigproc_props.dereverb_decay);
+		cs.writeEntry("/nh/signalproc/gate_level",
+			      m_sigproc_props.gate_level);
 
 		/* Alerting */
 		cs.writeEntry("/nh/alerting/ringtonefile",
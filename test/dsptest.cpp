@@ -0,0 +1,340 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Unit test for the sample processing kernels
+ * Each vectorized implementation supported by the CPU is checked
+ * against the scalar implementation, including unaligned buffers and
+ * odd lengths, and the G.711 tables are checked for round trips.  The
+ * record kernels specialized by format are checked against the generic
+ * ones.  The polyphase resampler is checked for pass band gain, alias
+ * rejection, and independence from how its input is divided up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/soundio-dsp.h>
+
+using namespace libhfp;
+
+#define NSAMPS 1027
+
+static int failures;
+
+static void
+Fail(const char *impl, const char *what, size_t off)
+{
+	fprintf(stderr, "[%s] %s mismatch at sample %d\n",
+		impl, what, (int) off);
+	failures++;
+}
+
+static void
+FillRandom(uint8_t *buf, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++)
+		buf[i] = random();
+	/* Make sure the extremes are covered */
+	buf[0] = 0x00; buf[1] = 0x80;
+	buf[2] = 0xff; buf[3] = 0x7f;
+}
+
+static void
+CheckImpl(SoundIoDspKernels const *ref, SoundIoDspKernels const *kp)
+{
+	int16_t a[NSAMPS + 1], b[NSAMPS + 1], c[NSAMPS + 1];
+	int16_t *ap, *bp;
+	uint8_t ua[NSAMPS + 1], ub[NSAMPS + 1], uc[NSAMPS + 1];
+	SoundIoDspLevel l1, l2;
+	size_t i, n, off;
+	unsigned int gain;
+
+	for (off = 0; off < 2; off++) {
+		for (n = 0; n <= (NSAMPS - off); n += (n < 40) ? 1 : 97) {
+			FillRandom((uint8_t *) a, sizeof(a));
+			FillRandom((uint8_t *) b, sizeof(b));
+			ap = &a[off];
+			bp = &b[off];
+
+			memcpy(c, a, sizeof(c));
+			ref->mix_s16(&c[off], bp, n);
+			kp->mix_s16(ap, bp, n);
+			for (i = 0; i < n; i++)
+				if (ap[i] != c[off + i])
+					Fail(kp->name, "mix_s16", i);
+
+			FillRandom(ua, sizeof(ua));
+			FillRandom(ub, sizeof(ub));
+			memcpy(uc, ua, sizeof(uc));
+			ref->mix_u8(&uc[off], &ub[off], n);
+			kp->mix_u8(&ua[off], &ub[off], n);
+			if (memcmp(ua, uc, sizeof(ua)))
+				Fail(kp->name, "mix_u8", n);
+
+			gain = random() % (SIO_DSP_GAIN_MAX + 1);
+			memcpy(c, a, sizeof(c));
+			ref->gain_s16(&c[off], n, gain);
+			kp->gain_s16(ap, n, gain);
+			for (i = 0; i < n; i++)
+				if (ap[i] != c[off + i])
+					Fail(kp->name, "gain_s16", i);
+
+			memset(&l1, 0, sizeof(l1));
+			memset(&l2, 0, sizeof(l2));
+			ref->level_s16(ap, n, l1);
+			kp->level_s16(ap, n, l2);
+			if ((l1.peak != l2.peak) ||
+			    (l1.sum_sq != l2.sum_sq) ||
+			    (l1.count != l2.count))
+				Fail(kp->name, "level_s16", n);
+		}
+	}
+}
+
+static void
+CheckLaw(sio_sampletype_t type, const char *name)
+{
+	uint8_t enc[256], enc2[256];
+	int16_t dec[256];
+	int i;
+
+	for (i = 0; i < 256; i++)
+		enc[i] = i;
+
+	/* Every code must survive decode and re-encode */
+	SoundIoDspConvert(SIO_PCM_S16_LE, (uint8_t *) dec, type, enc, 256);
+	SoundIoDspConvert(type, enc2, SIO_PCM_S16_LE, (uint8_t *) dec, 256);
+	for (i = 0; i < 256; i++) {
+		if ((enc[i] != enc2[i]) &&
+		    /* Mu-law has two codes for zero */
+		    !((type == SIO_PCM_MU_LAW) && !dec[i]))
+			Fail(name, "round trip", i);
+	}
+
+	/* Silence must decode to the smallest magnitude, A-law has no 0 */
+	SoundIoDspSilence(type, enc, 1);
+	SoundIoDspConvert(SIO_PCM_S16_LE, (uint8_t *) dec, type, enc, 1);
+	if ((dec[0] < -8) || (dec[0] > 8))
+		Fail(name, "silence", 0);
+}
+
+static void
+CheckRecord(sio_sampletype_t type, const char *name)
+{
+	SoundIoDspRecordKernels const *gen, *kp;
+	uint8_t src[4 * (NSAMPS + 2)], a[4 * NSAMPS], b[4 * NSAMPS];
+	unsigned int nch, bpr;
+	uint32_t step;
+	size_t n;
+
+	gen = SoundIoDspGetRecordKernels(type, 1, true);
+	assert(gen && !gen->nchannels);
+
+	for (nch = 1; nch <= 2; nch++) {
+		kp = SoundIoDspGetRecordKernels(type, nch);
+		if (!kp || (kp->nchannels != nch)) {
+			Fail(name, "specialized lookup", nch);
+			continue;
+		}
+		bpr = nch * ((type == SIO_PCM_S16_LE) ? 2 : 1);
+
+		for (n = 0; n <= NSAMPS; n += (n < 40) ? 1 : 97) {
+			FillRandom(src, sizeof(src));
+			FillRandom(a, sizeof(a));
+			memcpy(b, a, sizeof(b));
+			gen->fill(a, src, bpr, n);
+			kp->fill(b, src, bpr, n);
+			if (memcmp(a, b, sizeof(a)))
+				Fail(name, "fill", n);
+
+			if (!gen->interp || !kp->interp)
+				continue;
+
+			/* Stay within the source, one record of slack */
+			step = (1 << SIO_DSP_INTERP_SHIFT) -
+				(random() % (1 << (SIO_DSP_INTERP_SHIFT - 7)));
+			memcpy(b, a, sizeof(b));
+			gen->interp(a, src, n, 12345, step, nch);
+			kp->interp(b, src, n, 12345, step, nch);
+			if (memcmp(a, b, sizeof(a)))
+				Fail(name, "interp", n);
+		}
+	}
+}
+
+/*
+ * Tone at one eighth of the sample rate, from the recurrence
+ * s[n] = 2cos(w)s[n-1] - s[n-2], so that no libm is needed
+ */
+static void
+FillTone(int16_t *buf, size_t nrecs, unsigned int nch, double amp)
+{
+	const double c = 0.70710678118654752;
+	double s0 = 0, s1 = amp * c, s2;
+	size_t i;
+	unsigned int j;
+
+	for (i = 0; i < nrecs; i++) {
+		for (j = 0; j < nch; j++)
+			*(buf++) = (int16_t) ((s0 >= 0) ? (s0 + 0.5) :
+					      (s0 - 0.5));
+		s2 = (2 * c * s1) - s0;
+		s0 = s1;
+		s1 = s2;
+	}
+}
+
+/* Mean square of the given records, skipping the filter's settling */
+static double
+MeanSquare(const int16_t *buf, size_t start, size_t end)
+{
+	double sum = 0;
+	size_t i;
+
+	for (i = start; i < end; i++)
+		sum += (double) buf[i] * buf[i];
+	return sum / (end - start);
+}
+
+static void
+CheckResample(void)
+{
+	SoundIoDspResampler up, down, rs;
+	static int16_t a[NSAMPS * 2], b[NSAMPS * 12], c[NSAMPS * 2];
+	static int16_t d[NSAMPS * 2];
+	double in, out;
+	size_t i, n, na, nb;
+
+	/* Unsupported ratios */
+	if (rs.Configure(2, 3, 1) || rs.Configure(13, 1, 1) ||
+	    rs.Configure(1, 0, 1) || rs.Configure(1, 2, 0))
+		Fail("resampler", "bad ratio", 0);
+
+	/* 1kHz at 8kHz, to 48kHz and back, keeps its level */
+	FillTone(a, 1024, 1, 16000);
+	if (!up.Configure(6, 1, 1) || !down.Configure(1, 6, 1))
+		Fail("resampler", "configure", 0);
+	nb = up.Process(b, a, 1024);
+	if (nb != (1024 * 6))
+		Fail("resampler", "interpolated count", nb);
+	na = down.Process(c, b, nb);
+	if (na != 1024)
+		Fail("resampler", "decimated count", na);
+	in = MeanSquare(a, 0, 1024);
+	out = MeanSquare(c, 64, 1024);
+	if ((out < (in * 0.95)) || (out > (in * 1.05)))
+		Fail("resampler", "pass band", (size_t) (100 * out / in));
+
+	/* 6kHz at 48kHz is rejected when going to 8kHz */
+	FillTone(b, 6144, 1, 16000);
+	down.Reset();
+	na = down.Process(c, b, 6144);
+	in = MeanSquare(b, 0, 6144);
+	out = MeanSquare(c, 64, na);
+	if (out > (in * 0.0001))
+		Fail("resampler", "stop band", (size_t) (1000000 * out / in));
+
+	/*
+	 * Stereo decimation of random data in random pieces matches
+	 * mono decimation of each channel in one piece
+	 */
+	FillRandom((uint8_t *) a, sizeof(a));
+	if (!rs.Configure(1, 3, 2))
+		Fail("resampler", "configure", 0);
+	nb = 0;
+	for (i = 0; i < NSAMPS; i += n) {
+		n = random() % 300;
+		if (n > (NSAMPS - i))
+			n = NSAMPS - i;
+		na = rs.OutputCount(n);
+		if (rs.Process(b + (nb * 2), a + (i * 2), n) != na)
+			Fail("resampler", "output count", i);
+		nb += na;
+	}
+	if (nb != ((NSAMPS + 2) / 3))
+		Fail("resampler", "total count", nb);
+
+	for (i = 0; i < 2; i++) {
+		for (n = 0; n < NSAMPS; n++)
+			c[n] = a[(n * 2) + i];
+		rs.Configure(1, 3, 1);
+		na = rs.Process(d, c, NSAMPS);
+		for (n = 0; n < na; n++) {
+			if (d[n] != b[(n * 2) + i]) {
+				Fail("resampler", "stereo", n);
+				break;
+			}
+		}
+	}
+
+	/* Mono to stereo and back is lossless */
+	SoundIoDspRemix(b, 2, a, 1, NSAMPS);
+	SoundIoDspRemix(c, 1, b, 2, NSAMPS);
+	if (memcmp(a, c, NSAMPS * sizeof(*a)) || (b[0] != b[1]))
+		Fail("remix", "round trip", 0);
+	if (SoundIoDspRemix(c, 2, b, 3, 1))
+		Fail("remix", "unsupported", 0);
+}
+
+int
+main(int /*argc*/, char **/*argv*/)
+{
+	static const char *impls[] = { "sse2", "avx2", "neon" };
+	SoundIoDspKernels const *ref, *kp;
+	SoundIoDspLevel lev;
+	int16_t samp[4] = { -32768, 32767, 0, 0 };
+	unsigned int i;
+
+	ref = SoundIoDspSelect("scalar");
+	assert(ref);
+
+	for (i = 0; i < (sizeof(impls) / sizeof(impls[0])); i++) {
+		kp = SoundIoDspSelect(impls[i]);
+		if (!kp) {
+			printf("%s: not supported\n", impls[i]);
+			continue;
+		}
+		CheckImpl(ref, kp);
+		printf("%s: checked\n", impls[i]);
+	}
+
+	CheckLaw(SIO_PCM_A_LAW, "alaw");
+	CheckLaw(SIO_PCM_MU_LAW, "ulaw");
+
+	CheckRecord(SIO_PCM_U8, "u8 records");
+	CheckRecord(SIO_PCM_S16_LE, "s16 records");
+	CheckRecord(SIO_PCM_A_LAW, "alaw records");
+
+	CheckResample();
+
+	memset(&lev, 0, sizeof(lev));
+	SoundIoDspMeasure(SIO_PCM_S16_LE, (uint8_t *) samp, 4, lev);
+	if ((lev.peak != 32768) || (lev.Rms() != 23170))
+		Fail("scalar", "peak/rms", 0);
+
+	kp = SoundIoDspSelect(0);
+	printf("selected: %s\n", kp->name);
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,321 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Test for SoundIoMixer
+ * Synthetic clocked members each produce a constant level, and the
+ * mixed input is checked for their sum.  Output written to the mixer
+ * is checked for arriving at each member.  Members are added, drift,
+ * and stop while the mixer is streaming.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+
+#include "testep.h"
+
+using namespace libhfp;
+
+#define PACKET		40
+
+/* Queue one packet of a constant level as member input */
+static void
+Produce(SoundIoTestEp *ep, int16_t level, sio_sampnum_t count = PACKET)
+{
+	int16_t *bufp;
+	sio_sampnum_t i;
+
+	bufp = (int16_t *) ep->m_source_buf.GetSpace(count * 2);
+	assert(bufp);
+	for (i = 0; i < count; i++)
+		bufp[i] = level;
+	ep->m_source_buf.m_end += (count * 2);
+}
+
+/* Check, then discard, everything written to a member */
+static bool
+Consume(SoundIoTestEp *ep, int16_t level)
+{
+	const int16_t *bufp;
+	size_t i, count;
+	bool res = true;
+
+	bufp = (const int16_t *) ep->m_sink_buf.GetStart();
+	count = ep->m_sink_buf.SpaceUsed() / 2;
+	for (i = 0; i < count; i++) {
+		if (bufp[i] != level)
+			res = false;
+	}
+	ep->m_sink_buf.m_start = ep->m_sink_buf.m_end = 0;
+	return res;
+}
+
+/*
+ * Stands in for SoundIoPump: each time the mixer is clocked, take all
+ * of its input, and write a packet of output.
+ */
+class MixClient {
+public:
+	SoundIoMixer	*m_mix;
+	int16_t		m_level;
+	sio_sampnum_t	m_count;
+	sio_sampnum_t	m_bad;
+	int		m_notified;
+	int		m_stopped;
+	int		m_member_stops;
+	bool		m_remove_on_stop;
+
+	MixClient(SoundIoMixer *mixp)
+		: m_mix(mixp), m_level(0), m_count(0), m_bad(0),
+		  m_notified(0), m_stopped(0), m_member_stops(0),
+		  m_remove_on_stop(true) {
+		mixp->cb_NotifyPacket.Register(this, &MixClient::Notify);
+		mixp->cb_NotifyAsyncStop.Register(this, &MixClient::Stopped);
+		mixp->cb_NotifyMemberStop.Register(this,
+						   &MixClient::MemberStop);
+	}
+
+	void Expect(int16_t level) {
+		m_level = level;
+		m_count = 0;
+		m_bad = 0;
+	}
+
+	void Notify(SoundIo *siop, SoundIoQueueState &qs) {
+		SoundIoBuffer buf;
+		const int16_t *samps;
+		sio_sampnum_t i;
+
+		assert(siop == m_mix);
+		m_notified++;
+		while (1) {
+			buf.m_size = 0;
+			m_mix->SndGetIBuf(buf);
+			if (!buf.m_size)
+				break;
+			samps = (const int16_t *) buf.m_data;
+			for (i = 0; i < buf.m_size; i++) {
+				if (samps[i] != m_level)
+					m_bad++;
+			}
+			m_count += buf.m_size;
+			m_mix->SndDequeueIBuf(buf.m_size);
+		}
+
+		buf.m_size = PACKET;
+		m_mix->SndGetOBuf(buf);
+		assert(buf.m_size == PACKET);
+		for (i = 0; i < buf.m_size; i++)
+			((int16_t *) buf.m_data)[i] = 500;
+		m_mix->SndQueueOBuf(buf.m_size);
+	}
+
+	void Stopped(SoundIo *siop, ErrorInfo &) {
+		assert(siop == m_mix);
+		m_stopped++;
+	}
+
+	void MemberStop(SoundIoMixer *mixp, SoundIo *memberp, ErrorInfo &) {
+		assert(mixp == m_mix);
+		m_member_stops++;
+		if (m_remove_on_stop)
+			mixp->RemoveMember(memberp);
+	}
+};
+
+static SoundIoTestEp *
+NewMember(const char *name)
+{
+	return NewTestEp(name, PACKET, PACKET * 64);
+}
+
+/* Simulate a remote disconnection */
+static void
+Disconnect(SoundIoTestEp *ep)
+{
+	ErrorInfo error;
+
+	error.Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+		  LIBHFP_ERROR_SOUNDIO_SOUNDCARD_FAILED,
+		  "Test disconnection");
+	ep->SndAsyncStop();
+	ep->cb_NotifyAsyncStop(ep, error);
+}
+
+int
+main(int /*argc*/, char **/*argv*/)
+{
+	SoundIoTestEp *a, *b, *c, *u8ep;
+	SoundIoMixerStatistics stat;
+	SoundIoFormat fmt;
+	SoundIoMixer *mixp;
+	MixClient *client;
+	ErrorInfo error;
+	bool res, outok;
+	int i;
+
+	a = NewMember("A");
+	b = NewMember("B");
+	c = NewMember("C");
+
+	mixp = SoundIoCreateMixer();
+	assert(mixp);
+	client = new MixClient(mixp);
+
+	res = mixp->AddMember(a) && mixp->AddMember(b);
+	assert(res);
+	Expect("member count", mixp->GetMemberCount(), 2);
+
+	/* A member with a different format must be refused */
+	u8ep = NewMember("U8");
+	u8ep->SndGetFormat(fmt);
+	u8ep->SndClose();
+	fmt.sampletype = SIO_PCM_U8;
+	fmt.bytes_per_record = 1;
+	u8ep->SndSetFormat(fmt);
+	Expect("format mismatch", mixp->AddMember(u8ep, &error), false);
+	Expect("format mismatch code",
+	       error.Matches(LIBHFP_ERROR_SUBSYS_SOUNDIO,
+			     LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH), true);
+	delete u8ep;
+
+	res = mixp->SndOpen(true, true) && mixp->SndAsyncStart(true, true);
+	assert(res);
+
+	/*
+	 * Two members: B is clocked just after A, and is mixed in once
+	 * it reaches its fill level.
+	 */
+	outok = true;
+	for (i = 0; i < 50; i++) {
+		if (i == 10)
+			client->Expect(1000 + 2000);
+		Produce(a, 1000);
+		a->DoAsync();
+		Produce(b, 2000);
+		b->DoAsync();
+		if (i >= 10)
+			outok = Consume(a, 500) && Consume(b, 500) && outok;
+		else {
+			Consume(a, 500);
+			Consume(b, 500);
+		}
+	}
+	Expect("mix of two", client->m_bad, 0);
+	Expect("mix of two count", client->m_count, 40 * PACKET);
+	Expect("fan out to two", outok, true);
+
+	/* Add C while streaming, its level saturates the mix */
+	res = mixp->AddMember(c);
+	assert(res);
+	outok = true;
+	for (i = 0; i < 50; i++) {
+		if (i == 10)
+			client->Expect(32767);
+		Produce(a, 1000);
+		a->DoAsync();
+		Produce(b, 2000);
+		b->DoAsync();
+		Produce(c, 30000);
+		c->DoAsync();
+		outok = Consume(a, 500) && Consume(b, 500) &&
+			Consume(c, 500) && outok;
+	}
+	Expect("saturated mix", client->m_bad, 0);
+	Expect("fan out to three", outok, true);
+	mixp->GetMemberStatistics(c, stat);
+	Expect("C in padded", stat.in_padded, 0);
+
+	/* B runs fast, and must be held to its fill level */
+	client->Expect(32767);
+	for (i = 0; i < 100; i++) {
+		Produce(a, 1000);
+		a->DoAsync();
+		Produce(b, 2000, (i % 4) ? PACKET : (2 * PACKET));
+		b->DoAsync();
+		Produce(c, 30000);
+		c->DoAsync();
+		Consume(a, 500);
+		Consume(b, 500);
+		Consume(c, 500);
+	}
+	Expect("fast member mix", client->m_bad, 0);
+	mixp->GetMemberStatistics(b, stat);
+	if (!stat.in_dropped) {
+		fprintf(stderr, "fast member: no input dropped\n");
+		failures++;
+	}
+	if (b->m_source_buf.SpaceUsed()) {
+		fprintf(stderr, "fast member: input left behind\n");
+		failures++;
+	}
+
+	/* B disconnects, the mix continues without it */
+	Disconnect(b);
+	Expect("member stops", client->m_member_stops, 1);
+	Expect("member count after stop", mixp->GetMemberCount(), 2);
+	client->Expect(1000 + 30000);
+	for (i = 0; i < 10; i++) {
+		Produce(a, 1000);
+		a->DoAsync();
+		Produce(c, 30000);
+		c->DoAsync();
+	}
+	Expect("mix after stop", client->m_bad, 0);
+	Expect("mix after stop count", client->m_count, 10 * PACKET);
+
+	/* The lead disconnects, C takes over the clock */
+	client->m_remove_on_stop = false;
+	Disconnect(a);
+	Expect("lead stops", client->m_member_stops, 2);
+	Expect("lead stop keeps mixer", mixp->SndIsAsyncStarted(), true);
+	client->Expect(30000);
+	i = client->m_notified;
+	Produce(c, 30000);
+	c->DoAsync();
+	Expect("new lead clocks", client->m_notified, i + 1);
+	Expect("new lead mix", client->m_bad, 0);
+	/* C's buffered input is delivered along with the new packet */
+	Expect("new lead count", client->m_count >= PACKET, true);
+
+	/* The last member disconnects, the mixer stops */
+	Disconnect(c);
+	Expect("last stops", client->m_member_stops, 3);
+	Expect("mixer stopped", client->m_stopped, 1);
+	Expect("mixer not async", mixp->SndIsAsyncStarted(), false);
+
+	mixp->SndClose();
+	mixp->RemoveMember(a);
+	mixp->RemoveMember(c);
+	Expect("member count at end", mixp->GetMemberCount(), 0);
+
+	delete client;
+	delete mixp;
+	delete a;
+	delete b;
+	delete c;
+
+	return TestResult();
+}
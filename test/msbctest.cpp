@@ -0,0 +1,195 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Loopback test for the mSBC codec
+ * A test signal is encoded, the packet stream is delivered to the
+ * decoder in SCO MTU-sized pieces, and the output is compared with the
+ * input.  The stream is then damaged in various ways, and the decoder
+ * is checked for keeping its output clocked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <libhfp/soundio-msbc.h>
+
+#include "testep.h"
+
+using namespace libhfp;
+
+#define NFRAMES		200
+#define NSAMPS		(NFRAMES * SoundIoMsbc::MSBC_PCM_SAMPS)
+#define PKTSIZE		SoundIoMsbc::MSBC_PACKET_SIZE
+
+/* Combined delay of the analysis and synthesis filter banks */
+#define CODEC_DELAY	73
+
+/* Minimum acceptable signal-to-noise ratio, as a power ratio: 20dB */
+#define MIN_SNR		100
+
+
+static int16_t s_in[NSAMPS];
+static int16_t s_out[NSAMPS + (4 * SoundIoMsbc::MSBC_PCM_SAMPS)];
+static uint8_t s_stream[(NFRAMES + 2) * PKTSIZE];
+
+/* Sine approximation, to avoid dragging in libm */
+static int
+Tone(unsigned int phase, int amp)
+{
+	int x, y;
+
+	/* phase is 0-65535 for one period, parabolic approximation */
+	x = (int) (phase & 0xffff) - 32768;
+	y = (x * (32768 - ((x < 0) ? -x : x))) >> 15;
+	return -((y * amp) >> 13);
+}
+
+static void
+MakeSignal(void)
+{
+	unsigned int i;
+	int v;
+
+	for (i = 0; i < NSAMPS; i++) {
+		v = Tone(i * 2867, 6000);		/* 700Hz */
+		v += Tone(i * 7782, 3000);		/* 1900Hz */
+		v += Tone(i * 25395, 1500);		/* 6200Hz */
+		v += (random() % 512) - 256;
+		s_in[i] = v;
+	}
+}
+
+static size_t
+EncodeAll(SoundIoMsbc &codec, uint8_t *stream)
+{
+	int i;
+
+	for (i = 0; i < NFRAMES; i++)
+		codec.Encode(&s_in[i * SoundIoMsbc::MSBC_PCM_SAMPS],
+			     &stream[i * PKTSIZE]);
+	return NFRAMES * PKTSIZE;
+}
+
+static int
+DecodeAll(SoundIoMsbc &codec, const uint8_t *stream, size_t len,
+	  size_t mtu)
+{
+	const uint8_t *p;
+	size_t plen;
+	int nframes = 0;
+
+	while (len) {
+		p = stream;
+		plen = (len < mtu) ? len : mtu;
+		stream += plen;
+		len -= plen;
+		while (codec.Decode(p, plen,
+			    &s_out[nframes * SoundIoMsbc::MSBC_PCM_SAMPS])) {
+			nframes++;
+			assert(nframes <= (NFRAMES + 4));
+		}
+		assert(!plen);
+	}
+	return nframes;
+}
+
+static void
+CheckQuality(const char *what)
+{
+	double sig = 0, noise = 0, d;
+	int i;
+
+	/* Skip the first frame while the filter banks fill */
+	for (i = SoundIoMsbc::MSBC_PCM_SAMPS; i < NSAMPS - CODEC_DELAY; i++) {
+		d = s_in[i];
+		sig += d * d;
+		d -= s_out[i + CODEC_DELAY];
+		noise += d * d;
+	}
+
+	printf("%s: SNR %.1f:1\n", what, noise ? (sig / noise) : 0);
+	if (!noise || ((sig / noise) < MIN_SNR))
+		Fail("%s: poor SNR", what);
+}
+
+int
+main(int /*argc*/, char **/*argv*/)
+{
+	SoundIoMsbc enc, dec;
+	size_t len;
+	int n;
+
+	MakeSignal();
+
+	/* Clean round trip, as various SCO MTUs */
+	len = EncodeAll(enc, s_stream);
+	n = DecodeAll(dec, s_stream, len, 24);
+	Expect("mtu 24 frames", n, NFRAMES);
+	Expect("mtu 24 concealed", dec.GetConcealCount(), 0);
+	CheckQuality("mtu 24");
+
+	enc.Reset();
+	dec.Reset();
+	len = EncodeAll(enc, s_stream);
+	n = DecodeAll(dec, s_stream, len, 48);
+	Expect("mtu 48 frames", n, NFRAMES);
+	CheckQuality("mtu 48");
+
+	enc.Reset();
+	dec.Reset();
+	len = EncodeAll(enc, s_stream);
+	n = DecodeAll(dec, s_stream, len, PKTSIZE);
+	Expect("mtu 60 frames", n, NFRAMES);
+	CheckQuality("mtu 60");
+
+	/* A dropped packet must be detected by its sequence number */
+	enc.Reset();
+	dec.Reset();
+	len = EncodeAll(enc, s_stream);
+	memmove(&s_stream[50 * PKTSIZE], &s_stream[51 * PKTSIZE],
+		len - (51 * PKTSIZE));
+	len -= PKTSIZE;
+	n = DecodeAll(dec, s_stream, len, 48);
+	Expect("dropped frames", n, NFRAMES);
+	Expect("dropped concealed", dec.GetConcealCount(), 1);
+
+	/* A corrupted scale factor must fail the CRC check */
+	enc.Reset();
+	dec.Reset();
+	len = EncodeAll(enc, s_stream);
+	s_stream[(80 * PKTSIZE) + 6] ^= 0x10;
+	n = DecodeAll(dec, s_stream, len, 24);
+	Expect("corrupt frames", n, NFRAMES);
+	Expect("corrupt concealed", dec.GetConcealCount(), 1);
+
+	/* A packet of garbage must produce a concealment frame */
+	enc.Reset();
+	dec.Reset();
+	memset(s_stream, 0, PKTSIZE);
+	len = EncodeAll(enc, &s_stream[PKTSIZE]) + PKTSIZE;
+	n = DecodeAll(dec, s_stream, len, 24);
+	Expect("garbage frames", n, NFRAMES + 1);
+	Expect("garbage concealed", dec.GetConcealCount(), 1);
+
+	return TestResult();
+}
@@ -0,0 +1,330 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Benchmark for the SoundIoPump hot path
+ * Two synthetic clocked endpoints are pumped through a configurable
+ * filter chain, with a configurable number of snooper endpoints.  Each
+ * packet notification, and the SoundIoPump processing it triggers, is
+ * timed.  The cost per sample, the number of heap allocations per
+ * packet, and the distribution of processing times are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+#include <libhfp/events-indep.h>
+
+#include "testep.h"
+
+using namespace libhfp;
+
+
+/*
+ * Count heap allocations by interposing on the C library allocator,
+ * which operator new also uses.
+ */
+#if defined(__GLIBC__)
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+}
+
+static unsigned long s_nallocs;
+
+extern "C" void *
+malloc(size_t size)
+{
+	s_nallocs++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *
+calloc(size_t nmemb, size_t size)
+{
+	s_nallocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+extern "C" void *
+realloc(void *ptr, size_t size)
+{
+	s_nallocs++;
+	return __libc_realloc(ptr, size);
+}
+#define HAVE_ALLOC_COUNT
+#endif
+
+static unsigned long
+AllocCount(void)
+{
+#if defined(HAVE_ALLOC_COUNT)
+	return s_nallocs;
+#else
+	return 0;
+#endif
+}
+
+static uint64_t
+NowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static int
+CompareU64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t *) a, vb = *(const uint64_t *) b;
+	return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
+}
+
+static uint64_t
+Percentile(const uint64_t *sorted, size_t count, unsigned int permille)
+{
+	size_t idx;
+	idx = (count * permille) / 1000;
+	if (idx >= count)
+		idx = count - 1;
+	return sorted[idx];
+}
+
+static void
+usage(const char *argv0)
+{
+	const char *bn;
+
+	bn = strrchr(argv0, '/');
+	if (!bn)
+		bn = argv0;
+	else
+		bn++;
+
+	fprintf(stderr,
+"Usage: %s [-n packets] [-p samples] [-r rate] [-c channels] [-t type]\n"
+"	[-f filters] [-x filters] [-e endpoints]\n"
+"Benchmark for the SoundIoPump audio path\n"
+"\n"
+"-n <count>	Number of packets to time (DEFAULT: 100000)\n"
+"-p <samples>	Samples per packet (DEFAULT: 128)\n"
+"-r <rate>	Sample rate (DEFAULT: 8000)\n"
+"-c <channels>	Number of channels (DEFAULT: 1)\n"
+"-t <type>	Sample type, s16 or u8 (DEFAULT: s16)\n"
+"-f <count>	Number of pass-through filters (DEFAULT: 0)\n"
+"-x <count>	Number of in-place processing filters (DEFAULT: 0)\n"
+"-e <count>	Number of snooper endpoints (DEFAULT: 0)\n"
+		"\n",
+		bn);
+}
+
+int
+main(int argc, char **argv)
+{
+	IndepEventDispatcher disp;
+	SoundIoFormat fmt;
+	SoundIoTestEp *bot, *top, **snoop_eps;
+	SoundIoFilter **flts;
+	SoundIoPump *pump;
+	uint64_t *lat, t0, t1, total;
+	unsigned long allocs;
+	unsigned int npackets = 100000, nwarm, packet = 128, rate = 8000;
+	unsigned int nchannels = 1, ndummy = 0, nxor = 0, nsnoop = 0;
+	unsigned int nflts, i, j;
+	size_t nlat;
+	bool s16 = true, res;
+	int c;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "hH?n:p:r:c:t:f:x:e:")) != -1) {
+		switch (c) {
+		case 'n':
+			npackets = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			packet = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			nchannels = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if (!strcmp(optarg, "s16"))
+				s16 = true;
+			else if (!strcmp(optarg, "u8"))
+				s16 = false;
+			else {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'f':
+			ndummy = strtoul(optarg, NULL, 0);
+			break;
+		case 'x':
+			nxor = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			nsnoop = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return (c == '?') ? 1 : 0;
+		}
+	}
+
+	if (!npackets || !packet || !rate || !nchannels) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fmt.samplerate = rate;
+	fmt.sampletype = s16 ? SIO_PCM_S16_LE : SIO_PCM_U8;
+	fmt.nchannels = nchannels;
+	fmt.bytes_per_record = nchannels * (s16 ? 2 : 1);
+	fmt.packet_samps = packet;
+
+	bot = new SoundIoTestEp("Bot", packet * 16);
+	top = new SoundIoTestEp("Top", packet * 16);
+	bot->m_check = false;
+	top->m_check = false;
+	bot->SndSetFormat(fmt);
+	top->SndSetFormat(fmt);
+
+	pump = new SoundIoPump(&disp, bot);
+	res = pump->SetTop(top);
+	assert(res);
+
+	nflts = ndummy + nxor + nsnoop;
+	flts = new SoundIoFilter *[nflts + 1];
+	snoop_eps = new SoundIoTestEp *[nsnoop + 1];
+	for (i = 0; i < nflts; i++) {
+		if (i < ndummy) {
+			flts[i] = SoundIoFltCreateDummy();
+		} else if (i < (ndummy + nxor)) {
+			flts[i] = new SoundIoTestXorFlt(0x5a, true);
+		} else {
+			j = i - (ndummy + nxor);
+			snoop_eps[j] = new SoundIoTestEp("Snoop", packet * 16);
+			snoop_eps[j]->m_check = false;
+			snoop_eps[j]->SndSetFormat(fmt);
+			flts[i] = SoundIoCreateSnooper(snoop_eps[j],
+						       true, true);
+		}
+		assert(flts[i]);
+		res = pump->AddBottom(flts[i]);
+		assert(res);
+	}
+
+	res = bot->SndOpen(true, true) && top->SndOpen(true, true);
+	assert(res);
+	res = pump->Start();
+	assert(res);
+
+	/* Let the pump settle before measuring */
+	nwarm = 1000;
+	nlat = 0;
+	lat = new uint64_t[npackets * 2];
+	total = 0;
+	allocs = 0;
+
+	for (i = 0; i < (nwarm + npackets); i++) {
+		if (i == nwarm)
+			allocs = AllocCount();
+
+		bot->FillOutput();
+		bot->ConsumeInput();
+		t0 = NowNs();
+		bot->DoAsync();
+		t1 = NowNs();
+		if (i >= nwarm) {
+			lat[nlat++] = t1 - t0;
+			total += t1 - t0;
+		}
+
+		top->FillOutput();
+		top->ConsumeInput();
+		t0 = NowNs();
+		top->DoAsync();
+		t1 = NowNs();
+		if (i >= nwarm) {
+			lat[nlat++] = t1 - t0;
+			total += t1 - t0;
+		}
+
+		for (j = 0; j < nsnoop; j++)
+			snoop_eps[j]->ConsumeInput();
+
+		if (!pump->IsStarted()) {
+			fprintf(stderr, "Pump stopped unexpectedly\n");
+			return 1;
+		}
+	}
+
+	allocs = AllocCount() - allocs;
+
+	pump->Stop();
+	bot->SndClose();
+	top->SndClose();
+
+	qsort(lat, nlat, sizeof(*lat), CompareU64);
+
+	printf("format: %u Hz, %s, %u ch, %u samples/packet\n",
+	       rate, s16 ? "s16" : "u8", nchannels, packet);
+	printf("filters: %u pass-through, %u in-place, %u snoopers\n",
+	       ndummy, nxor, nsnoop);
+	printf("packets: %u\n", npackets);
+	printf("ns/sample: %.2f\n",
+	       (double) total / ((double) npackets * packet));
+#if defined(HAVE_ALLOC_COUNT)
+	printf("allocs/packet: %.3f\n", (double) allocs / npackets);
+#else
+	printf("allocs/packet: not measured\n");
+#endif
+	printf("notify ns: p50 %llu p90 %llu p99 %llu p99.9 %llu max %llu\n",
+	       (unsigned long long) Percentile(lat, nlat, 500),
+	       (unsigned long long) Percentile(lat, nlat, 900),
+	       (unsigned long long) Percentile(lat, nlat, 990),
+	       (unsigned long long) Percentile(lat, nlat, 999),
+	       (unsigned long long) lat[nlat - 1]);
+
+	delete[] lat;
+	for (i = 0; i < nflts; i++) {
+		pump->RemoveFilter(flts[i]);
+		delete flts[i];
+	}
+	for (i = 0; i < nsnoop; i++)
+		delete snoop_eps[i];
+	delete[] flts;
+	delete[] snoop_eps;
+	delete pump;
+	delete bot;
+	delete top;
+	return 0;
+}
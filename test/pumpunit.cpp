@@ -25,328 +25,298 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include <libhfp/soundio.h>
 #include <libhfp/soundio-buf.h>
 #include <libhfp/events-indep.h>
 
+#include "testep.h"
+
 using namespace libhfp;
 
 
-class SoundIoTestEp : public SoundIo {
-public:
-	SoundIoFormat	m_fmt;
-	bool		m_do_sink, m_do_source;
-	bool		m_async_sink, m_async_source;
-	const char	*m_name;
-	sio_sampnum_t	m_buf_size;
-	bool		m_has_clock;
-	VarBuf		m_source_buf;
-	VarBuf		m_sink_buf;
-
-	uint8_t		m_source_seq;
-	uint8_t		m_sink_seq;
-
-	bool		m_source_overflow;
-	bool		m_sink_underflow;
-
-	SoundIoTestEp(const char *name, sio_sampnum_t bufsize)
-		: m_do_sink(false), m_do_source(false),
-		  m_async_sink(false), m_async_source(false),
-		  m_name(name), m_buf_size(bufsize), m_has_clock(true),
-		  m_source_overflow(false), m_sink_underflow(false) {}
-
-	~SoundIoTestEp() {
-		SndClose();
-	}
+void
+run_test(SoundIoPump *pump, SoundIoTestEp *bot, SoundIoTestEp *top,
+	 SoundIoTestEp *div)
+{
+	bool res;
+	int i;
 
-	virtual void SndGetFormat(SoundIoFormat &format) const {
-		format = m_fmt;
-	}
+	res = bot->SndOpen(true, true);
+	assert(res);
+	res = top->SndOpen(true, true);
+	assert(res);
+	res = pump->Start();
+	assert(res);
+	assert(bot->SndIsAsyncStarted());
 
-	virtual bool SndSetFormat(SoundIoFormat &format,
-				  ErrorInfo *error = 0) {
-		if ((m_do_sink || m_do_source) &&
-		    ((format.samplerate != m_fmt.samplerate) ||
-		     (format.sampletype != m_fmt.sampletype) ||
-		     (format.nchannels != m_fmt.nchannels))) {
-			error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
-				   LIBHFP_ERROR_SOUNDIO_FORMAT_MISMATCH,
-				   "Format mismatch");
-			return false;
-		}
-
-		m_fmt = format;
-		return true;
-	}
+	for (i = 0; i < 10000; i++) {
+		bot->FillOutput();
+		bot->ConsumeInput();
+		bot->DoAsync();
+	
+		top->FillOutput();
+		top->ConsumeInput();
+		top->DoAsync();
 
-	virtual void SndGetProps(SoundIoProps &props) const {
-		props.has_clock = m_has_clock;
-		props.does_source = m_do_source;
-		props.does_sink = m_do_sink;
-		props.does_loop = false;
-		props.remove_on_exhaust = true;
-		props.outbuf_size = m_source_buf.m_size;
-	}
+		if (div)
+			div->ConsumeInput();
 
-	virtual bool SndOpen(bool sink, bool source, ErrorInfo *error = 0) {
-		assert(!m_do_sink && !m_do_source);
-		if (sink) {
-			if (!m_sink_buf.AllocateBuffer(m_fmt.bytes_per_record *
-						       m_buf_size)) {
-				if (error)
-					error->SetNoMem();
-				return false;
-			}
-			m_sink_buf.m_start = 0;
-			m_sink_buf.m_end = 0;
-			m_sink_seq = 0;
-			m_do_sink = true;
-		}
-		if (source) {
-			if (!m_source_buf.AllocateBuffer(
-				    m_fmt.bytes_per_record * m_buf_size)) {
-				SndClose();
-				if (error)
-					error->SetNoMem();
-				return false;
-			}
-			m_source_buf.m_start = 0;
-			m_source_buf.m_end = 0;
-			m_source_seq = 0;
-			m_do_source = true;
-		}
-
-		m_source_overflow = false;
-		m_sink_underflow = false;
-		return true;
+		assert(pump->IsStarted());
 	}
 
-	virtual void SndClose(void) {
-		SndAsyncStop();
-		if (m_do_sink) {
-			m_sink_buf.FreeBuffer();
-			m_do_sink = false;
-		}
-		if (m_do_source) {
-			m_source_buf.FreeBuffer();
-			m_do_source = false;
-		}
-
-		m_source_overflow = false;
-		m_sink_underflow = false;
-	}
+	pump->Stop();
+	bot->SndClose();
+	top->SndClose();
+}
 
-	void FillOutput(void) {
-		uint8_t *bufp;
-		sio_sampnum_t i;
+/*
+ * Run a pair of unclocked memory buffers through a filter offline,
+ * and check that every sample made it through, padded out to a
+ * whole filter packet.
+ */
+void
+run_offline_test(DispatchInterface *dip)
+{
+	SoundIoTestXorFlt xorf(0x5a, true);
+	SoundIoPumpStatistics stat;
+	SoundIoFormat fmt;
+	SoundIoBuffer buf;
+	SoundIo *src, *dest;
+	SoundIoPump *pump;
+	sio_sampnum_t i, nsamps = 8037, npad;
+	bool res;
 
-		bufp = m_source_buf.GetSpace(m_fmt.packet_samps *
-					     m_fmt.bytes_per_record);
-		assert(bufp);
+	fmt.samplerate = 8000;
+	fmt.sampletype = SIO_PCM_U8;
+	fmt.nchannels = 1;
+	fmt.bytes_per_record = 1;
+	fmt.packet_samps = 160;
 
-		for (i = 0; i < m_fmt.packet_samps; i++) {
-			memset(bufp, m_source_seq, m_fmt.bytes_per_record);
-			bufp += m_fmt.bytes_per_record;
-			m_source_seq++;
-		}
+	/* Fill the source, then turn it around */
+	src = SoundIoCreateMembuf(&fmt, nsamps);
+	assert(src);
+	res = src->SndOpen(true, false);
+	assert(res);
+	buf.m_size = 0;
+	src->SndGetOBuf(buf);
+	assert(buf.m_size == nsamps);
+	for (i = 0; i < nsamps; i++)
+		buf.m_data[i] = i & 0xff;
+	src->SndQueueOBuf(nsamps);
+	res = src->SndOpen(false, true);
+	assert(res);
 
-		m_source_buf.m_end += (m_fmt.packet_samps *
-				       m_fmt.bytes_per_record);
-	}
+	dest = SoundIoCreateMembuf(&fmt, 2 * nsamps);
+	assert(dest);
+	res = dest->SndOpen(true, false);
+	assert(res);
 
-	void ConsumeInput(void) {
-		size_t nbytes = m_fmt.packet_samps * m_fmt.bytes_per_record;
-		if (m_sink_buf.SpaceUsed() < nbytes) {
-			m_sink_buf.m_start = 0;
-			m_sink_buf.m_end = 0;
-		} else {
-			m_sink_buf.m_start += nbytes;
-		}
-	}
+	memset(&stat, 0, sizeof(stat));
+	pump = new SoundIoPump(dip, src);
+	pump->SetStatistics(&stat);
+	res = pump->SetTop(dest) && pump->AddBottom(&xorf);
+	assert(res);
 
-	virtual void SndGetIBuf(SoundIoBuffer &fillme) {
-		if (!m_do_source || !m_source_buf.m_buf) {
-			fillme.m_size = 0;
-			return;
-		}
-		if (!fillme.m_size ||
-		    (fillme.m_size > (m_source_buf.SpaceUsed() /
-				      m_fmt.bytes_per_record))) {
-			fillme.m_size = (m_source_buf.SpaceUsed() /
-					 m_fmt.bytes_per_record);
-		}
-		fillme.m_data = m_source_buf.GetStart();
-	}
-	virtual void SndDequeueIBuf(sio_sampnum_t samps) {
-		if (samps > (m_source_buf.SpaceUsed() /
-			     m_fmt.bytes_per_record)) {
-			assert(!m_source_buf.SpaceUsed());
-			return;
-		}
-		m_source_buf.m_start += (samps * m_fmt.bytes_per_record);
-		assert(m_source_buf.m_start <= m_source_buf.m_end);
-		m_source_overflow = false;
-	}
-	virtual void SndGetOBuf(SoundIoBuffer &fillme) {
-		int nbytes;
-		if (!m_do_sink || !m_sink_buf.m_buf) {
-			fillme.m_size = 0;
-			return;
-		}
-		if (!fillme.m_size ||
-		    (fillme.m_size > (m_sink_buf.SpaceFree() /
-				      m_fmt.bytes_per_record))) {
-			fillme.m_size = (m_sink_buf.SpaceFree() /
-					 m_fmt.bytes_per_record);
-		}
-		nbytes = fillme.m_size * m_fmt.bytes_per_record;
-		fillme.m_data = m_sink_buf.GetSpace(nbytes);
-	}
+	/* Neither endpoint has a clock */
+	res = pump->Start();
+	assert(!res);
 
-	void CheckOBuf(const uint8_t *ibuf, size_t ilen) {
-		int subsamp, bpr, count = 0;
-		const uint8_t *buf;
-		size_t len;
-		bool last_mismatch = false;
-		int mismatch_count = 0;
-
-		buf = ibuf;
-		len = ilen;
-		bpr = m_fmt.bytes_per_record;
-		assert(!(len % bpr));
-
-		while (len) {
-			if (buf[0] != m_sink_seq) {
-				if (!last_mismatch) {
-					fprintf(stderr,
-						"[%s] Sample %d has "
-						"mismatching sequence number: "
-						"expect: 0x%02x got: 0x%02x\n",
-						m_name, count, m_sink_seq,
-						buf[0]);
-				}
-				m_sink_seq = buf[0];
-				last_mismatch = true;
-				mismatch_count++;
-			} else {
-				last_mismatch = false;
-			}
-
-			for (subsamp = 1; subsamp < bpr; subsamp++) {
-				if (buf[subsamp] != m_sink_seq) {
-					fprintf(stderr,
-						"[%s] Mismatched subsample at "
-						"position %d: "
-						"expect: 0x%02x got: 0x%02x\n",
-						m_name, subsamp, m_sink_seq,
-						buf[subsamp]);
-					mismatch_count++;
-				}
-			}
-
-			buf += bpr;
-			len -= bpr;
-			count++;
-			m_sink_seq++;
-		}
-	}
+	res = pump->RunOffline();
+	assert(res);
+	assert(!pump->IsStarted());
 
-	virtual void SndQueueOBuf(sio_sampnum_t samps) {
-		size_t xend = m_sink_buf.m_end;
+	/* 20ms packets, the last one padded */
+	npad = ((nsamps + 159) / 160) * 160;
+	assert(stat.process_count == npad);
 
-		m_sink_buf.m_end += (samps * m_fmt.bytes_per_record);
-		assert(m_sink_buf.m_end <= m_sink_buf.m_size);
+	res = dest->SndOpen(false, true);
+	assert(res);
+	buf.m_size = 0;
+	dest->SndGetIBuf(buf);
+	assert(buf.m_size == npad);
+	for (i = 0; i < nsamps; i++)
+		assert(buf.m_data[i] == ((i & 0xff) ^ 0x5a));
+
+	pump->RemoveFilter(&xorf);
+	delete pump;
+	delete dest;
+	delete src;
+}
 
-		/*
-		 * Analyze what was submitted
-		 */
-		if (samps) {
-			assert(m_sink_buf.SpaceUsed());
-			CheckOBuf(&m_sink_buf.m_buf[xend],
-				  m_sink_buf.m_end - xend);
-		}
+/* Test endpoint that counts the samples moved through it */
+class SoundIoCountEp : public SoundIoTestEp {
+public:
+	sio_sampnum_t	m_taken;
+	sio_sampnum_t	m_given;
 
-		m_sink_underflow = false;
+	SoundIoCountEp(const char *name, sio_sampnum_t bufsize)
+		: SoundIoTestEp(name, bufsize), m_taken(0), m_given(0) {
+		m_check = false;
 	}
 
-	virtual void SndGetQueueState(SoundIoQueueState &qs) {
-		qs.in_queued = m_do_source
-			? (m_source_buf.SpaceUsed() / m_fmt.bytes_per_record)
-			: 0;
-		qs.out_queued = m_do_sink
-			? (m_sink_buf.SpaceUsed() / m_fmt.bytes_per_record)
-			: 0;
-		qs.in_overflow = m_source_overflow;
-		qs.out_underflow = m_sink_underflow;
+	virtual void SndDequeueIBuf(sio_sampnum_t samps) {
+		m_taken += samps;
+		SoundIoTestEp::SndDequeueIBuf(samps);
 	}
 
-	virtual bool SndAsyncStart(bool sink, bool source, ErrorInfo *error) {
-		assert(!m_async_sink && !m_async_source);
-		assert(sink || source);
-		if (!m_has_clock) {
-			if (error)
-				error->Set(LIBHFP_ERROR_SUBSYS_SOUNDIO,
-					   LIBHFP_ERROR_SOUNDIO_NO_CLOCK,
-					   "Not a clocked endpoint");
-			return false;
-		}
-		m_async_sink = sink;
-		m_async_source = source;
-		return true;
+	virtual void SndQueueOBuf(sio_sampnum_t samps) {
+		m_given += samps;
+		SoundIoTestEp::SndQueueOBuf(samps);
 	}
 
-	virtual void SndAsyncStop(void) {
-		m_async_sink = false;
-		m_async_source = false;
+	void Tick(void) {
+		FillOutput();
+		ConsumeInput();
+		DoAsync();
 	}
+};
 
-	virtual bool SndIsAsyncStarted(void) const {
-		return m_async_sink || m_async_source;
-	}
+static void
+SetTestFormat(SoundIoTestEp *ep, sio_sampnum_t rate, uint8_t nch,
+	      sio_sampnum_t packet)
+{
+	SoundIoFormat fmt;
+
+	fmt.samplerate = rate;
+	fmt.sampletype = SIO_PCM_S16_LE;
+	fmt.nchannels = nch;
+	fmt.bytes_per_record = 2 * nch;
+	fmt.packet_samps = packet;
+	ep->SndSetFormat(fmt);
+}
 
-	void DoAsync(void) {
-		SoundIoQueueState qs;
-		SndGetQueueState(qs);
-		cb_NotifyPacket(this, qs);
+/*
+ * Run a 48KHz stereo bottom under an 8KHz mono top, so that the pump
+ * places a converter in front of the bottom.  Every 5ms tick, each
+ * side produces and consumes one packet, and the sample counts on
+ * both sides must agree at the 6:1 ratio, give or take what is
+ * buffered.  The bottom queue state must be translated for the pump
+ * to see balanced levels, or it would pad and drop.
+ */
+static void
+run_convert_leg(SoundIoCountEp *bot, SoundIoCountEp *top,
+		SoundIoPumpStatistics &stat, const char *what)
+{
+	char desc[64];
+	sio_sampnum_t bot_taken, bot_given, top_taken, top_given;
+	long slack = 8 * 40;
+	int i;
+
+	/* Let the fill levels settle, then count */
+	for (i = 0; i < 200; i++) {
+		bot->Tick();
+		top->Tick();
+	}
+	memset(&stat, 0, sizeof(stat));
+	bot_taken = bot->m_taken;
+	bot_given = bot->m_given;
+	top_taken = top->m_taken;
+	top_given = top->m_given;
+
+	for (i = 0; i < 2000; i++) {
+		bot->Tick();
+		top->Tick();
 	}
-};
 
+	sprintf(desc, "%s: top output", what);
+	Expect(desc, top->m_given - top_given, 2000 * 40 - slack,
+	       2000 * 40 + slack);
+	sprintf(desc, "%s: bottom output", what);
+	Expect(desc, (bot->m_given - bot_given) / 6, 2000 * 40 - slack,
+	       2000 * 40 + slack);
+	sprintf(desc, "%s: upward", what);
+	Expect(desc, (bot->m_taken - bot_taken) / 6,
+	       (top->m_given - top_given) - slack,
+	       (top->m_given - top_given) + slack);
+	sprintf(desc, "%s: downward", what);
+	Expect(desc, top->m_taken - top_taken,
+	       ((bot->m_given - bot_given) / 6) - slack,
+	       ((bot->m_given - bot_given) / 6) + slack);
+	sprintf(desc, "%s: bottom level", what);
+	Expect(desc, stat.bottom.out.level, 0, 64 * 40);
+	sprintf(desc, "%s: bottom drops", what);
+	Expect(desc, stat.bottom.in.drop + stat.bottom.out.drop, 0);
+	sprintf(desc, "%s: bottom pads", what);
+	Expect(desc, stat.bottom.in.pad + stat.bottom.out.pad, 0);
+}
 
 void
-run_test(SoundIoPump *pump, SoundIoTestEp *bot, SoundIoTestEp *top,
-	 SoundIoTestEp *div)
+run_convert_test(DispatchInterface *dip)
 {
+	SoundIoCountEp bot("CvBot", 240 * 64), top("CvTop", 40 * 64);
+	SoundIoCountEp bot2("CvBot2", 240 * 64), top2("CvTop2", 40 * 64);
+	SoundIoCountEp wide("CvWide", 80 * 64);
+	SoundIoPumpStatistics stat;
+	SoundIo *cv;
+	SoundIoBuffer buf;
+	SoundIoQueueState qs;
+	SoundIoPump *pump;
 	bool res;
-	int i;
 
-	res = bot->SndOpen(true, true);
+	SetTestFormat(&bot, 48000, 2, 240);
+	SetTestFormat(&bot2, 48000, 2, 240);
+	SetTestFormat(&top, 8000, 1, 40);
+	SetTestFormat(&top2, 8000, 1, 40);
+	SetTestFormat(&wide, 16000, 1, 80);
+
+	/* The converter reports native queue levels in its own format */
+	res = bot.SndOpen(true, true);
 	assert(res);
-	res = top->SndOpen(true, true);
+	cv = SoundIoCreateConverter(&bot, top.m_fmt);
+	assert(cv);
+	bot.FillOutput();
+	bot.FillOutput();
+	buf.m_size = 40;
+	cv->SndGetOBuf(buf);
+	assert(buf.m_size == 40);
+	memset(buf.m_data, 0, 40 * top.m_fmt.bytes_per_record);
+	cv->SndQueueOBuf(40);
+	memset(&qs, 0, sizeof(qs));
+	bot.SndGetQueueState(qs);
+	Expect("native output level", qs.out_queued, 240);
+	Expect("native input level", qs.in_queued, 480);
+	cv->SndGetQueueState(qs);
+	Expect("converter output level", qs.out_queued, 40);
+	Expect("converter input level", qs.in_queued, 60, 80);
+	delete cv;
+	bot.SndClose();
+
+	res = bot.SndOpen(true, true) && bot2.SndOpen(true, true) &&
+		top.SndOpen(true, true) && top2.SndOpen(true, true) &&
+		wide.SndOpen(true, true);
+	assert(res);
+
+	memset(&stat, 0, sizeof(stat));
+	pump = new SoundIoPump(dip, &bot);
+	pump->SetStatistics(&stat);
+	res = pump->SetTop(&top);
 	assert(res);
 	res = pump->Start();
 	assert(res);
-	assert(bot->SndIsAsyncStarted());
 
-	for (i = 0; i < 10000; i++) {
-		bot->FillOutput();
-		bot->ConsumeInput();
-		bot->DoAsync();
-	
-		top->FillOutput();
-		top->ConsumeInput();
-		top->DoAsync();
+	run_convert_leg(&bot, &top, stat, "converted");
 
-		if (div)
-			div->ConsumeInput();
+	/* A new bottom gets a converter of its own */
+	res = pump->SetBottom(&bot2);
+	Expect("converted SetBottom", res, true);
+	run_convert_leg(&bot2, &top, stat, "new bottom");
 
-		assert(pump->IsStarted());
-	}
+	/* A new top of the same format reuses the converter */
+	res = pump->SetTop(&top2);
+	Expect("converted SetTop", res, true);
+	run_convert_leg(&bot2, &top2, stat, "new top");
+
+	/* A top that would change the filter format is refused */
+	res = pump->SetTop(&wide);
+	Expect("format changing SetTop", res, false);
+	Expect("pump kept running", pump->IsStarted(), true);
+	run_convert_leg(&bot2, &top2, stat, "refused top");
 
 	pump->Stop();
-	bot->SndClose();
-	top->SndClose();
+	delete pump;
 }
 
 int
@@ -356,6 +326,7 @@ main(int /*argc*/, char **/*argv*/)
 	SoundIoTestEp top("Top", 10000), bot("Bot", 10000), div("Div", 10000);
 	SoundIoPump pump(&disp, &bot);
 	SoundIoFilter *fltp, *snoopp;
+	SoundIoTestXorFlt xor1(0x5a, false), xor2(0x0f, true), xor3(0x55, true);
 	SoundIoFormat xfmt;
 	bool res;
 
@@ -386,5 +357,15 @@ main(int /*argc*/, char **/*argv*/)
 
 	run_test(&pump, &bot, &top, &div);
 
-	return 0;
+	/* Exercise in-place processing and direct writes to the sink */
+	res = pump.AddTop(&xor1) && pump.AddTop(&xor2) && pump.AddTop(&xor3);
+	assert(res);
+
+	run_test(&pump, &bot, &top, &div);
+
+	run_offline_test(&disp);
+
+	run_convert_test(&disp);
+
+	return TestResult();
 }
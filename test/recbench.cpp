@@ -0,0 +1,182 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Benchmark for the record kernels used by SoundIoPump
+ * The silence fill and drift compensation resampler are timed for each
+ * format that has specialized kernels, against the generic kernels that
+ * take the record size and channel count at run time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include <libhfp/soundio-dsp.h>
+
+using namespace libhfp;
+
+static uint64_t
+NowNs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/* Keeps the compiler from discarding the kernel output */
+static volatile uint8_t s_sink;
+
+static double
+TimeFill(SoundIoDspRecordKernels const *kp, uint8_t *dest,
+	 const uint8_t *rec, unsigned int bpr, size_t nrecs,
+	 unsigned int iters)
+{
+	uint64_t t0, t1;
+	unsigned int i;
+
+	t0 = NowNs();
+	for (i = 0; i < iters; i++) {
+		kp->fill(dest, rec, bpr, nrecs);
+		s_sink = dest[i % (bpr * nrecs)];
+	}
+	t1 = NowNs();
+	return (double) (t1 - t0) / ((double) iters * nrecs);
+}
+
+static double
+TimeInterp(SoundIoDspRecordKernels const *kp, uint8_t *dest,
+	   const uint8_t *src, unsigned int nch, unsigned int bpr,
+	   size_t nrecs, unsigned int iters)
+{
+	/* A typical drift compensation step, 0.1% fast */
+	const uint32_t step = (1 << SIO_DSP_INTERP_SHIFT) -
+		(1 << (SIO_DSP_INTERP_SHIFT - 10));
+	uint64_t t0, t1;
+	unsigned int i;
+
+	t0 = NowNs();
+	for (i = 0; i < iters; i++) {
+		kp->interp(dest, src, nrecs, i & 0xfff, step, nch);
+		s_sink = dest[i % (bpr * nrecs)];
+	}
+	t1 = NowNs();
+	return (double) (t1 - t0) / ((double) iters * nrecs);
+}
+
+static void
+usage(const char *argv0)
+{
+	const char *bn;
+
+	bn = strrchr(argv0, '/');
+	if (!bn)
+		bn = argv0;
+	else
+		bn++;
+
+	fprintf(stderr,
+"Usage: %s [-n iterations] [-p records]\n"
+"Benchmark for the SoundIoPump record kernels\n"
+"\n"
+"-n <count>	Number of calls to time per kernel (DEFAULT: 200000)\n"
+"-p <records>	Records per call (DEFAULT: 128)\n"
+		"\n",
+		bn);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const struct {
+		sio_sampletype_t	type;
+		const char		*name;
+		unsigned int		size;
+	} types[] = {
+		{ SIO_PCM_U8, "u8", 1 },
+		{ SIO_PCM_S16_LE, "s16", 2 },
+	};
+	SoundIoDspRecordKernels const *gen, *kp;
+	unsigned int iters = 200000, nrecs = 128;
+	unsigned int i, nch, bpr;
+	uint8_t *src, *dest;
+	double tg, ts;
+	int c;
+
+	opterr = 0;
+	while ((c = getopt(argc, argv, "hH?n:p:")) != -1) {
+		switch (c) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			nrecs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return (c == '?') ? 1 : 0;
+		}
+	}
+
+	if (!iters || !nrecs) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Room for the largest record, plus resampler slack */
+	src = (uint8_t *) malloc(4 * (nrecs + 2));
+	dest = (uint8_t *) malloc(4 * nrecs);
+	assert(src && dest);
+	for (i = 0; i < (4 * (nrecs + 2)); i++)
+		src[i] = random();
+
+	printf("%u records/call, %u calls\n", nrecs, iters);
+	printf("%-8s %-7s %10s %10s %8s\n",
+	       "format", "kernel", "generic", "special", "speedup");
+
+	for (i = 0; i < (sizeof(types) / sizeof(types[0])); i++) {
+		for (nch = 1; nch <= 2; nch++) {
+			gen = SoundIoDspGetRecordKernels(types[i].type,
+							 nch, true);
+			kp = SoundIoDspGetRecordKernels(types[i].type, nch);
+			assert(gen && kp && (kp->nchannels == nch));
+			bpr = nch * types[i].size;
+
+			tg = TimeFill(gen, dest, src, bpr, nrecs, iters);
+			ts = TimeFill(kp, dest, src, bpr, nrecs, iters);
+			printf("%3s/%uch  %-7s %7.3f ns %7.3f ns %7.2fx\n",
+			       types[i].name, nch, "fill", tg, ts, tg / ts);
+
+			tg = TimeInterp(gen, dest, src, nch, bpr, nrecs,
+					iters);
+			ts = TimeInterp(kp, dest, src, nch, bpr, nrecs,
+					iters);
+			printf("%3s/%uch  %-7s %7.3f ns %7.3f ns %7.2fx\n",
+			       types[i].name, nch, "interp", tg, ts, tg / ts);
+		}
+	}
+
+	free(src);
+	free(dest);
+	return 0;
+}
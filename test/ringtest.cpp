@@ -0,0 +1,117 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Unit test for SoundIoRing
+ * Records of three channels are numbered, streamed through a ring in
+ * uneven pieces, and checked on the way out.  The ring's positions
+ * start just short of ULONG_MAX, so they wrap partway through, as they
+ * eventually do on a long running stream.  The storage size is not a
+ * power of two, so the wrap must not disturb the storage offsets.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+
+#include "testep.h"
+
+#define BPR		6
+#define PACKET		64
+
+/* Stream some multiple of the ring size through it */
+static void
+run_ring(SoundIoRing &ring, const char *what)
+{
+	uint16_t *rec;
+	uint16_t in_seq = 0, out_seq = 0;
+	unsigned long total = 0, bad = 0;
+	unsigned int i, j, n, nin;
+	uint8_t *buf;
+	int fill = 0;
+
+	ring.Clear();
+	ring.m_head = ring.m_tail = ULONG_MAX - (5 * PACKET * BPR) + 2;
+
+	for (i = 0; total < (8 * ring.m_size); i++) {
+		/* Produce unevenly, up to what fits */
+		n = ((i * 37) % 150) + 1;
+		ring.GetUnfilled(buf, n);
+		for (j = 0; j < n; j++) {
+			rec = (uint16_t *) (buf + (j * BPR));
+			rec[0] = rec[1] = rec[2] = in_seq++;
+		}
+		ring.PutUnfilled(n);
+		nin = n;
+		fill += n;
+		total += (n * BPR);
+
+		if (ring.TotalFill() != fill) {
+			Fail("%s: fill %d, expected %d", what,
+			     ring.TotalFill(), fill);
+			return;
+		}
+
+		/* Consume unevenly, up to what is there */
+		n = ((i * 53) % 170) + 1;
+		ring.Peek(buf, n);
+		for (j = 0; j < n; j++) {
+			rec = (uint16_t *) (buf + (j * BPR));
+			if ((rec[0] != out_seq) || (rec[1] != out_seq) ||
+			    (rec[2] != out_seq))
+				bad++;
+			out_seq++;
+		}
+		ring.Dequeue(n);
+		fill -= n;
+
+		if (!nin && !n) {
+			Fail("%s: ring stalled", what);
+			return;
+		}
+	}
+
+	Expect(what, bad, 0);
+	Expect("positions wrapped", ring.m_tail < total, true);
+}
+
+int
+main(int /*argc*/, char **/*argv*/)
+{
+	SoundIoRing ring;
+	bool mirrored;
+
+	if (!ring.SetPacketSize(PACKET, BPR)) {
+		Fail("ring allocation");
+		return TestResult();
+	}
+	Expect("size is a record multiple", ring.m_size % BPR, 0);
+
+	mirrored = ring.m_mirrored;
+	run_ring(ring, mirrored ? "mirrored ring" : "ring");
+
+	/* Treat the storage as plain, stopping at the end of it */
+	ring.m_mirrored = false;
+	run_ring(ring, "split ring");
+	ring.m_mirrored = mirrored;
+
+	return TestResult();
+}
@@ -0,0 +1,272 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Test for SoundIoRtThread
+ * A SoundIoPump and two synthetic endpoints clocked by a timer all run
+ * on the audio thread.  While they stream, the main thread adds and
+ * removes a filter and swaps the top endpoint through the command
+ * queue, and the audio thread reports back through PostMain().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/soundio-buf.h>
+#include <libhfp/soundio-rt.h>
+#include <libhfp/events-indep.h>
+
+#include "testep.h"
+
+using namespace libhfp;
+
+#define PACKET		64
+#define NTICKS		250
+
+/* Pass-through filter that counts the packets it sees */
+class CountFlt : public SoundIoTestXorFlt {
+public:
+	unsigned int	m_count;
+
+	CountFlt(void) : SoundIoTestXorFlt(0, true), m_count(0) {}
+
+	virtual SoundIoBuffer const *FltProcess(bool up,
+						SoundIoBuffer const &src,
+						SoundIoBuffer &dest) {
+		m_count++;
+		return SoundIoTestXorFlt::FltProcess(up, src, dest);
+	}
+};
+
+class RtHarness {
+public:
+	SoundIoRtThread	*m_rt;
+	SoundIoPump	*m_pump;
+	SoundIoTestEp	*m_bot, *m_top, *m_alt, *m_cur;
+	CountFlt	m_flt;
+	TimerNotifier	*m_clock;
+	unsigned int	m_ticks;
+	sio_sampnum_t	m_top_fed, m_alt_fed;
+	bool		m_wrong_thread;
+	bool		m_flt_added;
+	bool		m_started;
+	bool		m_done;
+
+	RtHarness(SoundIoRtThread *rtp, SoundIoPump *pumpp,
+		  SoundIoTestEp *bot, SoundIoTestEp *top, SoundIoTestEp *alt)
+		: m_rt(rtp), m_pump(pumpp), m_bot(bot), m_top(top),
+		  m_alt(alt), m_cur(top), m_clock(0), m_ticks(0),
+		  m_top_fed(0), m_alt_fed(0), m_wrong_thread(false),
+		  m_flt_added(false), m_started(false), m_done(false) {}
+
+	void CheckThread(void) {
+		if (!m_rt->IsAudioThread())
+			m_wrong_thread = true;
+	}
+
+	/* Audio thread methods */
+	void StartClock(void) {
+		CheckThread();
+		m_clock = m_rt->GetDi()->NewTimer();
+		assert(m_clock);
+		m_clock->Register(this, &RtHarness::Tick);
+		m_clock->Set(1);
+	}
+
+	void StopClock(void) {
+		CheckThread();
+		delete m_clock;
+		m_clock = 0;
+		m_started = m_pump->IsStarted();
+	}
+
+	void Tick(TimerNotifier *notp) {
+		Callback<void> cb;
+
+		assert(notp == m_clock);
+		CheckThread();
+
+		m_bot->FillOutput();
+		m_bot->ConsumeInput();
+		m_bot->DoAsync();
+		m_cur->FillOutput();
+		m_cur->DoAsync();
+		if (m_cur == m_top)
+			m_top_fed += m_cur->m_sink_buf.SpaceUsed();
+		else
+			m_alt_fed += m_cur->m_sink_buf.SpaceUsed();
+		m_cur->m_sink_buf.m_start = m_cur->m_sink_buf.m_end = 0;
+
+		__atomic_store_n(&m_ticks, m_ticks + 1, __ATOMIC_RELEASE);
+		if (m_ticks == NTICKS) {
+			cb.Register(this, &RtHarness::Done);
+			if (!m_rt->PostMain(cb))
+				Fail("PostMain failed");
+		}
+		m_clock->Set(1);
+	}
+
+	void AddFilter(void) {
+		CheckThread();
+		m_flt_added = m_pump->AddBottom(&m_flt);
+	}
+
+	void RemoveFilter(void) {
+		CheckThread();
+		m_pump->RemoveFilter(&m_flt);
+	}
+
+	void SwapTop(void) {
+		CheckThread();
+		m_cur = (m_cur == m_top) ? m_alt : m_top;
+		if (!m_pump->SetTop(m_cur))
+			Fail("SetTop failed");
+	}
+
+	/* Main thread methods */
+	void Done(void) {
+		if (m_rt->IsAudioThread())
+			Fail("PostMain ran on the audio thread");
+		m_done = true;
+	}
+
+	unsigned int Ticks(void) const {
+		return __atomic_load_n(&m_ticks, __ATOMIC_ACQUIRE);
+	}
+
+	void Post(void (RtHarness::*mfp)(void)) {
+		Callback<void> cb;
+		cb.Register(this, mfp);
+		if (!m_rt->Post(cb))
+			Fail("Post failed");
+	}
+
+	void Call(void (RtHarness::*mfp)(void)) {
+		Callback<void> cb;
+		cb.Register(this, mfp);
+		m_rt->Call(cb);
+	}
+};
+
+int
+main(int argc, char **argv)
+{
+	IndepEventDispatcher disp;
+	SoundIoRtConfig cfg;
+	SoundIoTestEp *bot, *top, *alt;
+	SoundIoPump *pump;
+	SoundIoRtThread *rtp;
+	RtHarness *harn;
+	ErrorInfo error;
+	unsigned int flt_count, step;
+	bool res;
+	int c;
+
+	memset(&cfg, 0, sizeof(cfg));
+	while ((c = getopt(argc, argv, "p:c:m")) != -1) {
+		switch (c) {
+		case 'p':
+			cfg.priority = strtol(optarg, NULL, 0);
+			break;
+		case 'c':
+			cfg.cpu_mask = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			cfg.mlock = true;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-p priority] "
+				"[-c cpumask] [-m]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	rtp = new SoundIoRtThread(&disp);
+	bot = NewTestEp("Bot", PACKET, PACKET * 16);
+	top = NewTestEp("Top", PACKET, PACKET * 16);
+	alt = NewTestEp("Alt", PACKET, PACKET * 16);
+
+	/* Everything is set up before the audio thread starts */
+	pump = new SoundIoPump(rtp->GetDi(), bot);
+	res = pump->SetTop(top) && pump->Start();
+	assert(res);
+	harn = new RtHarness(rtp, pump, bot, top, alt);
+
+	if (!rtp->Start(cfg, &error)) {
+		fprintf(stderr, "Start audio thread: %s\n", error.Desc());
+		return 1;
+	}
+
+	harn->Call(&RtHarness::StartClock);
+
+	step = 0;
+	flt_count = 0;
+	while (!harn->m_done) {
+		disp.RunOnce(2);
+		if ((step == 0) && (harn->Ticks() >= 50)) {
+			harn->Post(&RtHarness::AddFilter);
+			step++;
+		} else if ((step == 1) && (harn->Ticks() >= 100)) {
+			harn->Post(&RtHarness::SwapTop);
+			step++;
+		} else if ((step == 2) && (harn->Ticks() >= 150)) {
+			harn->Call(&RtHarness::RemoveFilter);
+			flt_count = harn->m_flt.m_count;
+			step++;
+		} else if ((step == 3) && (harn->Ticks() >= 200)) {
+			harn->Post(&RtHarness::SwapTop);
+			step++;
+		}
+	}
+
+	harn->Call(&RtHarness::StopClock);
+	rtp->Stop();
+
+	if (step != 4)
+		Fail("Not all commands were posted");
+	if (harn->m_wrong_thread)
+		Fail("Audio work ran on the wrong thread");
+	if (!harn->m_started)
+		Fail("Pump stopped while streaming");
+	if (!harn->m_flt_added)
+		Fail("Filter add failed");
+	if (!flt_count)
+		Fail("Filter saw no packets");
+	if (harn->m_flt.m_count != flt_count)
+		Fail("Filter saw packets after it was removed");
+	if (!harn->m_top_fed || !harn->m_alt_fed)
+		Fail("Swapped top endpoints were not both fed");
+
+	/* The main thread owns the pump again */
+	pump->Stop();
+
+	delete harn;
+	delete pump;
+	delete rtp;
+	delete bot;
+	delete top;
+	delete alt;
+
+	return TestResult();
+}
@@ -85,6 +85,7 @@ main(int /*argc*/, char **/*argv*/)
 	sprops.agc_level = 0;
 	sprops.dereverb_level = 0.0;
 	sprops.dereverb_decay = 0.0;
+	sprops.gate_level = 0;
 
 	fltsp = SoundIoFltCreateSpeex(&g_dispatcher);
 	fltsp->Configure(sprops);
@@ -56,6 +56,13 @@ public:
 				       tp, ms);
 				tp->Set(ms);
 			}
+
+			if (!(random() % 4)) {
+				ms = random() % 10000000;
+				printf("tp %p re-registered for %dus\n",
+				       tp, ms);
+				tp->SetUsec(ms);
+			}
 		}
 	}
 };
@@ -0,0 +1,151 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Test for the virtual sound card
+ * A pump is run in real time between two virtual cards with seeded
+ * interrupt jitter, the bottom one with a fast clock.  The cards must
+ * not overrun or underrun, and the samples that the pump removes from
+ * the upward stream and inserts into the downward stream at the top
+ * endpoint -- by drift compensation, or by dropping and padding --
+ * are its estimate of the drift.  The cards' clocks advance a packet
+ * at a time, so the estimate is only good to about a packet.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/events-indep.h>
+
+#include "testep.h"
+
+using namespace libhfp;
+
+#define RATE		8000
+#define PACKET		64
+#define JITTER_US	2000
+#define DRIFT_PPM	4000
+#define SETTLE_MS	2000
+#define RUN_MS		10000
+
+static uint64_t
+NowMs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+}
+
+static void
+RunFor(IndepEventDispatcher *disp, unsigned int ms)
+{
+	uint64_t end = NowMs() + ms;
+	while (NowMs() < end)
+		disp->RunOnce(10);
+}
+
+static SoundIo *
+NewCard(DispatchInterface *di, int drift, unsigned int seed)
+{
+	SoundIoFormat fmt;
+	SoundIo *siop;
+	ErrorInfo error;
+	char opts[128];
+
+	sprintf(opts, "rate=%d&packet=%d&jitter=%d&drift=%d&seed=%u",
+		RATE, PACKET, JITTER_US, drift, seed);
+	siop = SoundIoCreateVirtual(di, opts, &error);
+	if (!siop) {
+		fprintf(stderr, "Create virtual card: %s\n", error.Desc());
+		exit(1);
+	}
+
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.sampletype = SIO_PCM_S16_LE;
+	fmt.samplerate = RATE;
+	fmt.nchannels = 1;
+	fmt.bytes_per_record = 2;
+	fmt.packet_samps = PACKET;
+	if (!siop->SndSetFormat(fmt, &error) ||
+	    !siop->SndOpen(true, true, &error)) {
+		fprintf(stderr, "Open virtual card: %s\n", error.Desc());
+		exit(1);
+	}
+	return siop;
+}
+
+/* Samples added at an endpoint, less those taken away */
+static long
+Slip(SoundIoPumpStatistics::SubEp const &sub)
+{
+	return ((long) sub.stretch + (long) sub.pad) -
+		((long) sub.shrink + (long) sub.drop);
+}
+
+int
+main(int /*argc*/, char **/*argv*/)
+{
+	IndepEventDispatcher disp;
+	SoundIoPumpStatistics stat;
+	SoundIo *bot, *top;
+	SoundIoPump *pump;
+	ErrorInfo error;
+	long expect, slack;
+
+	/* The bottom card's clock is fast */
+	bot = NewCard(&disp, DRIFT_PPM, 1);
+	top = NewCard(&disp, 0, 2);
+
+	pump = new SoundIoPump(&disp, bot);
+	pump->SetDriftCompensation(true);
+	if (!pump->SetTop(top, &error) || !pump->Start(&error)) {
+		fprintf(stderr, "Start pump: %s\n", error.Desc());
+		return 1;
+	}
+
+	RunFor(&disp, SETTLE_MS);
+	memset(&stat, 0, sizeof(stat));
+	pump->SetStatistics(&stat);
+	RunFor(&disp, RUN_MS);
+	pump->SetStatistics(0);
+
+	Expect("bottom input xruns", stat.bottom.in.xrun, 0, 0);
+	Expect("bottom output xruns", stat.bottom.out.xrun, 0, 0);
+	Expect("top input xruns", stat.top.in.xrun, 0, 0);
+	Expect("top output xruns", stat.top.out.xrun, 0, 0);
+
+	expect = ((long long) RATE * RUN_MS * DRIFT_PPM) / 1000000000LL;
+	slack = PACKET + (PACKET / 2);
+	Expect("upward drift estimate", -Slip(stat.top.out),
+	       expect - slack, expect + slack);
+	Expect("downward drift estimate", Slip(stat.top.in),
+	       expect - slack, expect + slack);
+
+	pump->Stop();
+	delete pump;
+	delete top;
+	delete bot;
+
+	return TestResult();
+}
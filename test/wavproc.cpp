@@ -0,0 +1,350 @@
+/*
+ * Software Bluetooth Hands-Free Implementation
+ *
+ * Copyright (C) 2008 Sam Revitch <samr7@cs.washington.edu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/*
+ * Offline batch processor
+ * Runs each .wav file in a directory through the Speex filter with
+ * SoundIoPump::RunOffline(), writing the results to another directory.
+ * Files are shared out among one worker thread per CPU, each with its
+ * own dispatcher, pump, and filter.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <assert.h>
+
+#include <libhfp/soundio.h>
+#include <libhfp/events-indep.h>
+
+using namespace libhfp;
+
+/* Keeps pump configuration chatter off the console */
+class WavDispatcher : public IndepEventDispatcher {
+public:
+	logtype_t	m_level;
+
+	WavDispatcher(logtype_t level) : m_level(level) {}
+
+	virtual void LogVa(logtype_t lt, const char *fmt, va_list ap) {
+		if (lt > m_level)
+			return;
+		IndepEventDispatcher::LogVa(lt, fmt, ap);
+	}
+};
+
+struct WavJob {
+	char			*src;
+	char			*dest;
+	bool			ok;
+	sio_sampnum_t		nsamps;
+	sio_sampnum_t		samplerate;
+	char			errmsg[128];
+};
+
+static WavJob *s_jobs;
+static unsigned int s_njobs;
+static unsigned int s_next;
+static SoundIoSpeexProps s_props;
+static bool s_speex = true;
+static DispatchInterface::logtype_t s_level =
+	DispatchInterface::EVLOG_WARNING;
+
+static uint64_t
+NowUs(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static bool
+ProcessFile(DispatchInterface *dip, WavJob *jobp, ErrorInfo *error)
+{
+	SoundIo *in = 0, *out = 0;
+	SoundIoFltSpeex *fltp = 0;
+	SoundIoPump *pump = 0;
+	SoundIoPumpStatistics stat;
+	SoundIoFormat fmt;
+	bool res = false;
+
+	memset(&stat, 0, sizeof(stat));
+
+	in = SoundIoCreateFileHandler(dip, jobp->src, false, error);
+	if (!in || !in->SndOpen(false, true, error))
+		goto done;
+
+	in->SndGetFormat(fmt);
+	jobp->samplerate = fmt.samplerate;
+
+	out = SoundIoCreateFileHandler(dip, jobp->dest, true, error);
+	if (!out ||
+	    !out->SndSetFormat(fmt, error) ||
+	    !out->SndOpen(true, false, error))
+		goto done;
+
+	if (s_speex) {
+		fltp = SoundIoFltCreateSpeex(dip, error);
+		if (!fltp || !fltp->Configure(s_props, error))
+			goto done;
+	}
+
+	pump = new SoundIoPump(dip, in);
+	pump->SetStatistics(&stat);
+	if (!pump->SetTop(out, error) ||
+	    (fltp && !pump->AddBottom(fltp, error)))
+		goto done;
+
+	res = pump->RunOffline(error);
+	jobp->nsamps = stat.process_count;
+
+done:
+	if (pump) {
+		if (fltp)
+			pump->RemoveFilter(fltp);
+		delete pump;
+	}
+	if (fltp)
+		delete fltp;
+	if (out)
+		delete out;
+	if (in)
+		delete in;
+	return res;
+}
+
+static void *
+Worker(void *)
+{
+	WavDispatcher disp(s_level);
+	ErrorInfo error;
+	unsigned int i;
+	WavJob *jobp;
+
+	while (1) {
+		i = __atomic_fetch_add(&s_next, 1, __ATOMIC_RELAXED);
+		if (i >= s_njobs)
+			break;
+
+		jobp = &s_jobs[i];
+		error.Clear();
+		jobp->ok = ProcessFile(&disp, jobp, &error);
+		if (!jobp->ok)
+			snprintf(jobp->errmsg, sizeof(jobp->errmsg), "%s",
+				 error.IsSet() ? error.Desc() :
+				 "Could not open file");
+	}
+	return 0;
+}
+
+static bool
+IsWav(const char *name)
+{
+	size_t len = strlen(name);
+	return (len > 4) && !strcasecmp(name + len - 4, ".wav");
+}
+
+static int
+CompareJobs(const void *a, const void *b)
+{
+	return strcmp(((const WavJob *) a)->src, ((const WavJob *) b)->src);
+}
+
+static char *
+JoinPath(const char *dir, const char *name)
+{
+	char *path;
+
+	path = (char *) malloc(strlen(dir) + strlen(name) + 2);
+	if (path)
+		sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static bool
+ScanDir(const char *indir, const char *outdir)
+{
+	DIR *dirp;
+	struct dirent *dep;
+	WavJob *jobs;
+	unsigned int size = 0;
+
+	dirp = opendir(indir);
+	if (!dirp) {
+		perror(indir);
+		return false;
+	}
+
+	while ((dep = readdir(dirp)) != NULL) {
+		if (!IsWav(dep->d_name))
+			continue;
+
+		if (s_njobs == size) {
+			size = size ? (size * 2) : 16;
+			jobs = (WavJob *) realloc(s_jobs,
+						  size * sizeof(*jobs));
+			if (!jobs)
+				goto nomem;
+			s_jobs = jobs;
+		}
+
+		memset(&s_jobs[s_njobs], 0, sizeof(s_jobs[s_njobs]));
+		s_jobs[s_njobs].src = JoinPath(indir, dep->d_name);
+		s_jobs[s_njobs].dest = JoinPath(outdir, dep->d_name);
+		if (!s_jobs[s_njobs].src || !s_jobs[s_njobs].dest)
+			goto nomem;
+		s_njobs++;
+	}
+
+	closedir(dirp);
+	if (s_njobs)
+		qsort(s_jobs, s_njobs, sizeof(*s_jobs), CompareJobs);
+	return true;
+
+nomem:
+	closedir(dirp);
+	fprintf(stderr, "Memory exhausted\n");
+	return false;
+}
+
+static void
+Usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-j jobs] [-n] [-a agc] [-d level,decay] "
+		"[-g gate] [-x] [-v] indir outdir\n"
+		"  -j  Worker threads, default one per CPU\n"
+		"  -n  Enable noise reduction\n"
+		"  -a  Automatic gain control level\n"
+		"  -d  Dereverberation level and decay\n"
+		"  -g  Voice activity gate threshold\n"
+		"  -x  Copy only, no Speex filter\n"
+		"  -v  Show debug messages\n",
+		argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t *threads;
+	unsigned int i, nthreads = 0, nfailed = 0;
+	uint64_t start, elapsed;
+	double secs = 0.0;
+	int c;
+
+	while ((c = getopt(argc, argv, "j:na:d:g:xv")) != -1) {
+		switch (c) {
+		case 'j':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			s_props.noisereduce = true;
+			break;
+		case 'a':
+			s_props.agc_level = strtol(optarg, NULL, 0);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%f,%f", &s_props.dereverb_level,
+				   &s_props.dereverb_decay) != 2) {
+				Usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'g':
+			s_props.gate_level = strtol(optarg, NULL, 0);
+			break;
+		case 'x':
+			s_speex = false;
+			break;
+		case 'v':
+			s_level = DispatchInterface::EVLOG_DEBUG;
+			break;
+		default:
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((argc - optind) != 2) {
+		Usage(argv[0]);
+		return 1;
+	}
+
+	if (!ScanDir(argv[optind], argv[optind + 1]))
+		return 1;
+	if (!s_njobs) {
+		fprintf(stderr, "No .wav files in %s\n", argv[optind]);
+		return 1;
+	}
+
+	if (!nthreads) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (ncpus > 0) ? ncpus : 1;
+	}
+	if (nthreads > s_njobs)
+		nthreads = s_njobs;
+
+	threads = (pthread_t *) malloc(nthreads * sizeof(*threads));
+	assert(threads);
+
+	start = NowUs();
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, Worker, NULL)) {
+			fprintf(stderr, "Could not create worker thread\n");
+			nthreads = i;
+			break;
+		}
+	}
+	if (!nthreads)
+		Worker(NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = NowUs() - start;
+	free(threads);
+
+	for (i = 0; i < s_njobs; i++) {
+		if (!s_jobs[i].ok) {
+			printf("%s: FAILED: %s\n",
+			       s_jobs[i].src, s_jobs[i].errmsg);
+			nfailed++;
+		} else {
+			printf("%s: %u samples\n",
+			       s_jobs[i].src, s_jobs[i].nsamps);
+			if (s_jobs[i].samplerate)
+				secs += ((double) s_jobs[i].nsamps /
+					 s_jobs[i].samplerate);
+		}
+		free(s_jobs[i].src);
+		free(s_jobs[i].dest);
+	}
+	free(s_jobs);
+
+	printf("%u files, %u failed, %.1fs of audio in %.3fs",
+	       s_njobs, nfailed, secs, elapsed / 1000000.0);
+	if (elapsed)
+		printf(" (%.0fx real time)", secs * 1000000.0 / elapsed);
+	printf("\n");
+	return nfailed ? 1 : 0;
+}